@@ -0,0 +1,104 @@
+// bench.h
+// Small helpers shared by the benchmark executables. Each benchmark loads a rom, runs a fixed number
+// of frames as fast as possible, and reports emulated throughput.
+
+#pragma once
+#include "bus.h"
+#include "paths.h"
+#include "global-types.h"
+#include <chrono>
+#include <fmt/base.h>
+#include <functional>
+#include <memory>
+#include <string>
+
+namespace bench
+{
+
+// NTSC CPU clock, used to express throughput relative to real hardware
+constexpr double gNtscCpuHz = 1789773.0;
+
+struct Result {
+  std::string rom;
+  u64         frames = 0;
+  u64         cycles = 0;
+  double      seconds = 0.0;
+
+  double Mhz() const { return seconds > 0.0 ? static_cast<double>( cycles ) / seconds / 1e6 : 0.0; }
+  double Fps() const { return seconds > 0.0 ? static_cast<double>( frames ) / seconds : 0.0; }
+  double Speed() const { return Mhz() * 1e6 / gNtscCpuHz; }
+};
+
+/*
+ * @brief Heap allocate a bus with a rom loaded and the cpu reset. The bus is too big for the stack.
+ */
+inline std::unique_ptr<Bus> MakeBus( const std::string &romName )
+{
+  auto bus = std::make_unique<Bus>();
+  bus->cartridge.LoadRom( std::string( paths::roms() ) + "/" + romName );
+  bus->cpu.Reset();
+  return bus;
+}
+
+/*
+ * @brief Run a whole frame the same way the frontend does
+ */
+inline void RunFrame( Bus &bus )
+{
+  bus.RunFrame();
+}
+
+/*
+ * @brief Run `frames` frames of a rom after a short warmup and time them
+ * `setup` runs on the fresh bus before the warmup, e.g. to toggle an optimization
+ */
+inline Result RunRom( const std::string &romName, u64 frames, u64 warmupFrames = 60,
+                      const std::function<void( Bus & )> &setup = {} )
+{
+  auto bus = MakeBus( romName );
+  if ( setup ) {
+    setup( *bus );
+  }
+  for ( u64 i = 0; i < warmupFrames; i++ ) {
+    RunFrame( *bus );
+  }
+
+  u64 const  startCycles = bus->cpu.GetCycles();
+  auto const start = std::chrono::steady_clock::now();
+  for ( u64 i = 0; i < frames; i++ ) {
+    RunFrame( *bus );
+  }
+  auto const end = std::chrono::steady_clock::now();
+
+  Result result;
+  result.rom = romName;
+  result.frames = frames;
+  result.cycles = bus->cpu.GetCycles() - startCycles;
+  result.seconds = std::chrono::duration<double>( end - start ).count();
+  return result;
+}
+
+inline void PrintHeader( const std::string &title )
+{
+  fmt::print( "\n---------- {} ----------\n", title );
+  fmt::print( "{:<16} {:>8} {:>12} {:>9} {:>10} {:>9}\n", "rom", "frames", "cycles", "seconds", "MHz", "fps" );
+}
+
+inline void PrintResult( const Result &result )
+{
+  fmt::print( "{:<16} {:>8} {:>12} {:>9.3f} {:>10.2f} {:>9.1f}  ({:.1f}x realtime)\n", result.rom, result.frames,
+              result.cycles, result.seconds, result.Mhz(), result.Fps(), result.Speed() );
+}
+
+/*
+ * @brief Frame count from the first command line argument, or the fallback
+ */
+inline u64 FramesArg( int argc, char **argv, u64 fallback )
+{
+  if ( argc > 1 ) {
+    return std::stoull( argv[1] );
+  }
+  return fallback;
+}
+
+} // namespace bench
@@ -0,0 +1,28 @@
+// breakpoints_bench.cpp
+// Host time per emulated frame with no breakpoints, and with an execution breakpoint that never hits. The
+// first is the cost of the hooks themselves, one branch each. The second shows what an armed engine costs,
+// with the idle loop skipping and bulk OAM DMA stepping aside. Usage: breakpoints_bench [frames]
+
+#include "bench.h"
+#include <fmt/base.h>
+
+int main( int argc, char **argv )
+{
+  u64 const frames = bench::FramesArg( argc, argv, 1200 );
+
+  fmt::print( "{:<16} {:>14} {:>14} {:>9}\n", "rom", "none us/f", "armed us/f", "slowdown" );
+  for ( const auto *rom : { "nestest.nes", "mario.nes", "metroid.nes", "amagon.nes" } ) {
+    double usPerFrame[2] = {};
+    for ( bool const armed : { false, true } ) {
+      bench::Result const result = bench::RunRom( rom, frames, 60, [armed]( Bus &bus ) {
+        if ( armed ) {
+          bus.breakpoints.Add( Breakpoints::Kind::Execute, 0x5FFF );
+        }
+      } );
+      usPerFrame[armed ? 1 : 0] = result.seconds * 1e6 / static_cast<double>( result.frames );
+    }
+    fmt::print( "{:<16} {:>14.1f} {:>14.1f} {:>8.2f}x\n", rom, usPerFrame[0], usPerFrame[1],
+                usPerFrame[1] / usPerFrame[0] );
+  }
+  return 0;
+}
@@ -0,0 +1,71 @@
+// bus_bench.cpp
+// Cost of a single CPU bus access through the page table (Bus::Read / Bus::Write) and through the range
+// checks it replaced (Bus::DecodeRead / Bus::DecodeWrite), per region. Usage: bus_bench [millions of accesses]
+
+#include "bench.h"
+#include <chrono>
+#include <fmt/base.h>
+#include <string>
+
+namespace
+{
+/*
+ * @brief Time `count` accesses spread over a region (a power of two in size), and return the average cost in
+ * nanoseconds
+ */
+template <typename Access> double TimeAccesses( u64 count, u16 base, u16 size, Access access )
+{
+  u32        sum = 0;
+  auto const start = std::chrono::steady_clock::now();
+  for ( u64 i = 0; i < count; i++ ) {
+    // A stride that isn't a power of two, so accesses wander over every page of the region
+    sum += access( static_cast<u16>( base + ( ( i * 97 ) & ( size - 1 ) ) ) );
+  }
+  auto const end = std::chrono::steady_clock::now();
+
+  // Keep the loop from being optimized away
+  static volatile u32 sink = 0;
+  sink = sum;
+  return std::chrono::duration<double, std::nano>( end - start ).count() / static_cast<double>( count );
+}
+} // namespace
+
+int main( int argc, char **argv )
+{
+  u64 const count = bench::FramesArg( argc, argv, 50 ) * 1000000;
+
+  // Metroid (MMC1) has PRG RAM and switches PRG banks
+  auto bus = bench::MakeBus( "metroid.nes" );
+  for ( int i = 0; i < 60; i++ ) {
+    bench::RunFrame( *bus );
+  }
+
+  struct Region {
+    const char *name;
+    u16         base;
+    u16         size;
+  };
+
+  fmt::print( "\n---------- Bus Access: ns per access ----------\n" );
+  fmt::print( "{:<16} {:>12} {:>12} {:>9}\n", "region", "decode", "page table", "speedup" );
+  for ( Region const region : { Region{ "RAM read", 0x0000, 0x2000 }, Region{ "PRG RAM read", 0x6000, 0x2000 },
+                                Region{ "PRG ROM read", 0x8000, 0x8000 } } ) {
+    double const decode =
+        TimeAccesses( count, region.base, region.size, [&]( u16 address ) { return bus->DecodeRead( address ); } );
+    double const paged =
+        TimeAccesses( count, region.base, region.size, [&]( u16 address ) { return bus->Read( address ); } );
+    fmt::print( "{:<16} {:>12.2f} {:>12.2f} {:>8.1f}x\n", region.name, decode, paged, decode / paged );
+  }
+  for ( Region const region : { Region{ "RAM write", 0x0000, 0x0800 }, Region{ "PRG RAM write", 0x6000, 0x2000 } } ) {
+    double const decode = TimeAccesses( count, region.base, region.size, [&]( u16 address ) {
+      bus->DecodeWrite( address, static_cast<u8>( address ) );
+      return 0;
+    } );
+    double const paged = TimeAccesses( count, region.base, region.size, [&]( u16 address ) {
+      bus->Write( address, static_cast<u8>( address ) );
+      return 0;
+    } );
+    fmt::print( "{:<16} {:>12.2f} {:>12.2f} {:>8.1f}x\n", region.name, decode, paged, decode / paged );
+  }
+  return 0;
+}
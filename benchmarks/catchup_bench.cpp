@@ -0,0 +1,24 @@
+// catchup_bench.cpp
+// Host time per emulated frame with the PPU ticked in lockstep and caught up in batches.
+// Usage: catchup_bench [frames]
+
+#include "bench.h"
+#include <fmt/base.h>
+
+int main( int argc, char **argv )
+{
+  u64 const frames = bench::FramesArg( argc, argv, 1200 );
+
+  fmt::print( "{:<16} {:>14} {:>14} {:>9}\n", "rom", "lockstep us/f", "catch-up us/f", "speedup" );
+  for ( const auto *rom : { "nestest.nes", "mario.nes", "metroid.nes", "amagon.nes" } ) {
+    double usPerFrame[2] = {};
+    for ( bool const enabled : { false, true } ) {
+      bench::Result const result =
+          bench::RunRom( rom, frames, 60, [enabled]( Bus &bus ) { bus.ppu.SetCatchUp( enabled ); } );
+      usPerFrame[enabled ? 1 : 0] = result.seconds * 1e6 / static_cast<double>( result.frames );
+    }
+    fmt::print( "{:<16} {:>14.1f} {:>14.1f} {:>8.2f}x\n", rom, usPerFrame[0], usPerFrame[1],
+                usPerFrame[0] / usPerFrame[1] );
+  }
+  return 0;
+}
@@ -0,0 +1,17 @@
+// checks_bench.cpp
+// Built once against the fast core and once against the instrumented one (checks_bench_fast,
+// checks_bench_debug), see core/checks.h. Usage: checks_bench_<core> [frames]
+
+#include "bench.h"
+#include "checks.h"
+
+int main( int argc, char **argv )
+{
+  u64 const frames = bench::FramesArg( argc, argv, 1200 );
+
+  bench::PrintHeader( checks::enabled ? "Core: instrumented" : "Core: fast" );
+  for ( const auto *rom : { "nestest.nes", "instr_test-v5.nes", "mario.nes", "metroid.nes" } ) {
+    bench::PrintResult( bench::RunRom( rom, frames ) );
+  }
+  return 0;
+}
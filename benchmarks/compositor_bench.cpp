@@ -0,0 +1,93 @@
+// compositor_bench.cpp
+// Host time of each compositor kernel the host can run, for whole lines (the scanline renderer) and tile
+// groups of 8 pixels (the dot renderer's batches), over lines taken from a game. Usage: compositor_bench [frames]
+
+#include "bench.h"
+#include "compositor.h"
+#include <array>
+#include <chrono>
+#include <fmt/base.h>
+#include <vector>
+
+namespace
+{
+struct Line {
+  std::array<u8, 256> background{};
+  std::array<u8, 256> sprites{};
+};
+
+/*
+ * @brief A frame's worth of line buffers, rebuilt from what a game drew: its colors back to palette entries
+ * Only the layers' opacity and the entries matter to the kernels, so a guess from the colors is enough
+ */
+std::vector<Line> LinesFrom( const Bus &bus )
+{
+  PPU const &ppu = bus.ppu;
+  u32 const  backdrop = ppu.GetFrameBuffer()->at( 0 );
+  std::vector<Line> lines( 240 );
+  for ( size_t y = 0; y < lines.size(); y++ ) {
+    for ( size_t x = 0; x < 256; x++ ) {
+      u32 const color = ppu.GetFrameBuffer()->at( ( y * 256 ) + x );
+      u8 const  shade = static_cast<u8>( ( ( color >> 4 ) ^ ( color >> 12 ) ) & 0x0F );
+      lines[y].background[x] = color == backdrop ? 0 : static_cast<u8>( shade | 0x01 );
+      // A sprite or two over every other tile row
+      if ( ( ( x / 16 ) + ( y / 8 ) ) % 7 == 0 ) {
+        lines[y].sprites[x] = static_cast<u8>( ( shade & 0x07 ) | ( ( y % 3 ) == 0 ? compositor::spriteFront : 0 ) );
+      }
+    }
+  }
+  return lines;
+}
+
+double NsPerLine( const std::vector<Line> &lines, const std::array<u32, 32> &colors, compositor::Kernel kernel, int count,
+                  u64 rounds )
+{
+  std::array<u32, 256> out{};
+  u64                  hits = 0;
+  auto const           start = std::chrono::steady_clock::now();
+  for ( u64 round = 0; round < rounds; round++ ) {
+    for ( Line const &line : lines ) {
+      for ( int x = 0; x < 256; x += count ) {
+        compositor::Span const span{ &line.background[x], &line.sprites[x], colors.data(), &out[x], x, count, 8, 0 };
+        hits += compositor::Composite( span, kernel ) ? 1 : 0;
+      }
+    }
+  }
+  auto const end = std::chrono::steady_clock::now();
+  // Keeps the work from being thrown away
+  if ( hits == ~u64{ 0 } || out[0] == 0xDEADBEEF ) {
+    fmt::print( "\n" );
+  }
+  double const ns = std::chrono::duration<double, std::nano>( end - start ).count();
+  return ns / static_cast<double>( rounds * lines.size() );
+}
+} // namespace
+
+int main( int argc, char **argv )
+{
+  u64 const frames = bench::FramesArg( argc, argv, 2000 );
+
+  auto bus = bench::MakeBus( "mario.nes" );
+  for ( int i = 0; i < 120; i++ ) {
+    bench::RunFrame( *bus );
+  }
+  std::vector<Line> const   lines = LinesFrom( *bus );
+  std::array<u32, 32> const colors = bus->ppu.PaletteColors();
+
+  fmt::print( "best kernel: {}\n", compositor::KernelName( compositor::BestKernel() ) );
+  fmt::print( "{:<10} {:>14} {:>16} {:>9}\n", "kernel", "ns/line whole", "ns/line by tile", "vs scalar" );
+  double scalar = 0.0;
+  for ( auto const kernel : { compositor::Kernel::Scalar, compositor::Kernel::Sse2, compositor::Kernel::Avx2 } ) {
+    if ( !compositor::IsSupported( kernel ) ) {
+      fmt::print( "{:<10} {:>14} {:>16}\n", compositor::KernelName( kernel ), "n/a", "n/a" );
+      continue;
+    }
+    double const whole = NsPerLine( lines, colors, kernel, 256, frames );
+    double const tiles = NsPerLine( lines, colors, kernel, 8, frames );
+    if ( kernel == compositor::Kernel::Scalar ) {
+      scalar = whole;
+    }
+    fmt::print( "{:<10} {:>14.1f} {:>16.1f} {:>8.2f}x\n", compositor::KernelName( kernel ), whole, tiles, scalar / whole );
+  }
+  return 0;
+}
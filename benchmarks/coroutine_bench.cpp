@@ -0,0 +1,52 @@
+// coroutine_bench.cpp
+// Host time per emulated frame with the classic run loop and with the coroutine engine, and how often the
+// engine resumes a component per frame. Usage: coroutine_bench [frames]
+
+#include "bench.h"
+#include <chrono>
+#include <fmt/base.h>
+
+namespace
+{
+struct Timing {
+  double usPerFrame = 0.0;
+  double resumesPerFrame = 0.0;
+};
+
+Timing TimeFrames( const char *rom, u64 frames, bool coroutines )
+{
+  auto bus = bench::MakeBus( rom );
+  bus->engine.SetEnabled( coroutines );
+  for ( int i = 0; i < 60; i++ ) {
+    bench::RunFrame( *bus );
+  }
+  bus->engine.ResetStats();
+
+  auto const start = std::chrono::steady_clock::now();
+  for ( u64 i = 0; i < frames; i++ ) {
+    bench::RunFrame( *bus );
+  }
+  auto const end = std::chrono::steady_clock::now();
+
+  u64 resumes = 0;
+  for ( u64 const count : bus->engine.GetStats().resumes ) {
+    resumes += count;
+  }
+  double const seconds = std::chrono::duration<double>( end - start ).count();
+  return { seconds * 1e6 / static_cast<double>( frames ), static_cast<double>( resumes ) / static_cast<double>( frames ) };
+}
+} // namespace
+
+int main( int argc, char **argv )
+{
+  u64 const frames = bench::FramesArg( argc, argv, 1200 );
+
+  fmt::print( "{:<16} {:>14} {:>14} {:>9} {:>12}\n", "rom", "classic us/f", "engine us/f", "speedup", "resumes/f" );
+  for ( const auto *rom : { "nestest.nes", "mario.nes", "metroid.nes", "amagon.nes" } ) {
+    Timing const classic = TimeFrames( rom, frames, false );
+    Timing const engine = TimeFrames( rom, frames, true );
+    fmt::print( "{:<16} {:>14.1f} {:>14.1f} {:>8.2f}x {:>12.0f}\n", rom, classic.usPerFrame, engine.usPerFrame,
+                classic.usPerFrame / engine.usPerFrame, engine.resumesPerFrame );
+  }
+  return 0;
+}
@@ -0,0 +1,15 @@
+// cpu_bench.cpp
+// Emulated CPU throughput on real roms. Usage: cpu_bench [frames]
+
+#include "bench.h"
+
+int main( int argc, char **argv )
+{
+  u64 const frames = bench::FramesArg( argc, argv, 1200 );
+
+  bench::PrintHeader( "CPU Throughput" );
+  for ( const auto *rom : { "nestest.nes", "mario.nes" } ) {
+    bench::PrintResult( bench::RunRom( rom, frames ) );
+  }
+  return 0;
+}
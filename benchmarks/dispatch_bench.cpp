@@ -0,0 +1,17 @@
+// dispatch_bench.cpp
+// Built once per CPU dispatch engine (dispatch_bench_table, dispatch_bench_switch, dispatch_bench_goto).
+// Run them back to back to compare. Usage: dispatch_bench_<engine> [frames]
+
+#include "bench.h"
+#include "cpu.h"
+
+int main( int argc, char **argv )
+{
+  u64 const frames = bench::FramesArg( argc, argv, 1200 );
+
+  bench::PrintHeader( "CPU Dispatch: " + std::string( CPU::dispatchName ) );
+  for ( const auto *rom : { "nestest.nes", "mario.nes" } ) {
+    bench::PrintResult( bench::RunRom( rom, frames ) );
+  }
+  return 0;
+}
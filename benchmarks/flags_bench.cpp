@@ -0,0 +1,17 @@
+// flags_bench.cpp
+// Built once with eager and once with lazy N/Z flags (flags_bench_eager, flags_bench_lazy).
+// The test roms are mostly compare-and-branch loops. Usage: flags_bench_<mode> [frames]
+
+#include "bench.h"
+#include "cpu.h"
+
+int main( int argc, char **argv )
+{
+  u64 const frames = bench::FramesArg( argc, argv, 1200 );
+
+  bench::PrintHeader( CPU::lazyFlags ? "CPU Flags: lazy" : "CPU Flags: eager" );
+  for ( const auto *rom : { "nestest.nes", "instr_test-v5.nes", "mario.nes" } ) {
+    bench::PrintResult( bench::RunRom( rom, frames ) );
+  }
+  return 0;
+}
@@ -0,0 +1,230 @@
+// layout_bench.cpp
+// Where the per-cycle state of the CPU and PPU sits in memory, and what it costs the host caches: L1 data
+// cache loads and misses, and instructions, per emulated frame. One bus at a time, and a batch of headless
+// buses run round robin, which is where a spread out hot state shows most. Usage: layout_bench [frames]
+//
+// The counters come from perf_event_open (Linux). Without them (no PMU in a VM, perf_event_paranoid too
+// high) only the host time is printed. The benchmark only names members that predate the hot state layout,
+// so it can be dropped into an older tree to get the before numbers.
+
+#include "bench.h"
+#include "bus-arena.h"
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <fmt/base.h>
+#include <memory>
+#include <string>
+
+#if defined( __linux__ )
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+namespace
+{
+constexpr size_t lineSize = 64;
+
+/*
+ * @brief One hardware counter of this thread, user space only
+ */
+class PerfCounter
+{
+public:
+  PerfCounter( u32 type, u64 config )
+  {
+#if defined( __linux__ )
+    perf_event_attr attr{};
+    attr.size = sizeof( attr );
+    attr.type = type;
+    attr.config = config;
+    attr.disabled = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    _fd = static_cast<int>( syscall( SYS_perf_event_open, &attr, 0, -1, -1, 0 ) );
+#else
+    (void) type;
+    (void) config;
+#endif
+  }
+  ~PerfCounter()
+  {
+#if defined( __linux__ )
+    if ( _fd >= 0 ) {
+      close( _fd );
+    }
+#endif
+  }
+  PerfCounter( const PerfCounter & ) = delete;
+  PerfCounter &operator=( const PerfCounter & ) = delete;
+  PerfCounter( PerfCounter && ) = delete;
+  PerfCounter &operator=( PerfCounter && ) = delete;
+
+  bool IsOpen() const { return _fd >= 0; }
+
+  void Start()
+  {
+#if defined( __linux__ )
+    if ( IsOpen() ) {
+      ioctl( _fd, PERF_EVENT_IOC_RESET, 0 );
+      ioctl( _fd, PERF_EVENT_IOC_ENABLE, 0 );
+    }
+#endif
+  }
+
+  u64 Stop()
+  {
+    u64 count = 0;
+#if defined( __linux__ )
+    if ( IsOpen() ) {
+      ioctl( _fd, PERF_EVENT_IOC_DISABLE, 0 );
+      if ( read( _fd, &count, sizeof( count ) ) != sizeof( count ) ) {
+        count = 0;
+      }
+    }
+#endif
+    return count;
+  }
+
+private:
+  int _fd = -1;
+};
+
+struct Counters {
+#if defined( __linux__ )
+  static constexpr u64 L1dRead( u64 result )
+  {
+    return PERF_COUNT_HW_CACHE_L1D | ( PERF_COUNT_HW_CACHE_OP_READ << 8 ) | ( result << 16 );
+  }
+  PerfCounter loads{ PERF_TYPE_HW_CACHE, L1dRead( PERF_COUNT_HW_CACHE_RESULT_ACCESS ) };
+  PerfCounter misses{ PERF_TYPE_HW_CACHE, L1dRead( PERF_COUNT_HW_CACHE_RESULT_MISS ) };
+  PerfCounter instructions{ PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS };
+#else
+  PerfCounter loads{ 0, 0 };
+  PerfCounter misses{ 0, 0 };
+  PerfCounter instructions{ 0, 0 };
+#endif
+
+  bool IsOpen() const { return loads.IsOpen() && misses.IsOpen() && instructions.IsOpen(); }
+};
+
+struct Sample {
+  double usPerFrame = 0.0;
+  double loadsPerFrame = 0.0;
+  double missesPerFrame = 0.0;
+  double instructionsPerFrame = 0.0;
+};
+
+/*
+ * @brief Time and count `rounds` calls of `runRound`, each of which emulates `framesPerRound` frames
+ */
+template <typename Round> Sample Measure( Counters &counters, u64 rounds, u64 framesPerRound, Round &&runRound )
+{
+  counters.loads.Start();
+  counters.misses.Start();
+  counters.instructions.Start();
+  auto const start = std::chrono::steady_clock::now();
+  for ( u64 i = 0; i < rounds; i++ ) {
+    runRound();
+  }
+  auto const end = std::chrono::steady_clock::now();
+  u64 const instructions = counters.instructions.Stop();
+  u64 const misses = counters.misses.Stop();
+  u64 const loads = counters.loads.Stop();
+
+  auto const frames = static_cast<double>( rounds * framesPerRound );
+  return { std::chrono::duration<double>( end - start ).count() * 1e6 / frames, static_cast<double>( loads ) / frames,
+           static_cast<double>( misses ) / frames, static_cast<double>( instructions ) / frames };
+}
+
+void PrintSample( const char *name, const Sample &sample, bool counted )
+{
+  if ( !counted ) {
+    fmt::print( "{:<20} {:>10.1f} {:>14} {:>12} {:>8} {:>14}\n", name, sample.usPerFrame, "n/a", "n/a", "n/a", "n/a" );
+    return;
+  }
+  double const missRate = sample.loadsPerFrame > 0.0 ? 100.0 * sample.missesPerFrame / sample.loadsPerFrame : 0.0;
+  fmt::print( "{:<20} {:>10.1f} {:>14.0f} {:>12.0f} {:>7.2f}% {:>14.0f}\n", name, sample.usPerFrame,
+              sample.loadsPerFrame, sample.missesPerFrame, missRate, sample.instructionsPerFrame );
+}
+
+template <typename Object, typename Member> size_t OffsetIn( const Object &object, const Member &member )
+{
+  return static_cast<size_t>( reinterpret_cast<const std::byte *>( &member ) -
+                              reinterpret_cast<const std::byte *>( &object ) );
+}
+
+/*
+ * @brief Cache lines that the bytes from `first` to the end of `last` touch
+ */
+template <typename First, typename Last> size_t LinesSpanned( const First &first, const Last &last )
+{
+  auto const from = reinterpret_cast<std::uintptr_t>( &first );
+  auto const to = reinterpret_cast<std::uintptr_t>( &last ) + sizeof( Last ) - 1;
+  return ( to / lineSize ) - ( from / lineSize ) + 1;
+}
+
+void PrintLayout( const Bus &bus )
+{
+  CPU const &cpu = bus.cpu;
+  PPU const &ppu = bus.ppu;
+
+  fmt::print( "\n---------- Hot State Layout ----------\n" );
+  fmt::print( "{:<20} {:>8} {:>10} {:>12} {:>8}\n", "member", "offset", "sizeof", "hot bytes", "lines" );
+  // The CPU's registers and cycle counters, from the bus pointer to the last field a step looks at
+  fmt::print( "{:<20} {:>8} {:>10} {:>12} {:>8}\n", "Bus::cpu", OffsetIn( bus, cpu ), sizeof( CPU ),
+              OffsetIn( cpu, cpu.mesenFormatTraceEnabled ) + 1, LinesSpanned( cpu.bus, cpu.mesenFormatTraceEnabled ) );
+  // The PPU's position, registers, fetch latches and shifters
+  fmt::print( "{:<20} {:>8} {:>10} {:>12} {:>8}\n", "Bus::ppu", OffsetIn( bus, ppu ), sizeof( PPU ),
+              OffsetIn( ppu, ppu.nOamEntry ) + 1, LinesSpanned( ppu.bus, ppu.nOamEntry ) );
+  fmt::print( "{:<20} {:>8} {:>10}\n", "Bus::dmaInProgress", OffsetIn( bus, bus.dmaInProgress ), sizeof( Bus ) );
+}
+} // namespace
+
+int main( int argc, char **argv )
+{
+  u64 const frames = bench::FramesArg( argc, argv, 1200 );
+
+  {
+    auto const bus = std::make_unique<Bus>();
+    PrintLayout( *bus );
+  }
+
+  Counters   counters;
+  bool const counted = counters.IsOpen();
+  if ( !counted ) {
+    fmt::print( "\nHardware counters unavailable (no PMU, or perf_event_paranoid too high): host time only\n" );
+  }
+
+  fmt::print( "\n---------- Per Emulated Frame ----------\n" );
+  fmt::print( "{:<20} {:>10} {:>14} {:>12} {:>8} {:>14}\n", "run", "us", "L1D loads", "L1D misses", "miss", "instructions" );
+  for ( const auto *rom : { "nestest.nes", "mario.nes", "metroid.nes", "amagon.nes" } ) {
+    auto bus = bench::MakeBus( rom );
+    for ( int i = 0; i < 60; i++ ) {
+      bench::RunFrame( *bus );
+    }
+    PrintSample( rom, Measure( counters, frames, 1, [&]() { bench::RunFrame( *bus ); } ), counted );
+  }
+
+  // Many headless machines taking turns a frame at a time, the way a batch runner would drive them: each
+  // one comes back to a cache that the others have been through
+  constexpr size_t batch = 64;
+  BusArena         arena( batch, true );
+  for ( size_t i = 0; i < batch; i++ ) {
+    arena[i].cartridge.LoadRom( std::string( paths::roms() ) + "/mario.nes" );
+    arena[i].cpu.Reset();
+    for ( int frame = 0; frame < 10; frame++ ) {
+      arena[i].RunFrame();
+    }
+  }
+  u64 const rounds = frames / batch > 0 ? frames / batch : 1;
+  Sample const interleaved = Measure( counters, rounds, batch, [&]() {
+    for ( size_t i = 0; i < batch; i++ ) {
+      arena[i].RunFrame();
+    }
+  } );
+  PrintSample( "mario.nes x64 arena", interleaved, counted );
+  return 0;
+}
@@ -0,0 +1,75 @@
+// nametable_bench.cpp
+// Host time of a nametable read: through the page pointers the PPU keeps, and through the mapper's mirroring
+// and a switch on every access as before, over the addresses the background fetches walk in a frame.
+// Usage: nametable_bench [rounds]
+
+#include "bench.h"
+#include <chrono>
+#include <fmt/base.h>
+#include <vector>
+
+namespace
+{
+// The lookup the page pointers replaced: the mirroring from the cartridge, then the nametable it picks
+u8 ReadThroughMirroring( Bus &bus, u16 address )
+{
+  u16 const v = address & 0x0FFF;
+  u8        table = 0;
+  switch ( bus.cartridge.GetMirrorMode() ) {
+    case MirrorMode::Vertical   : table = ( ( v / 0x400 ) & 0x01 ); break;
+    case MirrorMode::Horizontal : table = ( v < 0x800 ) ? 0 : 1; break;
+    case MirrorMode::SingleLower: table = 0; break;
+    case MirrorMode::SingleUpper: table = 1; break;
+    case MirrorMode::FourScreen : table = ( v / 0x400 ) & 0x03; break;
+  }
+  return bus.ppu.nameTables.at( table ).at( v & 0x03FF );
+}
+
+template <typename Read> double NsPerRead( const std::vector<u16> &addresses, u64 rounds, Read &&read )
+{
+  u64        sum = 0;
+  auto const start = std::chrono::steady_clock::now();
+  for ( u64 round = 0; round < rounds; round++ ) {
+    for ( u16 const address : addresses ) {
+      sum += read( address );
+    }
+  }
+  auto const end = std::chrono::steady_clock::now();
+  // Keeps the work from being thrown away
+  if ( sum == ~u64{ 0 } ) {
+    fmt::print( "\n" );
+  }
+  double const ns = std::chrono::duration<double, std::nano>( end - start ).count();
+  return ns / static_cast<double>( rounds * addresses.size() );
+}
+} // namespace
+
+int main( int argc, char **argv )
+{
+  u64 const rounds = bench::FramesArg( argc, argv, 2000 );
+
+  fmt::print( "{:<12} {:>14} {:>14} {:>9}\n", "rom", "ns/read switch", "ns/read pages", "speedup" );
+  for ( const auto *rom : { "mario.nes", "metroid.nes" } ) {
+    auto bus = bench::MakeBus( rom );
+    for ( int i = 0; i < 120; i++ ) {
+      bench::RunFrame( *bus );
+    }
+
+    // A nametable and an attribute byte per tile, 32 tiles a line, 240 lines, across two nametables
+    std::vector<u16> addresses;
+    for ( u16 line = 0; line < 240; line++ ) {
+      for ( u16 tile = 0; tile < 32; tile++ ) {
+        u16 const table = ( line & 0x01 ) != 0 ? 0x0400 : 0x0000;
+        u16 const row = line / 8;
+        addresses.push_back( 0x2000 | table | ( row << 5 ) | tile );
+        addresses.push_back( 0x23C0 | table | ( ( row >> 2 ) << 3 ) | ( tile >> 2 ) );
+      }
+    }
+
+    double const before =
+        NsPerRead( addresses, rounds, [&]( u16 address ) { return ReadThroughMirroring( *bus, address ); } );
+    double const after = NsPerRead( addresses, rounds, [&]( u16 address ) { return bus->ppu.ReadVram( address ); } );
+    fmt::print( "{:<12} {:>14.2f} {:>14.2f} {:>8.2f}x\n", rom, before, after, before / after );
+  }
+  return 0;
+}
@@ -0,0 +1,18 @@
+// predecode_bench.cpp
+// Emulated CPU throughput with the PRG ROM predecode cache off and on. Usage: predecode_bench [frames]
+
+#include "bench.h"
+
+int main( int argc, char **argv )
+{
+  u64 const frames = bench::FramesArg( argc, argv, 1200 );
+
+  for ( bool const enabled : { false, true } ) {
+    bench::PrintHeader( enabled ? "Predecode: on" : "Predecode: off" );
+    for ( const auto *rom : { "nestest.nes", "mario.nes", "metroid.nes", "amagon.nes" } ) {
+      bench::PrintResult(
+          bench::RunRom( rom, frames, 60, [enabled]( Bus &bus ) { bus.cartridge.SetPredecodeEnabled( enabled ); } ) );
+    }
+  }
+  return 0;
+}
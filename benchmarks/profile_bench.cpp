@@ -0,0 +1,28 @@
+// profile_bench.cpp
+// Runs a rom with the host profiler compiled in (emu_core_profiled) and prints where the host time went:
+// per opcode, addressing mode, PPU phase, and bus region. Usage: profile_bench [frames] [rom]
+
+#include "bench.h"
+#include "profiler.h"
+#include <fmt/base.h>
+#include <string>
+
+int main( int argc, char **argv )
+{
+  u64 const         frames = bench::FramesArg( argc, argv, 600 );
+  std::string const rom = argc > 2 ? argv[2] : "mario.nes";
+
+  auto bus = bench::MakeBus( rom );
+  for ( u64 i = 0; i < 60; i++ ) {
+    bench::RunFrame( *bus );
+  }
+
+  profiler::Get().Reset();
+  for ( u64 i = 0; i < frames; i++ ) {
+    bench::RunFrame( *bus );
+  }
+
+  fmt::print( "\n---------- Host Profile: {}, {} frames ----------\n", rom, frames );
+  fmt::print( "{}", profiler::Get().Report() );
+  return 0;
+}
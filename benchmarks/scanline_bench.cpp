@@ -0,0 +1,23 @@
+// scanline_bench.cpp
+// Frames per second with every visible line drawn dot by dot, and with the scanline renderer drawing the
+// lines and tile groups that a catch-up batch covers whole. Usage: scanline_bench [frames]
+
+#include "bench.h"
+#include <fmt/base.h>
+
+int main( int argc, char **argv )
+{
+  u64 const frames = bench::FramesArg( argc, argv, 1200 );
+
+  fmt::print( "{:<16} {:>12} {:>14} {:>9}\n", "rom", "dots fps", "scanlines fps", "speedup" );
+  for ( const auto *rom : { "mario.nes", "metroid.nes", "bomberman2.nes", "scanline.nes" } ) {
+    double fps[2] = {};
+    for ( bool const enabled : { false, true } ) {
+      bench::Result const result =
+          bench::RunRom( rom, frames, 60, [enabled]( Bus &bus ) { bus.ppu.SetScanlineRenderer( enabled ); } );
+      fps[enabled ? 1 : 0] = result.Fps();
+    }
+    fmt::print( "{:<16} {:>12.1f} {:>14.1f} {:>8.2f}x\n", rom, fps[0], fps[1], fps[1] / fps[0] );
+  }
+  return 0;
+}
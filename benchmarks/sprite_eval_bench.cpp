@@ -0,0 +1,78 @@
+// sprite_eval_bench.cpp
+// Host time of sprite evaluation per line: PPU::SpriteEval(), which tests all 64 OAM entries at once, against
+// the entry by entry walk over OAM it replaced, on random OAM with most sprites crowded into a band of lines.
+// Usage: sprite_eval_bench [rounds]
+
+#include "bench.h"
+#include <array>
+#include <chrono>
+#include <cstring>
+#include <fmt/base.h>
+#include <random>
+
+namespace
+{
+// The walk over the 64 entries, one at a time, stopping at the ninth sprite on the line
+int WalkOam( const PPU &ppu, int line, bool isLarge, SecondaryOAM &secondary )
+{
+  std::memset( secondary.data.data(), 0xFF, secondary.data.size() );
+  int found = 0;
+  for ( u8 i = 0; i < 64; i++ ) {
+    if ( PPU::IsSpriteInRange( line, ppu.oam.entries[i].y, isLarge ) ) {
+      if ( found == 8 ) {
+        return found + 1;
+      }
+      secondary.entries[found] = ppu.oam.entries[i];
+      found++;
+    }
+  }
+  return found;
+}
+
+template <typename Eval> double NsPerLine( u64 rounds, Eval &&eval )
+{
+  u64        sum = 0;
+  auto const start = std::chrono::steady_clock::now();
+  for ( u64 round = 0; round < rounds; round++ ) {
+    for ( int line = 0; line < 240; line++ ) {
+      sum += eval( line );
+    }
+  }
+  auto const end = std::chrono::steady_clock::now();
+  // Keeps the work from being thrown away
+  if ( sum == ~u64{ 0 } ) {
+    fmt::print( "\n" );
+  }
+  double const ns = std::chrono::duration<double, std::nano>( end - start ).count();
+  return ns / static_cast<double>( rounds * 240 );
+}
+} // namespace
+
+int main( int argc, char **argv )
+{
+  u64 const rounds = bench::FramesArg( argc, argv, 20000 );
+
+  auto bus = bench::MakeBus( "mario.nes" );
+  PPU &ppu = bus->ppu;
+  std::mt19937 random( 24 );
+  for ( u16 address = 0; address < 256; address++ ) {
+    bool const crowded = ( address & 0x03 ) == 0 && ( random() % 4 ) != 0;
+    ppu.WriteOam( static_cast<u8>( address ), static_cast<u8>( crowded ? 100 + ( random() % 40 ) : random() ) );
+  }
+  ppu.ppuMask.value = 0x18;
+
+  fmt::print( "{:<8} {:>14} {:>12} {:>9}\n", "height", "ns/line walk", "ns/line eval", "speedup" );
+  for ( bool const isLarge : { false, true } ) {
+    ppu.ppuCtrl.bit.spriteSize = isLarge ? 1 : 0;
+    SecondaryOAM secondary{};
+    double const walk = NsPerLine( rounds, [&]( int line ) { return WalkOam( ppu, line, isLarge, secondary ); } );
+    double const eval = NsPerLine( rounds, [&]( int line ) {
+      ppu.scanline = static_cast<u16>( line );
+      ppu.cycle = 257;
+      ppu.SpriteEval();
+      return ppu.spriteCount;
+    } );
+    fmt::print( "{:<8} {:>14.1f} {:>12.1f} {:>8.2f}x\n", isLarge ? 16 : 8, walk, eval, walk / eval );
+  }
+  return 0;
+}
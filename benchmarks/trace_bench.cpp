@@ -0,0 +1,32 @@
+// trace_bench.cpp
+// Emulated CPU throughput with tracing off, with the instruction trace, and with the Mesen format trace.
+// Usage: trace_bench [frames]
+
+#include "bench.h"
+
+int main( int argc, char **argv )
+{
+  u64 const frames = bench::FramesArg( argc, argv, 600 );
+
+  bench::PrintHeader( "Trace: off" );
+  for ( const auto *rom : { "mario.nes", "metroid.nes" } ) {
+    bench::PrintResult( bench::RunRom( rom, frames ) );
+  }
+
+  bench::PrintHeader( "Trace: instructions (10000 records)" );
+  for ( const auto *rom : { "mario.nes", "metroid.nes" } ) {
+    bench::PrintResult( bench::RunRom( rom, frames, 60, []( Bus &bus ) {
+      bus.cpu.SetTraceSize( 10000 );
+      bus.cpu.EnableTracelog();
+    } ) );
+  }
+
+  bench::PrintHeader( "Trace: mesen (10000 records)" );
+  for ( const auto *rom : { "mario.nes", "metroid.nes" } ) {
+    bench::PrintResult( bench::RunRom( rom, frames, 60, []( Bus &bus ) {
+      bus.cpu.SetMesenTraceSize( 10000 );
+      bus.cpu.EnableMesenFormatTraceLog();
+    } ) );
+  }
+  return 0;
+}
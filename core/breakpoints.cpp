@@ -0,0 +1,167 @@
+#include "breakpoints.h"
+#include "bus.h"
+#include "global-types.h"
+
+/*
+################################
+||     Breakpoint Methods     ||
+################################
+*/
+void Breakpoints::AddRange( Kind kind, u16 first, u16 last )
+{
+  if ( _maps == nullptr ) {
+    _maps = std::make_unique<std::array<Bitmap, kindCount>>();
+  }
+  Bitmap &bits = ( *_maps )[Index( kind )];
+  for ( u32 address = first; address <= last; address++ ) {
+    // PPU space is 16 KiB, its mirrors above $3FFF land on the same bits
+    u16 const bit = IsPpu( kind ) ? address & 0x3FFF : address;
+    u64 const mask = u64{ 1 } << ( bit & 63 );
+    if ( ( bits[bit >> 6] & mask ) == 0 ) {
+      bits[bit >> 6] |= mask;
+      _counts[Index( kind )]++;
+    }
+  }
+  UpdateArmed();
+}
+
+void Breakpoints::Remove( Kind kind, u16 address )
+{
+  if ( !Has( kind, address ) ) {
+    return;
+  }
+  u16 const bit = IsPpu( kind ) ? address & 0x3FFF : address;
+  ( *_maps )[Index( kind )][bit >> 6] &= ~( u64{ 1 } << ( bit & 63 ) );
+  _counts[Index( kind )]--;
+  UpdateArmed();
+}
+
+void Breakpoints::Clear( Kind kind )
+{
+  if ( _maps != nullptr ) {
+    ( *_maps )[Index( kind )].fill( 0 );
+  }
+  _counts[Index( kind )] = 0;
+  UpdateArmed();
+}
+
+void Breakpoints::ClearAll()
+{
+  _maps.reset();
+  _counts.fill( 0 );
+  _hit.reset();
+  UpdateArmed();
+}
+
+bool Breakpoints::Has( Kind kind, u16 address ) const
+{
+  if ( _maps == nullptr ) {
+    return false;
+  }
+  return Test( kind, IsPpu( kind ) ? address & 0x3FFF : address );
+}
+
+std::vector<u16> Breakpoints::List( Kind kind ) const
+{
+  std::vector<u16> addresses;
+  if ( _maps == nullptr ) {
+    return addresses;
+  }
+  for ( u32 address = 0; address < 0x10000; address++ ) {
+    if ( Test( kind, address ) ) {
+      addresses.push_back( address );
+    }
+  }
+  return addresses;
+}
+
+void Breakpoints::SetEnabled( bool enabled )
+{
+  _enabled = enabled;
+  UpdateArmed();
+}
+
+void Breakpoints::UpdateArmed()
+{
+  bool any = false;
+  for ( u32 const count : _counts ) {
+    any = any || count > 0;
+  }
+  bool const wasArmed = _armed;
+  _armed = _enabled && any;
+  if ( _armed && !wasArmed ) {
+    // Armed between runs or in the middle of one: the instruction at pc is the one to run next
+    Resume();
+  } else if ( !_armed ) {
+    _hit.reset();
+  }
+}
+
+/*
+################################
+||           Hooks            ||
+################################
+*/
+void Breakpoints::Resume()
+{
+  // The execution breakpoint at pc, if there is one, is what stopped the last run: let that instruction go
+  _hit.reset();
+  _stepPc = bus->cpu.GetProgramCounter();
+  _resumeInstructions = bus->cpu.GetInstructions();
+}
+
+bool Breakpoints::CheckStep()
+{
+  // A watchpoint went off during the step that just ended
+  if ( _hit ) {
+    return true;
+  }
+
+  CPU const &cpu = bus->cpu;
+  u16 const  pc = cpu.GetProgramCounter();
+  _stepPc = pc;
+  if ( cpu.GetInstructions() != _resumeInstructions && Test( Kind::Execute, pc ) ) {
+    Record( Kind::Execute, pc, bus->Read( pc, true ) );
+    return true;
+  }
+  return false;
+}
+
+void Breakpoints::Record( Kind kind, u16 address, u8 value )
+{
+  // The first hit of a step is the one reported
+  if ( !_hit ) {
+    _hit = Hit{ kind, address, _stepPc, value };
+  }
+}
+
+void Breakpoints::OnCpuRead( u16 address, u8 value )
+{
+  // The instruction's own bytes, from its opcode up to pc, are fetches
+  u16 const pc = bus->cpu.GetProgramCounter();
+  bool const fetch = static_cast<u16>( address - _stepPc ) < static_cast<u16>( pc - _stepPc );
+  if ( !fetch && Test( Kind::Read, address ) ) {
+    Record( Kind::Read, address, value );
+  }
+}
+
+void Breakpoints::OnCpuWrite( u16 address, u8 data )
+{
+  if ( Test( Kind::Write, address ) ) {
+    Record( Kind::Write, address, data );
+  }
+}
+
+void Breakpoints::OnPpuRead( u16 address, u8 value )
+{
+  if ( Test( Kind::PpuRead, address & 0x3FFF ) ) {
+    Record( Kind::PpuRead, address & 0x3FFF, value );
+  }
+}
+
+void Breakpoints::OnPpuWrite( u16 address, u8 data )
+{
+  if ( Test( Kind::PpuWrite, address & 0x3FFF ) ) {
+    Record( Kind::PpuWrite, address & 0x3FFF, data );
+  }
+}
@@ -0,0 +1,120 @@
+#pragma once
+
+#include "checks.h"
+#include "global-types.h"
+#include <array>
+#include <cstddef>
+#include <memory>
+#include <optional>
+#include <vector>
+
+class Bus;
+
+/*
+################################################################
+||                                                            ||
+||                        Breakpoints                         ||
+||                                                            ||
+################################################################
+*/
+
+/*
+ * @brief Execution breakpoints and memory watchpoints that stop the run loops
+ *
+ * One bitmap of 64 Ki bits per kind: execution, reads and writes in CPU space, and reads and writes of PPU
+ * space through $2007. A hit stops Bus::RunUntil() at the next step boundary, and GetHit() tells where:
+ * - Execute stops before the instruction at the address runs. The next run starts by executing it
+ * - Read and Write stop after the instruction that made the access. Opcode and operand fetches are
+ *   execution, not reads, and debug reads never hit
+ * - PpuRead and PpuWrite watch the CPU's $2007 accesses, not the PPU's own rendering fetches
+ *
+ * With nothing set, every hook is one test of IsArmed(), and the bitmaps aren't even allocated. While
+ * armed, the idle loop skipping and bulk OAM DMA step aside, so every instruction and
+ * access is seen. The fast core (see checks.h) compiles the hooks out like the trace hooks.
+ */
+class Breakpoints
+{
+public:
+  explicit Breakpoints( Bus *bus ) : bus( bus ) {}
+
+  enum class Kind : u8 { Execute, Read, Write, PpuRead, PpuWrite, Count };
+  static constexpr size_t kindCount = static_cast<size_t>( Kind::Count );
+
+  struct Hit {
+    Kind kind = Kind::Execute;
+    u16  address = 0x0000; // What was executed or accessed, a PPU address for the PPU kinds
+    u16  pc = 0x0000;      // Instruction that hit
+    u8   value = 0x00;     // Opcode, byte read, or byte written
+  };
+
+  /*
+  ################################
+  ||     Breakpoint Methods     ||
+  ################################
+  */
+  void Add( Kind kind, u16 address ) { AddRange( kind, address, address ); }
+  // Inclusive, e.g. a whole page or a nametable
+  void             AddRange( Kind kind, u16 first, u16 last );
+  void             Remove( Kind kind, u16 address );
+  void             Clear( Kind kind );
+  void             ClearAll();
+  bool             Has( Kind kind, u16 address ) const;
+  size_t           Count( Kind kind ) const { return _counts[Index( kind )]; }
+  std::vector<u16> List( Kind kind ) const;
+
+  // Keeps the breakpoints but stops checking them
+  void SetEnabled( bool enabled );
+  bool IsEnabled() const { return _enabled; }
+
+  // What stopped the last run, if a breakpoint did
+  std::optional<Hit> const &GetHit() const { return _hit; }
+
+  /*
+  ################################
+  ||           Hooks            ||
+  ################################
+  */
+  bool IsArmed() const { return checks::enabled && _armed; }
+
+  // Called by Bus::RunUntil() when a run starts, and before every step. Each is one branch when disarmed
+  void BeginRun()
+  {
+    if ( IsArmed() ) {
+      Resume();
+    }
+  }
+  bool ShouldStop() { return IsArmed() && CheckStep(); }
+
+  // Called by the bus and the PPU for accesses while armed
+  void OnCpuRead( u16 address, u8 value );
+  void OnCpuWrite( u16 address, u8 data );
+  void OnPpuRead( u16 address, u8 value );
+  void OnPpuWrite( u16 address, u8 data );
+
+private:
+  Bus *bus;
+
+  using Bitmap = std::array<u64, 0x10000 / 64>;
+
+  bool                       _armed = false; // Enabled, and something is set
+  bool                       _enabled = true;
+  u16                        _stepPc = 0x0000; // Instruction of the step in progress
+  u64                        _resumeInstructions = 0;
+  std::optional<Hit>         _hit;
+  std::array<u32, kindCount> _counts{};
+
+  // Allocated with the first breakpoint
+  std::unique_ptr<std::array<Bitmap, kindCount>> _maps;
+
+  static constexpr size_t Index( Kind kind ) { return static_cast<size_t>( kind ); }
+  static constexpr bool   IsPpu( Kind kind ) { return kind == Kind::PpuRead || kind == Kind::PpuWrite; }
+  bool                    Test( Kind kind, u16 address ) const
+  {
+    u64 const word = ( *_maps )[Index( kind )][address >> 6];
+    return ( ( word >> ( address & 63 ) ) & 1 ) != 0;
+  }
+  void Record( Kind kind, u16 address, u8 value );
+  void UpdateArmed();
+  void Resume();
+  bool CheckStep();
+};
@@ -0,0 +1,36 @@
+#include "bus-arena.h"
+#include "bus.h"
+#include "ppu.h"
+#include <cstddef>
+#include <memory>
+#include <new>
+
+BusArena::BusArena( size_t count, bool headless )
+    : _storage( static_cast<std::byte *>( ::operator new[]( count * stride, std::align_val_t{ alignment } ) ) )
+{
+  if ( !headless ) {
+    _frameBuffers = std::make_unique<PPU::FrameBuffer[]>( count );
+  }
+  try {
+    for ( ; _count < count; _count++ ) {
+      PPU::FrameBuffer *frameBuffer = headless ? nullptr : &_frameBuffers[_count];
+      new ( _storage.get() + ( _count * stride ) ) Bus( frameBuffer );
+    }
+  } catch ( ... ) {
+    // The destructor doesn't run for a constructor that throws, the storage is freed by its owner
+    DestroyAll();
+    throw;
+  }
+}
+
+BusArena::~BusArena()
+{
+  DestroyAll();
+}
+
+void BusArena::DestroyAll()
+{
+  while ( _count > 0 ) {
+    At( --_count )->~Bus();
+  }
+}
@@ -0,0 +1,56 @@
+#pragma once
+#include "bus.h"
+#include "ppu.h"
+#include <cstddef>
+#include <memory>
+#include <new>
+
+/*
+################################################################
+||                                                            ||
+||                          Bus Arena                         ||
+||                                                            ||
+################################################################
+*/
+
+/*
+ * @brief A batch of buses constructed side by side in one allocation
+ * Each bus starts on its own cache line, so neighbours never share one. The frame buffers, when there are
+ * any, sit in a second block of their own, so the emulation state of the whole batch stays together.
+ * Buses never move: the components keep pointers to their bus.
+ */
+class BusArena
+{
+public:
+  // `headless` buses have no frame buffer at all (see PPU::SetFrameBuffer())
+  explicit BusArena( size_t count, bool headless = false );
+  ~BusArena();
+
+  BusArena( const BusArena & ) = delete;
+  BusArena &operator=( const BusArena & ) = delete;
+  BusArena( BusArena && ) = delete;
+  BusArena &operator=( BusArena && ) = delete;
+
+  Bus       &operator[]( size_t index ) { return *At( index ); }
+  Bus const &operator[]( size_t index ) const { return *At( index ); }
+  size_t     Size() const { return _count; }
+
+  static constexpr size_t alignment = cacheLineSize;
+  // Distance between two buses, sizeof(Bus) rounded up to the alignment
+  static constexpr size_t stride = ( sizeof( Bus ) + alignment - 1 ) / alignment * alignment;
+
+private:
+  struct AlignedDelete {
+    void operator()( std::byte *memory ) const { ::operator delete[]( memory, std::align_val_t{ alignment } ); }
+  };
+
+  Bus *At( size_t index ) const
+  {
+    return std::launder( reinterpret_cast<Bus *>( _storage.get() + ( index * stride ) ) );
+  }
+  void DestroyAll();
+
+  std::unique_ptr<std::byte[], AlignedDelete> _storage;
+  std::unique_ptr<PPU::FrameBuffer[]>         _frameBuffers;
+  size_t                                      _count = 0; // Constructed so far
+};
@@ -1,7 +1,9 @@
 #include "bus.h"
 #include "Nes_Apu.h"
 #include "cartridge.h"
+#include "checks.h"
 #include "paths.h"
+#include "profiler.h"
 #include "utils.h"
 #include "global-types.h"
 
@@ -20,9 +22,18 @@
 #include <stdexcept>
 #include <system_error>
 
-// Constructor to initialize the bus with a flat memory model
-Bus::Bus() : cpu( this ), ppu( this ), cartridge( this )
+Bus::Bus() : Bus( nullptr )
 {
+  ppu.UseOwnFrameBuffer();
+}
+
+Bus::Bus( PPU::FrameBuffer *frameBuffer )
+    : cpu( this ), ppu( this ), breakpoints( this ), cartridge( this ), idleLoop( this ),
+      callGraph( this ), engine( this )
+{
+  ppu.SetFrameBuffer( frameBuffer );
+  UpdateMemoryMap();
+  ppu.ScheduleEvents();
 }
 
 /*
@@ -32,19 +43,32 @@ Bus::Bus() : cpu( this ), ppu( this ), cartridge( this )
 */
 u8 Bus::Read( const u16 address, bool debugMode )
 {
-  if ( _useFlatMemory ) {
-    return _flatMemory.at( address );
+  NES_PROFILE_SCOPE( profiler::BusRegion( address ) );
+  const u8 *page = _readPages[address >> 8];
+  u8 const  data = page != nullptr ? page[address & 0xFF] : DecodeRead( address, debugMode );
+  if ( breakpoints.IsArmed() && !debugMode ) {
+    breakpoints.OnCpuRead( address, data );
+  }
+  return data;
+}
+
+u8 Bus::DecodeRead( const u16 address, bool debugMode )
+{
+  // Flat memory maps every page, so Read() only gets here from tests calling DecodeRead() directly
+  if ( checks::enabled && _flatMemory != nullptr ) {
+    return _flatMemory[address];
   }
 
   // System RAM: 0x0000 - 0x1FFF (mirrored every 2KB)
   if ( address >= 0x0000 && address <= 0x1FFF ) {
-    return _ram.at( address & 0x07FF );
+    return checks::At( _ram, address & 0x07FF );
   }
 
   // PPU Registers: 0x2000 - 0x3FFF (mirrored every 8 bytes)
   if ( address >= 0x2000 && address <= 0x3FFF ) {
     // ppu read will go here. For now, return from temp private member of bus
     const u16 ppuRegister = 0x2000 + ( address & 0x0007 );
+    ppu.CatchUp();
     return ppu.CpuRead( ppuRegister, debugMode );
   }
 
@@ -77,21 +101,35 @@ u8 Bus::Read( const u16 address, bool debugMode )
 */
 void Bus::Write( const u16 address, const u8 data )
 {
+  NES_PROFILE_SCOPE( profiler::BusRegion( address ) );
+  if ( breakpoints.IsArmed() ) {
+    breakpoints.OnCpuWrite( address, data );
+  }
+  u8 *page = _writePages[address >> 8];
+  if ( page != nullptr ) {
+    page[address & 0xFF] = data;
+    return;
+  }
+  DecodeWrite( address, data );
+}
 
-  if ( _useFlatMemory ) {
-    _flatMemory.at( address ) = data;
+void Bus::DecodeWrite( const u16 address, const u8 data )
+{
+  if ( checks::enabled && _flatMemory != nullptr ) {
+    _flatMemory[address] = data;
     return;
   }
 
   // System RAM: 0x0000 - 0x1FFF (mirrored every 2KB)
   if ( address >= 0x0000 && address <= 0x1FFF ) {
-    _ram.at( address & 0x07FF ) = data;
+    checks::At( _ram, address & 0x07FF ) = data;
     return;
   }
 
   // PPU Registers: 0x2000 - 0x3FFF (mirrored every 8 bytes)
   if ( address >= 0x2000 && address <= 0x3FFF ) {
     const u16 ppuRegister = 0x2000 + ( address & 0x0007 );
+    ppu.CatchUp();
     ppu.CpuWrite( ppuRegister, data );
     return;
   }
@@ -99,6 +137,7 @@ void Bus::Write( const u16 address, const u8 data )
   // PPU DMA: 0x4014
   if ( address == 0x4014 ) {
     dmaInProgress = true;
+    EndBatch();
     dmaAddr = data << 8;
     dmaOffset = 0;
     return;
@@ -118,6 +157,8 @@ void Bus::Write( const u16 address, const u8 data )
 
   // 4020 and up is cartridge territory
   if ( address >= 0x4020 && address <= 0xFFFF ) {
+    // Mapper registers can switch CHR banks and mirroring under the PPU
+    ppu.CatchUp();
     cartridge.Write( address, data );
     return;
   }
@@ -126,8 +167,60 @@ void Bus::Write( const u16 address, const u8 data )
   std::cout << "Unhandled write to address: " << std::hex << address << "\n";
 }
 
+/*
+################################
+||         Memory Map         ||
+################################
+*/
+void Bus::UpdateMemoryMap()
+{
+  if ( _flatMemory != nullptr ) {
+    for ( u32 page = 0; page < 256; page++ ) {
+      _readPages[page] = _flatMemory + ( page << 8 );
+      _writePages[page] = _flatMemory + ( page << 8 );
+    }
+    return;
+  }
+
+  // System RAM: 0x0000 - 0x1FFF, the 2KB mirrored four times
+  for ( u32 page = 0x00; page < 0x20; page++ ) {
+    _readPages[page] = _ram.data() + ( ( page << 8 ) & 0x07FF );
+    _writePages[page] = _ram.data() + ( ( page << 8 ) & 0x07FF );
+  }
+
+  // PPU registers, APU and IO, expansion area: every access has side effects or needs the mapper
+  for ( u32 page = 0x20; page < 0x60; page++ ) {
+    _readPages[page] = nullptr;
+    _writePages[page] = nullptr;
+  }
+  UpdateCartridgePages();
+}
+
+void Bus::UpdateCartridgePages()
+{
+  if ( _flatMemory != nullptr ) {
+    return;
+  }
+
+  // PRG RAM: 0x6000 - 0x7FFF, when the mapper has any
+  for ( u32 page = 0x60; page < 0x80; page++ ) {
+    _readPages[page] = cartridge.GetPrgRamPointer( page << 8 );
+    _writePages[page] = cartridge.GetPrgRamPointer( page << 8 );
+  }
+
+  // PRG ROM: 0x8000 - 0xFFFF, read only. Writes reach the mapper registers
+  for ( u32 page = 0x80; page < 0x100; page++ ) {
+    _readPages[page] = cartridge.GetPrgRomPointer( page << 8 );
+    _writePages[page] = nullptr;
+  }
+}
+
 void Bus::ProcessDma()
 {
+  if ( dmaOffset == 0 && _bulkDma && TryBulkDma() ) {
+    return;
+  }
+
   const u64 cycle = cpu.GetCycles();
 
   u8 const oamAddr = ppu.oamAddr;
@@ -141,7 +234,8 @@ void Bus::ProcessDma()
   if ( cycle % 2 == 0 ) {
     auto data = Read( dmaAddr + dmaOffset );
     cpu.Tick();
-    ppu.oam.data.at( ( oamAddr + dmaOffset ) & 0xFF ) = data;
+    ppu.CatchUp();
+    ppu.WriteOam( ( oamAddr + dmaOffset ) & 0xFF, data );
     dmaOffset++;
   } else {
     dmaInProgress = dmaOffset < 256;
@@ -149,35 +243,155 @@ void Bus::ProcessDma()
   }
 }
 
+bool Bus::TryBulkDma()
+{
+  /** @brief Copies the 256 bytes straight into OAM, then stalls the CPU for the whole transfer at once
+   * Only when the result can't differ from the byte by byte copy:
+   * - The source page is plain memory (RAM, PRG RAM or PRG ROM), so reading it has no side effects
+   * - No scheduled event falls inside the transfer. Otherwise vblank could raise an NMI, which Clock()
+   *   would take in the middle of the transfer, or the frame could end in it
+   * - The PPU doesn't read OAM while the transfer runs: rendering is off, or the transfer ends before the
+   *   sprite evaluation of the pre-render line (dot 257 of scanline 261)
+   * - No breakpoints are armed, so read watchpoints on the source page see every byte
+   */
+  const u8 *source = _readPages[dmaAddr >> 8];
+  if ( source == nullptr || breakpoints.IsArmed() ) {
+    return false;
+  }
+
+  // An even cycle reads, the odd one after it writes. Starting on an odd cycle waits one out first
+  u64 const cycles = 512 + ( cpu.GetCycles() % 2 );
+  if ( scheduler.GetNextTimestamp() <= ( cpu.GetCycles() + cycles ) * timing::masterTicksPerCpuCycle ) {
+    return false;
+  }
+  ppu.CatchUp();
+  if ( ppu.IsRenderingEnabled() ) {
+    constexpr u64 spriteEvalDot = ( PPU::gPrerenderScanline * PPU::dotsPerScanline ) + 257;
+    u64 const     start = ( ppu.scanline * PPU::dotsPerScanline ) + ppu.cycle;
+    if ( ppu.scanline < 240 || start + ( cycles * 3 ) > spriteEvalDot ) {
+      return false;
+    }
+  }
+
+  // OAM wraps around from the address the transfer starts at
+  ppu.WriteOamPage( source );
+
+  cpu.Stall( cycles );
+  dmaOffset = 256;
+  dmaInProgress = false;
+  return true;
+}
+
+void Bus::RunEvents()
+{
+  EndBatch();
+  u64 const now = GetMasterClock();
+  EventType type{};
+  while ( scheduler.PopDue( now, type ) ) {
+    switch ( type ) {
+      // Catching up runs the PPU through the event's dot, and schedules its next events
+      case EventType::Nmi:
+      case EventType::FrameEnd: ppu.RunOwedDots(); break;
+      default:                  break;
+    }
+  }
+}
+
 void Bus::Clock()
 {
   if ( dmaInProgress ) {
     ProcessDma();
   } else {
-    cpu.DecodeExecute();
+    ExecuteStep();
   }
+  PollNmi();
+}
 
-  if ( ppu.nmiReady ) {
-    ppu.nmiReady = false;
-    cpu.NMI();
+void Bus::ExecuteStep()
+{
+  // The enabled check is repeated here so the common case doesn't call out
+  if ( idleLoop.IsEnabled() && idleLoop.FastForward() ) {
+    // Spun until the next NMI or the end of the frame
+  } else if ( idleLoop.IsEnabled() ) {
+    u16 const startPc = cpu.GetProgramCounter();
+    u64 const startCycles = cpu.GetCycles();
+    cpu.DecodeExecute();
+    idleLoop.Observe( startPc, startCycles );
+  } else {
+    cpu.DecodeExecute();
   }
 }
 
 /*
 ################################
-||        Debug Methods       ||
+||          Run Loops         ||
 ################################
 */
-[[nodiscard]] bool Bus::IsTestMode() const
+Bus::RunStats Bus::RunFrame()
+{
+  return RunBatched( ~u64{ 0 }, true );
+}
+
+Bus::RunStats Bus::RunCycles( u64 cycles )
 {
-  return _useFlatMemory;
+  return RunBatched( cpu.GetCycles() + cycles, false );
 }
 
+Bus::RunStats Bus::RunBatched( u64 targetCycle, bool toFrameEnd )
+{
+  /** @brief The loop of RunFrame() and RunCycles(): steps in batches, and checks between them
+   * Between two edges the steps are all there is: no DMA to run, no NMI to take, and the frame and the stop
+   * condition can't change. So a batch is a bare loop over steps up to the target cycle, and the DMA, the NMI
+   * and the stop condition are looked at once it ends. An edge (events running, an OAM DMA starting, the PPU
+   * raising an NMI or ending a frame) calls EndBatch(), which ends the batch after the step it happened in:
+   * where Clock() would have run the DMA or taken the NMI, so both loops step identically. Breakpoints and
+   * the coroutine engine need the check before every step, and go through RunUntil().
+   */
+  if ( breakpoints.IsArmed() || engine.IsEnabled() ) {
+    u64 const frame = ppu.frame;
+    return RunUntil( [this, targetCycle, toFrameEnd, frame] {
+      return cpu.GetCycles() >= targetCycle || ( toFrameEnd && ppu.frame != frame );
+    } );
+  }
+
+  u64 const startCycles = cpu.GetCycles();
+  u64 const startInstructions = cpu.GetInstructions();
+  u64 const startFrame = ppu.frame;
+  // The mode of the steps can't change during a run either
+  bool const plainSteps = !idleLoop.IsEnabled();
+  while ( cpu.GetCycles() < targetCycle && ( !toFrameEnd || ppu.frame == startFrame ) ) {
+    if ( dmaInProgress ) {
+      ProcessDma();
+    } else {
+      _batchEnd = targetCycle;
+      if ( plainSteps ) {
+        do {
+          cpu.DecodeExecute();
+        } while ( cpu.GetCycles() < _batchEnd );
+      } else {
+        do {
+          ExecuteStep();
+        } while ( cpu.GetCycles() < _batchEnd );
+      }
+    }
+    PollNmi();
+  }
+  ppu.CatchUp();
+  return { cpu.GetCycles() - startCycles, cpu.GetInstructions() - startInstructions, ppu.frame - startFrame, false };
+}
+
+/*
+################################
+||        Debug Methods       ||
+################################
+*/
 void Bus::DebugReset()
 {
   cpu.SetCycles( 0 );
   cpu.Reset();
   ppu.Reset();
+  idleLoop.Reset();
+  callGraph.ResetStack();
 }
 
 /*
@@ -227,6 +441,8 @@ void Bus::SaveState( const std::string &filename )
       throw std::runtime_error( "Could not open '" + filename + "' for writing" );
     }
 
+    // Owed dots aren't part of the state
+    ppu.CatchUp();
     cereal::BinaryOutputArchive archive( outStream );
     archive( *this );
   } catch ( const std::exception &e ) {
@@ -244,6 +460,13 @@ void Bus::LoadState( const std::string &filename )
 
     cereal::BinaryInputArchive archive( inStream );
     archive( *this );
+    ppu.ClearDebt();
+    ppu.SyncOamShadow();
+    // The page table still points at the banks and PRG RAM from before the load, repoint it at the restored ones
+    UpdateMemoryMap();
+    // A loop confirmed before the load may wait on RAM that just changed
+    idleLoop.Reset();
+    callGraph.ResetStack();
   } catch ( const std::exception &e ) {
     std::cerr << "Error loading state: " << e.what() << "\n";
   }
@@ -4,6 +4,11 @@
 #include "cartridge.h"
 #include "cpu.h"
 #include "ppu.h"
+#include "idle-loop.h"
+#include "call-graph.h"
+#include "scheduler.h"
+#include "coroutine-engine.h"
+#include "breakpoints.h"
 
 // Blargg's apu
 #include "Simple_Apu.h"
@@ -21,13 +26,14 @@ class Simple_Apu;
 class Bus
 {
 public:
-  // Initialized with flat memory disabled by default. Enabled in json tests only
+  // The PPU draws into a frame buffer of its own
   Bus();
+  // The PPU draws into `frameBuffer`, owned by the caller, or nowhere if it's null (see PPU::SetFrameBuffer())
+  explicit Bus( PPU::FrameBuffer *frameBuffer );
 
   template <class Archive> void serialize( Archive &ar ) // NOLINT
   {
-    ar( cpu, ppu, apu, cartridge, dmaInProgress, dmaAddr, dmaOffset, controllerState, controller, _ram, _useFlatMemory,
-        _flatMemory );
+    ar( cpu, ppu, apu, cartridge, dmaInProgress, dmaAddr, dmaOffset, controllerState, controller, _ram );
   }
 
   /*
@@ -35,10 +41,16 @@ public:
   ||         Peripherals        ||
   ################################
   */
-  CPU        cpu;
-  PPU        ppu;
-  Simple_Apu apu;
-  Cartridge  cartridge;
+  // In the order the run loop reaches for them: the CPU, PPU and scheduler every cycle, the rest less often
+  CPU               cpu;
+  PPU               ppu;
+  Scheduler         scheduler;
+  Breakpoints       breakpoints;
+  Cartridge         cartridge;
+  Simple_Apu        apu;
+  IdleLoopDetector  idleLoop;
+  CallGraphProfiler callGraph;
+  CoroutineEngine   engine;
 
   /*
   ################################
@@ -49,6 +61,92 @@ public:
   void Write( u16 address, u8 data );
   void Clock();
   void ProcessDma();
+  // Clock() without the DMA and the NMI: one instruction, or a skipped idle loop
+  void ExecuteStep();
+  void PollNmi()
+  {
+    if ( ppu.nmiReady ) {
+      ppu.nmiReady = false;
+      cpu.NMI();
+    }
+  }
+
+  // OAM DMA copies the page in one go when nothing could see it happen byte by byte (see TryBulkDma()).
+  // When off, it always takes one trip through Clock() per cycle. For comparisons and benchmarks
+  void SetBulkDma( bool enabled ) { _bulkDma = enabled; }
+  bool IsBulkDmaEnabled() const { return _bulkDma; }
+
+  /*
+  ################################
+  ||          Run Loops         ||
+  ################################
+  */
+  // What a run did. Instructions are the ones executed: idle loop iterations that were skipped don't count
+  struct RunStats {
+    u64  cycles = 0;
+    u64  instructions = 0;
+    u64  frames = 0;
+    bool breakpoint = false; // Stopped early by a breakpoint, see breakpoints.GetHit()
+  };
+
+  // Until the PPU finishes the current frame
+  RunStats RunFrame();
+  // At least `cycles` CPU cycles, up to the end of the step that crosses the count: an instruction, an OAM
+  // DMA, or a skipped idle loop when that is on
+  RunStats RunCycles( u64 cycles );
+  // Both step in batches (see RunBatched()). A batch ends after the step running when this is called: when
+  // events run, an OAM DMA starts, or the PPU raises an NMI or ends a frame
+  void EndBatch() { _batchEnd = 0; }
+  // Until `done()` is true, checked before every step. The PPU is only caught up when the run ends, so a
+  // predicate that looks at its position or flags should call ppu.CatchUp() first.
+  // Runs through the coroutine engine instead of Clock() when it's enabled (see coroutine-engine.h).
+  // A breakpoint hit ends the run before `done()` is true (see breakpoints.h)
+  template <typename Predicate> RunStats RunUntil( Predicate &&done )
+  {
+    u64 const startCycles = cpu.GetCycles();
+    u64 const startInstructions = cpu.GetInstructions();
+    u64 const startFrame = ppu.frame;
+    breakpoints.BeginRun();
+    if ( engine.IsEnabled() ) {
+      engine.Run( [&]() { return breakpoints.ShouldStop() || done(); } );
+    } else {
+      while ( !breakpoints.ShouldStop() && !done() ) {
+        Clock();
+      }
+    }
+    ppu.CatchUp();
+    return { cpu.GetCycles() - startCycles, cpu.GetInstructions() - startInstructions, ppu.frame - startFrame,
+             breakpoints.GetHit().has_value() };
+  }
+
+  // Master clock ticks so far, the timeline of the scheduler (see scheduler.h)
+  u64 GetMasterClock() const { return cpu.GetCycles() * timing::masterTicksPerCpuCycle; }
+  // Runs the scheduled events that are due, earliest first. Called by the CPU when one is, or by the PPU
+  // coroutine while the coroutine engine runs
+  void RunEvents();
+  // Whether the CPU runs due events itself. While the coroutine engine runs they wait for the end of the step
+  bool RunsEventsInline() const { return !engine.IsRunning(); }
+
+  /*
+  ################################
+  ||         Memory Map         ||
+  ################################
+  */
+  // Rebuilds the whole page table: after a rom or state load, and when flat memory is switched on or off
+  void UpdateMemoryMap();
+  // Repoints the cartridge pages ($6000-$FFFF). Called by the cartridge whenever its PRG mapping changes
+  void UpdateCartridgePages();
+  // Host memory behind an address, without side effects, or nullptr where the page has to be decoded
+  const u8 *GetReadPointer( u16 address ) const
+  {
+    const u8 *page = _readPages[address >> 8];
+    return page != nullptr ? page + ( address & 0xFF ) : nullptr;
+  }
+
+  // Address decoding without the page table, by range checks. Read() and Write() fall back to these for
+  // the pages that have side effects: PPU and APU registers, controllers, and mapper registers
+  u8   DecodeRead( u16 address, bool debugMode = false );
+  void DecodeWrite( u16 address, u8 data );
 
   /*
   ################################
@@ -62,27 +160,29 @@ public:
   bool DoesSaveSlotExist( int idx = 0 ) const;
   bool IsRomSignatureValid( const std::string &stateFile );
 
+  std::string statefileExt = ".nesstate";
+
   /*
   ################################
   ||      Global Variables      ||
   ################################
   */
-  bool        dmaInProgress = false;
-  u16         dmaAddr = 0x00;
-  u16         dmaOffset = 0x00;
-  u8          controllerState[2]{};
-  u8          controller[2]{};
-  std::string statefileExt = ".nesstate";
+  // Looked at on every step: these start a cache line, shared with the private DMA and page table state below
+  alignas( cacheLineSize ) bool dmaInProgress = false;
+  u16 dmaAddr = 0x00;
+  u16 dmaOffset = 0x00;
+  u8  controllerState[2]{};
+  u8  controller[2]{};
 
   /*
   ################################
   ||        Debug Methods       ||
   ################################
   */
-  [[nodiscard]] bool IsTestMode() const;
-  void               DebugReset();
-  void               EnableJsonTestMode() { _useFlatMemory = true; }
-  void               DisableJsonTestMode() { _useFlatMemory = false; }
+  // Flat memory is only ever set by TestBus (see test-bus.h)
+  [[nodiscard]] bool          IsTestMode() const { return _flatMemory != nullptr; }
+  void                        DebugReset();
+  std::array<u8, 2048> const &GetRam() const { return _ram; }
 
   /*
   ################################
@@ -92,19 +192,52 @@ public:
   const long sampleRate = 44100;
   static int ReadDmc( void *objPtr, cpu_addr_t addr );
 
+protected:
+  /*
+  ################################
+  ||        Flat Memory         ||
+  ################################
+  */
+  // Maps all 64 KiB of the address space straight to `memory`, or back to the memory map when it's null
+  void SetFlatMemory( u8 *memory )
+  {
+    _flatMemory = memory;
+    UpdateMemoryMap();
+  }
+
 private:
   /*
   ################################
-  ||           CPU RAM          ||
+  ||          OAM DMA           ||
   ################################
   */
-  std::array<u8, 2048> _ram{}; // 2KB internal cpu RAM
+  bool TryBulkDma();
+  bool _bulkDma = true;
+
+  /*
+  ################################
+  ||          Run Loops         ||
+  ################################
+  */
+  RunStats RunBatched( u64 targetCycle, bool toFrameEnd );
+  u64      _batchEnd = 0; // CPU cycle the current batch runs to, 0 once an edge ended it
 
   /*
   ################################
-  ||       Debug Variables      ||
+  ||         Page Table         ||
   ################################
   */
-  bool                  _useFlatMemory{}; // For testing purposes
-  std::array<u8, 65536> _flatMemory{};    // 64KB memory, for early testing
+  // One entry per 256 byte page of the CPU address space. Pages backed by plain memory (RAM and its
+  // mirrors, PRG RAM, the mapped PRG ROM banks) point straight at it, so an access is a load and a mask.
+  // Null pages go through DecodeRead() / DecodeWrite()
+  u8                         *_flatMemory = nullptr; // Replaces the memory map when set, see SetFlatMemory(). Not owned
+  std::array<const u8 *, 256> _readPages{};
+  std::array<u8 *, 256>       _writePages{};
+
+  /*
+  ################################
+  ||           CPU RAM          ||
+  ################################
+  */
+  std::array<u8, 2048> _ram{}; // 2KB internal cpu RAM
 };
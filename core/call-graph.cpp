@@ -0,0 +1,254 @@
+#include "call-graph.h"
+#include "bus.h"
+#include "global-types.h"
+#include <algorithm>
+#include <cstddef>
+#include <fmt/format.h>
+#include <fstream>
+#include <iterator>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+CallGraphProfiler::CallGraphProfiler( Bus *bus ) : bus( bus )
+{
+  _nodes.push_back( { rootNode, 0 } );
+}
+
+/*
+################################
+||        Shadow Stack        ||
+################################
+*/
+void CallGraphProfiler::OnCall( u16 target, u8 returnStackPointer, CallKind kind )
+{
+  Charge();
+  if ( _stack.size() == maxDepth ) {
+    // A game that never returns (e.g. an NMI handler that jumps back into the main loop) would grow the
+    // stack forever. Start over from the root rather than keep a stack that means nothing
+    _stack.clear();
+  }
+  // Interrupt handlers hang off the root rather than off whatever they interrupted, so each one shows up as
+  // a single tree. The interrupted frames stay on the stack for the RTI to return to
+  bool const interrupt = kind != CallKind::Subroutine;
+  u32 const  parent = _stack.empty() || interrupt ? rootNode : _stack.back().node;
+  u32 const  node = Child( parent, MakeKey( target, kind ) );
+  _nodes[node].calls++;
+  _stack.push_back( { node, returnStackPointer } );
+}
+
+void CallGraphProfiler::OnReturn( u8 stackPointer )
+{
+  /** @brief Pops the frames the stack pointer has moved past
+   * An RTS used as a jump leaves the stack pointer below the frame's return point, and pops nothing.
+   * A return that skips a level (the callee dropped its own return address) pops both frames.
+   */
+  Charge();
+  while ( !_stack.empty() && _stack.back().returnStackPointer <= stackPointer ) {
+    _stack.pop_back();
+  }
+}
+
+void CallGraphProfiler::SetEnabled( bool enabled )
+{
+  _enabled = enabled;
+  bus->cpu.SetCallGraph( enabled ? this : nullptr );
+  ResetStack();
+}
+
+void CallGraphProfiler::Clear()
+{
+  _nodes.clear();
+  _nodes.push_back( { rootNode, 0 } );
+  _children.clear();
+  ResetStack();
+}
+
+void CallGraphProfiler::ResetStack()
+{
+  _stack.clear();
+  _lastCycles = bus->cpu.GetCycles();
+}
+
+void CallGraphProfiler::Charge()
+{
+  u64 const now = bus->cpu.GetCycles();
+  u32 const node = _stack.empty() ? rootNode : _stack.back().node;
+  _nodes[node].cycles += now - _lastCycles;
+  _lastCycles = now;
+}
+
+u32 CallGraphProfiler::Child( u32 parent, u64 key )
+{
+  u64 const  childKey = ( static_cast<u64>( parent ) << 34 ) | key;
+  auto const it = _children.find( childKey );
+  if ( it != _children.end() ) {
+    return it->second;
+  }
+  auto const node = static_cast<u32>( _nodes.size() );
+  _nodes.push_back( { parent, key } );
+  _children.emplace( childKey, node );
+  return node;
+}
+
+u64 CallGraphProfiler::MakeKey( u16 target, CallKind kind ) const
+{
+  /** @brief Packs kind (bits 32-33), bank (bits 16-31) and address (bits 0-15) */
+  u16 bank = noBank;
+  if ( !bus->IsTestMode() && bus->cartridge.GetPrgRomSize() > 0 ) {
+    u32 const offset = bus->cartridge.GetPrgRomOffset( target );
+    if ( offset != Cartridge::invalidPrgPage ) {
+      bank = static_cast<u16>( offset / 0x4000 );
+    }
+  }
+  return ( static_cast<u64>( kind ) << 32 ) | ( static_cast<u64>( bank ) << 16 ) | target;
+}
+
+/*
+################################
+||           Output           ||
+################################
+*/
+std::string CallGraphProfiler::FrameName( u64 key )
+{
+  /** @brief "03:C5D2" for ROM code in bank 3, "$0300" for code without a bank, prefixed with the
+   * interrupt that entered it, e.g. "NMI 07:C0A3"
+   */
+  auto const kind = static_cast<CallKind>( ( key >> 32 ) & 0x03 );
+  auto const bank = static_cast<u16>( key >> 16 );
+  auto const address = static_cast<u16>( key );
+
+  std::string name;
+  switch ( kind ) {
+    case CallKind::Nmi: name = "NMI "; break;
+    case CallKind::Irq: name = "IRQ "; break;
+    case CallKind::Brk: name = "BRK "; break;
+    default:            break;
+  }
+  if ( bank == noBank ) {
+    fmt::format_to( std::back_inserter( name ), "${:04X}", address );
+  } else {
+    fmt::format_to( std::back_inserter( name ), "{:02X}:{:04X}", bank, address );
+  }
+  return name;
+}
+
+std::string CallGraphProfiler::StackName( u32 node ) const
+{
+  if ( node == rootNode ) {
+    return "(root)";
+  }
+  std::vector<u32> path;
+  for ( ; node != rootNode; node = _nodes[node].parent ) {
+    path.push_back( node );
+  }
+  std::string name;
+  for ( auto it = path.rbegin(); it != path.rend(); ++it ) {
+    if ( !name.empty() ) {
+      name += ';';
+    }
+    name += FrameName( _nodes[*it].key );
+  }
+  return name;
+}
+
+u64 CallGraphProfiler::GetTotalCycles()
+{
+  Charge();
+  u64 total = 0;
+  for ( const auto &node : _nodes ) {
+    total += node.cycles;
+  }
+  return total;
+}
+
+std::string CallGraphProfiler::GetFoldedStacks()
+{
+  Charge();
+  std::string out;
+  for ( u32 node = 0; node < _nodes.size(); node++ ) {
+    if ( _nodes[node].cycles > 0 ) {
+      fmt::format_to( std::back_inserter( out ), "{} {}\n", StackName( node ), _nodes[node].cycles );
+    }
+  }
+  return out;
+}
+
+void CallGraphProfiler::WriteFoldedStacks( const std::string &path )
+{
+  std::ofstream file( path, std::ios::out | std::ios::trunc );
+  if ( !file ) {
+    throw std::runtime_error( "Could not open '" + path + "' for writing" );
+  }
+  file << GetFoldedStacks();
+}
+
+std::string CallGraphProfiler::Report( size_t top )
+{
+  /** @brief Per function: calls, cycles in its own code, and cycles including everything it called
+   * A function that shows up at several places in the tree is summed over all of them. Recursive calls
+   * are only counted once towards the total.
+   */
+  u64 const total = GetTotalCycles();
+
+  // Children are always created after their parent, so one backwards pass sums every subtree
+  std::vector<u64> inclusive( _nodes.size() );
+  for ( size_t node = _nodes.size(); node-- > 0; ) {
+    inclusive[node] += _nodes[node].cycles;
+    if ( node != rootNode ) {
+      inclusive[_nodes[node].parent] += inclusive[node];
+    }
+  }
+
+  struct Row {
+    u64  key;
+    bool root = false;
+    u64  calls = 0;
+    u64  self = 0;
+    u64  inclusive = 0;
+  };
+  std::unordered_map<u64, Row> functions;
+  for ( u32 node = 1; node < _nodes.size(); node++ ) {
+    Node const &entry = _nodes[node];
+    Row        &row = functions.try_emplace( entry.key, Row{ entry.key } ).first->second;
+    row.calls += entry.calls;
+    row.self += entry.cycles;
+
+    bool recursive = false;
+    for ( u32 parent = entry.parent; parent != rootNode && !recursive; parent = _nodes[parent].parent ) {
+      recursive = _nodes[parent].key == entry.key;
+    }
+    if ( !recursive ) {
+      row.inclusive += inclusive[node];
+    }
+  }
+
+  std::vector<Row> rows;
+  rows.reserve( functions.size() + 1 );
+  rows.push_back( { 0, true, 0, _nodes[rootNode].cycles, total } );
+  for ( const auto &[key, row] : functions ) {
+    rows.push_back( row );
+  }
+  std::ranges::sort( rows, []( const Row &a, const Row &b ) { return a.self > b.self; } );
+
+  auto percent = [total]( u64 cycles ) {
+    return total == 0 ? 0.0 : 100.0 * static_cast<double>( cycles ) / static_cast<double>( total );
+  };
+
+  std::string out;
+  auto        inserter = std::back_inserter( out );
+  fmt::format_to( inserter, "Total: {} cycles, {} functions\n", total, functions.size() );
+  fmt::format_to( inserter, "  {:<14} {:>10} {:>12} {:>7} {:>12} {:>7}\n", "function", "calls", "self", "self %",
+                  "total", "total %" );
+  for ( size_t i = 0; i < rows.size() && i < top; i++ ) {
+    Row const        &row = rows[i];
+    std::string const name = row.root ? "(root)" : FrameName( row.key );
+    fmt::format_to( inserter, "  {:<14} {:>10} {:>12} {:>6.2f}% {:>12} {:>6.2f}%\n", name, row.calls, row.self,
+                    percent( row.self ), row.inclusive, percent( row.inclusive ) );
+  }
+  if ( rows.size() > top ) {
+    fmt::format_to( inserter, "  ... {} more\n", rows.size() - top );
+  }
+  return out;
+}
@@ -0,0 +1,100 @@
+#pragma once
+
+#include "global-types.h"
+#include <cstddef>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+class Bus;
+
+/*
+################################################################
+||                                                            ||
+||                    Call Graph Profiler                     ||
+||                                                            ||
+################################################################
+*/
+
+/*
+ * @brief Attributes the cycles of the running game to its call stack
+ *
+ * The CPU reports every JSR, interrupt entry (NMI, IRQ, BRK), RTS and RTI, and the profiler mirrors them
+ * in a shadow call stack. Whenever the stack changes, the cycles since the last change are charged to
+ * the stack that was current, so every cycle is counted exactly once and nothing is sampled.
+ *
+ * Functions are keyed by their entry address plus the 16 KiB PRG ROM bank it was mapped to at the time of
+ * the call, so the same address in two banks is two functions. Code running from RAM has no bank.
+ *
+ * Games don't always return the way they were called: some push an address and RTS to it as a jump, and
+ * some drop a return address and unwind two levels at once. Each frame remembers the stack pointer it
+ * returns to, and a return only pops the frames that the stack pointer has actually moved past.
+ */
+class CallGraphProfiler
+{
+public:
+  explicit CallGraphProfiler( Bus *bus );
+
+  enum class CallKind : u8 { Subroutine, Nmi, Irq, Brk };
+
+  /*
+  ################################
+  ||    Call Graph Methods      ||
+  ################################
+  */
+  // Called by the CPU once a call pushed its return address, with the stack pointer from before the push
+  void OnCall( u16 target, u8 returnStackPointer, CallKind kind );
+  // Called by the CPU after RTS or RTI pulled the return address
+  void OnReturn( u8 stackPointer );
+
+  // Enabling hooks the profiler into the CPU and starts from an empty stack
+  void SetEnabled( bool enabled );
+  bool IsEnabled() const { return _enabled; }
+
+  // Forgets everything recorded so far
+  void Clear();
+  // Unwinds the shadow stack without losing the counts, for when the CPU state jumps (reset, state load)
+  void ResetStack();
+
+  size_t GetDepth() const { return _stack.size(); }
+  u64    GetTotalCycles();
+
+  // One line per stack, "root;caller;callee cycles", the input format of flamegraph.pl and speedscope
+  std::string GetFoldedStacks();
+  void        WriteFoldedStacks( const std::string &path );
+
+  // Functions sorted by the cycles spent in their own code, `top` rows
+  std::string Report( size_t top = 25 );
+
+  static constexpr u16    noBank = 0xFFFF;
+  static constexpr size_t maxDepth = 256;
+
+private:
+  Bus *bus;
+
+  struct Node {
+    u32 parent;
+    u64 key; // Kind, bank and address of the function, see MakeKey()
+    u64 cycles = 0;
+    u64 calls = 0;
+  };
+
+  struct StackEntry {
+    u32 node;
+    u8  returnStackPointer;
+  };
+
+  static constexpr u32 rootNode = 0;
+
+  u64         MakeKey( u16 target, CallKind kind ) const;
+  static auto FrameName( u64 key ) -> std::string;
+  std::string StackName( u32 node ) const;
+  void        Charge();
+  u32         Child( u32 parent, u64 key );
+
+  bool                         _enabled = false;
+  std::vector<Node>            _nodes;
+  std::unordered_map<u64, u32> _children; // (parent, key) -> node
+  std::vector<StackEntry>      _stack;
+  u64                          _lastCycles = 0;
+};
@@ -9,6 +9,8 @@
 #include <stdexcept>
 #include <string>
 
+#include "bus.h"
+#include "checks.h"
 #include "global-types.h"
 #include "utils.h"
 
@@ -19,8 +21,22 @@
 #include "mappers/mapper2.h"
 #include "mappers/mapper3.h"
 
+namespace
+{
+// Without a rom, every PPU fetch ends up here, so only the instrumented core says so
+void WarnNoMapper( const char *method )
+{
+  if constexpr ( checks::enabled ) {
+    fmt::print( "Cartridge:{}:Mapper is null. Rom file was likely not loaded.\n", method );
+  }
+}
+} // namespace
+
 Cartridge::Cartridge( Bus *bus ) : bus( bus )
 {
+  // Nothing is mapped until a rom is loaded
+  _prgPages.fill( invalidPrgPage );
+  _chrPages.fill( invalidChrPage );
 }
 
 bool Cartridge::IsRomValid( const std::string &filePath )
@@ -139,6 +155,18 @@ void Cartridge::LoadRom( const std::string &filePath )
     didMapperLoad = true;
   }
 
+  // Fresh predecode cache for the new PRG ROM
+  _decodeCache.assign( _prgRom.size(), DecodedInstruction{} );
+  UpdatePrgPages();
+  DecodeChr();
+  UpdateChrPages();
+  UpdateMirroring();
+
+  // The ROM was reallocated, so the bus pages need repointing even if the bank layout is the same
+  if ( bus != nullptr ) {
+    bus->UpdateCartridgePages();
+  }
+
   romFile.close();
 }
 
@@ -214,9 +242,10 @@ void Cartridge::Write( u16 address, u8 data )
    */
   if ( address >= 0x8000 && address <= 0xFFFF ) {
     if ( _mapper == nullptr ) {
-      fmt::print( "Cartridge:ReadPrgROM:Mapper is null. Rom file was likely not loaded.\n" );
+      WarnNoMapper( "ReadPrgROM" );
       return _prgRom.at( address & 0x3FFF );
     }
+    // The page table serves every bank that is inside the ROM, so this only sees the ones that aren't
     u32 const prgOffset = _mapper->MapPrgOffset( address );
     return _prgRom.at( prgOffset );
   }
@@ -232,15 +261,17 @@ void Cartridge::Write( u16 address, u8 data )
     return 0xFF;
 
   if ( _mapper == nullptr ) {
-    fmt::print( "Cartridge:ReadChrROM:Mapper is null. Rom file was likely not loaded.\n" );
+    WarnNoMapper( "ReadChrROM" );
     return _chrRom.at( address & 0x1FFF );
   }
 
-  u32 const chrOffset = _mapper->MapChrOffset( address );
+  // Through the CHR windows where the mapper maps inside of CHR, which leaves the mapper out of every fetch
+  u32 const page = _chrPages[( address >> 10 ) & 0x07];
+  u32 const chrOffset = page != invalidChrPage ? page + ( address & 0x03FF ) : _mapper->MapChrOffset( address );
   if ( _usesChrRam ) {
-    return _chrRam.at( chrOffset );
+    return checks::At( _chrRam, chrOffset );
   }
-  return _chrRom.at( chrOffset );
+  return checks::At( _chrRom, chrOffset );
 }
 
 [[nodiscard]] u8 Cartridge::ReadPrgRAM( u16 address )
@@ -252,11 +283,11 @@ void Cartridge::Write( u16 address, u8 data )
    * a game uses PRG RAM or not will be determined by the mapper.
    */
   if ( _mapper == nullptr ) {
-    fmt::print( "Cartridge:ReadPrgRAM:Mapper is null. Rom file was likely not loaded.\n" );
+    WarnNoMapper( "ReadPrgRAM" );
     return _prgRam.at( address - 0x6000 );
   }
   if ( address >= 0x6000 && address <= 0x7FFF && _mapper->SupportsPrgRam() ) {
-    return _prgRam.at( address - 0x6000 );
+    return checks::At( _prgRam, address - 0x6000 );
   }
   return 0xFF;
 }
@@ -267,12 +298,12 @@ void Cartridge::Write( u16 address, u8 data )
    * Expansion ROM is rarely used, but when it is, it's used for additional program data
    */
   if ( _mapper == nullptr ) {
-    fmt::print( "Cartridge:ReadExpansionROM:Mapper is null. Rom file was likely not loaded.\n" );
+    WarnNoMapper( "ReadExpansionROM" );
     return _expansionMemory.at( address - 0x4020 );
   }
 
   if ( address >= 0x4020 && address <= 0x5FFF && _mapper->HasExpansionRom() ) {
-    return _expansionMemory.at( address - 0x4020 );
+    return checks::At( _expansionMemory, address - 0x4020 );
   }
   return 0xFF;
 }
@@ -291,12 +322,128 @@ void Cartridge::WritePrgROM( u16 address, u8 data )
    * to trigger bank switching.
    */
   if ( _mapper == nullptr ) {
-    fmt::print( "Cartridge:WritePrgROM:Mapper is null. Rom file was likely not loaded.\n" );
+    WarnNoMapper( "WritePrgROM" );
     return;
   }
 
   if ( address >= 0x8000 && address <= 0xFFFF ) {
     _mapper->HandleCPUWrite( address, data );
+
+    // The write may have switched PRG or CHR banks, or the mirroring
+    UpdatePrgPages();
+    UpdateChrPages();
+    UpdateMirroring();
+  }
+}
+
+/*
+################################
+||                            ||
+||   Instruction Predecode    ||
+||                            ||
+################################
+*/
+void Cartridge::UpdatePrgPages()
+{
+  /** @brief Recompute where each 4 KiB CPU page of $8000-$FFFF lands in PRG ROM
+   * Every supported mapper switches PRG in 8 KiB units or larger, so each 4 KiB page is contiguous in ROM.
+   * Pages that map outside of the ROM are left invalid and always fall back to the bus.
+   */
+  std::array<u32, 8> const previous = _prgPages;
+  for ( u32 page = 0; page < _prgPages.size(); page++ ) {
+    _prgPages[page] = invalidPrgPage;
+    if ( _mapper == nullptr ) {
+      continue;
+    }
+    u32 const offset = _mapper->MapPrgOffset( 0x8000 + ( page * 0x1000 ) );
+    if ( offset + 0x1000 <= _prgRom.size() ) {
+      _prgPages[page] = offset;
+    }
+  }
+  if ( _prgPages != previous && bus != nullptr ) {
+    bus->UpdateCartridgePages();
+  }
+}
+
+const DecodedInstruction *Cartridge::Predecode( u16 address )
+{
+  /** @brief Returns the decoded instruction at a PRG ROM address, decoding it on first use
+   * Returns nullptr when the instruction can't be served from the cache, in which case the CPU fetches
+   * through the bus as usual: anything below $8000 (RAM, PRG RAM), unmapped pages, and instructions
+   * that straddle a 4 KiB page, since their operands may live in a different bank.
+   */
+  if ( !_predecodeEnabled || address < 0x8000 || ( address & 0x0FFF ) > 0x0FFD ) {
+    return nullptr;
+  }
+  u32 const offset = GetPrgRomOffset( address );
+  if ( offset == invalidPrgPage ) {
+    return nullptr;
+  }
+
+  DecodedInstruction &record = _decodeCache[offset];
+  if ( record.length == 0 ) {
+    record.opcode = _prgRom[offset];
+    record.length = gOpcodeInfo[record.opcode].bytes;
+    record.operand = { _prgRom[offset + 1], _prgRom[offset + 2] };
+  }
+  return &record;
+}
+
+/*
+################################
+||                            ||
+||       CHR Tile Cache       ||
+||                            ||
+################################
+*/
+void Cartridge::UpdateChrPages()
+{
+  /** @brief Recompute where each 1 KiB PPU page of $0000-$1FFF lands in CHR
+   * Every supported mapper switches CHR in 4 KiB units or larger, so each 1 KiB page is contiguous. Pages that
+   * map outside of CHR are left invalid, and reads there go through the mapper as before.
+   */
+  size_t const chrSize = _usesChrRam ? _chrRam.size() : _chrRom.size();
+  for ( u32 page = 0; page < _chrPages.size(); page++ ) {
+    _chrPages[page] = invalidChrPage;
+    if ( _mapper == nullptr ) {
+      continue;
+    }
+    u32 const offset = _mapper->MapChrOffset( page * 0x0400 );
+    if ( offset + 0x0400 <= chrSize ) {
+      _chrPages[page] = offset;
+    }
+  }
+}
+
+void Cartridge::DecodeChr()
+{
+  size_t const chrSize = _usesChrRam ? _chrRam.size() : _chrRom.size();
+  _chrRows.assign( chrSize / 2, ChrRow{} );
+  for ( u32 tile = 0; tile < chrSize; tile += 16 ) {
+    for ( u32 row = 0; row < 8; row++ ) {
+      DecodeChrRow( tile + row );
+    }
+  }
+}
+
+void Cartridge::DecodeChrRow( u32 offset )
+{
+  /** @brief Decode the tile row that the CHR byte at `offset` belongs to, from either of its planes
+   */
+  u32 const plane0 = ( offset & ~0x0Fu ) | ( offset & 0x07 );
+  u32 const index = ( ( plane0 >> 4 ) << 3 ) | ( plane0 & 0x07 );
+  if ( index >= _chrRows.size() ) {
+    return;
+  }
+  u8 const low = _usesChrRam ? _chrRam[plane0] : _chrRom[plane0];
+  u8 const high = _usesChrRam ? _chrRam[plane0 + 8] : _chrRom[plane0 + 8];
+
+  ChrRow &row = _chrRows[index];
+  for ( int x = 0; x < 8; x++ ) {
+    int const bit = 7 - x;
+    u8 const  pixel = static_cast<u8>( ( ( ( high >> bit ) & 0x01 ) << 1 ) | ( ( low >> bit ) & 0x01 ) );
+    row.pixels[x] = pixel;
+    row.flipped[7 - x] = pixel;
   }
 }
 
@@ -324,11 +471,12 @@ void Cartridge::WriteChrRAM( u16 address, u8 data )
    */
   if ( _usesChrRam && address >= 0x0000 && address <= 0x1FFF ) {
     if ( _mapper == nullptr ) {
-      fmt::print( "Cartridge:WriteChrRAM:Mapper is null. Rom file was likely not loaded.\n" );
+      WarnNoMapper( "WriteChrRAM" );
       return;
     }
     u16 const translatedAddress = _mapper->MapChrOffset( address );
-    _chrRam.at( translatedAddress & 0x1FFF ) = data;
+    checks::At( _chrRam, translatedAddress & 0x1FFF ) = data;
+    DecodeChrRow( translatedAddress & 0x1FFF );
   }
 }
 
@@ -341,13 +489,13 @@ void Cartridge::WritePrgRAM( u16 address, u8 data )
    * a game uses PRG RAM or not will be determined by the mapper.
    */
   if ( _mapper == nullptr ) {
-    fmt::print( "Cartridge:WritePrgRAM:Mapper is null. Rom file was likely not loaded.\n" );
+    WarnNoMapper( "WritePrgRAM" );
     return;
   }
 
   if ( address >= 0x6000 && address <= 0x7FFF && _mapper->SupportsPrgRam() ) {
 
-    _prgRam.at( address - 0x6000 ) = data;
+    checks::At( _prgRam, address - 0x6000 ) = data;
   }
 }
 
@@ -357,12 +505,12 @@ void Cartridge::WriteExpansionRAM( u16 address, u8 data )
    * Expansion ROM is rarely used, but when it is, it's used for additional program data
    */
   if ( _mapper == nullptr ) {
-    fmt::print( "Cartridge:WriteExpansionRAM:Mapper is null. Rom file was likely not loaded.\n" );
+    WarnNoMapper( "WriteExpansionRAM" );
     return;
   }
 
   if ( address >= 0x4020 && address <= 0x5FFF && _mapper->HasExpansionRam() ) {
-    _expansionMemory.at( address - 0x4020 ) = data;
+    checks::At( _expansionMemory, address - 0x4020 ) = data;
   }
 }
 
@@ -385,3 +533,14 @@ MirrorMode Cartridge::GetMirrorMode()
 
   return _mapper->GetMirrorMode();
 }
+
+void Cartridge::UpdateMirroring()
+{
+  /** @brief Repoints the PPU's nametable pages when the mirroring changed
+   * Checked after every mapper write, so nametable accesses never have to ask the mapper.
+   */
+  MirrorMode const mode = GetMirrorMode();
+  if ( bus != nullptr && mode != bus->ppu.GetMirrorMode() ) {
+    bus->ppu.SetMirroring( mode );
+  }
+}
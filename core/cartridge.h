@@ -1,7 +1,9 @@
 #pragma once
 
 #include "global-types.h"
+#include "cpu-types.h"
 #include "mappers/mapper-base.h"
+#include "ppu-types.h"
 #include <array>
 #include <string>
 #include <vector>
@@ -73,6 +75,10 @@ public:
       }
       default:
     }
+    UpdatePrgPages();
+    DecodeChr();
+    UpdateChrPages();
+    UpdateMirroring();
   }
 
   /*
@@ -114,9 +120,61 @@ public:
   ################################
   */
   MirrorMode GetMirrorMode();
+  void       UpdateMirroring(); // Passes a change of the mapper's mirroring on to the PPU
   void       LoadRom( const std::string &filePath );
   bool       IsRomValid( const std::string &filePath );
 
+  /*
+  ################################
+  ||     Instruction Predecode  ||
+  ################################
+  */
+  const DecodedInstruction *Predecode( u16 address );
+  void                      UpdatePrgPages();
+  void                      SetPredecodeEnabled( bool enabled ) { _predecodeEnabled = enabled; }
+  bool                      IsPredecodeEnabled() const { return _predecodeEnabled; }
+
+  // PRG ROM offset of a CPU address in $8000-$FFFF, or invalidPrgPage if it isn't mapped into the ROM
+  static constexpr u32 invalidPrgPage = 0xFFFFFFFF;
+  u32                  GetPrgRomOffset( u16 address ) const
+  {
+    u32 const pageOffset = _prgPages[( address >> 12 ) & 0x07];
+    return ( address < 0x8000 || pageOffset == invalidPrgPage ) ? invalidPrgPage : pageOffset + ( address & 0x0FFF );
+  }
+  size_t GetPrgRomSize() const { return _prgRom.size(); }
+
+  // Host memory behind a CPU address, for the bus page table. nullptr where the mapper has to be involved
+  const u8 *GetPrgRomPointer( u16 address ) const
+  {
+    u32 const offset = GetPrgRomOffset( address );
+    return offset == invalidPrgPage ? nullptr : _prgRom.data() + offset;
+  }
+  u8 *GetPrgRamPointer( u16 address )
+  {
+    bool const mapped = address >= 0x6000 && address <= 0x7FFF && _mapper != nullptr && _mapper->SupportsPrgRam();
+    return mapped ? _prgRam.data() + ( address - 0x6000 ) : nullptr;
+  }
+
+  /*
+  ################################
+  ||       CHR Tile Cache       ||
+  ################################
+  */
+  // Decoded row of the tile at a PPU pattern address in $0000-$1FFF. Bits 4-12 pick the tile and bits 0-2 the
+  // row, the plane bit doesn't matter. Pages the mapper maps outside of CHR read as a blank row
+  static constexpr u32    invalidChrPage = 0xFFFFFFFF;
+  static constexpr ChrRow blankChrRow{};
+  const ChrRow           &GetChrRow( u16 address ) const
+  {
+    u32 const page = _chrPages[( address >> 10 ) & 0x07];
+    if ( page == invalidChrPage ) {
+      return blankChrRow;
+    }
+    u32 const offset = page + ( address & 0x03F7 );
+    return _chrRows[( ( offset >> 4 ) << 3 ) | ( offset & 0x07 )];
+  }
+  void UpdateChrPages();
+
   /*
   ################################
   ||        Debug Methods       ||
@@ -124,7 +182,13 @@ public:
   */
   bool DidMapperLoad() const { return didMapperLoad; }
   bool DoesMapperExist() const { return _mapper != nullptr; }
-  void SetChrROM( u16 address, u8 data ) { _chrRom.at( address ) = data; }
+  void SetChrROM( u16 address, u8 data )
+  {
+    _chrRom.at( address ) = data;
+    if ( !_usesChrRam ) {
+      DecodeChrRow( address );
+    }
+  }
   /*
   ################################
   ||       Debug Variables      ||
@@ -142,6 +206,45 @@ public:
   std::string GetRomHash() const { return romHash; }
 
 private:
+  /*
+  ################################
+  ||      Private Variables     ||
+  ################################
+  */
+  // Ahead of the 8 KiB arrays, which a frame mostly doesn't touch, so the mapper and predecode lookups of every
+  // instruction stay on a couple of cache lines
+  std::shared_ptr<Mapper> _mapper;
+  std::string             _romPath;
+  u8                      _mapperNumber = 0;
+  bool                    _usesChrRam = false;
+
+  /*
+  ################################
+  ||     Predecode Variables    ||
+  ################################
+  */
+  // One record per PRG ROM byte, filled the first time the CPU executes from that offset. Keyed by ROM offset,
+  // so the records never go stale. Only the CPU page -> ROM offset translation changes with bank switches.
+  std::vector<DecodedInstruction> _decodeCache;
+
+  // PRG ROM offset of each 4 KiB CPU page from $8000 to $FFFF. Rebuilt after mapper writes.
+  std::array<u32, 8> _prgPages{};
+  bool               _predecodeEnabled = true;
+
+  /*
+  ################################
+  ||     CHR Cache Variables    ||
+  ################################
+  */
+  // One decoded row per two bytes of CHR ROM, or of the 8 KiB of CHR RAM, decoded when the rom loads. Keyed by
+  // CHR offset like the predecode cache: a CHR RAM write decodes its row again, and bank switches only move
+  // the CHR offset of each 1 KiB PPU page of $0000-$1FFF, rebuilt after mapper writes
+  std::vector<ChrRow> _chrRows;
+  std::array<u32, 8>  _chrPages{};
+
+  void DecodeChr();
+  void DecodeChrRow( u32 offset );
+
   /*
   ################################
   ||      Memory Variables      ||
@@ -193,14 +296,4 @@ private:
   // Some cartridges provided 2Kib extra which allowed for four unique
   // nametables without mirroring. Nametables are documented in the PPU class.
   // array<u8, 2048> _cartridgeVram{}; // For simplicity, I've defined all nametables in the PPU class.
-
-  /*
-  ################################
-  ||      Private Variables     ||
-  ################################
-  */
-  std::shared_ptr<Mapper> _mapper;
-  std::string             _romPath;
-  u8                      _mapperNumber = 0;
-  bool                    _usesChrRam = false;
 };
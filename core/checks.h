@@ -0,0 +1,39 @@
+#pragma once
+
+#include <cstddef>
+
+// Core build policy, set per core target with -DCORE_CHECKS=ON|OFF (see CMakeLists.txt).
+// The instrumented core (the default, and emu_core_debug) bounds checks memory accesses and keeps the
+// trace hooks. The fast core (emu_core_fast) compiles both out of the hot path.
+#ifndef NES_CORE_CHECKS
+#define NES_CORE_CHECKS 1
+#endif
+
+/*
+################################################################
+||                                                            ||
+||                      Core Build Policy                     ||
+||                                                            ||
+################################################################
+*/
+namespace checks
+{
+
+constexpr bool enabled = NES_CORE_CHECKS != 0;
+
+/*
+ * @brief Element access for the emulation hot path
+ * .at() in the instrumented core, so a bad index throws std::out_of_range where it happens. Plain
+ * indexing in the fast core, where a bad index is undefined: run new code against the instrumented core
+ * first.
+ */
+template <typename Container> constexpr decltype( auto ) At( Container &container, size_t index )
+{
+  if constexpr ( enabled ) {
+    return container.at( index );
+  } else {
+    return container[index];
+  }
+}
+
+} // namespace checks
@@ -0,0 +1,275 @@
+#include "compositor.h"
+#include "global-types.h"
+#include <array>
+
+// SSE2 is part of x86-64, so that kernel is always there. The AVX2 one is compiled for the AVX2 target on
+// its own and only called when the host has it, so the core keeps running on any x86-64
+#if defined( __SSE2__ ) || defined( _M_X64 )
+#define NES_COMPOSITOR_SSE2 1
+#include <emmintrin.h>
+#else
+#define NES_COMPOSITOR_SSE2 0
+#endif
+
+#if NES_COMPOSITOR_SSE2 && ( defined( __GNUC__ ) || defined( __clang__ ) )
+#define NES_COMPOSITOR_AVX2 1
+#define NES_TARGET_AVX2     __attribute__( ( target( "avx2" ) ) )
+#include <immintrin.h>
+#else
+#define NES_COMPOSITOR_AVX2 0
+#endif
+
+namespace compositor
+{
+
+namespace
+{
+// Sprite 0 hits from dot 9 to dot 255, pixels 8 to 254
+constexpr int hitFirst = 8;
+constexpr int hitLast = 254;
+
+/*
+################################
+||           Scalar           ||
+################################
+*/
+bool Scalar( const Span &span, int begin )
+{
+  bool hit = false;
+  for ( int i = begin; i < span.count; i++ ) {
+    int const x = span.x + i;
+    u8 const  bg = x >= span.backgroundFrom ? span.background[i] : 0;
+    u8 const  sprite = x >= span.spritesFrom ? span.sprites[i] : 0;
+    u8        entry = 0;
+    if ( ( sprite & 0x03 ) != 0 && ( ( bg & 0x03 ) == 0 || ( sprite & spriteFront ) != 0 ) ) {
+      entry = static_cast<u8>( 0x10 | ( sprite & 0x0F ) );
+    } else if ( ( bg & 0x03 ) != 0 ) {
+      entry = bg & 0x0F;
+    }
+    hit = hit || ( ( sprite & spriteZero ) != 0 && x >= hitFirst && x <= hitLast );
+    if ( span.out != nullptr ) {
+      span.out[i] = span.colors[entry];
+    }
+  }
+  return hit;
+}
+
+/*
+################################
+||            SSE2            ||
+################################
+*/
+#if NES_COMPOSITOR_SSE2
+// Lanes whose pixel is at or right of `from`. Pixels are 0-255, compared unsigned
+__m128i AtLeast( __m128i positions, int from )
+{
+  if ( from <= 0 ) {
+    return _mm_set1_epi8( -1 );
+  }
+  if ( from > 255 ) {
+    return _mm_setzero_si128();
+  }
+  return _mm_cmpeq_epi8( _mm_max_epu8( positions, _mm_set1_epi8( static_cast<char>( from ) ) ), positions );
+}
+
+bool Sse2( const Span &span, int begin )
+{
+  __m128i const zero = _mm_setzero_si128();
+  __m128i const pixelBits = _mm_set1_epi8( 0x03 );
+  __m128i const entryBits = _mm_set1_epi8( 0x0F );
+  __m128i const spritePalettes = _mm_set1_epi8( 0x10 );
+  __m128i const front = _mm_set1_epi8( spriteFront );
+  __m128i const zeroBit = _mm_set1_epi8( spriteZero );
+  __m128i const lanes = _mm_setr_epi8( 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15 );
+
+  alignas( 16 ) std::array<u8, 16> entries{};
+  int hits = 0;
+  int i = begin;
+  while ( i < span.count ) {
+    // 16 pixels, or the 8 of a span's last tile in the low half
+    int const width = i + 16 <= span.count ? 16 : 8;
+    __m128i   bg = width == 16 ? _mm_loadu_si128( reinterpret_cast<const __m128i *>( span.background + i ) )
+                               : _mm_loadl_epi64( reinterpret_cast<const __m128i *>( span.background + i ) );
+    __m128i   sprite = width == 16 ? _mm_loadu_si128( reinterpret_cast<const __m128i *>( span.sprites + i ) )
+                                   : _mm_loadl_epi64( reinterpret_cast<const __m128i *>( span.sprites + i ) );
+
+    __m128i const positions = _mm_add_epi8( _mm_set1_epi8( static_cast<char>( span.x + i ) ), lanes );
+    bg = _mm_and_si128( bg, AtLeast( positions, span.backgroundFrom ) );
+    sprite = _mm_and_si128( sprite, AtLeast( positions, span.spritesFrom ) );
+
+    __m128i const bgClear = _mm_cmpeq_epi8( _mm_and_si128( bg, pixelBits ), zero );
+    __m128i const spriteClear = _mm_cmpeq_epi8( _mm_and_si128( sprite, pixelBits ), zero );
+    __m128i const inFront = _mm_cmpeq_epi8( _mm_and_si128( sprite, front ), front );
+    __m128i const useSprite = _mm_andnot_si128( spriteClear, _mm_or_si128( bgClear, inFront ) );
+    __m128i const spriteEntry = _mm_or_si128( _mm_and_si128( sprite, entryBits ), spritePalettes );
+    __m128i const bgEntry = _mm_andnot_si128( bgClear, _mm_and_si128( bg, entryBits ) );
+    __m128i const entry = _mm_or_si128( _mm_and_si128( useSprite, spriteEntry ), _mm_andnot_si128( useSprite, bgEntry ) );
+
+    __m128i const window = _mm_andnot_si128( _mm_cmpeq_epi8( positions, _mm_set1_epi8( static_cast<char>( 0xFF ) ) ),
+                                             AtLeast( positions, hitFirst ) );
+    hits |= _mm_movemask_epi8( _mm_and_si128( _mm_cmpeq_epi8( _mm_and_si128( sprite, zeroBit ), zeroBit ), window ) );
+
+    // SSE2 has no gather: the colors come from the table one at a time
+    if ( span.out != nullptr ) {
+      _mm_store_si128( reinterpret_cast<__m128i *>( entries.data() ), entry );
+      for ( int lane = 0; lane < width; lane++ ) {
+        span.out[i + lane] = span.colors[entries[lane]];
+      }
+    }
+    i += width;
+  }
+  return hits != 0;
+}
+#endif
+
+/*
+################################
+||            AVX2            ||
+################################
+*/
+#if NES_COMPOSITOR_AVX2
+NES_TARGET_AVX2 __m256i AtLeast256( __m256i positions, int from )
+{
+  if ( from <= 0 ) {
+    return _mm256_set1_epi8( -1 );
+  }
+  if ( from > 255 ) {
+    return _mm256_setzero_si256();
+  }
+  return _mm256_cmpeq_epi8( _mm256_max_epu8( positions, _mm256_set1_epi8( static_cast<char>( from ) ) ), positions );
+}
+
+// The colors of the 8 entries in the low bytes of `entries`, widened to the 32-bit indices the gather takes
+NES_TARGET_AVX2 void GatherEight( const u32 *colors, __m128i entries, u32 *out )
+{
+  __m256i const indices = _mm256_cvtepu8_epi32( entries );
+  __m256i const gathered = _mm256_i32gather_epi32( reinterpret_cast<const int *>( colors ), indices, 4 );
+  _mm256_storeu_si256( reinterpret_cast<__m256i *>( out ), gathered );
+}
+
+NES_TARGET_AVX2 void GatherColors( const u32 *colors, __m256i entry, u32 *out )
+{
+  __m128i const low = _mm256_castsi256_si128( entry );
+  __m128i const high = _mm256_extracti128_si256( entry, 1 );
+  GatherEight( colors, low, out );
+  GatherEight( colors, _mm_srli_si128( low, 8 ), out + 8 );
+  GatherEight( colors, high, out + 16 );
+  GatherEight( colors, _mm_srli_si128( high, 8 ), out + 24 );
+}
+
+NES_TARGET_AVX2 bool Avx2( const Span &span )
+{
+  __m256i const zero = _mm256_setzero_si256();
+  __m256i const pixelBits = _mm256_set1_epi8( 0x03 );
+  __m256i const entryBits = _mm256_set1_epi8( 0x0F );
+  __m256i const spritePalettes = _mm256_set1_epi8( 0x10 );
+  __m256i const front = _mm256_set1_epi8( spriteFront );
+  __m256i const zeroBit = _mm256_set1_epi8( spriteZero );
+  __m256i const lanes = _mm256_setr_epi8( 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15, 16, 17, 18, 19, 20,
+                                          21, 22, 23, 24, 25, 26, 27, 28, 29, 30, 31 );
+
+  int hits = 0;
+  int i = 0;
+  for ( ; i + 32 <= span.count; i += 32 ) {
+    __m256i bg = _mm256_loadu_si256( reinterpret_cast<const __m256i *>( span.background + i ) );
+    __m256i sprite = _mm256_loadu_si256( reinterpret_cast<const __m256i *>( span.sprites + i ) );
+
+    __m256i const positions = _mm256_add_epi8( _mm256_set1_epi8( static_cast<char>( span.x + i ) ), lanes );
+    bg = _mm256_and_si256( bg, AtLeast256( positions, span.backgroundFrom ) );
+    sprite = _mm256_and_si256( sprite, AtLeast256( positions, span.spritesFrom ) );
+
+    __m256i const bgClear = _mm256_cmpeq_epi8( _mm256_and_si256( bg, pixelBits ), zero );
+    __m256i const spriteClear = _mm256_cmpeq_epi8( _mm256_and_si256( sprite, pixelBits ), zero );
+    __m256i const inFront = _mm256_cmpeq_epi8( _mm256_and_si256( sprite, front ), front );
+    __m256i const useSprite = _mm256_andnot_si256( spriteClear, _mm256_or_si256( bgClear, inFront ) );
+    __m256i const spriteEntry = _mm256_or_si256( _mm256_and_si256( sprite, entryBits ), spritePalettes );
+    __m256i const bgEntry = _mm256_andnot_si256( bgClear, _mm256_and_si256( bg, entryBits ) );
+    __m256i const entry = _mm256_blendv_epi8( bgEntry, spriteEntry, useSprite );
+
+    __m256i const window = _mm256_andnot_si256(
+        _mm256_cmpeq_epi8( positions, _mm256_set1_epi8( static_cast<char>( 0xFF ) ) ), AtLeast256( positions, hitFirst ) );
+    hits |= _mm256_movemask_epi8(
+        _mm256_and_si256( _mm256_cmpeq_epi8( _mm256_and_si256( sprite, zeroBit ), zeroBit ), window ) );
+
+    if ( span.out != nullptr ) {
+      GatherColors( span.colors, entry, span.out + i );
+    }
+  }
+  // A tile group, or what's left of a span that isn't a multiple of 32
+  bool const rest = i < span.count && Sse2( span, i );
+  return hits != 0 || rest;
+}
+#endif
+
+Kernel Detect()
+{
+#if NES_COMPOSITOR_AVX2
+  if ( __builtin_cpu_supports( "avx2" ) ) {
+    return Kernel::Avx2;
+  }
+#endif
+#if NES_COMPOSITOR_SSE2
+  return Kernel::Sse2;
+#else
+  return Kernel::Scalar;
+#endif
+}
+} // namespace
+
+/*
+################################
+||         Compositing        ||
+################################
+*/
+bool Composite( const Span &span )
+{
+  return Composite( span, BestKernel() );
+}
+
+bool Composite( const Span &span, Kernel kernel )
+{
+  // A kernel the host can't run falls back to the scalar one. A tile group has no 32 pixels for AVX2, and
+  // setting up its constants costs more than SSE2 takes for the whole group
+  switch ( kernel ) {
+#if NES_COMPOSITOR_AVX2
+    case Kernel::Avx2:
+      if ( IsSupported( Kernel::Avx2 ) && span.count >= 32 ) {
+        return Avx2( span );
+      }
+      return Sse2( span, 0 );
+#endif
+#if NES_COMPOSITOR_SSE2
+    case Kernel::Sse2: return Sse2( span, 0 );
+#endif
+    default: break;
+  }
+  return Scalar( span, 0 );
+}
+
+Kernel BestKernel()
+{
+  static Kernel const best = Detect();
+  return best;
+}
+
+bool IsSupported( Kernel kernel )
+{
+  switch ( kernel ) {
+    case Kernel::Scalar: return true;
+    case Kernel::Sse2  : return NES_COMPOSITOR_SSE2 != 0;
+    case Kernel::Avx2  : return BestKernel() == Kernel::Avx2;
+  }
+  return false;
+}
+
+const char *KernelName( Kernel kernel )
+{
+  switch ( kernel ) {
+    case Kernel::Scalar: return "scalar";
+    case Kernel::Sse2  : return "sse2";
+    case Kernel::Avx2  : return "avx2";
+  }
+  return "?";
+}
+
+} // namespace compositor
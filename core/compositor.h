@@ -0,0 +1,55 @@
+#pragma once
+
+#include "global-types.h"
+
+/*
+################################################################
+||                                                            ||
+||                         Compositor                         ||
+||                                                            ||
+################################################################
+*/
+namespace compositor
+{
+
+// Line buffer entries, one byte per pixel. Background: the pixel index in bits 0-1 and the palette in bits 2-3.
+// Sprites: the same, plus whether the sprite is in front of the background and whether the pixel is an
+// opaque one of sprite 0 (the first sprite of the line, when it's OAM entry 0)
+constexpr u8 spriteFront = 0x10;
+constexpr u8 spriteZero = 0x20;
+
+// The kernels give the same pixels and hits. The best one the host has is picked at startup
+enum class Kernel : u8 { Scalar, Sse2, Avx2 };
+
+/*
+ * @brief A run of pixels of one line: its two line buffers in, its colors out
+ * `background` and `sprites` hold `count` entries, for pixels x to x + count - 1, and `count` is a multiple
+ * of 8: a tile group for the dot renderer, the whole line for the scanline renderer. A layer is clipped
+ * left of its first pixel, 8 when PPUMASK hides its left column.
+ */
+struct Span {
+  const u8  *background = nullptr;
+  const u8  *sprites = nullptr;
+  const u32 *colors = nullptr; // The 32 palette entries, resolved to RGB
+  u32       *out = nullptr;    // Null when only the hit is wanted
+  int        x = 0;
+  int        count = 0;
+  int        backgroundFrom = 0;
+  int        spritesFrom = 0;
+};
+
+/*
+ * @brief Combines the two layers as PPU::GetOutputPixel() does, 16 or 32 pixels at a time
+ * An opaque sprite pixel wins over a transparent background pixel, and over an opaque one when it's in
+ * front. Entry 0 shows where both are transparent. Returns true when sprite 0 hits in the span: an opaque
+ * sprite 0 pixel from x = 8 to 254. Like the dot renderer, the background under it isn't looked at, and the
+ * caller checks that both layers are on and that sprite 0 is on the line.
+ */
+bool Composite( const Span &span );
+bool Composite( const Span &span, Kernel kernel );
+
+Kernel      BestKernel();
+bool        IsSupported( Kernel kernel );
+const char *KernelName( Kernel kernel );
+
+} // namespace compositor
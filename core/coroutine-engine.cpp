@@ -0,0 +1,177 @@
+#include "coroutine-engine.h"
+#include "bus.h"
+#include "global-types.h"
+#include "scheduler.h"
+
+CoroutineEngine::~CoroutineEngine()
+{
+  Destroy();
+}
+
+/*
+################################
+||         Scheduling         ||
+################################
+*/
+u64 CoroutineEngine::TimeOf( Component component, u64 now ) const
+{
+  // The CPU and the DMA unit are always at the present: the master clock is the CPU's cycle count
+  switch ( _slots[Index( component )].wait ) {
+    case Wait::Boundary:
+    case Wait::Now:       return now;
+    case Wait::NextEvent: return bus->scheduler.GetNextTimestamp();
+    case Wait::NextFrame: return bus->ppu.frame != _apuFrame ? now : Scheduler::never;
+    case Wait::Asleep:    return Scheduler::never;
+  }
+  return Scheduler::never;
+}
+
+CoroutineEngine::Component CoroutineEngine::Pick() const
+{
+  // One of the CPU and the DMA unit is always awake, so something is due by now
+  u64 const now = bus->GetMasterClock();
+  Component next = Component::Cpu;
+  u64       nextTime = Scheduler::never;
+  for ( size_t i = 0; i < componentCount; i++ ) {
+    u64 const time = TimeOf( static_cast<Component>( i ), now );
+    if ( time < nextTime ) {
+      next = static_cast<Component>( i );
+      nextTime = time;
+    }
+  }
+  return next;
+}
+
+void CoroutineEngine::Resume( Component component )
+{
+  _stats.resumes[Index( component )]++;
+  _slots[Index( component )].handle.resume();
+}
+
+void CoroutineEngine::Wake( Component component )
+{
+  Slot &slot = _slots[Index( component )];
+  if ( slot.wait == Wait::Asleep ) {
+    slot.wait = Wait::Boundary;
+  }
+}
+
+/*
+################################
+||          Lifetime          ||
+################################
+*/
+void CoroutineEngine::Begin()
+{
+  if ( !_started ) {
+    Start();
+  }
+  _running = true;
+
+  // Between runs the CPU and the DMA unit both wait at a boundary or asleep, and both look at the bus
+  // when they resume. The classic loop or a state load may have started or finished a transfer since,
+  // so the one that has the bus now is the one that goes on
+  bool const dma = bus->dmaInProgress;
+  _slots[Index( Component::Dma )].wait = dma ? Wait::Boundary : Wait::Asleep;
+  _slots[Index( Component::Cpu )].wait = dma ? Wait::Asleep : Wait::Boundary;
+}
+
+void CoroutineEngine::Start()
+{
+  _slots[Index( Component::Cpu )].handle = CpuLoop().handle;
+  _slots[Index( Component::Ppu )].handle = PpuLoop().handle;
+  _slots[Index( Component::Apu )].handle = ApuLoop().handle;
+  _slots[Index( Component::Dma )].handle = DmaLoop().handle;
+  _started = true;
+
+  // Up to where each one first waits
+  for ( Slot &slot : _slots ) {
+    slot.handle.resume();
+  }
+}
+
+void CoroutineEngine::Abort()
+{
+  // A coroutine that threw is done, start over on the next run
+  Destroy();
+  _running = false;
+}
+
+void CoroutineEngine::Destroy()
+{
+  for ( Slot &slot : _slots ) {
+    if ( slot.handle ) {
+      slot.handle.destroy();
+    }
+    slot = Slot{};
+  }
+  _started = false;
+}
+
+/*
+################################
+||         Components         ||
+################################
+*/
+CoroutineEngine::Task CoroutineEngine::CpuLoop()
+{
+  for ( ;; ) {
+    if ( bus->dmaInProgress ) {
+      // The DMA unit has the CPU's cycles until the transfer ends, then wakes the CPU at a boundary
+      Wake( Component::Dma );
+      co_await Until( Component::Cpu, Wait::Asleep );
+    } else {
+      co_await Until( Component::Cpu, Wait::Boundary );
+    }
+    if ( bus->dmaInProgress ) {
+      continue;
+    }
+
+    bus->ExecuteStep();
+    // Events that came due during the step run before the NMI line is looked at
+    co_await Until( Component::Cpu, Wait::Now );
+    bus->PollNmi();
+  }
+}
+
+CoroutineEngine::Task CoroutineEngine::DmaLoop()
+{
+  for ( ;; ) {
+    if ( !bus->dmaInProgress ) {
+      Wake( Component::Cpu );
+      co_await Until( Component::Dma, Wait::Asleep );
+    } else {
+      co_await Until( Component::Dma, Wait::Boundary );
+    }
+    if ( !bus->dmaInProgress ) {
+      continue;
+    }
+
+    // One cycle of the transfer, or all of it at once (see Bus::TryBulkDma())
+    bus->ProcessDma();
+    co_await Until( Component::Dma, Wait::Now );
+    bus->PollNmi();
+  }
+}
+
+CoroutineEngine::Task CoroutineEngine::PpuLoop()
+{
+  for ( ;; ) {
+    co_await Until( Component::Ppu, Wait::NextEvent );
+    // Catches the PPU up through the event and schedules the next ones
+    bus->RunEvents();
+  }
+}
+
+CoroutineEngine::Task CoroutineEngine::ApuLoop()
+{
+  // Blargg's APU keeps its own time within a frame, so frame ends are all it needs to hear about
+  for ( ;; ) {
+    _apuFrame = bus->ppu.frame;
+    co_await Until( Component::Apu, Wait::NextFrame );
+    _stats.apuFrames++;
+    if ( onApuFrameEnd ) {
+      onApuFrameEnd();
+    }
+  }
+}
@@ -0,0 +1,159 @@
+#pragma once
+
+#include "global-types.h"
+#include <array>
+#include <coroutine>
+#include <cstddef>
+#include <functional>
+
+class Bus;
+
+/*
+################################################################
+||                                                            ||
+||                      Coroutine Engine                      ||
+||                                                            ||
+################################################################
+*/
+
+/*
+ * @brief An experimental run loop where the CPU, PPU, APU and OAM DMA unit are coroutines
+ *
+ * In the classic loop the CPU drives everything: CPU::Tick() owes the PPU its dots and runs the scheduled
+ * events the moment they come due, and Bus::Clock() takes care of DMA and the NMI. Here each component is
+ * a coroutine that suspends on what it waits for, and the engine always resumes the one that is furthest
+ * behind on the master clock:
+ * - CPU: one step at a time (an instruction or an idle loop replay), at the CPU's
+ *   own time. Its accesses to the PPU still catch the PPU up (see PPU::CatchUp()), so a step doesn't need
+ *   to suspend on every bus access, only at its end
+ * - PPU: waits for the next scheduled event (vblank, frame end) and runs it. Events no longer run inside
+ *   CPU::Tick(), they wait for the CPU to reach the end of its step
+ * - APU: waits for the PPU to finish a frame and closes the sound frame (see onApuFrameEnd)
+ * - DMA: sleeps until the CPU starts an OAM DMA, then has the CPU's cycles until the transfer ends
+ *
+ * Components due at the same tick run in the order of Component, so the events of a step run before the
+ * CPU looks at the NMI line. Runs stop at the same step boundaries as Bus::RunUntil(), and leave the same
+ * state behind (see coroutine_engine_test). The engine is off by default: Bus::RunUntil() uses it when
+ * SetEnabled( true ), and coroutine_bench compares the throughput of both loops.
+ */
+class CoroutineEngine
+{
+public:
+  explicit CoroutineEngine( Bus *bus ) : bus( bus ) {}
+  ~CoroutineEngine();
+
+  CoroutineEngine( const CoroutineEngine & ) = delete;
+  CoroutineEngine &operator=( const CoroutineEngine & ) = delete;
+  CoroutineEngine( CoroutineEngine && ) = delete;
+  CoroutineEngine &operator=( CoroutineEngine && ) = delete;
+
+  // Ordered by priority: components due at the same tick resume in this order
+  enum class Component : u8 { Ppu, Apu, Dma, Cpu, Count };
+  static constexpr size_t componentCount = static_cast<size_t>( Component::Count );
+
+  struct Stats {
+    std::array<u64, componentCount> resumes{};
+    u64                             apuFrames = 0;
+  };
+
+  /*
+  ################################
+  ||       Engine Methods       ||
+  ################################
+  */
+  // Resumes components until `done()` is true, checked whenever the CPU or the DMA unit is about to start
+  // a step: the same points Bus::RunUntil() checks it at
+  template <typename Predicate> void Run( Predicate &&done )
+  {
+    Begin();
+    try {
+      for ( ;; ) {
+        Component const next = Pick();
+        if ( _slots[Index( next )].wait == Wait::Boundary && done() ) {
+          break;
+        }
+        Resume( next );
+      }
+    } catch ( ... ) {
+      Abort();
+      throw;
+    }
+    _running = false;
+  }
+
+  void SetEnabled( bool enabled ) { _enabled = enabled; }
+  bool IsEnabled() const { return _enabled; }
+  // While a run is in progress the scheduled events are left to the PPU coroutine
+  bool         IsRunning() const { return _running; }
+  Stats const &GetStats() const { return _stats; }
+  void         ResetStats() { _stats = Stats{}; }
+
+  // Called by the APU coroutine whenever the PPU finishes a frame, e.g. to end the sound frame
+  std::function<void()> onApuFrameEnd;
+
+private:
+  Bus *bus;
+
+  // What a suspended component waits for
+  enum class Wait : u8 {
+    Boundary,  // To start a step at the present. Runs may stop here
+    Now,       // To go on at the present, once everything due before it has run
+    NextEvent, // For the next scheduled event
+    NextFrame, // For the PPU to leave the frame it was in
+    Asleep,    // For another component to Wake() it
+  };
+
+  struct Task {
+    struct promise_type {
+      Task                get_return_object() { return { std::coroutine_handle<promise_type>::from_promise( *this ) }; }
+      std::suspend_always initial_suspend() noexcept { return {}; }
+      std::suspend_always final_suspend() noexcept { return {}; }
+      void                return_void() {}
+      // Out of resume(), and into Run(), which drops the coroutines
+      void unhandled_exception() { throw; } // NOLINT
+    };
+    std::coroutine_handle<promise_type> handle;
+  };
+
+  struct Awaiter {
+    CoroutineEngine *engine;
+    Component        component;
+    Wait             wait;
+
+    bool await_ready() const noexcept { return false; }
+    void await_suspend( std::coroutine_handle<> /*handle*/ ) const noexcept
+    {
+      engine->_slots[Index( component )].wait = wait;
+    }
+    void await_resume() const noexcept {}
+  };
+
+  struct Slot {
+    std::coroutine_handle<Task::promise_type> handle;
+    Wait                                      wait = Wait::Now;
+  };
+
+  static constexpr size_t Index( Component component ) { return static_cast<size_t>( component ); }
+  Awaiter                 Until( Component component, Wait wait ) { return { this, component, wait }; }
+  void                    Wake( Component component );
+  u64                     TimeOf( Component component, u64 now ) const;
+  Component               Pick() const;
+  void                    Resume( Component component );
+
+  void Begin();
+  void Start();
+  void Abort();
+  void Destroy();
+
+  Task CpuLoop();
+  Task PpuLoop();
+  Task ApuLoop();
+  Task DmaLoop();
+
+  std::array<Slot, componentCount> _slots{};
+  bool                             _enabled = false;
+  bool                             _started = false;
+  bool                             _running = false;
+  u64                              _apuFrame = 0; // The frame the APU coroutine is waiting to see end
+  Stats                            _stats;
+};
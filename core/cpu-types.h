@@ -1,11 +1,10 @@
 #pragma once
 #include "global-types.h"
-#include <string>
-#include <bitset>
+#include <string_view>
 
 // clang-format off
 #include <array>
-const std::array<std::string, 256> gInstructionNames = {
+constexpr std::array<std::string_view, 256> gInstructionNames = {
           //0      1        2        3        4        5        6        7        8        9        A       B        C        D        E        F
     /*0*/"BRK",   "ORA",   "*JAM",  "*SLO",  "*NOP",  "ORA",   "*ASL",  "*SLO",  "PHP",  "ORA",   "ASL",   "*ANC",  "*NOP",  "ORA",   "ASL",   "*SLO",
     /*1*/"BPL",   "ORA",   "*JAM",  "*SLO",  "*NOP",  "ORA",   "*ASL",  "*SLO",  "CLC",  "ORA",   "*NOP",  "*SLO",  "*NOP",  "ORA",   "ASL",   "*SLO",
@@ -25,7 +24,7 @@ const std::array<std::string, 256> gInstructionNames = {
     /*F*/"BEQ",   "SBC",   "*JAM",  "*ISC",  "*NOP",  "SBC",   "*INC",  "*ISC",  "SED",  "SBC",   "*NOP",  "*ISC",  "*NOP",  "SBC",   "INC",   "*ISC"
 };
 
-const std::array<std::string, 256> gAddressingModes = {
+constexpr std::array<std::string_view, 256> gAddressingModes = {
           //0      1        2        3        4        5        6        7        8        9        A       B        C        D        E        F
      /*0*/"IMP",   "INDX",  "IMP",   "INDX",  "ZPG",   "ZPG",   "ZPG",   "ZPG",   "IMP",  "IMM",   "IMP",   "IMM",   "ABS",   "ABS",   "ABS",   "ABS",
      /*1*/"REL",   "INDY",  "IMP",   "INDY",  "ZPGX",  "ZPGX",  "ZPGX",  "ZPGX",  "IMP",  "ABSY",  "IMP",   "ABSY",  "ABSX",  "ABSX",  "ABSX",  "ABSX",
@@ -45,7 +44,7 @@ const std::array<std::string, 256> gAddressingModes = {
      /*F*/"REL",   "INDY",  "IMP",   "INDY",  "ZPGX",  "ZPGX",  "ZPGX",  "ZPGX",  "IMP",  "ABSY",  "IMP",   "ABSY",  "ABSX",  "ABSX",  "ABSX",  "ABSX"
 };
 
-const std::array<u8, 256> gInstructionCycles = {
+constexpr std::array<u8, 256> gInstructionCycles = {
           //0      1        2        3        4        5        6        7        8        9        A       B        C        D        E        F
      /*0*/7,       6,       2,       8,       3,       3,       5,       5,       3,       2,       2,      2,       4,       4,       6,       6,
      /*1*/2,       5,       2,       8,       4,       4,       6,       6,       2,       4,       2,      7,       4,       4,       7,       7,
@@ -65,7 +64,7 @@ const std::array<u8, 256> gInstructionCycles = {
      /*F*/2,       5,       2,       8,       4,       4,       6,       6,       2,       4,       2,      7,       4,       4,       7,       7
 };
 
-const std::array<u8, 256> gInstructionBytes = {
+constexpr std::array<u8, 256> gInstructionBytes = {
           //0      1        2        3        4        5        6        7        8        9        A       B        C        D        E        F
      /*0*/1,       2,       1,       2,       2,       2,       2,       2,       1,       2,       1,      2,       3,       3,       3,       3,
      /*1*/2,       2,       1,       2,       2,       2,       2,       2,       1,       3,       1,      3,       3,       3,       3,       3,
@@ -85,34 +84,111 @@ const std::array<u8, 256> gInstructionBytes = {
      /*F*/2,       2,       1,       2,       2,       2,       2,       2,       1,       3,       1,      3,       3,       3,       3,       3
 };
 
-inline const std::bitset<256> noPageCrossPenaltyOpcodes = []() {
-    std::bitset<256> bs;
-    bs.set( 0x9D ); bs.set( 0x99 ); bs.set( 0x81 ); bs.set( 0x91 ); bs.set( 0xFE ); bs.set( 0xDE );
-    bs.set( 0x1E ); bs.set( 0x5E ); bs.set( 0x3E ); bs.set( 0x7E ); bs.set( 0x1F ); bs.set( 0x1B );
-    bs.set( 0x13 ); bs.set( 0x3F ); bs.set( 0x3B ); bs.set( 0x33 ); bs.set( 0x5F ); bs.set( 0x5B );
-    bs.set( 0x53 ); bs.set( 0x7F ); bs.set( 0x7B ); bs.set( 0x73 ); bs.set( 0xDF ); bs.set( 0xDB );
-    bs.set( 0xD3 ); bs.set( 0xFF ); bs.set( 0xFB ); bs.set( 0xF3 );
-    return bs;
-}();
+// Opcodes that never take the extra page-cross cycle (stores and read-modify-writes)
+constexpr std::array<u8, 28> gNoPageCrossPenaltyOpcodes = {
+    0x9D, 0x99, 0x81, 0x91, 0xFE, 0xDE, 0x1E, 0x5E, 0x3E, 0x7E, 0x1F, 0x1B, 0x13, 0x3F,
+    0x3B, 0x33, 0x5F, 0x5B, 0x53, 0x7F, 0x7B, 0x73, 0xDF, 0xDB, 0xD3, 0xFF, 0xFB, 0xF3
+};
 
-inline const std::bitset<256> writeModifyOpcodes = []() {
-    std::bitset<256> bs;
-    bs.set( 0xB6 ); bs.set( 0x9D ); bs.set( 0x99 ); bs.set( 0x91 ); bs.set( 0x96 ); bs.set( 0xFE );
-    bs.set( 0xDE ); bs.set( 0x1E ); bs.set( 0x5E ); bs.set( 0x3E ); bs.set( 0x7E ); bs.set( 0x1F );
-    bs.set( 0x1B ); bs.set( 0x13 ); bs.set( 0x3F ); bs.set( 0x3B ); bs.set( 0x33 ); bs.set( 0x5F );
-    bs.set( 0x5B ); bs.set( 0x53 ); bs.set( 0x7F ); bs.set( 0x7B ); bs.set( 0x73 ); bs.set( 0x97 );
-    bs.set( 0xB7 ); bs.set( 0xDF ); bs.set( 0xDB ); bs.set( 0xD3 ); bs.set( 0xFF ); bs.set( 0xFB );
-    bs.set( 0xF3 );
-    return bs;
-}();
+// Opcodes that perform a dummy read before writing
+constexpr std::array<u8, 31> gWriteModifyOpcodes = {
+    0xB6, 0x9D, 0x99, 0x91, 0x96, 0xFE, 0xDE, 0x1E, 0x5E, 0x3E, 0x7E, 0x1F, 0x1B, 0x13, 0x3F, 0x3B,
+    0x33, 0x5F, 0x5B, 0x53, 0x7F, 0x7B, 0x73, 0x97, 0xB7, 0xDF, 0xDB, 0xD3, 0xFF, 0xFB, 0xF3
+};
+
+/*
+################################
+||      Opcode Metadata       ||
+################################
+*/
+enum class Mnemonic : u8 {
+  ADC, ALR, ANC, AND, ANE, ARR, ASL, BCC, BCS, BEQ, BIT, BMI, BNE, BPL, BRK, BVC, BVS, CLC, CLD,
+  CLI, CLV, CMP, CPX, CPY, DCP, DEC, DEX, DEY, EOR, INC, INX, INY, ISC, JAM, JMP, JSR, LAS, LAX,
+  LDA, LDX, LDY, LSR, LXA, NOP, ORA, PHA, PHP, PLA, PLP, RLA, ROL, ROR, RRA, RTI, RTS, SAX, SBC,
+  SBX, SEC, SED, SEI, SHA, SHX, SHY, SLO, SRE, STA, STX, STY, TAS, TAX, TAY, TSX, TXA, TXS, TYA,
+  Count
+};
+
+constexpr std::array<std::string_view, static_cast<size_t>( Mnemonic::Count )> gMnemonicNames = {
+  "ADC", "ALR", "ANC", "AND", "ANE", "ARR", "ASL", "BCC", "BCS", "BEQ", "BIT", "BMI", "BNE", "BPL", "BRK", "BVC", "BVS", "CLC", "CLD",
+  "CLI", "CLV", "CMP", "CPX", "CPY", "DCP", "DEC", "DEX", "DEY", "EOR", "INC", "INX", "INY", "ISC", "JAM", "JMP", "JSR", "LAS", "LAX",
+  "LDA", "LDX", "LDY", "LSR", "LXA", "NOP", "ORA", "PHA", "PHP", "PLA", "PLP", "RLA", "ROL", "ROR", "RRA", "RTI", "RTS", "SAX", "SBC",
+  "SBX", "SEC", "SED", "SEI", "SHA", "SHX", "SHY", "SLO", "SRE", "STA", "STX", "STY", "TAS", "TAX", "TAY", "TSX", "TXA", "TXS", "TYA"
+};
+
+enum class AddrMode : u8 { IMP, IMM, ZPG, ZPGX, ZPGY, ABS, ABSX, ABSY, IND, INDX, INDY, REL, Count };
+
+constexpr std::array<std::string_view, static_cast<size_t>( AddrMode::Count )> gAddrModeNames = {
+  "IMP", "IMM", "ZPG", "ZPGX", "ZPGY", "ABS", "ABSX", "ABSY", "IND", "INDX", "INDY", "REL"
+};
 // clang-format on
 
+struct OpcodeInfo {
+  Mnemonic mnemonic = Mnemonic::JAM;
+  AddrMode addrMode = AddrMode::IMP;
+  u8       bytes = 1;
+  u8       cycles = 2;
+  bool     illegal = false;          // Listed with a "*" prefix in the trace logs
+  bool     pageCrossPenalty = true;  // Adds a cycle when ABSX, ABSY, or INDY cross a page
+  bool     writeModify = false;      // Does a dummy read before the write
+};
+
+/*
+ * @brief One entry per opcode, built at compile time from the tables above so the
+ * execute loop never has to touch the name strings.
+ */
+constexpr std::array<OpcodeInfo, 256> gOpcodeInfo = []() {
+  std::array<OpcodeInfo, 256> table{};
+  for ( size_t op = 0; op < 256; op++ ) {
+    OpcodeInfo      &info = table[op];
+    std::string_view name = gInstructionNames[op];
+    info.illegal = name.front() == '*';
+    if ( info.illegal ) {
+      name.remove_prefix( 1 );
+    }
+    for ( size_t i = 0; i < gMnemonicNames.size(); i++ ) {
+      if ( gMnemonicNames[i] == name ) {
+        info.mnemonic = static_cast<Mnemonic>( i );
+      }
+    }
+    for ( size_t i = 0; i < gAddrModeNames.size(); i++ ) {
+      if ( gAddrModeNames[i] == gAddressingModes[op] ) {
+        info.addrMode = static_cast<AddrMode>( i );
+      }
+    }
+    info.bytes = gInstructionBytes[op];
+    info.cycles = gInstructionCycles[op];
+  }
+  for ( u8 const op : gNoPageCrossPenaltyOpcodes ) {
+    table[op].pageCrossPenalty = false;
+  }
+  for ( u8 const op : gWriteModifyOpcodes ) {
+    table[op].writeModify = true;
+  }
+  return table;
+}();
+
+static_assert( gOpcodeInfo[0x6F].mnemonic == Mnemonic::RRA && gOpcodeInfo[0x6F].illegal );
+static_assert( gOpcodeInfo[0x0A].mnemonic == Mnemonic::ASL && gOpcodeInfo[0x0A].addrMode == AddrMode::IMP );
+static_assert( gOpcodeInfo[0xB1].addrMode == AddrMode::INDY && gOpcodeInfo[0x91].writeModify );
+
 inline bool isPageCrossPenalty( u8 opcode )
 {
-  return !noPageCrossPenaltyOpcodes.test( opcode );
+  return gOpcodeInfo[opcode].pageCrossPenalty;
 }
 
 inline bool isWriteModify( u8 opcode )
 {
-  return writeModifyOpcodes.test( opcode );
+  return gOpcodeInfo[opcode].writeModify;
 }
+
+/*
+ * @brief An instruction decoded once from PRG ROM and reused on every later visit.
+ * The opcode doubles as the handler id, it indexes the opcode table and the Execute<Op>() dispatch.
+ * A length of 0 means the record hasn't been decoded yet.
+ */
+struct DecodedInstruction {
+  u8                opcode = 0x00;
+  u8                length = 0;
+  std::array<u8, 2> operand{};
+};
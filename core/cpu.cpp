@@ -7,9 +7,10 @@
 #include "cpu.h"
 #include "cpu-types.h"
 #include "global-types.h"
-#include "utils.h"
+#include "profiler.h"
+#include "trace-writer.h"
+#include <algorithm>
 #include <string>
-#include <stdexcept>
 
 /*
 ################################################
@@ -26,125 +27,34 @@ std::string CPU::LogLineAtPC( bool verbose ) // NOLINT
    * Useful to understand what the current instruction is doing
    */
   std::string output;
+  AppendTraceLine( output, CaptureTraceRecord( pc ), verbose );
+  return output;
+}
 
-  u8 const           opcode = Read( pc );
-  std::string const &name = gInstructionNames.at( opcode );
-  std::string const &addrMode = gAddressingModes.at( opcode );
-
-  // Program counter address
-  // i.e. FFFF
-  output += utils::toHex( pc, 4 ) + " ";
-
-  if ( verbose ) {
-    output += "  ";
-    // Hex instruction
-    // i.e. 4C F5 C5, this is the hex instruction
-    u8 const    bytes = gInstructionBytes.at( opcode );
-    std::string hexInstruction;
-    for ( u8 i = 0; i < bytes; i++ ) {
-      hexInstruction += utils::toHex( Read( pc + i ), 2 ) + ' ';
-    }
-
-    // formatting, the instruction hex_instruction will be 9 characters long, with space padding to
-    // the right. This makes sure the hex line is the same length for all instructions
-    hexInstruction += std::string( 9 - ( bytes * 3 ), ' ' );
-    output += hexInstruction;
-  }
-
-  // If name starts with a "*", it is an illegal opcode
-  ( name[0] == '*' ) ? output += "*" + name.substr( 1 ) + " " : output += name + " ";
-
-  // Addressing mode and operand
-
-  std::string assemblyStr;
-  u8          value = 0x00;
-  u8          low = 0x00;
-  u8          high = 0x00;
-  if ( addrMode == "IMP" ) {
-    // Nothing to prefix
-  } else if ( addrMode == "IMM" ) {
-    value = Read( pc + 1 );
-    assemblyStr += "#$" + utils::toHex( value, 2 );
-  } else if ( addrMode == "ZPG" || addrMode == "ZPGX" || addrMode == "ZPGY" ) {
-    value = Read( pc + 1 );
-    assemblyStr += "$" + utils::toHex( value, 2 );
-
-    ( addrMode == "ZPGX" ) ? assemblyStr += ", X" : ( addrMode == "ZPGY" ) ? assemblyStr += ", Y" : assemblyStr += "";
-  } else if ( addrMode == "ABS" || addrMode == "ABSX" || addrMode == "ABSY" ) {
-    low = Read( pc + 1 );
-    high = Read( pc + 2 );
-    u16 const address = ( high << 8 ) | low;
-
-    assemblyStr += "$" + utils::toHex( address, 4 );
-    ( addrMode == "ABSX" ) ? assemblyStr += ", X" : ( addrMode == "ABSY" ) ? assemblyStr += ", Y" : assemblyStr += "";
-  } else if ( addrMode == "IND" ) {
-    low = Read( pc + 1 );
-    high = Read( pc + 2 );
-    u16 const address = ( high << 8 ) | low;
-    assemblyStr += "($" + utils::toHex( address, 4 ) + ")";
-  } else if ( addrMode == "INDX" || addrMode == "INDY" ) {
-    value = Read( pc + 1 );
-    ( addrMode == "INDX" ) ? assemblyStr += "($" + utils::toHex( value, 2 ) + ", X)"
-                           : assemblyStr += "($" + utils::toHex( value, 2 ) + "), Y";
-  } else if ( addrMode == "REL" ) {
-    value = Read( pc + 1 );
-    s8 const  offset = static_cast<s8>( value );
-    u16 const address = pc + 2 + offset;
-
-    assemblyStr += "$" + utils::toHex( value, 2 ) + " [$" + utils::toHex( address, 4 ) + "]";
-  } else {
-    // Houston.. yet again
-    throw std::runtime_error( "Unknown addressing mode: " + addrMode );
-  }
-
-  // Pad the assembly string with spaces, for fixed length
-  if ( verbose ) {
-    output += assemblyStr + std::string( 15 - assemblyStr.size(), ' ' );
-  }
-
-  // Add more log info
-  std::string registersStr;
-  // Format
-  // a: 00 x: 00 y: 00 s: FD
-  registersStr += "a: " + utils::toHex( a, 2 ) + " ";
-  registersStr += "x: " + utils::toHex( x, 2 ) + " ";
-  registersStr += "y: " + utils::toHex( y, 2 ) + " ";
-  registersStr += "s: " + utils::toHex( s, 2 ) + " ";
-
-  // status register
-  // Will return a formatted status string
-  // p: hex value, status string (NV-BDIZC). Letter present is flag set, dash is flag unset
-  std::string statusStr;
-  statusStr += "p: " + utils::toHex( p, 2 ) + " ";
-
-  std::string statusFlags = "NV-BDIZC";
-  std::string statusFlagsLower = "nv--dizc";
-  std::string statusFlagsStr;
-  for ( int i = 7; i >= 0; i-- ) {
-    statusFlagsStr += ( p & ( 1 << i ) ) != 0 ? statusFlags[7 - i] : statusFlagsLower[7 - i];
-  }
-  statusStr += statusFlagsStr;
-
-  // Combine to the output string
-  output += registersStr + statusStr;
-
-  // Scanline num (V)
-  if ( verbose ) {
-    std::string const scanlineStr = std::to_string( bus->ppu.scanline );
-    // std::string scanlinestradjusted = std::string( 4 - scanlinestr.size(), ' ' );
-    output += "  V: " + scanlineStr;
-
-    // PPU cycles (H), pad for 3 characters + space
-    u16 const   ppuCycles = bus->ppu.cycle;
-    std::string ppuCyclesStr = std::to_string( ppuCycles );
-    ppuCyclesStr += std::string( 4 - ppuCyclesStr.size(), ' ' );
-    output += "  H: " + ppuCyclesStr; // PPU cycle
-
-    // cycle count
-    output += "  Cycle: " + std::to_string( cycles );
+TraceRecord CPU::CaptureTraceRecord( u16 address ) const
+{
+  /*
+   * @brief Snapshot of the instruction at address and of the machine, for the trace logs
+   */
+  bus->ppu.CatchUp();
+  TraceRecord record{};
+  record.cycle = cycles;
+  record.pc = address;
+  record.scanline = bus->ppu.scanline;
+  record.dot = bus->ppu.cycle;
+  record.opcode = Read( address );
+
+  u8 const bytes = gOpcodeInfo[record.opcode].bytes;
+  for ( u8 i = 1; i < bytes; i++ ) {
+    record.operand[i - 1] = Read( address + i );
   }
 
-  return output;
+  record.a = a;
+  record.x = x;
+  record.y = y;
+  record.s = s;
+  record.p = GetStatusRegister();
+  return record;
 }
 
 /*
@@ -168,7 +78,15 @@ void CPU::Write( u16 address, u8 data ) const
 // Read with cycle spend
 auto CPU::ReadAndTick( u16 address ) -> u8
 {
+  // Immediate operands are read by the instruction itself, serve them from the predecoded record
+  if ( predecoded != nullptr && address == operandAddress ) {
+    Tick();
+    return predecoded->operand[0];
+  }
+
   if ( address == 0x2002 ) {
+    // Only the dots of this cycle may see the read, the owed ones ran before it
+    bus->ppu.CatchUp();
     SetReading2002( true );
   }
   Tick();
@@ -194,27 +112,93 @@ u8 CPU::Fetch()
 {
 
   // Read the current PC location and increment it
+  // Code in PRG ROM comes from the cartridge predecode cache, the cycle is spent either way
+  predecoded = bus->IsTestMode() ? nullptr : bus->cartridge.Predecode( pc );
+  if ( predecoded != nullptr ) {
+    pc++;
+    operandAddress = pc;
+    Tick();
+    return predecoded->opcode;
+  }
 
   u8 const opcode = ReadAndTick( pc++ );
   return opcode;
 }
 
+u8 CPU::FetchOperand()
+{
+  // Read the next operand byte of the current instruction and increment the program counter
+  if ( predecoded != nullptr ) {
+    u8 const operand = predecoded->operand[pc++ - operandAddress];
+    Tick();
+    return operand;
+  }
+  return ReadAndTick( pc++ );
+}
+
 void CPU::Tick()
 {
   // Increment the cycle count
   cycles++;
-  bus->ppu.Tick();
-  bus->ppu.Tick();
+  PPU &ppu = bus->ppu;
+  if ( ppu.IsCatchUpEnabled() && !IsMesenTracing() ) {
+    ppu.Owe( 3 );
+  } else {
+    // The Mesen trace samples the PPU in the middle of the cycle, so it needs the dots one by one
+    ppu.CatchUp();
+    ppu.Tick();
+    ppu.Tick();
+
+    // Match mesen trace log, place logger here.
+    if ( IsMesenTracing() && !didMesenTrace ) {
+      mesenFormatTraceLog.Push( CaptureTraceRecord( pc - 1 ) );
+      didMesenTrace = true;
+    }
 
-  // Match mesen trace log, place logger here.
-  if ( mesenFormatTraceEnabled && !didMesenTrace ) {
-    pc--;
-    AddMesenTracelog( LogLineAtPC( true ) );
-    pc++;
-    didMesenTrace = true;
+    ppu.Tick();
+  }
+
+  if ( bus->scheduler.IsDue( cycles * timing::masterTicksPerCpuCycle ) && bus->RunsEventsInline() ) {
+    bus->RunEvents();
+  }
+}
+
+void CPU::Stall( u64 count )
+{
+  PPU &ppu = bus->ppu;
+  if ( !ppu.IsCatchUpEnabled() || IsMesenTracing() ) {
+    for ( u64 i = 0; i < count; i++ ) {
+      Tick();
+    }
+    return;
+  }
+  if ( !bus->RunsEventsInline() ) {
+    // The events wait for the end of the step anyway
+    cycles += count;
+    ppu.Owe( static_cast<u32>( count * 3 ) );
+    return;
+  }
+
+  // Jump from event to event. An event due at tick T runs on the first cycle whose master clock reaches T
+  while ( count > 0 ) {
+    u64 const next = bus->scheduler.GetNextTimestamp();
+    u64 const dueCycle = ( next / timing::masterTicksPerCpuCycle ) +
+                         static_cast<u64>( next % timing::masterTicksPerCpuCycle != 0 );
+    u64 const step = std::min( count, dueCycle > cycles ? dueCycle - cycles : 1 );
+    cycles += step;
+    ppu.Owe( static_cast<u32>( step * 3 ) );
+    count -= step;
+    if ( bus->scheduler.IsDue( cycles * timing::masterTicksPerCpuCycle ) ) {
+      bus->RunEvents();
+    }
   }
+}
 
-  bus->ppu.Tick();
+void CPU::SetCycles( u64 value )
+{
+  // Scheduled events are timed on the cycle count, keep them as far ahead as they were
+  bus->scheduler.Rebase( cycles * timing::masterTicksPerCpuCycle, value * timing::masterTicksPerCpuCycle );
+  cycles = value;
 }
 
 void CPU::Reset()
@@ -223,7 +207,7 @@ void CPU::Reset()
   x = 0x00;
   y = 0x00;
   s = 0xFD;
-  p = 0x00 | Unused;
+  SetStatusRegister( 0x00 | Unused );
 
   // The program counter is usually read from the reset vector of a game, which is
   // located at 0xFFFC and 0xFFFD. If no cartridge, we'll assume 0x00 for both
@@ -251,39 +235,168 @@ void CPU::DecodeExecute()
    *
    */
 
-  if ( traceEnabled ) {
-    AddTraceLog( LogLineAtPC( true ) );
+  if ( IsTracingInstructions() ) {
+    TraceRecord const record = CaptureTraceRecord( pc );
+    if ( traceEnabled ) {
+      traceLog.Push( record );
+    }
+    if ( traceSink != nullptr ) {
+      traceSink->Push( record );
+    }
   }
 
   didMesenTrace = false;
 
   // Fetch the next opcode and increment the program counter
   opcode = Fetch();
-  auto const &instruction = opcodeTable.at( opcode );
-  auto        instructionHandler = instruction.handler;
-  auto        addressingModeHandler = instruction.addrMode;
+  NES_PROFILE_SCOPE( opcode );
+  instructions++;
+
+  // Everything else about the opcode comes from the constexpr metadata table. Handlers that need the
+  // mnemonic or addressing mode look it up through GetOpcodeInfo(), so nothing is copied here
+  OpcodeInfo const &info = gOpcodeInfo[opcode];
 
   // Set the page cross penalty for the current instruction
   // Used in addressing modes: ABSX, ABSY, INDY
-  pageCrossPenalty = isPageCrossPenalty( opcode );
+  pageCrossPenalty = info.pageCrossPenalty;
 
   // Write / modify instructions use a dummy read before writing, so
   // we should set a flag for those
-  writeModify = isWriteModify( opcode );
+  writeModify = info.writeModify;
 
-  // Set current instr mnemonic globally
-  instructionName = gInstructionNames.at( opcode );
-
-  // Set current address mode string globally
-  addrMode = gAddressingModes.at( opcode );
+#if NES_CPU_DISPATCH == NES_CPU_DISPATCH_TABLE
+  auto const &instruction = opcodeTable[opcode];
 
   // Calculate the address using the addressing mode
-  u16 const address = ( this->*addressingModeHandler )();
+  u16 const address = ( this->*instruction.addrMode )();
 
   // Execute the instruction fetched from the opcode table
-  ( this->*instructionHandler )( address );
+  ( this->*instruction.handler )( address );
+#else
+  // Addressing mode and instruction fused into one specialized body
+  ExecuteOpcode( opcode );
+#endif
 
   // Reset flags
   writeModify = false;
   didMesenTrace = false;
+  predecoded = nullptr;
+}
+
+/*
+################################################################
+||                                                            ||
+||                        Opcode Table                        ||
+||                                                            ||
+################################################################
+*/
+
+// clang-format off
+#define Imp( op )  CPU::Instruction { &CPU::op, &CPU::IMP }
+#define Imm( op )  CPU::Instruction { &CPU::op, &CPU::IMM }
+#define Zpg( op )  CPU::Instruction { &CPU::op, &CPU::ZPG }
+#define ZpgX( op ) CPU::Instruction { &CPU::op, &CPU::ZPGX }
+#define ZpgY( op ) CPU::Instruction { &CPU::op, &CPU::ZPGY }
+#define Abs( op )  CPU::Instruction { &CPU::op, &CPU::ABS }
+#define AbsX( op ) CPU::Instruction { &CPU::op, &CPU::ABSX }
+#define AbsY( op ) CPU::Instruction { &CPU::op, &CPU::ABSY }
+#define Ind( op )  CPU::Instruction { &CPU::op, &CPU::IND }
+#define IndX( op ) CPU::Instruction { &CPU::op, &CPU::INDX }
+#define IndY( op ) CPU::Instruction { &CPU::op, &CPU::INDY }
+#define Rel( op )  CPU::Instruction { &CPU::op, &CPU::REL }
+
+constexpr std::array<CPU::Instruction, 256> CPU::opcodeTable = {
+          //0        1          2          3          4           5          6          7          8         9          A         B          C           D          E          F
+    /*0*/ Imp(BRK),  IndX(ORA), Imp(JAM),  IndX(SLO), Zpg(NOP2),  Zpg(ORA),  Zpg(ASL),  Zpg(SLO),  Imp(PHP), Imm(ORA),  Imp(ASL), Imm(ANC),  Abs(NOP2),  Abs(ORA),  Abs(ASL),  Abs(SLO),
+    /*1*/ Rel(BPL),  IndY(ORA), Imp(JAM),  IndY(SLO), ZpgX(NOP2), ZpgX(ORA), ZpgX(ASL), ZpgX(SLO), Imp(CLC), AbsY(ORA), Imp(NOP), AbsY(SLO), AbsX(NOP2), AbsX(ORA), AbsX(ASL), AbsX(SLO),
+    /*2*/ Abs(JSR),  IndX(AND), Imp(JAM),  IndX(RLA), Zpg(BIT),   Zpg(AND),  Zpg(ROL),  Zpg(RLA),  Imp(PLP), Imm(AND),  Imp(ROL), Imm(ANC),  Abs(BIT),   Abs(AND),  Abs(ROL),  Abs(RLA),
+    /*3*/ Rel(BMI),  IndY(AND), Imp(JAM),  IndY(RLA), ZpgX(NOP2), ZpgX(AND), ZpgX(ROL), ZpgX(RLA), Imp(SEC), AbsY(AND), Imp(NOP), AbsY(RLA), AbsX(NOP2), AbsX(AND), AbsX(ROL), AbsX(RLA),
+    /*4*/ Imp(RTI),  IndX(EOR), Imp(JAM),  IndX(SRE), Zpg(NOP2),  Zpg(EOR),  Zpg(LSR),  Zpg(SRE),  Imp(PHA), Imm(EOR),  Imp(LSR), Imm(ALR),  Abs(JMP),   Abs(EOR),  Abs(LSR),  Abs(SRE),
+    /*5*/ Rel(BVC),  IndY(EOR), Imp(JAM),  IndY(SRE), ZpgX(NOP2), ZpgX(EOR), ZpgX(LSR), ZpgX(SRE), Imp(CLI), AbsY(EOR), Imp(NOP), AbsY(SRE), AbsX(NOP2), AbsX(EOR), AbsX(LSR), AbsX(SRE),
+    /*6*/ Imp(RTS),  IndX(ADC), Imp(JAM),  IndX(RRA), Zpg(NOP2),  Zpg(ADC),  Zpg(ROR),  Zpg(RRA),  Imp(PLA), Imm(ADC),  Imp(ROR), Imm(ARR),  Ind(JMP),   Abs(ADC),  Abs(ROR),  Abs(RRA),
+    /*7*/ Rel(BVS),  IndY(ADC), Imp(JAM),  IndY(RRA), ZpgX(NOP2), ZpgX(ADC), ZpgX(ROR), ZpgX(RRA), Imp(SEI), AbsY(ADC), Imp(NOP), AbsY(RRA), AbsX(NOP2), AbsX(ADC), AbsX(ROR), AbsX(RRA),
+    /*8*/ Imm(NOP2), IndX(STA), Imm(NOP2), IndX(SAX), Zpg(STY),   Zpg(STA),  Zpg(STX),  Zpg(SAX),  Imp(DEY), Imm(NOP2), Imp(TXA), Imm(ANE), Abs(STY),   Abs(STA),  Abs(STX),  Abs(SAX),
+    /*9*/ Rel(BCC),  IndY(STA), Imp(JAM),  IndY(XXX), ZpgX(STY),  ZpgX(STA), ZpgY(STX), ZpgY(SAX), Imp(TYA), AbsY(STA), Imp(TXS), AbsY(XXX), AbsX(XXX),  AbsX(STA), AbsY(XXX), AbsY(XXX),
+    /*A*/ Imm(LDY),  IndX(LDA), Imm(LDX),  IndX(LAX), Zpg(LDY),   Zpg(LDA),  Zpg(LDX),  Zpg(LAX),  Imp(TAY), Imm(LDA),  Imp(TAX), Imm(LXA),  Abs(LDY),   Abs(LDA),  Abs(LDX),  Abs(LAX),
+    /*B*/ Rel(BCS),  IndY(LDA), Imp(JAM),  IndY(LAX), ZpgX(LDY),  ZpgX(LDA), ZpgY(LDX), ZpgY(LAX), Imp(CLV), AbsY(LDA), Imp(TSX), AbsY(LAS), AbsX(LDY),  AbsX(LDA), AbsY(LDX), AbsY(LAX),
+    /*C*/ Imm(CPY),  IndX(CMP), Imm(NOP2), IndX(DCP), Zpg(CPY),   Zpg(CMP),  Zpg(DEC),  Zpg(DCP),  Imp(INY), Imm(CMP),  Imp(DEX), Imm(SBX),  Abs(CPY),   Abs(CMP),  Abs(DEC),  Abs(DCP),
+    /*D*/ Rel(BNE),  IndY(CMP), Imp(JAM),  IndY(DCP), ZpgX(NOP2), ZpgX(CMP), ZpgX(DEC), ZpgX(DCP), Imp(CLD), AbsY(CMP), Imp(NOP), AbsY(DCP), AbsX(NOP2), AbsX(CMP), AbsX(DEC), AbsX(DCP),
+    /*E*/ Imm(CPX),  IndX(SBC), Imm(NOP2), IndX(ISC), Zpg(CPX),   Zpg(SBC),  Zpg(INC),  Zpg(ISC),  Imp(INX), Imm(SBC),  Imp(NOP), Imm(SBC),  Abs(CPX),   Abs(SBC),  Abs(INC),  Abs(ISC),
+    /*F*/ Rel(BEQ),  IndY(SBC), Imp(JAM),  IndY(ISC), ZpgX(NOP2), ZpgX(SBC), ZpgX(INC), ZpgX(ISC), Imp(SED), AbsY(SBC), Imp(NOP), AbsY(ISC), AbsX(NOP2), AbsX(SBC), AbsX(INC), AbsX(ISC)
+};
+#undef Imp
+#undef Imm
+#undef Zpg
+#undef ZpgX
+#undef ZpgY
+#undef Abs
+#undef AbsX
+#undef AbsY
+#undef Ind
+#undef IndX
+#undef IndY
+#undef Rel
+// clang-format on
+
+/*
+################################################################
+||                                                            ||
+||                     Opcode Dispatch                        ||
+||                                                            ||
+################################################################
+*/
+
+template <u8 Op> void CPU::Execute()
+{
+  /*
+   * @brief Execute a single opcode with everything known at compile time
+   * The handler pair is a constant expression here, so the compiler can inline both the addressing
+   * mode and the operation into one body per opcode, instead of two indirect calls.
+   */
+  constexpr Instruction instruction = opcodeTable[Op];
+  u16 const             address = ( this->*instruction.addrMode )();
+  ( this->*instruction.handler )( address );
 }
+
+// X-macro helpers that expand to all 256 opcodes, one row of 16 at a time
+// clang-format off
+#define OPCODE_ROW( X, hi ) \
+  X( hi##0 ) X( hi##1 ) X( hi##2 ) X( hi##3 ) X( hi##4 ) X( hi##5 ) X( hi##6 ) X( hi##7 ) \
+  X( hi##8 ) X( hi##9 ) X( hi##A ) X( hi##B ) X( hi##C ) X( hi##D ) X( hi##E ) X( hi##F )
+#define ALL_OPCODES( X ) \
+  OPCODE_ROW( X, 0x0 ) OPCODE_ROW( X, 0x1 ) OPCODE_ROW( X, 0x2 ) OPCODE_ROW( X, 0x3 ) \
+  OPCODE_ROW( X, 0x4 ) OPCODE_ROW( X, 0x5 ) OPCODE_ROW( X, 0x6 ) OPCODE_ROW( X, 0x7 ) \
+  OPCODE_ROW( X, 0x8 ) OPCODE_ROW( X, 0x9 ) OPCODE_ROW( X, 0xA ) OPCODE_ROW( X, 0xB ) \
+  OPCODE_ROW( X, 0xC ) OPCODE_ROW( X, 0xD ) OPCODE_ROW( X, 0xE ) OPCODE_ROW( X, 0xF )
+// clang-format on
+
+void CPU::ExecuteOpcode( u8 op )
+{
+  /*
+   * @brief Jump straight to the specialized body for this opcode
+   */
+#if NES_CPU_DISPATCH == NES_CPU_DISPATCH_GOTO
+  // Labels as values are a GNU extension, the jump table is built by the compiler from the label addresses
+#define OPCODE_LABEL_ADDR( op ) &&op_##op,
+#define OPCODE_LABEL( op )                                                                                             \
+  op_##op : Execute<op>();                                                                                             \
+  return;
+  static void *const jumpTable[256] = { ALL_OPCODES( OPCODE_LABEL_ADDR ) };
+  goto *jumpTable[op];
+  ALL_OPCODES( OPCODE_LABEL )
+#undef OPCODE_LABEL_ADDR
+#undef OPCODE_LABEL
+#else
+#define OPCODE_CASE( op )                                                                                              \
+  case op:                                                                                                             \
+    Execute<op>();                                                                                                     \
+    return;
+  switch ( op ) {
+    ALL_OPCODES( OPCODE_CASE )
+  }
+#undef OPCODE_CASE
+#endif
+}
+
+#undef ALL_OPCODES
+#undef OPCODE_ROW
@@ -6,6 +6,10 @@
 #include <fmt/base.h>
 #include <string>
 #include "global-types.h"
+#include "checks.h"
+#include "cpu-types.h"
+#include "call-graph.h"
+#include "trace.h"
 // NOLINTBEGIN
 #include <cereal/archives/binary.hpp>
 #include <cereal/types/string.hpp>
@@ -14,58 +18,56 @@
 
 // Forward declaration for reads and writes
 class Bus;
+class TraceWriter;
+
+// Instruction dispatch engine, chosen at build time (see CPU_DISPATCH in CMakeLists.txt)
+#define NES_CPU_DISPATCH_TABLE 0  // Two indirect calls per instruction through opcodeTable
+#define NES_CPU_DISPATCH_SWITCH 1 // Dense switch over Execute<Op>() specializations
+#define NES_CPU_DISPATCH_GOTO 2   // Computed goto over Execute<Op>() specializations (GCC/Clang only)
+
+#ifndef NES_CPU_DISPATCH
+#define NES_CPU_DISPATCH NES_CPU_DISPATCH_SWITCH
+#endif
+
+#if NES_CPU_DISPATCH == NES_CPU_DISPATCH_GOTO && !defined( __GNUC__ )
+#undef NES_CPU_DISPATCH
+#define NES_CPU_DISPATCH NES_CPU_DISPATCH_SWITCH
+#endif
+
+// Lazy N/Z flags: keep the last result and only work out N and Z when the status register is read
+// (see CPU_LAZY_FLAGS in CMakeLists.txt)
+#ifndef NES_CPU_LAZY_FLAGS
+#define NES_CPU_LAZY_FLAGS 1
+#endif
 
 class CPU
 {
 public:
-  explicit CPU( Bus *bus ) : bus( bus )
-  {
-
-    // clang-format off
-#define Imp( op )  Instruction { &CPU::op, &CPU::IMP }
-#define Imm( op )  Instruction { &CPU::op, &CPU::IMM }
-#define Zpg( op )  Instruction { &CPU::op, &CPU::ZPG }
-#define ZpgX( op ) Instruction { &CPU::op, &CPU::ZPGX }
-#define ZpgY( op ) Instruction { &CPU::op, &CPU::ZPGY }
-#define Abs( op )  Instruction { &CPU::op, &CPU::ABS }
-#define AbsX( op ) Instruction { &CPU::op, &CPU::ABSX }
-#define AbsY( op ) Instruction { &CPU::op, &CPU::ABSY }
-#define Ind( op )  Instruction { &CPU::op, &CPU::IND }
-#define IndX( op ) Instruction { &CPU::op, &CPU::INDX }
-#define IndY( op ) Instruction { &CPU::op, &CPU::INDY }
-#define Rel( op )  Instruction { &CPU::op, &CPU::REL }
-
-        opcodeTable = {
-          //0        1          2          3          4           5          6          7          8         9          A         B          C           D          E          F
-    /*0*/ Imp(BRK),  IndX(ORA), Imp(JAM),  IndX(SLO), Zpg(NOP2),  Zpg(ORA),  Zpg(ASL),  Zpg(SLO),  Imp(PHP), Imm(ORA),  Imp(ASL), Imm(ANC),  Abs(NOP2),  Abs(ORA),  Abs(ASL),  Abs(SLO),
-    /*1*/ Rel(BPL),  IndY(ORA), Imp(JAM),  IndY(SLO), ZpgX(NOP2), ZpgX(ORA), ZpgX(ASL), ZpgX(SLO), Imp(CLC), AbsY(ORA), Imp(NOP), AbsY(SLO), AbsX(NOP2), AbsX(ORA), AbsX(ASL), AbsX(SLO),
-    /*2*/ Abs(JSR),  IndX(AND), Imp(JAM),  IndX(RLA), Zpg(BIT),   Zpg(AND),  Zpg(ROL),  Zpg(RLA),  Imp(PLP), Imm(AND),  Imp(ROL), Imm(ANC),  Abs(BIT),   Abs(AND),  Abs(ROL),  Abs(RLA),
-    /*3*/ Rel(BMI),  IndY(AND), Imp(JAM),  IndY(RLA), ZpgX(NOP2), ZpgX(AND), ZpgX(ROL), ZpgX(RLA), Imp(SEC), AbsY(AND), Imp(NOP), AbsY(RLA), AbsX(NOP2), AbsX(AND), AbsX(ROL), AbsX(RLA),
-    /*4*/ Imp(RTI),  IndX(EOR), Imp(JAM),  IndX(SRE), Zpg(NOP2),  Zpg(EOR),  Zpg(LSR),  Zpg(SRE),  Imp(PHA), Imm(EOR),  Imp(LSR), Imm(ALR),  Abs(JMP),   Abs(EOR),  Abs(LSR),  Abs(SRE),
-    /*5*/ Rel(BVC),  IndY(EOR), Imp(JAM),  IndY(SRE), ZpgX(NOP2), ZpgX(EOR), ZpgX(LSR), ZpgX(SRE), Imp(CLI), AbsY(EOR), Imp(NOP), AbsY(SRE), AbsX(NOP2), AbsX(EOR), AbsX(LSR), AbsX(SRE),
-    /*6*/ Imp(RTS),  IndX(ADC), Imp(JAM),  IndX(RRA), Zpg(NOP2),  Zpg(ADC),  Zpg(ROR),  Zpg(RRA),  Imp(PLA), Imm(ADC),  Imp(ROR), Imm(ARR),  Ind(JMP),   Abs(ADC),  Abs(ROR),  Abs(RRA),
-    /*7*/ Rel(BVS),  IndY(ADC), Imp(JAM),  IndY(RRA), ZpgX(NOP2), ZpgX(ADC), ZpgX(ROR), ZpgX(RRA), Imp(SEI), AbsY(ADC), Imp(NOP), AbsY(RRA), AbsX(NOP2), AbsX(ADC), AbsX(ROR), AbsX(RRA),
-    /*8*/ Imm(NOP2), IndX(STA), Imm(NOP2), IndX(SAX), Zpg(STY),   Zpg(STA),  Zpg(STX),  Zpg(SAX),  Imp(DEY), Imm(NOP2), Imp(TXA), Imm(ANE), Abs(STY),   Abs(STA),  Abs(STX),  Abs(SAX),
-    /*9*/ Rel(BCC),  IndY(STA), Imp(JAM),  IndY(XXX), ZpgX(STY),  ZpgX(STA), ZpgY(STX), ZpgY(SAX), Imp(TYA), AbsY(STA), Imp(TXS), AbsY(XXX), AbsX(XXX),  AbsX(STA), AbsY(XXX), AbsY(XXX),
-    /*A*/ Imm(LDY),  IndX(LDA), Imm(LDX),  IndX(LAX), Zpg(LDY),   Zpg(LDA),  Zpg(LDX),  Zpg(LAX),  Imp(TAY), Imm(LDA),  Imp(TAX), Imm(LXA),  Abs(LDY),   Abs(LDA),  Abs(LDX),  Abs(LAX),
-    /*B*/ Rel(BCS),  IndY(LDA), Imp(JAM),  IndY(LAX), ZpgX(LDY),  ZpgX(LDA), ZpgY(LDX), ZpgY(LAX), Imp(CLV), AbsY(LDA), Imp(TSX), AbsY(LAS), AbsX(LDY),  AbsX(LDA), AbsY(LDX), AbsY(LAX),
-    /*C*/ Imm(CPY),  IndX(CMP), Imm(NOP2), IndX(DCP), Zpg(CPY),   Zpg(CMP),  Zpg(DEC),  Zpg(DCP),  Imp(INY), Imm(CMP),  Imp(DEX), Imm(SBX),  Abs(CPY),   Abs(CMP),  Abs(DEC),  Abs(DCP),
-    /*D*/ Rel(BNE),  IndY(CMP), Imp(JAM),  IndY(DCP), ZpgX(NOP2), ZpgX(CMP), ZpgX(DEC), ZpgX(DCP), Imp(CLD), AbsY(CMP), Imp(NOP), AbsY(DCP), AbsX(NOP2), AbsX(CMP), AbsX(DEC), AbsX(DCP),
-    /*E*/ Imm(CPX),  IndX(SBC), Imm(NOP2), IndX(ISC), Zpg(CPX),   Zpg(SBC),  Zpg(INC),  Zpg(ISC),  Imp(INX), Imm(SBC),  Imp(NOP), Imm(SBC),  Abs(CPX),   Abs(SBC),  Abs(INC),  Abs(ISC),
-    /*F*/ Rel(BEQ),  IndY(SBC), Imp(JAM),  IndY(ISC), ZpgX(NOP2), ZpgX(SBC), ZpgX(INC), ZpgX(ISC), Imp(SED), AbsY(SBC), Imp(NOP), AbsY(ISC), AbsX(NOP2), AbsX(SBC), AbsX(INC), AbsX(ISC)
-        };
-    // clang-format on
-  }
+  explicit CPU( Bus *bus ) : bus( bus ) {}
 
   /*
   ################################
   ||          Serialize         ||
   ################################
   */
-  template <class Archive> void serialize( Archive &ar ) // NOLINT
+  template <class Archive> void save( Archive &ar ) const // NOLINT
+  {
+    // The mnemonic and addressing mode strings are derived from the opcode, but are still written
+    // so that the state file layout stays the same
+    std::string const instructionName( GetInstructionName() );
+    std::string const addrMode( GetAddrModeName() );
+    u8 const          status = GetStatusRegister();
+    ar( pc, a, x, y, s, status, cycles, didVblank, pageCrossPenalty, writeModify, reading2002, instructionName, addrMode,
+        opcode, isTestMode, traceEnabled, mesenFormatTraceEnabled, didMesenTrace, traceLog, mesenFormatTraceLog );
+  }
+  template <class Archive> void load( Archive &ar ) // NOLINT
   {
-    ar( pc, a, x, y, s, p, cycles, didVblank, pageCrossPenalty, writeModify, reading2002, instructionName, addrMode,
+    std::string instructionName;
+    std::string addrMode;
+    u8          status = 0;
+    ar( pc, a, x, y, s, status, cycles, didVblank, pageCrossPenalty, writeModify, reading2002, instructionName, addrMode,
         opcode, isTestMode, traceEnabled, mesenFormatTraceEnabled, didMesenTrace, traceLog, mesenFormatTraceLog );
+    SetStatusRegister( status );
   }
 
   /*
@@ -76,20 +78,33 @@ public:
   u8   GetAccumulator() const { return a; }
   u8   GetXRegister() const { return x; }
   u8   GetYRegister() const { return y; }
-  u8   GetStatusRegister() const { return p; }
+  u8   GetStatusRegister() const
+  {
+    if constexpr ( lazyFlags ) {
+      // N and Z are only materialized here, p holds every other flag
+      return p | ( IsZeroResult() ? Zero : 0 ) | ( IsNegativeResult() ? Negative : 0 );
+    }
+    return p;
+  }
   u16  GetProgramCounter() const { return pc; }
   u8   GetStackPointer() const { return s; }
   u64  GetCycles() const { return cycles; }
+  u64  GetInstructions() const { return instructions; }
   bool IsReading2002() const { return reading2002; }
 
+  // Metadata of the instruction currently executing
+  OpcodeInfo const &GetOpcodeInfo() const { return gOpcodeInfo[opcode]; }
+  std::string_view  GetInstructionName() const { return gInstructionNames[opcode]; }
+  std::string_view  GetAddrModeName() const { return gAddressingModes[opcode]; }
+
   // status getters
-  u8 GetCarryFlag() const { return ( p & Carry ) >> 0; }
-  u8 GetZeroFlag() const { return ( p & Zero ) >> 1; }
-  u8 GetInterruptDisableFlag() const { return ( p & InterruptDisable ) >> 2; }
-  u8 GetDecimalFlag() const { return ( p & Decimal ) >> 3; }
-  u8 GetBreakFlag() const { return ( p & Break ) >> 4; }
-  u8 GetOverflowFlag() const { return ( p & Overflow ) >> 6; }
-  u8 GetNegativeFlag() const { return ( p & Negative ) >> 7; }
+  u8 GetCarryFlag() const { return IsFlagSet( Carry ) ? 1 : 0; }
+  u8 GetZeroFlag() const { return IsFlagSet( Zero ) ? 1 : 0; }
+  u8 GetInterruptDisableFlag() const { return IsFlagSet( InterruptDisable ) ? 1 : 0; }
+  u8 GetDecimalFlag() const { return IsFlagSet( Decimal ) ? 1 : 0; }
+  u8 GetBreakFlag() const { return IsFlagSet( Break ) ? 1 : 0; }
+  u8 GetOverflowFlag() const { return IsFlagSet( Overflow ) ? 1 : 0; }
+  u8 GetNegativeFlag() const { return IsFlagSet( Negative ) ? 1 : 0; }
 
   /*
   ################################
@@ -99,10 +114,18 @@ public:
   void SetAccumulator( u8 value ) { a = value; }
   void SetXRegister( u8 value ) { x = value; }
   void SetYRegister( u8 value ) { y = value; }
-  void SetStatusRegister( u8 value ) { p = value; }
+  void SetStatusRegister( u8 value )
+  {
+    if constexpr ( lazyFlags ) {
+      p = value & ~( Zero | Negative );
+      SetZeroAndNegativeResult( ( value & Zero ) != 0, ( value & Negative ) != 0 );
+      return;
+    }
+    p = value;
+  }
   void SetProgramCounter( u16 value ) { pc = value; }
   void SetStackPointer( u8 value ) { s = value; }
-  void SetCycles( u64 value ) { cycles = value; }
+  void SetCycles( u64 value );
   void SetReading2002( bool value ) { reading2002 = value; };
 
   // status setters
@@ -121,8 +144,12 @@ public:
   */
   void Reset();
   u8   Fetch();
+  u8   FetchOperand();
   void DecodeExecute();
   void Tick();
+  // `count` cycles in which the CPU does nothing, e.g. an OAM DMA: the same as calling Tick() `count`
+  // times, with scheduled events still run on the cycle they fall in, but without a trip per cycle
+  void Stall( u64 count );
   auto Read( u16 address, bool debugMode = false ) const -> u8;
   auto ReadAndTick( u16 address ) -> u8;
   void Write( u16 address, u8 data ) const;
@@ -143,7 +170,7 @@ public:
     StackPush( pc & 0xFF );
 
     // 3) Push status register with B=0; bit 5 (Unused) = 1
-    u8 const pushedStatus = ( p & ~Break ) | Unused;
+    u8 const pushedStatus = ( GetStatusRegister() & ~Break ) | Unused;
     StackPush( pushedStatus );
 
     // 4) Fetch low byte of NMI vector ($FFFA)
@@ -157,6 +184,10 @@ public:
 
     // 7) Update PC
     pc = static_cast<u16>( high ) << 8 | low;
+
+    if ( callGraph != nullptr ) {
+      callGraph->OnCall( pc, static_cast<u8>( s + 3 ), CallGraphProfiler::CallKind::Nmi );
+    }
   }
 
   void IRQ()
@@ -164,19 +195,23 @@ public:
     /* @brief: IRQ, can be called when interrupt disable is turned off.
      * Uses 7 cycles
      */
-    if ( ( p & InterruptDisable ) != 0 ) {
+    if ( IsFlagSet( InterruptDisable ) ) {
       return;
     }
     Tick();
     Tick();
     StackPush( ( pc >> 8 ) & 0xFF );
     StackPush( pc & 0xFF );
-    u8 const pushedStatus = ( p & ~Break ) | Unused;
+    u8 const pushedStatus = ( GetStatusRegister() & ~Break ) | Unused;
     StackPush( pushedStatus );
     u8 const low = ReadAndTick( 0xFFFE );
     SetFlags( InterruptDisable );
     u8 const high = ReadAndTick( 0xFFFF );
     pc = static_cast<u16>( high ) << 8 | low;
+
+    if ( callGraph != nullptr ) {
+      callGraph->OnCall( pc, static_cast<u8>( s + 3 ), CallGraphProfiler::CallKind::Irq );
+    }
   }
 
   /*
@@ -184,9 +219,14 @@ public:
   ||        Debug Methods       ||
   ################################
   */
-  std::string             LogLineAtPC( bool verbose = true );
-  std::deque<std::string> GetTracelog() const { return traceLog; }
-  std::deque<std::string> GetMesenFormatTracelog() const { return mesenFormatTraceLog; }
+  std::string        LogLineAtPC( bool verbose = true );
+  TraceRecord        CaptureTraceRecord( u16 address ) const;
+  TraceBuffer const &GetTraceRecords() const { return traceLog; }
+  TraceBuffer const &GetMesenFormatTraceRecords() const { return mesenFormatTraceLog; }
+
+  // Formatted on request, one line per record
+  std::deque<std::string> GetTracelog() const { return traceLog.GetLines(); }
+  std::deque<std::string> GetMesenFormatTracelog() const { return mesenFormatTraceLog.GetLines(); }
   void                    EnableTracelog()
   {
     traceEnabled = true;
@@ -202,29 +242,23 @@ public:
   void EnableJsonTestMode() { isTestMode = true; }
   void DisableJsonTestMode() { isTestMode = false; }
 
-  size_t traceSize = 100;
-  size_t mesenTraceSize = 100;
-  void   SetMesenTraceSize( int size ) { mesenTraceSize = size; }
-  void   AddTraceLog( const std::string &log )
-  {
-    if ( traceEnabled ) {
-      traceLog.push_back( log + "\n" );
-      if ( traceLog.size() > traceSize ) {
-        traceLog.pop_front();
-      }
-    }
-  }
-  void ClearTraceLog() { traceLog.clear(); }
-  void AddMesenTracelog( const std::string &log )
-  {
-    if ( mesenFormatTraceEnabled ) {
-      mesenFormatTraceLog.push_back( log + "\n" );
-      if ( mesenFormatTraceLog.size() > mesenTraceSize ) {
-        mesenFormatTraceLog.pop_front();
-      }
-    }
-  }
-  void ClearMesenTraceLog() { mesenFormatTraceLog.clear(); }
+  // Resizing a trace clears it
+  size_t GetTraceSize() const { return traceLog.GetCapacity(); }
+  void   SetTraceSize( size_t size ) { traceLog.SetCapacity( size ); }
+  void   SetMesenTraceSize( size_t size ) { mesenFormatTraceLog.SetCapacity( size ); }
+  void   ClearTraceLog() { traceLog.Clear(); }
+  void   ClearMesenTraceLog() { mesenFormatTraceLog.Clear(); }
+
+  // Streams a record of every instruction to a trace file, alongside the in-memory traces. Not owned
+  void SetTraceSink( TraceWriter *sink ) { traceSink = sink; }
+
+  // The fast core compiles the trace hooks out (see checks.h): the traces can be enabled, but stay empty
+  bool IsTracing() const { return IsTracingInstructions() || IsMesenTracing(); }
+  bool IsTracingInstructions() const { return checks::enabled && ( traceEnabled || traceSink != nullptr ); }
+  bool IsMesenTracing() const { return checks::enabled && mesenFormatTraceEnabled; }
+
+  // Reports calls and returns to the guest call graph profiler, see Bus::callGraph. Not owned
+  void SetCallGraph( CallGraphProfiler *profiler ) { callGraph = profiler; }
 
   /*
   ################################
@@ -242,51 +276,55 @@ public:
     Negative = 1 << 7,         // 0b10000000
   };
 
-  /*
-  ################################
-  ||         Peripherals        ||
-  ################################
-  */
-  Bus *bus;
+  // With lazy flags, N and Z live in nzResult instead of in p. Either the last result (Z: low byte is zero,
+  // N: bit 7), or, after N and Z were set separately, bit 0 = !Z and bit 8 = N. See SetZeroAndNegativeResult
+  static constexpr bool lazyFlags = NES_CPU_LAZY_FLAGS != 0;
 
   /*
   ################################
-  ||          Registers         ||
+  ||          Hot State         ||
   ################################
   */
-  u16 pc = 0x0000;       // Program counter (PC)
+  // Everything an instruction touches, registers and hook pointers included, shares one cache line at the
+  // start of the CPU (checked in footprint_test). Widest members first, so it packs without padding
+  alignas( cacheLineSize ) Bus *bus;
+  u64 cycles = 0;       // Number of cycles
+  u64 instructions = 0; // Instructions executed, not saved with the state
+
+  // Instruction being executed, when it was served from the cartridge predecode cache. Not serialized, it only
+  // lives for the duration of one DecodeExecute call.
+  const DecodedInstruction *predecoded = nullptr;
+  TraceWriter              *traceSink = nullptr; // Not owned, see SetTraceSink()
+
+  u16 pc = 0x0000; // Program counter (PC)
+  u16 nzResult = 0x01;
+  u16 operandAddress = 0x0000;
   u8  a = 0x00;          // Accumulator register (A)
   u8  x = 0x00;          // X register
   u8  y = 0x00;          // Y register
   u8  s = 0xFD;          // Stack pointer (SP)
   u8  p = 0x00 | Unused; // Status register (P), per the specs, the unused flag should always be set
-  u64 cycles = 0;        // Number of cycles
+  u8  opcode = 0x00;
 
-  /*
-  ################################
-  ||  Private Global Variables  ||
-  ################################
-  */
-  bool        didVblank = false;
-  bool        pageCrossPenalty = true;
-  bool        writeModify = false;
-  bool        reading2002 = false;
-  std::string instructionName;
-  std::string addrMode;
-  u8          opcode = 0x00;
+  bool pageCrossPenalty = true;
+  bool writeModify = false;
+  bool reading2002 = false;
+  bool traceEnabled = false;
+  bool mesenFormatTraceEnabled = false;
 
   /*
   ################################
-  ||       Debug Variables      ||
+  ||         Cold State         ||
   ################################
   */
+  CallGraphProfiler *callGraph = nullptr; // Only looked at on calls and returns
+
+  bool didVblank = false;
   bool isTestMode = false;
-  bool traceEnabled = false;
-  bool mesenFormatTraceEnabled = false;
   bool didMesenTrace = false;
 
-  std::deque<std::string> traceLog;
-  std::deque<std::string> mesenFormatTraceLog;
+  TraceBuffer traceLog;
+  TraceBuffer mesenFormatTraceLog;
 
   /*
   ################################
@@ -298,9 +336,21 @@ public:
     u16 ( CPU::*addrMode )(){};      // Pointer to the address mode helper method
   };
 
-  // Opcode table
-  std::array<Instruction, 256> opcodeTable;
-  Instruction                  GetInstruction( u8 opcode ) { return opcodeTable[opcode]; }
+  // Opcode table, defined in cpu.cpp
+  static const std::array<Instruction, 256> opcodeTable;
+  Instruction                               GetInstruction( u8 opcode ) { return opcodeTable[opcode]; }
+
+  // Opcode-specialized handlers, with the addressing mode and operation fused (see cpu.cpp)
+  template <u8 Op> void Execute();
+  void                  ExecuteOpcode( u8 op );
+
+#if NES_CPU_DISPATCH == NES_CPU_DISPATCH_TABLE
+  static constexpr std::string_view dispatchName = "table";
+#elif NES_CPU_DISPATCH == NES_CPU_DISPATCH_SWITCH
+  static constexpr std::string_view dispatchName = "switch";
+#else
+  static constexpr std::string_view dispatchName = "goto";
+#endif
 
   /*
   ################################################################
@@ -344,6 +394,13 @@ public:
      * SetFlags( Status::Carry ); // Set one flag
      * SetFlags( Status::Carry | Status::Zero ); // Set multiple flags
      */
+    if constexpr ( lazyFlags ) {
+      if ( ( flag & ( Zero | Negative ) ) != 0 ) {
+        SetZeroAndNegativeResult( ( flag & Zero ) != 0 || IsZeroResult(), ( flag & Negative ) != 0 || IsNegativeResult() );
+      }
+      p |= flag & ~( Zero | Negative );
+      return;
+    }
     p |= flag;
   }
   void ClearFlags( const u8 flag )
@@ -359,6 +416,11 @@ public:
      * ClearFlags( Status::Carry ); // Clear one flag
      * ClearFlags( Status::Carry | Status::Zero ); // Clear multiple flags
      */
+    if constexpr ( lazyFlags ) {
+      if ( ( flag & ( Zero | Negative ) ) != 0 ) {
+        SetZeroAndNegativeResult( ( flag & Zero ) == 0 && IsZeroResult(), ( flag & Negative ) == 0 && IsNegativeResult() );
+      }
+    }
     p &= ~flag;
   }
   bool IsFlagSet( const u8 flag ) const
@@ -375,6 +437,18 @@ public:
      *   // Do something
      * }
      */
+    if constexpr ( lazyFlags ) {
+      // C, V, I and D are in p. Z and N are only worked out from nzResult when they're asked for
+      u8 const eager = flag & ~( Zero | Negative );
+      bool     isSet = ( p & eager ) == eager;
+      if ( ( flag & Zero ) != 0 ) {
+        isSet = isSet && IsZeroResult();
+      }
+      if ( ( flag & Negative ) != 0 ) {
+        isSet = isSet && IsNegativeResult();
+      }
+      return isSet;
+    }
     return ( p & flag ) == flag;
   }
 
@@ -383,6 +457,11 @@ public:
     /*
      * @brief Sets zero flag if value == 0, or negative flag if value is negative (bit 7 is set)
      */
+    if constexpr ( lazyFlags ) {
+      // Just remember the value, N and Z are worked out when something reads them
+      nzResult = value;
+      return;
+    }
 
     // Clear zero and negative flags
     ClearFlags( Status::Zero | Status::Negative );
@@ -398,6 +477,14 @@ public:
     }
   }
 
+  // Lazy N/Z state, see nzResult
+  bool IsZeroResult() const { return ( nzResult & 0x00FF ) == 0; }
+  bool IsNegativeResult() const { return ( nzResult & 0x0180 ) != 0; }
+  void SetZeroAndNegativeResult( bool zero, bool negative )
+  {
+    nzResult = static_cast<u16>( ( zero ? 0x000 : 0x001 ) | ( negative ? 0x100 : 0x000 ) );
+  }
+
   void BranchOnStatus( u16 offsetAddress, u8 flag, bool isSet )
   {
     /* @brief Branch if status flag is set or clear
@@ -409,7 +496,7 @@ public:
      * BranchOnStatus( Status::Zero, false ); // Branch if zero flag is clear
      */
 
-    bool const willBranch = ( p & flag ) == flag;
+    bool const willBranch = IsFlagSet( flag );
 
     // Path will branch
     if ( willBranch == isSet ) {
@@ -438,18 +525,14 @@ public:
      */
 
     u8 value = 0;
-    if ( instructionName == "*DCP" ) {
+    if ( GetOpcodeInfo().mnemonic == Mnemonic::DCP ) {
       value = Read( address ); // 0 cycles
     } else {
       value = ReadAndTick( address );
     }
 
-    // Set the zero flag if the values are equal
-    ( reg == value ) ? SetFlags( Status::Zero ) : ClearFlags( Status::Zero );
-
-    // Set negative flag if the result is negative,
-    // i.e. the sign bit is set
-    ( ( reg - value ) & 0b10000000 ) != 0 ? SetFlags( Status::Negative ) : ClearFlags( Status::Negative );
+    // Zero if the values are equal, negative if the sign bit of the difference is set
+    SetZeroAndNegativeFlags( static_cast<u8>( reg - value ) );
 
     // Set the carry flag if the reg >= value
     ( reg >= value ) ? SetFlags( Status::Carry ) : ClearFlags( Status::Carry );
@@ -510,7 +593,7 @@ public:
      * Returns the address from the zero page (0x0000 - 0x00FF).
      * The value of the next byte is the address in the zero page.
      */
-    return ReadAndTick( pc++ ) & 0x00FF;
+    return FetchOperand() & 0x00FF;
   }
 
   auto ZPGX() -> u16
@@ -520,7 +603,7 @@ public:
      * Returns the address from the zero page (0x0000 - 0x00FF) + X register
      * The value of the next byte is the address in the zero page.
      */
-    u8 const  zeroPageAddress = ReadAndTick( pc++ );
+    u8 const  zeroPageAddress = FetchOperand();
     u16 const finalAddress = ( zeroPageAddress + x ) & 0x00FF;
     Tick(); // Account for calculating the final address
     return finalAddress;
@@ -533,7 +616,7 @@ public:
      * Returns the address from the zero page (0x0000 - 0x00FF) + Y register
      * The value of the next byte is the address in the zero page.
      */
-    u8 const zeroPageAddress = ( ReadAndTick( pc++ ) + y ) & 0x00FF;
+    u8 const zeroPageAddress = ( FetchOperand() + y ) & 0x00FF;
 
     if ( writeModify ) {
       Tick();
@@ -547,8 +630,8 @@ public:
      * @brief Absolute addressing mode
      * Constructs a 16-bit address from the next two bytes
      */
-    u16 const low = ReadAndTick( pc++ );
-    u16 const high = ReadAndTick( pc++ );
+    u16 const low = FetchOperand();
+    u16 const high = FetchOperand();
     return ( high << 8 ) | low;
   }
 
@@ -559,8 +642,8 @@ public:
      * Constructs a 16-bit address from the next two bytes and adds the X register to the final
      * address
      */
-    u16 const low = ReadAndTick( pc++ );
-    u16 const high = ReadAndTick( pc++ );
+    u16 const low = FetchOperand();
+    u16 const high = FetchOperand();
     u16 const address = ( high << 8 ) | low;
     u16 const finalAddress = address + x;
 
@@ -584,8 +667,8 @@ public:
      * Constructs a 16-bit address from the next two bytes and adds the Y register to the final
      * address
      */
-    u16 const low = ReadAndTick( pc++ );
-    u16 const high = ReadAndTick( pc++ );
+    u16 const low = FetchOperand();
+    u16 const high = FetchOperand();
     u16 const address = ( high << 8 ) | low;
     u16 const finalAddress = address + y;
 
@@ -612,8 +695,8 @@ public:
      * There's a hardware bug that prevents the address from crossing a page boundary
      */
 
-    u16 const ptrLow = ReadAndTick( pc++ );
-    u16 const ptrHigh = ReadAndTick( pc++ );
+    u16 const ptrLow = FetchOperand();
+    u16 const ptrHigh = FetchOperand();
     u16 const ptr = ( ptrHigh << 8 ) | ptrLow;
 
     u8 const addressLow = ReadAndTick( ptr );
@@ -640,7 +723,7 @@ public:
      * Final address is the value stored at the POINTER address
      */
     Tick();                                                              // Account for operand fetch
-    u8 const  zeroPageAddress = ( ReadAndTick( pc++ ) + x ) & 0x00FF;    // 1 cycle
+    u8 const  zeroPageAddress = ( FetchOperand() + x ) & 0x00FF;    // 1 cycle
     u16 const ptrLow = ReadAndTick( zeroPageAddress );                   // 1 cycle
     u16 const ptrHigh = ReadAndTick( ( zeroPageAddress + 1 ) & 0x00FF ); // 1 cycle
     return ( ptrHigh << 8 ) | ptrLow;
@@ -654,7 +737,7 @@ public:
      * The value stored at the zero-page address is the pointer address
      * The value in the Y register is added to the FINAL address
      */
-    u16 const zeroPageAddress = ReadAndTick( pc++ );
+    u16 const zeroPageAddress = FetchOperand();
     u16 const ptrLow = ReadAndTick( zeroPageAddress );
     u16 const ptrHigh = ReadAndTick( ( zeroPageAddress + 1 ) & 0x00FF );
 
@@ -680,7 +763,7 @@ public:
      * The next byte is a signed offset
      * Sets the program counter between -128 and +127 bytes from the current location
      */
-    s8 const  offset = static_cast<s8>( ReadAndTick( pc++ ) );
+    s8 const  offset = static_cast<s8>( FetchOperand() );
     u16 const address = pc + offset;
     return address;
   }
@@ -850,7 +933,7 @@ public:
      */
     u8 value = 0;
 
-    if ( instructionName == "*RRA" ) {
+    if ( GetOpcodeInfo().mnemonic == Mnemonic::RRA ) {
       value = Read( address ); // No cycle spend
     } else {
       value = ReadAndTick( address );
@@ -864,8 +947,8 @@ public:
     // this means that there will be an overflow
     ( sum > 0xFF ) ? SetFlags( Status::Carry ) : ClearFlags( Status::Carry );
 
-    // If the lower part of sum is zero, set the zero flag
-    ( ( sum & 0xFF ) == 0 ) ? SetFlags( Status::Zero ) : ClearFlags( Status::Zero );
+    // Zero and negative come from the lower byte of the sum
+    SetZeroAndNegativeFlags( static_cast<u8>( sum & 0xFF ) );
 
     // Signed overflow is set if the sign bit is different in the accumulator and the result
     // e.g.
@@ -880,9 +963,6 @@ public:
     ( accumulatorSignBit == valueSignBit && accumulatorSignBit != sumSignBit ) ? SetFlags( Status::Overflow )
                                                                                : ClearFlags( Status::Overflow );
 
-    // If bit 7 is set, set the negative flag
-    ( sum & 0b10000000 ) != 0 ? SetFlags( Status::Negative ) : ClearFlags( Status::Negative );
-
     // Store the lower byte of the sum in the accumulator
     a = sum & 0xFF;
   }
@@ -907,7 +987,7 @@ public:
      */
 
     u8 value = 0;
-    if ( instructionName == "*ISC" ) {
+    if ( GetOpcodeInfo().mnemonic == Mnemonic::ISC ) {
       value = Read( address ); // 0 cycles
     } else {
       value = ReadAndTick( address );
@@ -921,8 +1001,8 @@ public:
     // Carry flag exists in the high byte?
     ( diff < 0x100 ) ? SetFlags( Status::Carry ) : ClearFlags( Status::Carry );
 
-    // If the lower part of diff is zero, set the zero flag
-    ( ( diff & 0xFF ) == 0 ) ? SetFlags( Status::Zero ) : ClearFlags( Status::Zero );
+    // Zero and negative come from the lower byte of the diff
+    SetZeroAndNegativeFlags( static_cast<u8>( diff & 0xFF ) );
 
     // Signed overflow is set if the sign bit is different in the accumulator and the result
     // e.g.
@@ -936,9 +1016,6 @@ public:
     ( accumulatorSignBit != valueSignBit && accumulatorSignBit != diffSignBit ) ? SetFlags( Status::Overflow )
                                                                                 : ClearFlags( Status::Overflow );
 
-    // If bit 7 is set, set the negative flag
-    ( diff & 0b10000000 ) != 0 ? SetFlags( Status::Negative ) : ClearFlags( Status::Negative );
-
     // Store the lower byte of the diff in the accumulator
     a = diff & 0xFF;
   }
@@ -1370,7 +1447,7 @@ public:
      *   ASL Absolute X: 1E(7)
      */
 
-    if ( addrMode == "IMP" ) {
+    if ( GetOpcodeInfo().addrMode == AddrMode::IMP ) {
       u8 accumulator = GetAccumulator();
       // Set the carry flag if bit 7 is set
       ( accumulator & 0b10000000 ) != 0 ? SetFlags( Status::Carry ) : ClearFlags( Status::Carry );
@@ -1414,7 +1491,7 @@ public:
      *   LSR Absolute X: 5E(7)
      */
 
-    if ( addrMode == "IMP" ) {
+    if ( GetOpcodeInfo().addrMode == AddrMode::IMP ) {
       u8 accumulator = GetAccumulator();
       // Set the carry flag if bit 0 is set
       ( accumulator & 0b00000001 ) != 0 ? SetFlags( Status::Carry ) : ClearFlags( Status::Carry );
@@ -1458,7 +1535,7 @@ public:
      */
 
     const u8 carry = IsFlagSet( Status::Carry ) ? 1 : 0;
-    if ( addrMode == "IMP" ) {
+    if ( GetOpcodeInfo().addrMode == AddrMode::IMP ) {
       u8 accumulator = GetAccumulator();
 
       // Set the carry flag if bit 7 is set
@@ -1508,7 +1585,7 @@ public:
 
     const u8 carry = IsFlagSet( Status::Carry ) ? 1 : 0;
 
-    if ( addrMode == "IMP" ) { // implied mode
+    if ( GetOpcodeInfo().addrMode == AddrMode::IMP ) { // implied mode
       u8 accumulator = GetAccumulator();
 
       // Set the carry flag if bit 0 is set
@@ -1568,6 +1645,10 @@ public:
     StackPush( ( returnAddress >> 8 ) & 0xFF );
     StackPush( returnAddress & 0xFF );
     pc = address;
+
+    if ( callGraph != nullptr ) {
+      callGraph->OnCall( pc, static_cast<u8>( s + 2 ), CallGraphProfiler::CallKind::Subroutine );
+    }
   }
 
   void RTS( const u16 address )
@@ -1585,6 +1666,10 @@ public:
     Tick(); // Account for reading the new address
     pc++;
     Tick(); // Account for reading the next pc value
+
+    if ( callGraph != nullptr ) {
+      callGraph->OnReturn( s );
+    }
   }
 
   void RTI( const u16 address )
@@ -1599,12 +1684,16 @@ public:
     u8 const status = StackPop();
 
     // Ignore the break flag and ensure the unused flag (bit 5) is set
-    p = ( status & ~Break ) | Unused;
+    SetStatusRegister( ( status & ~Break ) | Unused );
 
     u16 const low = StackPop();
     u16 const high = StackPop();
     pc = ( high << 8 ) | low;
     Tick(); // Account for reading the new address
+
+    if ( callGraph != nullptr ) {
+      callGraph->OnReturn( s );
+    }
   }
 
   void BRK( const u16 address )
@@ -1627,7 +1716,7 @@ public:
     StackPush( pc & 0x00FF ); // 1 cycle
 
     // Push status with break and unused flag set (ignored when popped)
-    StackPush( p | Break | Unused );
+    StackPush( GetStatusRegister() | Break | Unused );
 
     // Set PC to the value at the interrupt vector (0xFFFE)
     u16 const low = ReadAndTick( 0xFFFE );
@@ -1636,6 +1725,10 @@ public:
 
     // Set the interrupt disable flag
     SetFlags( InterruptDisable );
+
+    if ( callGraph != nullptr ) {
+      callGraph->OnCall( pc, static_cast<u8>( s + 3 ), CallGraphProfiler::CallKind::Brk );
+    }
   }
 
   void AND( u16 address )
@@ -1711,13 +1804,17 @@ public:
      */
 
     u8 const value = ReadAndTick( address );
-    SetZeroAndNegativeFlags( a & value );
+
+    // Zero comes from A & value, but negative is bit 7 of value
+    if constexpr ( lazyFlags ) {
+      SetZeroAndNegativeResult( ( a & value ) == 0, ( value & 0b10000000 ) != 0 );
+    } else {
+      SetZeroAndNegativeFlags( a & value );
+      ( value & 0b10000000 ) != 0 ? SetFlags( Status::Negative ) : ClearFlags( Status::Negative );
+    }
 
     // Set overflow flag to bit 6 of value
     ( value & 0b01000000 ) != 0 ? SetFlags( Status::Overflow ) : ClearFlags( Status::Overflow );
-
-    // Set negative flag to bit 7 of value
-    ( value & 0b10000000 ) != 0 ? SetFlags( Status::Negative ) : ClearFlags( Status::Negative );
   }
 
   void TAX( const u16 address )
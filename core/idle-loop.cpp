@@ -0,0 +1,314 @@
+#include "idle-loop.h"
+#include "bus.h"
+#include "cpu-types.h"
+#include "global-types.h"
+
+/*
+################################
+||        Fast-forward        ||
+################################
+*/
+bool IdleLoopDetector::FastForward()
+{
+  /** @brief Replays the confirmed loop until the next NMI or the end of the frame
+   * Only the clock runs, and the CPU is left at the instruction boundary where the interpreter would have
+   * stopped, with that step's pc and registers: a loop like `LDA flag / AND #$80 / BEQ` holds other values
+   * in the middle of an iteration than at its start.
+   * With the PPU caught up in batches, only a scheduled event can raise the NMI or end the frame, so the
+   * whole iterations that end before the next one are stalled in one go. The iteration that reaches it is
+   * replayed step by step, checking after each one.
+   * A loop that polls $2002 is only stalled in whole iterations, and left to the interpreter short of the
+   * next event (see PollsAreSkippable()).
+   */
+  if ( !_enabled || !_confirmed ) {
+    return false;
+  }
+  CPU &cpu = bus->cpu;
+  if ( cpu.GetProgramCounter() != _loopStart || cpu.IsTracing() || bus->IsTestMode() ||
+       bus->breakpoints.IsArmed() ) {
+    return false;
+  }
+  if ( CaptureRegisters() != _startRegisters ) {
+    Reset();
+    return false;
+  }
+
+  UpdateFrameStats();
+  u64 const frame = bus->ppu.frame;
+  u64 const startCycles = cpu.GetCycles();
+
+  if ( _pollsPpuStatus ) {
+    u64 const iterations = PollsAreSkippable() && !bus->ppu.nmiReady ? IterationsBeforeNextEvent( 1 ) : 0;
+    if ( iterations == 0 ) {
+      return false;
+    }
+    cpu.Stall( iterations * _loopCycles );
+    _expectedPc = _loopStart;
+
+    u64 const skipped = cpu.GetCycles() - startCycles;
+    _stats.skippedCycles += skipped;
+    _stats.skippedCyclesThisFrame += skipped;
+    return true;
+  }
+
+  if ( bus->ppu.IsCatchUpEnabled() && !bus->ppu.nmiReady ) {
+    cpu.Stall( IterationsBeforeNextEvent( 0 ) * _loopCycles );
+  }
+
+  for ( ;; ) {
+    for ( u8 i = 0; i < _stepCount; i++ ) {
+      Step const &step = _steps[i];
+      cpu.Stall( step.cycles );
+
+      // Under the coroutine engine, due events wait for the step to end, so the replay stops for them
+      bool const eventDue = bus->scheduler.IsDue( bus->GetMasterClock() );
+      if ( bus->ppu.nmiReady || bus->ppu.frame != frame || eventDue ) {
+        cpu.SetProgramCounter( step.pc );
+        RestoreRegisters( step.registers );
+        _expectedPc = step.pc;
+
+        u64 const skipped = cpu.GetCycles() - startCycles;
+        _stats.skippedCycles += skipped;
+        _stats.skippedCyclesThisFrame += skipped;
+        UpdateFrameStats();
+        return true;
+      }
+    }
+  }
+}
+
+u64 IdleLoopDetector::IterationsBeforeNextEvent( u64 margin ) const
+{
+  /** @brief How many whole iterations from the loop start end more than `margin` cycles before the cycle
+   * the next event is due on
+   */
+  u64 const next = bus->scheduler.GetNextTimestamp();
+  if ( next == Scheduler::never ) {
+    return 0;
+  }
+  u64 const dueCycle = ( next + timing::masterTicksPerCpuCycle - 1 ) / timing::masterTicksPerCpuCycle;
+  u64 const now = bus->cpu.GetCycles();
+  return dueCycle > now + margin ? ( dueCycle - now - margin - 1 ) / _loopCycles : 0;
+}
+
+bool IdleLoopDetector::PollsAreSkippable() const
+{
+  /** @brief Whether the $2002 reads of the loop can be left out until the next event
+   * A read returns the vblank flag, sprite 0 hit, sprite overflow and stale data bus bits, then clears the
+   * vblank flag and the write latch. Once the flags are clear, only the vblank event sets the first one
+   * (the event catches the PPU up, so the flag is current), and with rendering off the sprite flags stay
+   * clear. Every read left out would then have returned the same value and changed nothing. The reads
+   * just before the event stay with the interpreter (one cycle of margin): a read on the dot before
+   * vblank suppresses the flag. Sprite 0 hit waits (`BIT $2002 / BVC`) need the PPU position, and are
+   * never skipped.
+   */
+  PPU const &ppu = bus->ppu;
+  return ppu.IsCatchUpEnabled() && !ppu.IsRenderingEnabled() && ( ppu.ppuStatus.value & 0xE0 ) == 0;
+}
+
+/*
+################################
+||          Detection         ||
+################################
+*/
+void IdleLoopDetector::Observe( u16 startPc, u64 startCycles )
+{
+  /** @brief Follows the interpreter one instruction at a time, looking for a loop to confirm
+   * A candidate starts whenever an instruction jumps a short distance backwards. Its iteration is
+   * recorded until the next jump back to the same address, and it's confirmed if the registers at both
+   * arrivals match. Anything with side effects, or an unexpected pc (interrupt),
+   * drops the candidate.
+   */
+  if ( !_enabled ) {
+    return;
+  }
+
+  CPU const &cpu = bus->cpu;
+  u16 const  pc = cpu.GetProgramCounter();
+  bool const followsLoop = ( _tracking || _confirmed ) && startPc == _expectedPc;
+  Access const access = ClassifyAccess( startPc, cpu.opcode );
+  if ( access == Access::SideEffects || ( ( _tracking || _confirmed ) && !followsLoop ) ) {
+    Reset();
+    return;
+  }
+  _expectedPc = pc;
+
+  // A confirmed loop just keeps running until it reaches its start again
+  if ( _confirmed ) {
+    return;
+  }
+
+  if ( _tracking ) {
+    if ( _stepCount == maxLoopSteps ) {
+      Reset();
+      return;
+    }
+    _steps[_stepCount++] = { pc, CaptureRegisters(), static_cast<u8>( cpu.GetCycles() - startCycles ) };
+    _pollsPpuStatus = _pollsPpuStatus || access == Access::PpuStatus;
+  }
+
+  bool const jumpedBack = pc <= startPc && startPc - pc < maxLoopBytes;
+  if ( !jumpedBack ) {
+    return;
+  }
+
+  Registers const registers = CaptureRegisters();
+  if ( _tracking && pc == _loopStart && registers == _startRegisters ) {
+    _confirmed = true;
+    _loopCycles = 0;
+    for ( u8 i = 0; i < _stepCount; i++ ) {
+      _loopCycles += _steps[i].cycles;
+    }
+    _stats.loopsDetected++;
+    return;
+  }
+
+  // New candidate, or the same one with registers that haven't settled yet
+  _tracking = true;
+  _loopStart = pc;
+  _expectedPc = pc;
+  _startRegisters = registers;
+  _stepCount = 0;
+  _pollsPpuStatus = false;
+}
+
+void IdleLoopDetector::Reset()
+{
+  _tracking = false;
+  _confirmed = false;
+  _stepCount = 0;
+  _pollsPpuStatus = false;
+}
+
+void IdleLoopDetector::SetEnabled( bool enabled )
+{
+  UpdateFrameStats();
+  _enabled = enabled;
+  Reset();
+}
+
+IdleLoopDetector::Access IdleLoopDetector::ClassifyAccess( u16 pc, u8 opcode ) const
+{
+  /** @brief Whether the instruction at pc only reads registers, flags and plain memory, or polls $2002
+   * `opcode` is the one that just executed at pc. Writes, stack operations and reads that can reach
+   * I/O ($2000-$5FFF) or an unknown address (indirect modes) all disqualify a loop, except for absolute
+   * reads of $2002. Register updates are allowed, a loop that changes its registers simply never confirms.
+   */
+  if ( pc >= 0x2000 && pc < 0x6000 ) {
+    return Access::SideEffects;
+  }
+
+  OpcodeInfo const &info = gOpcodeInfo[opcode];
+  switch ( info.mnemonic ) {
+    case Mnemonic::LDA:
+    case Mnemonic::LDX:
+    case Mnemonic::LDY:
+    case Mnemonic::LAX:
+    case Mnemonic::CMP:
+    case Mnemonic::CPX:
+    case Mnemonic::CPY:
+    case Mnemonic::BIT:
+    case Mnemonic::AND:
+    case Mnemonic::ORA:
+    case Mnemonic::EOR:
+    case Mnemonic::ADC:
+    case Mnemonic::SBC:
+    case Mnemonic::NOP:
+    case Mnemonic::TAX:
+    case Mnemonic::TAY:
+    case Mnemonic::TXA:
+    case Mnemonic::TYA:
+    case Mnemonic::INX:
+    case Mnemonic::INY:
+    case Mnemonic::DEX:
+    case Mnemonic::DEY:
+    case Mnemonic::CLC:
+    case Mnemonic::SEC:
+    case Mnemonic::CLV:
+    case Mnemonic::BCC:
+    case Mnemonic::BCS:
+    case Mnemonic::BEQ:
+    case Mnemonic::BMI:
+    case Mnemonic::BNE:
+    case Mnemonic::BPL:
+    case Mnemonic::BVC:
+    case Mnemonic::BVS:
+      break;
+    case Mnemonic::JMP:
+      return info.addrMode == AddrMode::ABS ? Access::Plain : Access::SideEffects;
+    default:
+      return Access::SideEffects;
+  }
+
+  switch ( info.addrMode ) {
+    case AddrMode::IMP:
+    case AddrMode::IMM:
+    case AddrMode::REL:
+    case AddrMode::ZPG:
+    case AddrMode::ZPGX:
+    case AddrMode::ZPGY:
+      return Access::Plain;
+    case AddrMode::ABS:
+    case AddrMode::ABSX:
+    case AddrMode::ABSY:
+      break;
+    default:
+      return Access::SideEffects;
+  }
+
+  // The operand, read once: from the predecode cache in PRG ROM, otherwise through the page table
+  u32 base = 0;
+  if ( const DecodedInstruction *record = bus->cartridge.Predecode( pc ) ) {
+    base = record->operand[0] | ( record->operand[1] << 8 );
+  } else {
+    const u8 *lo = bus->GetReadPointer( pc + 1 );
+    const u8 *hi = bus->GetReadPointer( pc + 2 );
+    if ( lo == nullptr || hi == nullptr ) {
+      return Access::SideEffects;
+    }
+    base = *lo | ( *hi << 8 );
+  }
+  u32 const first = info.addrMode == AddrMode::ABS ? base : base & 0xFF00;
+  u32 const last = info.addrMode == AddrMode::ABS ? base : base + 0xFF;
+  if ( last < 0x2000 || ( first >= 0x6000 && last <= 0xFFFF ) ) {
+    return Access::Plain;
+  }
+  return info.addrMode == AddrMode::ABS && base == 0x2002 ? Access::PpuStatus : Access::SideEffects;
+}
+
+IdleLoopDetector::Registers IdleLoopDetector::CaptureRegisters() const
+{
+  CPU const &cpu = bus->cpu;
+  return { cpu.GetAccumulator(), cpu.GetXRegister(), cpu.GetYRegister(), cpu.GetStackPointer(),
+           cpu.GetStatusRegister() };
+}
+
+void IdleLoopDetector::RestoreRegisters( const Registers &registers )
+{
+  CPU &cpu = bus->cpu;
+  cpu.SetAccumulator( registers.a );
+  cpu.SetXRegister( registers.x );
+  cpu.SetYRegister( registers.y );
+  cpu.SetStackPointer( registers.s );
+  cpu.SetStatusRegister( registers.p );
+}
+
+void IdleLoopDetector::UpdateFrameStats()
+{
+  /** @brief Moves the count to the last frame once the frame changed
+   * Only called on a fast-forward, a toggle and a stats read, so whole frames can go by in between: the
+   * last one then skipped nothing.
+   */
+  if ( bus->ppu.frame == _frame ) {
+    return;
+  }
+  _stats.skippedCyclesLastFrame = bus->ppu.frame == _frame + 1 ? _stats.skippedCyclesThisFrame : 0;
+  _stats.skippedCyclesThisFrame = 0;
+  _frame = bus->ppu.frame;
+}
+
+IdleLoopDetector::Stats const &IdleLoopDetector::GetStats()
+{
+  UpdateFrameStats();
+  return _stats;
+}
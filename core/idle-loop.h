@@ -0,0 +1,114 @@
+#pragma once
+
+#include "global-types.h"
+#include <array>
+
+class Bus;
+
+/*
+################################################################
+||                                                            ||
+||                     Idle Loop Detector                     ||
+||                                                            ||
+################################################################
+*/
+
+/*
+ * @brief Recognizes spin loops and fast-forwards through them
+ *
+ * Games wait for the NMI handler in short loops that only read memory: `JMP *`, or polling a RAM flag
+ * with `LDA flag / BEQ loop`. While such a loop spins, nothing the CPU does can change, so instead of
+ * fetching and executing its instructions we only tick the clock for the cycles they take.
+ *
+ * A loop is confirmed once two consecutive iterations start with the same registers, take the same
+ * path and only use side-effect-free instructions (loads, compares and branches on RAM or ROM). After
+ * that, each step of the recorded iteration is replayed as a CPU::Stall() of the cycles it took plus the
+ * pc and registers it ends with, and the whole iterations before the next scheduled event are stalled at
+ * once. The replay stops at the first instruction boundary where an NMI is pending or the frame changed,
+ * which is exactly where the interpreter would have returned to the bus, so the result is cycle-identical.
+ *
+ * Loops that poll the vblank flag (`BIT $2002 / BPL loop`) are skipped up to just before the next event
+ * while rendering is off: then the reads left out would all have returned the same value. Other PPU
+ * registers, and $2002 with rendering on, are left to the interpreter.
+ */
+class IdleLoopDetector
+{
+public:
+  explicit IdleLoopDetector( Bus *bus ) : bus( bus ) {}
+
+  struct Stats {
+    u64 loopsDetected = 0;
+    u64 skippedCycles = 0;         // Total, since the last ResetStats()
+    u64 skippedCyclesThisFrame = 0;
+    u64 skippedCyclesLastFrame = 0;
+  };
+
+  /*
+  ################################
+  ||    Idle Loop Methods       ||
+  ################################
+  */
+
+  // Replays the confirmed loop at pc. Returns false when the caller should execute normally
+  bool FastForward();
+
+  // Called after an instruction ran through the interpreter, with the pc and cycle count it started at.
+  // The bus only calls it while skipping is enabled
+  void Observe( u16 startPc, u64 startCycles );
+  void Reset();
+
+  void         SetEnabled( bool enabled );
+  bool         IsEnabled() const { return _enabled; }
+  Stats const &GetStats();
+  void         ResetStats() { _stats = Stats{}; }
+
+  static constexpr u8 maxLoopSteps = 8;
+  static constexpr u8 maxLoopBytes = 32;
+
+private:
+  Bus *bus;
+
+  struct Registers {
+    u8 a;
+    u8 x;
+    u8 y;
+    u8 s;
+    u8 p;
+
+    bool operator==( const Registers & ) const = default;
+  };
+
+  struct Step {
+    u16       pc;        // pc after the instruction
+    Registers registers; // Registers after the instruction
+    u8        cycles;    // Cycles the instruction took
+  };
+
+  enum class Access : u8 {
+    SideEffects, // Writes, stack operations, I/O and unknown addresses
+    Plain,       // Registers, flags, RAM and ROM
+    PpuStatus,   // An absolute read of $2002
+  };
+
+  Access    ClassifyAccess( u16 pc, u8 opcode ) const;
+  Registers CaptureRegisters() const;
+  void      RestoreRegisters( const Registers &registers );
+  u64       IterationsBeforeNextEvent( u64 margin ) const;
+  bool      PollsAreSkippable() const;
+  void      UpdateFrameStats();
+
+  bool  _enabled = true;
+  Stats _stats;
+  u64   _frame = 0;
+
+  // Candidate loop, recorded from one arrival at loopStart to the next
+  u16                               _loopStart = 0;
+  u16                               _expectedPc = 0; // Where the next observed instruction must start
+  bool                              _tracking = false;
+  bool                              _confirmed = false;
+  Registers                         _startRegisters{};
+  std::array<Step, maxLoopSteps>    _steps{};
+  u8                                _stepCount = 0;
+  u32                               _loopCycles = 0; // Cycles of one iteration, once confirmed
+  bool                              _pollsPpuStatus = false;
+};
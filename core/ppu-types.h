@@ -1,5 +1,6 @@
 #pragma once
 #include <array>
+#include <cstddef>
 #include "global-types.h"
 
 union PPUCTRL {
@@ -91,3 +92,35 @@ union SecondaryOAM {
 
   template <class Archive> void serialize( Archive &ar ) { ar( data ); } // NOLINT
 };
+
+// OAM split by field, byte n of every entry in fields[n], so sprite evaluation can look at 16 Ys at once. The
+// PPU keeps it in step with OAM
+struct OamShadow {
+  static constexpr size_t fieldY = 0;
+  static constexpr size_t fieldTile = 1;
+  static constexpr size_t fieldAttribute = 2;
+  static constexpr size_t fieldX = 3;
+
+  alignas( 16 ) std::array<std::array<u8, 64>, 4> fields{};
+
+  void Write( u8 address, u8 value ) { fields[address & 0x03][address >> 2] = value; }
+  void Load( const OAM &oam )
+  {
+    for ( u16 address = 0; address < oam.data.size(); address++ ) {
+      Write( static_cast<u8>( address ), oam.data[address] );
+    }
+  }
+  SpriteEntry Entry( size_t index ) const
+  {
+    SpriteEntry entry{ fields[fieldY][index], fields[fieldTile][index], {}, fields[fieldX][index] };
+    entry.attribute.value = fields[fieldAttribute][index];
+    return entry;
+  }
+};
+
+// A row of a pattern table tile, decoded from its two bit planes: the 2-bit pixel indices from left to right,
+// and from right to left for horizontally flipped sprites
+struct ChrRow {
+  std::array<u8, 8> pixels{};
+  std::array<u8, 8> flipped{};
+};
@@ -1,12 +1,20 @@
 #include "ppu.h"
 #include "bus.h"
 #include "cartridge.h" // NOLINT
+#include "compositor.h"
 #include "global-types.h"
 #include "mappers/mapper-base.h"
+#include "profiler.h"
+#include "scheduler.h"
+#include <algorithm>
 #include <exception>
 #include <array>
 #include <iostream>
 
+#if defined( __SSE2__ ) || defined( _M_X64 )
+#include <emmintrin.h>
+#endif
+
 PPU::PPU( Bus *bus ) : bus( bus )
 {
   try {
@@ -18,6 +26,8 @@ PPU::PPU( Bus *bus ) : bus( bus )
     failedPaletteRead = true;
     LoadDefaultSystemPalette();
   }
+  // Until a cartridge sets its own, what Cartridge::GetMirrorMode() gives without a mapper
+  SetMirroring( MirrorMode::Vertical );
 }
 
 /*
@@ -72,7 +82,7 @@ u8 PPU::CpuRead( u16 address, bool debugMode )
        If called while renderingEnabled and in visible scanline range (0-239),
        Returns corrupted data (0xFF)
     */
-    u8 value = oam.data.at( oamAddr & 0xFF );
+    u8 value = checks::At( oam.data, oamAddr );
     if ( debugMode ) {
       return value;
     }
@@ -103,6 +113,9 @@ u8 PPU::CpuRead( u16 address, bool debugMode )
 
     u8 data = vramBuffer;
     vramBuffer = ReadVram( vramAddr.value );
+    if ( bus->breakpoints.IsArmed() ) {
+      bus->breakpoints.OnPpuRead( vramAddr.value, vramBuffer );
+    }
     if ( vramAddr.value >= 0x3F00 && vramAddr.value <= 0x3FFF ) {
       data = vramBuffer;
     }
@@ -175,7 +188,7 @@ void PPU::CpuWrite( u16 address, u8 data )
       if ( IsRenderingEnabled() && scanline >= 0 && scanline <= 239 ) {
         return;
       }
-      oam.data.at( oamAddr & 0xFF ) = data;
+      WriteOam( oamAddr, data );
       oamAddr = ( oamAddr + 1 ) & 0xFF;
       break;
     }
@@ -246,6 +259,9 @@ void PPU::CpuWrite( u16 address, u8 data )
         1 if ppuCtrl increment mode is 0, 32 if 1
       */
       //
+      if ( bus->breakpoints.IsArmed() ) {
+        bus->breakpoints.OnPpuWrite( vramAddr.value, data );
+      }
       WriteVram( vramAddr.value, data );
       vramAddr.value += ppuCtrl.bit.vramIncrement ? 32 : 1;
     }
@@ -261,12 +277,6 @@ void PPU::CpuWrite( u16 address, u8 data )
 ################################
 */
 
-//------------------------------------------------------------------------------
-// In your PPU class you still keep:
-//   std::array<std::array<u8,0x400>,4> nameTables;
-// but we will only ever use [0] and [1] in 2-table modes.
-//------------------------------------------------------------------------------
-
 u8 PPU::ReadVram( u16 address )
 {
   // Mask to 14-bit range
@@ -279,31 +289,7 @@ u8 PPU::ReadVram( u16 address )
 
   // Nametables (0x2000–0x2FFF)
   if ( address >= 0x2000 && address <= 0x2FFF ) {
-    // Mirror down into 0x000–0xFFF
-    u16 const v = address & 0x0FFF;
-    u8        table = 0;
-    auto      m = GetMirrorMode();
-
-    switch ( m ) {
-      case MirrorMode::Vertical:
-        //  0x000–0x3FF → NT0 0x400–0x7FF → NT1
-        //  0x800–0xBFF → NT0 0xC00–0xFFF → NT1
-        table = ( ( v >= 0x0000 && v <= 0x3FF ) || ( v >= 0x800 && v <= 0xBFF ) ) ? 0 : 1;
-        break;
-      case MirrorMode::Horizontal:
-        //  0x000–0x3FF → NT0 0x400–0x7FF → NT0
-        //  0x800–0xBFF → NT1 0xC00–0xFFF → NT1
-        table = ( v < 0x800 ) ? 0 : 1;
-        break;
-      case MirrorMode::SingleLower: table = 0; break;
-      case MirrorMode::SingleUpper: table = 1; break;
-      case MirrorMode::FourScreen:
-        // 0x000–0x3FF → NT0 0x400–0x7FF → NT1
-        // 0x800–0xBFF → NT2 0xC00–0xFFF → NT3
-        table = ( v / 0x400 ) & 0x03;
-        break;
-    }
-    return nameTables.at( table ).at( v & 0x03FF );
+    return Nametable( address );
   }
 
   // palettes
@@ -321,6 +307,11 @@ u8 PPU::ReadVram( u16 address )
   return 0xFF;
 }
 
+const ChrRow &PPU::PatternRow( u16 address ) const
+{
+  return bus->cartridge.GetChrRow( address & 0x1FFF );
+}
+
 void PPU::WriteVram( u16 address, u8 data )
 {
   address &= 0x3FFF;
@@ -333,20 +324,7 @@ void PPU::WriteVram( u16 address, u8 data )
 
   // Nametables
   if ( address >= 0x2000 && address <= 0x2FFF ) {
-    u16 const v = address & 0x0FFF;
-    u8        table = 0;
-    auto      m = GetMirrorMode();
-
-    switch ( m ) {
-      case MirrorMode::Vertical:
-        table = ( ( v >= 0x0000 && v <= 0x3FF ) || ( v >= 0x800 && v <= 0xBFF ) ) ? 0 : 1;
-        break;
-      case MirrorMode::Horizontal : table = ( v < 0x800 ) ? 0 : 1; break;
-      case MirrorMode::SingleLower: table = 0; break;
-      case MirrorMode::SingleUpper: table = 1; break;
-      case MirrorMode::FourScreen : table = ( v / 0x400 ) & 0x03; break;
-    }
-    nameTables.at( table ).at( v & 0x03FF ) = data;
+    Nametable( address ) = data;
     return;
   }
 
@@ -390,6 +368,7 @@ void PPU::VBlank()
         // Signal to trigger NMI if enabled
         if ( ppuCtrl.bit.nmiEnable ) {
           nmiReady = true;
+          bus->EndBatch();
         }
       }
       preventVBlank = false;
@@ -397,9 +376,55 @@ void PPU::VBlank()
   }
 }
 
-MirrorMode PPU::GetMirrorMode() const
+void PPU::SetMirroring( MirrorMode mode )
+{
+  /** @brief Points the four nametable pages of $2000-$2FFF at the nametables the mirroring maps them to
+   * The PPU has 2 KiB of its own for two nametables; four screen cartridges bring the other two.
+   */
+  std::array<u8, 4> tables{};
+  switch ( mode ) {
+    case MirrorMode::Vertical   : tables = { 0, 1, 0, 1 }; break;
+    case MirrorMode::Horizontal : tables = { 0, 0, 1, 1 }; break;
+    case MirrorMode::SingleLower: tables = { 0, 0, 0, 0 }; break;
+    case MirrorMode::SingleUpper: tables = { 1, 1, 1, 1 }; break;
+    case MirrorMode::FourScreen : tables = { 0, 1, 2, 3 }; break;
+  }
+  for ( size_t page = 0; page < _nametablePages.size(); page++ ) {
+    _nametablePages[page] = checks::At( nameTables, tables[page] ).data();
+  }
+  _mirroring = mode;
+}
+
+u64 PPU::SpritesOnLine( int line, int height ) const
 {
-  return bus->cartridge.GetMirrorMode();
+  /** @brief The range check of sprite evaluation, on the Y column of the OAM shadow
+   * An entry covers the line when line - height < y <= line. Clamped to 0-255, that's one unsigned compare per
+   * byte: y - first <= last - first, with the subtraction wrapping. 16 entries at a time with SSE2
+   */
+  int const first = std::max( line - height + 1, 0 );
+  int const last = std::min( line, 255 );
+  if ( first > last ) {
+    return 0;
+  }
+  auto const &ys = _oamShadow.fields[OamShadow::fieldY];
+
+  u64 onLine = 0;
+#if defined( __SSE2__ ) || defined( _M_X64 )
+  __m128i const from = _mm_set1_epi8( static_cast<char>( first ) );
+  __m128i const span = _mm_set1_epi8( static_cast<char>( last - first ) );
+  for ( size_t i = 0; i < ys.size(); i += 16 ) {
+    __m128i const offset = _mm_sub_epi8( _mm_load_si128( reinterpret_cast<const __m128i *>( ys.data() + i ) ), from );
+    __m128i const inRange = _mm_cmpeq_epi8( _mm_min_epu8( offset, span ), offset );
+    onLine |= static_cast<u64>( static_cast<u16>( _mm_movemask_epi8( inRange ) ) ) << i;
+  }
+#else
+  for ( size_t i = 0; i < ys.size(); i++ ) {
+    if ( static_cast<u8>( ys[i] - first ) <= last - first ) {
+      onLine |= u64{ 1 } << i;
+    }
+  }
+#endif
+  return onLine;
 }
 
 /*
@@ -414,6 +439,7 @@ void PPU::Tick()
   if ( isDisabled ) {
     return;
   }
+  NES_PROFILE_SCOPE( profiler::PpuTick );
   OddFrameSkip();
 
   if ( InScanline( 0, 239 ) )
@@ -437,6 +463,291 @@ void PPU::Tick()
     if ( scanline > 261 ) {
       scanline = 0;
       frame++;
+      bus->EndBatch();
+    }
+  }
+}
+
+/*
+################################
+||                            ||
+||          Catch-Up          ||
+||                            ||
+################################
+*/
+void PPU::RunOwedDots()
+{
+  u32 dots = _debt;
+  _debt = 0;
+  while ( dots > 0 ) {
+    // Lines start at dot 0, the only place the scanline renderer can take over. Otherwise whole tile groups
+    // can still go 8 dots at a time
+    if ( cycle == 0 ) {
+      u32 const lineDots = ScanlineDots();
+      if ( lineDots > 0 && dots >= lineDots ) {
+        RenderScanline();
+        dots -= lineDots;
+        continue;
+      }
+    } else if ( dots >= tileDots && TileDots() > 0 ) {
+      RenderTile();
+      dots -= tileDots;
+      continue;
+    }
+    Tick();
+    dots--;
+  }
+  ScheduleEvents();
+}
+
+void PPU::ScheduleEvents()
+{
+  constexpr u32 vblankDot = ( 241 * dotsPerScanline ) + 1;
+  constexpr u32 lastDot = dotsPerFrame - 1;
+
+  u64 const now = bus->GetMasterClock();
+  bus->scheduler.Schedule( EventType::Nmi, now + ( DotsUntil( vblankDot ) * timing::masterTicksPerDot ) );
+  bus->scheduler.Schedule( EventType::FrameEnd, now + ( DotsUntil( lastDot ) * timing::masterTicksPerDot ) );
+}
+
+u32 PPU::DotsUntil( u32 dot ) const
+{
+  /** @brief Dots to run before `dot` (scanline * 341 + cycle) has run
+   * Counted one short, as the odd frame skip may drop a dot on the way. Catching up a dot early only
+   * costs an extra catch-up.
+   */
+  // Positions set from outside (tests, the python bindings) can be off the frame. Run dot by dot then
+  if ( scanline > gPrerenderScanline || cycle >= dotsPerScanline ) {
+    return 1;
+  }
+  u32 const position = ( scanline * dotsPerScanline ) + cycle;
+  u32 const distance = position <= dot ? dot - position : dot + dotsPerFrame - position;
+  return std::max<u32>( distance, 1 );
+}
+
+/*
+################################
+||                            ||
+||      Scanline Renderer     ||
+||                            ||
+################################
+*/
+u32 PPU::ScanlineDots() const
+{
+  if ( !_scanlineRenderer || isDisabled || cycle != 0 || scanline > 239 ) {
+    return 0;
+  }
+  // The first line of an odd frame skips its idle dot 0
+  bool const skipsDot = scanline == 0 && ( frame & 0x01 );
+  return skipsDot ? dotsPerScanline - 1 : dotsPerScanline;
+}
+
+void PPU::RenderScanline()
+{
+  /** @brief Runs the visible line from dot 0 to dot 340, as that many Tick() calls would
+   * Dots 1-256 fetch a tile every 8 dots and shift the background shifters once per dot, before the pixel
+   * is taken. Here each group of 8 dots shifts once and loads, fetches, and shifts the other 7 times in one
+   * go, while the decoded rows of the fetched tiles are laid out in a background row. Sprites are drawn into
+   * a row of their own, from their x counters as the dot renderer runs them down, and the compositor combines
+   * the two rows once the fetches are done. The fetches happen in the same order, so a mapper sees the same reads.
+   */
+  NES_PROFILE_SCOPE( profiler::PpuRenderScanline );
+  bool const renderBackground = ppuMask.bit.renderBackground;
+  bool const renderSprites = ppuMask.bit.renderSprites;
+
+  // Sprite row, one byte per pixel as the compositor takes them
+  std::array<u8, 256> sprites{};
+  if ( renderSprites ) {
+    DrawSprites( sprites.data(), 256 );
+  }
+
+  // Background row, a pixel index in bits 0-1 and the palette in bits 2-3: 8 pixels for each tile the shifters'
+  // high byte holds in turn. With fine x, pixel x is at x + fineX
+  std::array<u8, 33 * 8> background{};
+  if ( renderBackground ) {
+    // The first two came from the last line: what the shifters hold, and the tile in the fetch latches
+    u16 const patternLow = bgPatternShiftLow << 1;
+    u16 const patternHigh = bgPatternShiftHigh << 1;
+    u16 const attributeLow = bgAttributeShiftLow << 1;
+    u16 const attributeHigh = bgAttributeShiftHigh << 1;
+    for ( int x = 0; x < 8; x++ ) {
+      int const bit = 15 - x;
+      background[x] = static_cast<u8>( ( ( ( attributeHigh >> bit ) & 0x01 ) << 3 ) | ( ( ( attributeLow >> bit ) & 0x01 ) << 2 ) |
+                                       ( ( ( patternHigh >> bit ) & 0x01 ) << 1 ) | ( ( patternLow >> bit ) & 0x01 ) );
+      background[8 + x] = static_cast<u8>( ( ( attributeByte & 0x03 ) << 2 ) | ( ( ( bgPattern1Byte >> ( 7 - x ) ) & 0x01 ) << 1 ) |
+                                           ( ( bgPattern0Byte >> ( 7 - x ) ) & 0x01 ) );
+    }
+  }
+
+  for ( int tile = 0; tile < 32; tile++ ) {
+    // Dot 1 of the group: shift, then load the tile fetched during the previous group
+    cycle = static_cast<u16>( ( tile * 8 ) + 1 );
+    if ( renderBackground ) {
+      bgPatternShiftLow <<= 1;
+      bgPatternShiftHigh <<= 1;
+      bgAttributeShiftLow <<= 1;
+      bgAttributeShiftHigh <<= 1;
+    }
+    LoadBgShifters();
+
+    // The fetches of dots 1, 3, 5 and 7. The tile lands in the shifters' high byte two groups on
+    FetchNametableByte();
+    FetchAttributeByte();
+    FetchBgPattern0Byte();
+    FetchBgPattern1Byte();
+    int const slot = tile + 2;
+    if ( renderBackground && slot < 33 ) {
+      u16 const     address = ( ppuCtrl.bit.patternBackground << 12 ) | ( nametableByte << 4 ) | vramAddr.bit.fineY;
+      ChrRow const &pattern = PatternRow( address );
+      u8 const      palette = static_cast<u8>( ( attributeByte & 0x03 ) << 2 );
+      for ( int x = 0; x < 8; x++ ) {
+        background[( slot * 8 ) + x] = palette | pattern.pixels[x];
+      }
+    }
+
+    // The other 7 shifts, and the increments of dot 8
+    if ( renderBackground ) {
+      bgPatternShiftLow <<= 7;
+      bgPatternShiftHigh <<= 7;
+      bgAttributeShiftLow <<= 7;
+      bgAttributeShiftHigh <<= 7;
+    }
+    IncrementCoarseX();
+  }
+  IncrementCoarseY();
+
+  // Both rows into the frame, with fine x picking where the background starts
+  CompositePixels( background.data() + fineX, sprites.data(), 0, 256 );
+
+  // Sprite evaluation, the first two tiles of the next line and the sprite fetches, as the dots run them
+  cycle = 257;
+  LoadBgShifters();
+  TransferAddressX();
+  SpriteEval();
+  for ( cycle = 321; cycle <= 336; cycle++ ) {
+    FetchBgTileData();
+  }
+  cycle = 338;
+  FetchNametableByte();
+  cycle = 340;
+  FetchNametableByte();
+  FetchSpriteData();
+
+  cycle = 0;
+  scanline++;
+}
+
+void PPU::RenderTile()
+{
+  /** @brief Runs dots 1-8 of a tile group on a visible line, as 8 Tick() calls would
+   * The group's pixels are what the shifters hold once its first dot has loaded them, so they're laid out
+   * before its fetches run. Dot 256 also moves to the next row.
+   */
+  NES_PROFILE_SCOPE( profiler::PpuRenderTile );
+  bool const renderBackground = ppuMask.bit.renderBackground;
+  int const  x = cycle - 1;
+
+  if ( renderBackground ) {
+    bgPatternShiftLow <<= 1;
+    bgPatternShiftHigh <<= 1;
+    bgAttributeShiftLow <<= 1;
+    bgAttributeShiftHigh <<= 1;
+  }
+  LoadBgShifters();
+
+  // Pixel i of the group is under bit 15 - fineX once the shifters have moved i more times
+  std::array<u8, tileDots> background{};
+  if ( renderBackground ) {
+    for ( int i = 0; i < static_cast<int>( tileDots ); i++ ) {
+      int const bit = 15 - fineX - i;
+      background[i] = static_cast<u8>( ( ( ( bgAttributeShiftHigh >> bit ) & 0x01 ) << 3 ) |
+                                       ( ( ( bgAttributeShiftLow >> bit ) & 0x01 ) << 2 ) |
+                                       ( ( ( bgPatternShiftHigh >> bit ) & 0x01 ) << 1 ) | ( ( bgPatternShiftLow >> bit ) & 0x01 ) );
+    }
+  }
+  std::array<u8, tileDots> sprites{};
+  if ( ppuMask.bit.renderSprites ) {
+    DrawSprites( sprites.data(), tileDots );
+  }
+
+  FetchNametableByte();
+  FetchAttributeByte();
+  FetchBgPattern0Byte();
+  FetchBgPattern1Byte();
+  if ( renderBackground ) {
+    bgPatternShiftLow <<= 7;
+    bgPatternShiftHigh <<= 7;
+    bgAttributeShiftLow <<= 7;
+    bgAttributeShiftHigh <<= 7;
+  }
+  IncrementCoarseX();
+  if ( x == 248 ) {
+    IncrementCoarseY();
+  }
+
+  CompositePixels( background.data(), sprites.data(), x, tileDots );
+  cycle += tileDots;
+}
+
+void PPU::DrawSprites( u8 *row, int dots )
+{
+  // The pixel in bits 0-1, the palette in bits 2-3, then the compositor's flags. Lower slots win, so they're
+  // drawn last
+  for ( int i = spriteCount - 1; i >= 0; i-- ) {
+    SpriteEntry &sprite = checks::At( secondaryOam.entries, i );
+    u8 const     low = checks::At( spriteShiftLow, i );
+    u8 const     high = checks::At( spriteShiftHigh, i );
+    u8 const     tag = static_cast<u8>( ( sprite.attribute.bit.palette << 2 ) |
+                                        ( sprite.attribute.bit.priority == 0 ? compositor::spriteFront : 0 ) |
+                                        ( i == 0 ? compositor::spriteZero : 0 ) );
+    // The dots count the sprite's x down to 0 and then shift, so dot d (from 1) shows column d - x. Column 0
+    // is lost when x is already 0
+    int const x = sprite.x;
+    for ( int dot = std::max( x, 1 ); dot <= std::min( x + 7, dots ); dot++ ) {
+      int const bit = 7 - ( dot - x );
+      u8 const  pixel = static_cast<u8>( ( ( ( high >> bit ) & 0x01 ) << 1 ) | ( ( low >> bit ) & 0x01 ) );
+      if ( pixel != 0 ) {
+        row[dot - 1] = pixel | tag;
+      }
+    }
+
+    // Where the dots leave the counter and the shifters
+    int const shifts = std::max( dots - x, 0 );
+    sprite.x = static_cast<u8>( std::max( x - dots, 0 ) );
+    checks::At( spriteShiftLow, i ) = shifts >= 8 ? 0 : static_cast<u8>( low << shifts );
+    checks::At( spriteShiftHigh, i ) = shifts >= 8 ? 0 : static_cast<u8>( high << shifts );
+  }
+  bSprite0Appeared = ( row[dots - 1] & compositor::spriteZero ) != 0;
+}
+
+void PPU::CompositePixels( const u8 *background, const u8 *sprites, int x, int count )
+{
+  compositor::Span span;
+  span.background = background;
+  span.sprites = sprites;
+  span.colors = PaletteColors().data();
+  span.out = _frameBuffer != nullptr ? &checks::At( *_frameBuffer, ( scanline * 256 ) + x ) : nullptr;
+  span.x = x;
+  span.count = count;
+  span.backgroundFrom = ppuMask.bit.renderBackgroundLeft ? 0 : 8;
+  // The dot renderer doesn't hide sprites in the left column (renderSpritesLeft), so neither does this
+  span.spritesFrom = 0;
+
+  // Nothing reads the flag before the batch ends, so the dot it happened on doesn't matter
+  bool const hit = compositor::Composite( span );
+  if ( hit && bSpriteZeroHitPossible && ppuMask.bit.renderBackground && ppuMask.bit.renderSprites ) {
+    ppuStatus.bit.spriteZeroHit = 1;
+  }
+}
+
+const std::array<u32, 32> &PPU::PaletteColors()
+{
+  if ( _paletteColorsStale || _paletteColorsFrom != paletteMemory ) {
+    for ( u16 i = 0; i < 32; i++ ) {
+      _paletteColors[i] = checks::At( nesPaletteRgbValues, ReadVram( 0x3F00 + i ) & 0x3F );
     }
+    _paletteColorsFrom = paletteMemory;
+    _paletteColorsStale = false;
   }
+  return _paletteColors;
 }
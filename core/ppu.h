@@ -1,15 +1,20 @@
 #pragma once
 #include "paths.h"
+#include "checks.h"
 #include "cpu.h"
 #include "global-types.h"
 #include "ppu-types.h"
 #include "mappers/mapper-base.h"
+#include "profiler.h"
 #include <array>
+#include <bit>
+#include <cstddef>
 #include <cstdint>
 #include <cstdlib>
 #include <cstring>
 #include <functional>
 #include <iostream>
+#include <memory>
 #include <stdexcept>
 #include <string>
 #include <fstream>
@@ -18,7 +23,6 @@ class PPU
 {
 public:
   PPU( Bus *bus );
-  Bus *bus;
 
   template <class Archive> void serialize( Archive &ar ) // NOLINT
   {
@@ -29,23 +33,28 @@ public:
         nOamEntry, isDisabled );
   }
 
+  static constexpr int gBufferSize = 61440;
+  using FrameBuffer = std::array<u32, gBufferSize>;
+
   /*
   ################################
-  ||      Helper Variables      ||
+  ||          Hot State         ||
   ################################
   */
-  std::array<std::string, 3> systemPalettePaths = { std::string( paths::palettes() ) + "/palette1.pal",
-                                                    std::string( paths::palettes() ) + "/palette2.pal",
-                                                    std::string( paths::palettes() ) + "/palette3.pal" };
+  // What a dot touches fills the first two cache lines of the PPU: the position, the registers, the fetch
+  // latches and shifters, and the catch-up debt. The tables come next and the cold configuration last
+  alignas( cacheLineSize ) Bus *bus;
+  u64 frame = 1;
 
-  std::array<u32, 64> nesPaletteRgbValues{};
-  u32                 GetMasterPaletteColor( u8 index ) const { return nesPaletteRgbValues.at( index ); }
+private:
+  FrameBuffer *_frameBuffer = nullptr; // See UseOwnFrameBuffer() and SetFrameBuffer()
+  u32          _debt = 0;              // Dots the CPU has run ahead of the PPU
+  bool         _catchUpEnabled = true;
+  bool         _scanlineRenderer = true;
 
+public:
   bool preventVBlank = false;
   bool nmiReady = false;
-  bool failedPaletteRead = false;
-  int  systemPaletteIdx = 0;
-  int  maxSystemPalettes = 3;
 
   /*
   ################################
@@ -53,12 +62,20 @@ public:
   ################################
   */
   u16  scanline = 0;
-  void SetScanline( u16 line ) { scanline = line; }
+  void SetScanline( u16 line )
+  {
+    CatchUp();
+    scanline = line;
+    ScheduleEvents();
+  }
 
   u16  cycle = 0;
-  void SetCycles( u16 cycles ) { cycle = cycles; }
-
-  u64 frame = 1;
+  void SetCycles( u16 cycles )
+  {
+    CatchUp();
+    cycle = cycles;
+    ScheduleEvents();
+  }
 
   PPUCTRL ppuCtrl; // $2000
   u8      GetPpuCtrl() const { return ppuCtrl.value; }
@@ -120,29 +137,14 @@ public:
 
   u8 vramBuffer = 0x00;
 
-  using nametable_t = std::array<u8, 1024>;
-  std::array<nametable_t, 4> nameTables{};
-
-  // u8 nametables[4][1024];
-  std::array<u8, 32> defaultPalette = { 0x09, 0x01, 0x00, 0x01, 0x00, 0x02, 0x02, 0x0D, 0x08, 0x10, 0x08,
-                                        0x24, 0x00, 0x00, 0x04, 0x2C, 0x09, 0x01, 0x34, 0x03, 0x00, 0x04,
-                                        0x00, 0x14, 0x08, 0x3A, 0x00, 0x02, 0x00, 0x20, 0x2C, 0x08 };
-
-  std::array<u8, 32> paletteMemory = defaultPalette;
-  u8                 GetPaletteEntry( u8 index ) const { return paletteMemory.at( index ); }
-  void               SetPaletteEntry( u8 index, u8 value ) { paletteMemory.at( index ) = value; }
-
-  OAM          oam{};
-  SpriteEntry  GetOamEntry( u8 index ) const { return oam.entries.at( index ); }
-  SecondaryOAM secondaryOam{};
-  SpriteEntry  GetSecondaryOamEntry( u8 index ) const { return secondaryOam.entries.at( index ); }
-
   /*
   ################################
   ||     Rendering Variables    ||
   ################################
   */
   static constexpr u16 gPrerenderScanline = 261;
+  static constexpr u32 dotsPerScanline = 341;
+  static constexpr u32 dotsPerFrame = 262 * dotsPerScanline;
 
   u8  nametableByte = 0x00;
   u8  attributeByte = 0x00;
@@ -165,6 +167,70 @@ public:
   u8   spriteCount = 0;
   u8   nOamEntry = 0;
 
+  /*
+  ################################
+  ||         PPU Memory         ||
+  ################################
+  */
+  using nametable_t = std::array<u8, 1024>;
+  std::array<nametable_t, 4> nameTables{};
+
+  // The nametable behind each 1 KiB page of $2000-$2FFF, repointed only when the cartridge's mirroring changes
+  void SetMirroring( MirrorMode mode );
+  u8  &Nametable( u16 address ) { return checks::At( _nametablePages, ( address >> 10 ) & 0x03 )[address & 0x03FF]; }
+
+  // u8 nametables[4][1024];
+  std::array<u8, 32> defaultPalette = { 0x09, 0x01, 0x00, 0x01, 0x00, 0x02, 0x02, 0x0D, 0x08, 0x10, 0x08,
+                                        0x24, 0x00, 0x00, 0x04, 0x2C, 0x09, 0x01, 0x34, 0x03, 0x00, 0x04,
+                                        0x00, 0x14, 0x08, 0x3A, 0x00, 0x02, 0x00, 0x20, 0x2C, 0x08 };
+
+  std::array<u8, 32> paletteMemory = defaultPalette;
+  u8                 GetPaletteEntry( u8 index ) const { return paletteMemory.at( index ); }
+  void               SetPaletteEntry( u8 index, u8 value ) { paletteMemory.at( index ) = value; }
+
+  OAM          oam{};
+  SpriteEntry  GetOamEntry( u8 index ) const { return oam.entries.at( index ); }
+
+  // OAM writes, which keep the shadow in step. Anything that writes oam otherwise calls SyncOamShadow()
+  void WriteOam( u8 address, u8 value )
+  {
+    checks::At( oam.data, address ) = value;
+    _oamShadow.Write( address, value );
+  }
+  // The 256 bytes of a DMA page, from oamAddr on, wrapping around
+  void WriteOamPage( const u8 *page )
+  {
+    size_t const head = 256 - oamAddr;
+    std::memcpy( oam.data.data() + oamAddr, page, head );
+    std::memcpy( oam.data.data(), page + head, oamAddr );
+    SyncOamShadow();
+  }
+  void             SyncOamShadow() { _oamShadow.Load( oam ); }
+  OamShadow const &GetOamShadow() const { return _oamShadow; }
+
+  SecondaryOAM secondaryOam{};
+  SpriteEntry  GetSecondaryOamEntry( u8 index ) const { return secondaryOam.entries.at( index ); }
+
+  std::array<u32, 64> nesPaletteRgbValues{};
+  u32                 GetMasterPaletteColor( u8 index ) const { return nesPaletteRgbValues.at( index ); }
+
+  // The 32 palette entries resolved to RGB, for the batched renderers. Resolved again when palette memory is
+  // no longer what they were resolved from, or the system palette changes
+  const std::array<u32, 32> &PaletteColors();
+
+  /*
+  ################################
+  ||      Helper Variables      ||
+  ################################
+  */
+  std::array<std::string, 3> systemPalettePaths = { std::string( paths::palettes() ) + "/palette1.pal",
+                                                    std::string( paths::palettes() ) + "/palette2.pal",
+                                                    std::string( paths::palettes() ) + "/palette3.pal" };
+
+  bool failedPaletteRead = false;
+  int  systemPaletteIdx = 0;
+  int  maxSystemPalettes = 3;
+
   // SDL callbacks
   std::function<void( const u32 * )> onFrameReady = nullptr;
 
@@ -182,25 +248,132 @@ public:
   ||        SDL Variables       ||
   ################################
   */
-  static constexpr int         gBufferSize = 61440;
-  std::array<u32, gBufferSize> frameBuffer{};
-  std::array<u32, gBufferSize> GetFrameBuffer() const { return frameBuffer; }
+  /*
+   * @brief Where the pixels go: a buffer the PPU owns, one the caller owns, or none
+   * A PPU without a frame buffer still runs the whole pixel pipeline, which sprite 0 hit depends on, and
+   * only skips the stores. Many emulators running headless don't need 240 KiB each.
+   */
+  void UseOwnFrameBuffer()
+  {
+    if ( _ownFrameBuffer == nullptr ) {
+      _ownFrameBuffer = std::make_unique<FrameBuffer>();
+    }
+    _frameBuffer = _ownFrameBuffer.get();
+  }
+  // Not owned. Null for none, which frees the own buffer
+  void SetFrameBuffer( FrameBuffer *buffer )
+  {
+    _frameBuffer = buffer;
+    if ( buffer != _ownFrameBuffer.get() ) {
+      _ownFrameBuffer.reset();
+    }
+  }
+  FrameBuffer const *GetFrameBuffer() const { return _frameBuffer; }
 
-  void ClearFrameBuffer() { frameBuffer.fill( 0x00000000 ); }
+  void ClearFrameBuffer()
+  {
+    if ( _frameBuffer != nullptr ) {
+      _frameBuffer->fill( 0x00000000 );
+    }
+  }
 
   /*
   ################################
   ||     Method Definitions    ||
   ################################
   */
-  MirrorMode GetMirrorMode() const;
+  MirrorMode GetMirrorMode() const { return _mirroring; }
   u8         CpuRead( u16 address, bool debugMode = false );
   void       CpuWrite( u16 address, u8 data );
   u8         ReadVram( u16 addr );
   void       WriteVram( u16 addr, u8 data );
+  // Decoded tile row at a pattern table address, from the cartridge's CHR tile cache
+  const ChrRow &PatternRow( u16 addr ) const;
   void       Tick();
   void       VBlank();
 
+  /*
+  ################################
+  ||          Catch-Up          ||
+  ################################
+  */
+  /*
+   * @brief The CPU doesn't tick the PPU dot by dot, it owes it three dots per cycle
+   * The owed dots are run in one batch when the CPU is about to observe the PPU: a PPU register access,
+   * a mapper write, an OAM DMA write, or a trace capture. The rest of the time, only the PPU can change
+   * what the CPU sees, at two dots that are known in advance: vblank (241, 1), which raises the NMI, and
+   * the last dot of the frame. Both are registered with the bus scheduler, which catches the PPU up on the
+   * cycle they fall in, so every dot runs with the same inputs, and every event lands in the same CPU
+   * cycle, as ticking in lockstep would. Sprite 0 hit and sprite overflow need no event, they can only be
+   * seen through a $2002 read.
+   */
+  void Owe( u32 dots ) { _debt += dots; }
+  void CatchUp()
+  {
+    if ( _debt > 0 ) {
+      RunOwedDots();
+    }
+  }
+  // Forgets the owed dots, when the position is replaced (reset, state load)
+  void ClearDebt()
+  {
+    _debt = 0;
+    ScheduleEvents();
+  }
+  u32 GetDebt() const { return _debt; }
+
+  // When off, the CPU ticks the PPU three times per cycle, as it used to. For comparisons and benchmarks
+  void SetCatchUp( bool enabled )
+  {
+    CatchUp();
+    _catchUpEnabled = enabled;
+  }
+  bool IsCatchUpEnabled() const { return _catchUpEnabled; }
+
+  // Runs the owed dots, if any, and schedules the next vblank and frame end from where the PPU is then
+  void RunOwedDots();
+  // Registers the next vblank and frame end with the scheduler. The PPU must be caught up
+  void ScheduleEvents();
+  u32  DotsUntil( u32 dot ) const;
+
+  /*
+  ################################
+  ||      Scanline Renderer     ||
+  ################################
+  */
+  /*
+   * @brief Draws a whole visible scanline in one call, for the catch-up batches that cover it
+   * Nothing the CPU does can land inside a batch: register writes, mapper writes and DMA all catch the PPU up
+   * before they apply. So when a batch holds a visible line from its first dot to its last, the line's inputs
+   * are fixed, and it can be drawn tile by tile instead of dot by dot: 32 groups of fetches, and 256 pixels
+   * from the shifters, the sprite row and the resolved palette. The rest of the line (sprite evaluation,
+   * the prefetches) goes through the dot helpers. A batch that starts or ends inside a line still has its
+   * whole tile groups drawn 8 dots at a time by RenderTile(). Both go through the compositor (compositor.h),
+   * which also tells whether sprite 0 hit: the flag can't be read before the batch ends, so it's set once
+   * for the line or the group. The PPU ends up in the same state as with the dot renderer, so turning it off
+   * is only for comparisons and benchmarks.
+   */
+  void SetScanlineRenderer( bool enabled ) { _scanlineRenderer = enabled; }
+  bool IsScanlineRendererEnabled() const { return _scanlineRenderer; }
+
+  // Dots of the line the scanline renderer would draw from here, 0 when it's the dot renderer's
+  u32  ScanlineDots() const;
+  void RenderScanline();
+
+  // Dots of the tile group RenderTile() would draw from here, 0 when it's the dot renderer's
+  static constexpr u32 tileDots = 8;
+  u32                  TileDots() const
+  {
+    bool const groupStart = ( cycle & 0x07 ) == 1 && cycle <= 249;
+    return _scanlineRenderer && groupStart && !isDisabled && scanline <= 239 ? tileDots : 0;
+  }
+  void RenderTile();
+
+  // The sprite pixels of the next `dots` dots into `row`, moving the x counters and shifters past them
+  void DrawSprites( u8 *row, int dots );
+  // Pixels x to x + count - 1 of the line into the frame, and sprite 0's hit
+  void CompositePixels( const u8 *background, const u8 *sprites, int x, int count );
+
   /*
   ################################
   ||            Utils           ||
@@ -240,11 +413,11 @@ public:
     if ( InCycle( 1, 256 ) ) {
       if ( ppuMask.bit.renderSprites ) {
         for ( int i = 0; i < spriteCount; i++ ) {
-          if ( secondaryOam.entries.at( i ).x > 0 ) {
-            secondaryOam.entries.at( i ).x--;
+          if ( checks::At( secondaryOam.entries, i ).x > 0 ) {
+            checks::At( secondaryOam.entries, i ).x--;
           } else {
-            spriteShiftLow.at( i ) <<= 1;
-            spriteShiftHigh.at( i ) <<= 1;
+            checks::At( spriteShiftLow, i ) <<= 1;
+            checks::At( spriteShiftHigh, i ) <<= 1;
           }
         }
       }
@@ -282,6 +455,7 @@ public:
 
   void VisibleScanline()
   {
+    NES_PROFILE_SCOPE( profiler::PpuVisibleScanline );
     if ( InCycle( 1, 256 ) ) {
       FetchBgTileData();
     }
@@ -334,35 +508,33 @@ public:
   {
     if ( !IsRenderingEnabled() || cycle != 257 )
       return;
+    NES_PROFILE_SCOPE( profiler::PpuSpriteEval );
 
     std::memset( secondaryOam.data.data(), 0xFF, secondaryOam.data.size() );
-    spriteCount = 0;
     for ( u8 i = 0; i < 8; i++ ) {
       spriteShiftLow[i] = 0;
       spriteShiftHigh[i] = 0;
     }
-    nOamEntry = 0;
-    bSpriteZeroHitPossible = false;
-
-    while ( nOamEntry < 64 && spriteCount < 9 ) {
-      auto const sprite = oam.entries.at( nOamEntry );
-      bool const spriteInRange = IsSpriteInRange( scanline, sprite.y, (bool) ppuCtrl.bit.spriteSize );
 
-      if ( spriteInRange ) {
-        if ( spriteCount < 8 ) {
-          if ( nOamEntry == 0 ) {
-            bSpriteZeroHitPossible = true;
-          }
-          secondaryOam.entries.at( spriteCount ) = sprite;
-          spriteCount++;
-        }
-      }
-      nOamEntry++;
+    // The first 8 sprites on the line, in OAM order, go to secondary OAM
+    u64 const onLine = SpritesOnLine( scanline, ppuCtrl.bit.spriteSize ? 16 : 8 );
+    spriteCount = 0;
+    for ( u64 left = onLine; left != 0 && spriteCount < 8; left &= left - 1 ) {
+      checks::At( secondaryOam.entries, spriteCount ) = _oamShadow.Entry( std::countr_zero( left ) );
+      spriteCount++;
     }
+    nOamEntry = 64;
+    bSpriteZeroHitPossible = ( onLine & 0x01 ) != 0;
 
-    ppuStatus.bit.spriteOverflow = ( spriteCount > 8 );
+    // A ninth sets the flag until the pre-render line clears it
+    if ( std::popcount( onLine ) > 8 ) {
+      ppuStatus.bit.spriteOverflow = 1;
+    }
   }
 
+  // Bit i set when OAM entry i covers the line, for all 64 at once
+  u64 SpritesOnLine( int line, int height ) const;
+
   static bool IsSpriteInRange( int scanline, int y, bool isLarge )
   {
     return scanline >= y && scanline < y + ( isLarge ? 16 : 8 );
@@ -373,13 +545,11 @@ public:
 
   void FetchSpriteData()
   {
+    NES_PROFILE_SCOPE( profiler::PpuFetchSpriteData );
     for ( u8 i = 0; i < spriteCount; i++ ) {
       SpriteEntry const sprite = secondaryOam.entries[i];
 
-      u8         spritePattern0Byte = 0;
-      u8         spritePattern1Byte = 0;
       u16        spritePattern0Addr = 0;
-      u16        spritePattern1Addr = 0;
       bool const isLarge = ppuCtrl.bit.spriteSize;
 
       u16 baseAddr = ppuCtrl.bit.patternSprite << 12; // 0x0000 or 0x1000 depending on ppuCtrl (for 8x8 sprites)
@@ -427,29 +597,27 @@ public:
         }
       }
 
-      spritePattern1Addr = spritePattern0Addr + 8;
-      spritePattern0Byte = ReadVram( spritePattern0Addr );
-      spritePattern1Byte = ReadVram( spritePattern1Addr );
-
-      auto flipbyte = []( uint8_t b ) {
-        b = ( b & 0xF0 ) >> 4 | ( b & 0x0F ) << 4;
-        b = ( b & 0xCC ) >> 2 | ( b & 0x33 ) << 2;
-        b = ( b & 0xAA ) >> 1 | ( b & 0x55 ) << 1;
-        return b;
-      };
-
-      if ( sprite.attribute.bit.flipH ) {
-        spritePattern0Byte = flipbyte( spritePattern0Byte );
-        spritePattern1Byte = flipbyte( spritePattern1Byte );
-      }
+      // The cache has the row flipped already
+      ChrRow const &row = PatternRow( spritePattern0Addr );
+      auto const   &pixels = sprite.attribute.bit.flipH ? row.flipped : row.pixels;
+      checks::At( spriteShiftLow, i ) = PackPlane( pixels, 0 );
+      checks::At( spriteShiftHigh, i ) = PackPlane( pixels, 1 );
+    }
+  }
 
-      spriteShiftLow.at( i ) = spritePattern0Byte;
-      spriteShiftHigh.at( i ) = spritePattern1Byte;
+  // A bit plane of a decoded row, as the shifters hold it: the leftmost pixel in bit 7
+  static u8 PackPlane( const std::array<u8, 8> &pixels, int plane )
+  {
+    u8 bits = 0;
+    for ( u8 const pixel : pixels ) {
+      bits = static_cast<u8>( ( bits << 1 ) | ( ( pixel >> plane ) & 0x01 ) );
     }
+    return bits;
   }
 
   u32 GetOutputPixel()
   {
+    NES_PROFILE_SCOPE( profiler::PpuGetOutputPixel );
     u8 bgPixel = 0;
     u8 bgPalette = 0;
     FetchBackgroundPixel( bgPixel, bgPalette );
@@ -509,7 +677,7 @@ public:
     // Write final color to framebuffer
     u16 const paletteAddr = 0x3F00 + ( outPalette << 2 ) + outPixel;
     u8 const  paletteIdx = ReadVram( paletteAddr ) & 0x3F;
-    u32 const rgbColor = nesPaletteRgbValues.at( paletteIdx );
+    u32 const rgbColor = checks::At( nesPaletteRgbValues, paletteIdx );
     return rgbColor;
 
     return 0;
@@ -566,7 +734,7 @@ public:
     u8 const  attrX = vramAddr.bit.coarseX >> 2;
     u8 const  attrY = ( vramAddr.bit.coarseY >> 2 ) << 3;
     u16 const attrAddr = 0x23C0 | nametableSelect | attrY | attrX;
-    attributeByte = ReadVram( attrAddr );
+    attributeByte = Nametable( attrAddr );
     if ( vramAddr.bit.coarseY & 0x02 )
       attributeByte >>= 4;
     if ( vramAddr.bit.coarseX & 0x02 )
@@ -574,7 +742,7 @@ public:
     attributeByte &= 0x03;
   }
 
-  void FetchNametableByte() { nametableByte = ReadVram( 0x2000 | ( vramAddr.value & 0x0FFF ) ); }
+  void FetchNametableByte() { nametableByte = Nametable( vramAddr.value ); }
 
   void FetchBgPattern0Byte()
   {
@@ -630,18 +798,17 @@ public:
   {
     if ( InScanline( 0, 239 ) && InCycle( 1, 256 ) ) {
       u16 const bufferIdx = ( scanline * 256 ) + ( cycle - 1 );
-      if ( debugValue > -1 ) {
-        frameBuffer.at( bufferIdx ) = debugValue;
-      } else {
-        frameBuffer.at( bufferIdx ) = GetOutputPixel();
+      u32 const pixel = debugValue > -1 ? debugValue : GetOutputPixel();
+      if ( _frameBuffer != nullptr ) {
+        checks::At( *_frameBuffer, bufferIdx ) = pixel;
       }
     }
   }
 
   void RenderFrameBuffer()
   {
-    if ( onFrameReady ) {
-      onFrameReady( frameBuffer.data() );
+    if ( onFrameReady && _frameBuffer != nullptr ) {
+      onFrameReady( _frameBuffer->data() );
     }
   }
 
@@ -664,6 +831,7 @@ public:
 
   void Reset()
   {
+    ClearDebt();
     scanline = 0;
     cycle = 0;
     frame = 1;
@@ -714,6 +882,7 @@ public:
   {
     std::string const palettePath = systemPalettePaths.at( paletteIdx );
     nesPaletteRgbValues = ReadPalette( palettePath );
+    _paletteColorsStale = true;
   }
 
   u8 GetPpuPaletteValue( u8 index ) { return paletteMemory.at( index ); }
@@ -734,6 +903,7 @@ public:
             0xFF90E0FC, 0xFF98EAE2, 0xFFA0F2CA, 0xFFE2EAA0, 0xFFFAE2A0, 0xFFB6B6B6, 0xFF0C0C0C, 0xFF0C0C0C
         };
     // clang-format on
+    _paletteColorsStale = true;
   }
 
   // Get pattern table data, used in debugging (frontend/ui/pattern-tables.h)
@@ -752,15 +922,11 @@ public:
 
       // Each tile is 8x8 pixels
       for ( int row = 0; row < 8; row++ ) {
-        u8 const plane0Byte = ReadVram( tileAddr + row );
-        u8 const plane1Byte = ReadVram( tileAddr + row + 8 );
-        for ( int bit = 7; bit >= 0; bit-- ) {
-          u8 const plane0Bit = ( plane0Byte >> bit ) & 0x01;
-          u8 const plane1Bit = ( plane1Byte >> bit ) & 0x01;
-          u8 const colorIdx = ( plane1Bit << 1 ) | plane0Bit;
+        ChrRow const &pattern = PatternRow( tileAddr + row );
+        for ( int localX = 0; localX < 8; localX++ ) {
+          u8 const colorIdx = pattern.pixels[localX];
 
           // Calculate the buffer index (pixel position)
-          int const localX = 7 - bit;
           int const globalX = ( tileX * 8 ) + localX;
           int const globalY = ( tileY * 8 ) + row;
           int const bufferIdx = ( globalY * 128 ) + globalX;
@@ -785,20 +951,18 @@ public:
         u16 const tileAddr = baseAddr | ( entry.tileIndex << 4 );
 
         for ( int row = 0; row < 8; row++ ) {
-          u8 const plane0Byte = ReadVram( tileAddr + row );
-          u8 const plane1Byte = ReadVram( tileAddr + row + 8 );
+          // Drawn the way the sprite faces
+          ChrRow const &pattern = PatternRow( tileAddr + row );
+          auto const   &pixels = entry.attribute.bit.flipH ? pattern.flipped : pattern.pixels;
 
-          for ( int bit = 7; bit >= 0; bit-- ) {
+          for ( int localX = 0; localX < 8; localX++ ) {
             // Calculate the pixel's position in the 64x64 output buffer.
-            int const localX = 7 - bit;
             int const globalX = ( tileX * 8 ) + localX;
             int const globalY = ( tileY * 8 ) + row;
             int const bufferIdx = ( globalY * 64 ) + globalX;
 
             // Calculate pixel color
-            u8 const  plane0Bit = ( plane0Byte >> bit ) & 0x01;
-            u8 const  plane1Bit = ( plane1Byte >> bit ) & 0x01;
-            u8 const  colorOffset = ( plane1Bit << 1 ) | plane0Bit;
+            u8 const  colorOffset = pixels[localX];
             u8 const  paletteBase = 16 + ( entry.attribute.bit.palette * 4 );
             u16 const vramAddr = 0x3F00 + paletteBase + colorOffset;
             u8 const  paletteIdx = ReadVram( vramAddr );
@@ -876,15 +1040,11 @@ public:
 
       // Now, combining all the tile data and adding it to the correct location in the buffer
       for ( int pixelRow = 0; pixelRow < 8; pixelRow++ ) {
-        u8 const plane0Byte = ReadVram( tileAddr + pixelRow );
-        u8 const plane1Byte = ReadVram( tileAddr + pixelRow + 8 );
-        for ( int bit = 7; bit >= 0; bit-- ) {
-          u8 const plane0Bit = ( plane0Byte >> bit ) & 0x01;
-          u8 const plane1Bit = ( plane1Byte >> bit ) & 0x01;
-          u8 const colorIdx = ( plane1Bit << 1 ) | plane0Bit;
+        ChrRow const &pattern = PatternRow( tileAddr + pixelRow );
+        for ( int tilePixelX = 0; tilePixelX < 8; tilePixelX++ ) {
+          u8 const colorIdx = pattern.pixels[tilePixelX];
 
           // Calculate the buffer index (final pixel position)
-          int const tilePixelX = 7 - bit;
           int const screenPixelX = ( tileX * 8 ) + tilePixelX;
           int const screenPixelY = ( tileY * 8 ) + pixelRow;
           int const bufferIdx = ( screenPixelY * 256 ) + screenPixelX;
@@ -932,4 +1092,13 @@ public:
 
     return nesPalette;
   }
+
+private:
+  std::unique_ptr<FrameBuffer> _ownFrameBuffer;
+  std::array<u8 *, 4>          _nametablePages{}; // See Nametable()
+  MirrorMode                   _mirroring = MirrorMode::Vertical;
+  std::array<u32, 32>          _paletteColors{}; // See PaletteColors()
+  std::array<u8, 32>           _paletteColorsFrom{};
+  bool                         _paletteColorsStale = true;
+  OamShadow                    _oamShadow{}; // See SyncOamShadow()
 };
@@ -0,0 +1,175 @@
+#include "profiler.h"
+#include "cpu-types.h"
+#include "global-types.h"
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <fmt/format.h>
+#include <iterator>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#if defined( __x86_64__ ) || defined( __i386__ )
+#include <x86intrin.h>
+#endif
+
+namespace profiler
+{
+
+namespace
+{
+u64 SteadyNs()
+{
+  auto const now = std::chrono::steady_clock::now().time_since_epoch();
+  return std::chrono::duration_cast<std::chrono::nanoseconds>( now ).count();
+}
+
+struct Row {
+  std::string      name;
+  u64              calls;
+  u64              inclusive;
+  u64              exclusive;
+};
+
+void AppendTable( std::string &out, const HostProfiler &profiler, std::string_view title, std::vector<Row> rows,
+                  u64 total, size_t top )
+{
+  std::ranges::sort( rows, []( const Row &a, const Row &b ) { return a.exclusive > b.exclusive; } );
+  std::erase_if( rows, []( const Row &row ) { return row.calls == 0; } );
+
+  auto inserter = std::back_inserter( out );
+  fmt::format_to( inserter, "\n{}\n", title );
+  fmt::format_to( inserter, "  {:<16} {:>12} {:>12} {:>12} {:>10} {:>7}\n", "name", "calls", "excl ms", "incl ms",
+                  "ns/call", "excl %" );
+  for ( size_t i = 0; i < rows.size() && i < top; i++ ) {
+    Row const   &row = rows[i];
+    double const exclusiveNs = profiler.TicksToNs( row.exclusive );
+    fmt::format_to( inserter, "  {:<16} {:>12} {:>12.3f} {:>12.3f} {:>10.1f} {:>6.2f}%\n", row.name, row.calls,
+                    exclusiveNs / 1e6, profiler.TicksToNs( row.inclusive ) / 1e6,
+                    exclusiveNs / static_cast<double>( row.calls ),
+                    total == 0 ? 0.0 : 100.0 * static_cast<double>( row.exclusive ) / static_cast<double>( total ) );
+  }
+  if ( rows.size() > top ) {
+    fmt::format_to( inserter, "  ... {} more\n", rows.size() - top );
+  }
+}
+} // namespace
+
+/*
+################################
+||          Profiler          ||
+################################
+*/
+HostProfiler &Get()
+{
+  static HostProfiler profiler;
+  return profiler;
+}
+
+u64 HostProfiler::Now()
+{
+#if defined( __x86_64__ ) || defined( __i386__ )
+  return __rdtsc();
+#elif defined( __aarch64__ )
+  u64 ticks = 0;
+  asm volatile( "mrs %0, cntvct_el0" : "=r"( ticks ) );
+  return ticks;
+#else
+  return SteadyNs();
+#endif
+}
+
+void HostProfiler::Reset()
+{
+  _stats = {};
+  _depth = 0;
+  _overflows = 0;
+  _startTicks = Now();
+  _startNs = SteadyNs();
+  _last = _startTicks;
+}
+
+double HostProfiler::TicksToNs( u64 ticks ) const
+{
+  /** @brief Scales timestamp ticks by the tick rate measured since the last Reset() */
+  u64 const elapsedTicks = Now() - _startTicks;
+  u64 const elapsedNs = SteadyNs() - _startNs;
+  if ( elapsedTicks == 0 ) {
+    return 0.0;
+  }
+  return static_cast<double>( ticks ) * static_cast<double>( elapsedNs ) / static_cast<double>( elapsedTicks );
+}
+
+std::string_view HostProfiler::CounterName( Counter counter )
+{
+  if ( counter < PpuTick ) {
+    return gInstructionNames[counter];
+  }
+  switch ( counter ) {
+    case PpuTick:            return "Tick";
+    case PpuVisibleScanline: return "VisibleScanline";
+    case PpuSpriteEval:      return "SpriteEval";
+    case PpuFetchSpriteData: return "FetchSpriteData";
+    case PpuGetOutputPixel:  return "GetOutputPixel";
+    case PpuRenderScanline:  return "RenderScanline";
+    case PpuRenderTile:      return "RenderTile";
+    case BusRam:             return "RAM";
+    case BusPpuRegisters:    return "PPU registers";
+    case BusApuIo:           return "APU / IO";
+    case BusCartridge:       return "Cartridge";
+    default:                 return "?";
+  }
+}
+
+std::string HostProfiler::Report( size_t top ) const
+{
+  /** @brief Tables of opcodes, addressing modes, PPU phases, and bus regions, costliest first
+   * The percentages are of the total exclusive time, so they add up to 100 across all tables.
+   * Addressing modes are not timed separately: the dispatch loop runs the mode and the operation as
+   * one handler, so each mode's row adds up the opcodes that use it.
+   */
+  u64 total = 0;
+  for ( const auto &stats : _stats ) {
+    total += stats.exclusive;
+  }
+
+  std::vector<Row> opcodes;
+  std::array<Row, static_cast<size_t>( AddrMode::Count )> modes{};
+  for ( size_t mode = 0; mode < modes.size(); mode++ ) {
+    modes[mode].name = std::string( gAddrModeNames[mode] );
+  }
+  for ( u16 op = 0; op < 256; op++ ) {
+    Stats const &stats = _stats[op];
+    // Several opcodes share a mnemonic, so rows are named like "A9 LDA IMM"
+    auto const mode = static_cast<size_t>( gOpcodeInfo[op].addrMode );
+    std::string name = fmt::format( "{:02X} {} {}", op, gInstructionNames[op], gAddrModeNames[mode] );
+    opcodes.push_back( { std::move( name ), stats.calls, stats.inclusive, stats.exclusive } );
+    Row &modeRow = modes[mode];
+    modeRow.calls += stats.calls;
+    modeRow.inclusive += stats.inclusive;
+    modeRow.exclusive += stats.exclusive;
+  }
+
+  auto rowsFor = [this]( Counter first, Counter last ) {
+    std::vector<Row> rows;
+    for ( u16 id = first; id <= last; id++ ) {
+      Stats const &stats = _stats[id];
+      std::string name( CounterName( static_cast<Counter>( id ) ) );
+      rows.push_back( { std::move( name ), stats.calls, stats.inclusive, stats.exclusive } );
+    }
+    return rows;
+  };
+
+  std::string out;
+  fmt::format_to( std::back_inserter( out ), "Total profiled: {:.3f} ms\n", TicksToNs( total ) / 1e6 );
+  AppendTable( out, *this, "Opcodes", std::move( opcodes ), total, top );
+  AppendTable( out, *this, "Addressing modes", { modes.begin(), modes.end() }, total, top );
+  AppendTable( out, *this, "PPU", rowsFor( PpuTick, PpuRenderTile ), total, top );
+  AppendTable( out, *this, "Bus", rowsFor( BusRam, BusCartridge ), total, top );
+  return out;
+}
+
+} // namespace profiler
@@ -0,0 +1,156 @@
+#pragma once
+
+#include "global-types.h"
+#include <array>
+#include <cstddef>
+#include <string>
+#include <string_view>
+
+// Host profiler, compiled in with -DHOST_PROFILER=ON (see CMakeLists.txt). When it's off, the
+// NES_PROFILE_SCOPE hooks expand to nothing and cost nothing.
+#ifndef NES_HOST_PROFILER
+#define NES_HOST_PROFILER 0
+#endif
+
+/*
+################################################################
+||                                                            ||
+||                        Host Profiler                       ||
+||                                                            ||
+################################################################
+*/
+namespace profiler
+{
+
+// What host time is attributed to. The first 256 counters are opcodes
+enum Counter : u16 {
+  Opcode = 0,
+  PpuTick = 256,
+  PpuVisibleScanline,
+  PpuSpriteEval,
+  PpuFetchSpriteData,
+  PpuGetOutputPixel,
+  PpuRenderScanline,
+  PpuRenderTile,
+  BusRam,
+  BusPpuRegisters,
+  BusApuIo,
+  BusCartridge,
+  CounterCount
+};
+
+constexpr Counter BusRegion( u16 address )
+{
+  if ( address < 0x2000 ) {
+    return BusRam;
+  }
+  if ( address < 0x4000 ) {
+    return BusPpuRegisters;
+  }
+  return address < 0x4020 ? BusApuIo : BusCartridge;
+}
+
+/*
+ * @brief Attributes host time to nested scopes
+ *
+ * Timestamps come from the CPU timestamp counter where there is one (rdtsc on x86, cntvct on arm64) and
+ * from steady_clock otherwise, and are converted to nanoseconds when the report is built. Every counter
+ * keeps its call count, its inclusive time, and its exclusive time: the part not spent in a nested
+ * scope. An opcode's exclusive time is the handler itself, while the PPU ticks and bus accesses it
+ * triggers are charged to their own counters.
+ */
+class HostProfiler
+{
+public:
+  HostProfiler() { Reset(); }
+
+  struct Stats {
+    u64 calls = 0;
+    u64 inclusive = 0; // Timestamp ticks
+    u64 exclusive = 0;
+  };
+
+  void Enter( Counter counter )
+  {
+    u64 const now = Now();
+    if ( _depth == maxDepth ) {
+      _overflows++;
+      return;
+    }
+    if ( _depth > 0 ) {
+      _stats[_stack[_depth - 1].counter].exclusive += now - _last;
+    }
+    _stack[_depth++] = { counter, now };
+    _last = now;
+  }
+
+  void Leave()
+  {
+    u64 const now = Now();
+    if ( _overflows > 0 ) {
+      _overflows--;
+      return;
+    }
+    Frame const &frame = _stack[--_depth];
+    Stats       &stats = _stats[frame.counter];
+    stats.calls++;
+    stats.inclusive += now - frame.start;
+    stats.exclusive += now - _last;
+    _last = now;
+  }
+
+  void         Reset();
+  Stats const &GetStats( Counter counter ) const { return _stats[counter]; }
+  double       TicksToNs( u64 ticks ) const;
+
+  // Sorted by exclusive time, `top` rows per table
+  std::string Report( size_t top = 25 ) const;
+
+  static u64              Now();
+  static std::string_view CounterName( Counter counter );
+
+  static constexpr size_t maxDepth = 16;
+
+private:
+  struct Frame {
+    Counter counter;
+    u64     start;
+  };
+
+  std::array<Stats, CounterCount> _stats{};
+  std::array<Frame, maxDepth>     _stack{};
+  size_t                          _depth = 0;
+  size_t                          _overflows = 0;
+  u64                             _last = 0;
+
+  // Wall clock reference taken at Reset(), to convert timestamp ticks to nanoseconds
+  u64 _startTicks = 0;
+  u64 _startNs = 0;
+};
+
+// The emulator runs on one thread, so there's a single profiler
+HostProfiler &Get();
+
+class Scope
+{
+public:
+  explicit Scope( Counter counter ) { Get().Enter( counter ); }
+  ~Scope() { Get().Leave(); }
+
+  Scope( const Scope & ) = delete;
+  Scope &operator=( const Scope & ) = delete;
+  Scope( Scope && ) = delete;
+  Scope &operator=( Scope && ) = delete;
+};
+
+} // namespace profiler
+
+#define NES_PROFILE_CONCAT_INNER( a, b ) a##b
+#define NES_PROFILE_CONCAT( a, b ) NES_PROFILE_CONCAT_INNER( a, b )
+
+#if NES_HOST_PROFILER
+#define NES_PROFILE_SCOPE( counter )                                                                                   \
+  profiler::Scope const NES_PROFILE_CONCAT( profileScope, __LINE__ )( static_cast<profiler::Counter>( counter ) )
+#else
+#define NES_PROFILE_SCOPE( counter ) static_cast<void>( 0 )
+#endif
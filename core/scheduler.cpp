@@ -0,0 +1,124 @@
+#include "scheduler.h"
+#include "global-types.h"
+#include <cstddef>
+
+/*
+################################
+||     Scheduler Methods      ||
+################################
+*/
+void Scheduler::Schedule( EventType type, u64 timestamp )
+{
+  u8 const slot = _slots[Index( type )];
+  if ( slot == noSlot ) {
+    Place( _size++, { timestamp, type } );
+    SiftUp( _size - 1 );
+  } else {
+    u64 const previous = _heap[slot].timestamp;
+    _heap[slot].timestamp = timestamp;
+    if ( timestamp < previous ) {
+      SiftUp( slot );
+    } else {
+      SiftDown( slot );
+    }
+  }
+  UpdateNext();
+}
+
+void Scheduler::Cancel( EventType type )
+{
+  u8 const slot = _slots[Index( type )];
+  if ( slot != noSlot ) {
+    RemoveAt( slot );
+    UpdateNext();
+  }
+}
+
+void Scheduler::Clear()
+{
+  _slots = MakeEmptySlots();
+  _size = 0;
+  UpdateNext();
+}
+
+bool Scheduler::PopDue( u64 now, EventType &type )
+{
+  if ( _size == 0 || _heap[0].timestamp > now ) {
+    return false;
+  }
+  type = _heap[0].type;
+  RemoveAt( 0 );
+  UpdateNext();
+  return true;
+}
+
+void Scheduler::Rebase( u64 oldNow, u64 newNow )
+{
+  for ( size_t slot = 0; slot < _size; slot++ ) {
+    u64 &timestamp = _heap[slot].timestamp;
+    timestamp = timestamp >= oldNow ? newNow + ( timestamp - oldNow ) : newNow;
+  }
+  // Clamping can tie events that weren't tied before, so rebuild the heap
+  for ( size_t slot = _size / 2; slot-- > 0; ) {
+    SiftDown( slot );
+  }
+  UpdateNext();
+}
+
+/*
+################################
+||         Heap Helpers       ||
+################################
+*/
+void Scheduler::Place( size_t slot, const Event &event )
+{
+  _heap[slot] = event;
+  _slots[Index( event.type )] = static_cast<u8>( slot );
+}
+
+void Scheduler::SiftUp( size_t slot )
+{
+  Event const event = _heap[slot];
+  while ( slot > 0 ) {
+    size_t const parent = ( slot - 1 ) / 2;
+    if ( !Earlier( event, _heap[parent] ) ) {
+      break;
+    }
+    Place( slot, _heap[parent] );
+    slot = parent;
+  }
+  Place( slot, event );
+}
+
+void Scheduler::SiftDown( size_t slot )
+{
+  Event const event = _heap[slot];
+  for ( ;; ) {
+    size_t child = ( slot * 2 ) + 1;
+    if ( child >= _size ) {
+      break;
+    }
+    if ( child + 1 < _size && Earlier( _heap[child + 1], _heap[child] ) ) {
+      child++;
+    }
+    if ( !Earlier( _heap[child], event ) ) {
+      break;
+    }
+    Place( slot, _heap[child] );
+    slot = child;
+  }
+  Place( slot, event );
+}
+
+void Scheduler::RemoveAt( size_t slot )
+{
+  _slots[Index( _heap[slot].type )] = noSlot;
+  _size--;
+  if ( slot == _size ) {
+    return;
+  }
+  // Fill the hole with the last event, and move it whichever way it needs to go
+  Place( slot, _heap[_size] );
+  SiftDown( slot );
+  SiftUp( slot );
+}
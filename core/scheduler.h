@@ -0,0 +1,94 @@
+#pragma once
+
+#include "global-types.h"
+#include <array>
+#include <cstddef>
+#include <limits>
+
+/*
+################################################################
+||                                                            ||
+||                       Event Scheduler                      ||
+||                                                            ||
+################################################################
+*/
+
+// Timestamps are in ticks of the NTSC master clock (21.477 MHz): a CPU cycle is 12 ticks and a PPU dot 4, so
+// events of every chip can share one timeline
+namespace timing
+{
+constexpr u64 masterTicksPerCpuCycle = 12;
+constexpr u64 masterTicksPerDot = 4;
+} // namespace timing
+
+// Ordered by priority: events due at the same tick run in this order
+enum class EventType : u8 {
+  Nmi,      // The PPU's vblank dot, which sets the vblank flag and raises the NMI
+  FrameEnd, // The last dot of the frame
+  Count
+};
+
+/*
+ * @brief Deadlines registered by the components, earliest first
+ * A min-heap with room for one pending event per type. Scheduling a type that is already pending moves it.
+ * The CPU only compares the master clock against GetNextTimestamp() on every cycle, and hands the due
+ * events to Bus::RunEvents(), so everything between two deadlines runs straight through.
+ */
+class Scheduler
+{
+public:
+  static constexpr u64 never = std::numeric_limits<u64>::max();
+
+  void Schedule( EventType type, u64 timestamp );
+  void Cancel( EventType type );
+  void Clear();
+
+  bool IsScheduled( EventType type ) const { return _slots[Index( type )] != noSlot; }
+  u64  GetTimestamp( EventType type ) const
+  {
+    return IsScheduled( type ) ? _heap[_slots[Index( type )]].timestamp : never;
+  }
+  u64    GetNextTimestamp() const { return _next; }
+  bool   IsDue( u64 now ) const { return now >= _next; }
+  size_t Size() const { return _size; }
+
+  // Takes the earliest event off the heap if it's due by `now`
+  bool PopDue( u64 now, EventType &type );
+
+  // Moves every pending event by the same amount, when the clock they are timed on is set to a new value.
+  // Events that were already due stay due
+  void Rebase( u64 oldNow, u64 newNow );
+
+private:
+  struct Event {
+    u64       timestamp;
+    EventType type;
+  };
+
+  static constexpr size_t capacity = static_cast<size_t>( EventType::Count );
+  static constexpr u8     noSlot = 0xFF;
+
+  static constexpr size_t Index( EventType type ) { return static_cast<size_t>( type ); }
+  static bool             Earlier( const Event &a, const Event &b )
+  {
+    return a.timestamp != b.timestamp ? a.timestamp < b.timestamp : a.type < b.type;
+  }
+
+  void Place( size_t slot, const Event &event );
+  void SiftUp( size_t slot );
+  void SiftDown( size_t slot );
+  void RemoveAt( size_t slot );
+  void UpdateNext() { _next = _size == 0 ? never : _heap[0].timestamp; }
+
+  std::array<Event, capacity> _heap{};
+  std::array<u8, capacity>    _slots = MakeEmptySlots(); // Heap slot of each type, or noSlot
+  size_t                      _size = 0;
+  u64                         _next = never;
+
+  static constexpr std::array<u8, capacity> MakeEmptySlots()
+  {
+    std::array<u8, capacity> slots{};
+    slots.fill( noSlot );
+    return slots;
+  }
+};
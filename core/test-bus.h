@@ -0,0 +1,27 @@
+#pragma once
+#include "bus.h"
+#include "global-types.h"
+#include <array>
+
+/*
+################################################################
+||                                                            ||
+||                          Test Bus                          ||
+||                                                            ||
+################################################################
+*/
+
+/*
+ * @brief A bus that can replace its memory map with 64 KiB of flat memory, for the JSON CPU tests
+ * The flat memory lives here rather than in every Bus, so only the tests pay for it. In JSON test mode
+ * every address reads and writes plain memory: no RAM mirrors, PPU registers or cartridge.
+ */
+class TestBus : public Bus
+{
+public:
+  void EnableJsonTestMode() { SetFlatMemory( _flatMemory.data() ); }
+  void DisableJsonTestMode() { SetFlatMemory( nullptr ); }
+
+private:
+  std::array<u8, 65536> _flatMemory{};
+};
@@ -0,0 +1,423 @@
+#include "trace-writer.h"
+#include "cpu-types.h"
+#include "global-types.h"
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <chrono>
+#include <cstring>
+#include <stdexcept>
+#include <utility>
+
+namespace
+{
+constexpr std::array<char, 8> fileMagic = { 'N', 'E', 'S', 'T', 'R', 'A', 'C', 'E' };
+constexpr std::array<char, 8> footerMagic = { 'N', 'E', 'S', 'T', 'R', 'I', 'D', 'X' };
+constexpr size_t              headerSize = 12;  // magic, version
+constexpr size_t              footerSize = 40;  // index offset, chunks, records, dropped, magic
+constexpr size_t              indexEntrySize = 20; // offset, first cycle, records
+
+// Field mask of an encoded record
+enum TraceField : u8 {
+  FieldPc = 1 << 0,
+  FieldInstruction = 1 << 1,
+  FieldA = 1 << 2,
+  FieldX = 1 << 3,
+  FieldY = 1 << 4,
+  FieldS = 1 << 5,
+  FieldP = 1 << 6,
+  FieldPpu = 1 << 7,
+};
+
+template <typename T> void AppendLE( std::vector<u8> &out, T value )
+{
+  for ( size_t i = 0; i < sizeof( T ); i++ ) {
+    out.push_back( static_cast<u8>( value >> ( i * 8 ) ) );
+  }
+}
+
+template <typename T> T ReadLE( const u8 *data )
+{
+  T value = 0;
+  for ( size_t i = 0; i < sizeof( T ); i++ ) {
+    value |= static_cast<T>( data[i] ) << ( i * 8 );
+  }
+  return value;
+}
+
+void AppendVarint( std::vector<u8> &out, u64 value )
+{
+  while ( value >= 0x80 ) {
+    out.push_back( static_cast<u8>( value | 0x80 ) );
+    value >>= 7;
+  }
+  out.push_back( static_cast<u8>( value ) );
+}
+
+/*
+ * @brief Bounds checked cursor over an encoded chunk
+ */
+struct ChunkCursor {
+  const u8 *data;
+  size_t    size;
+  size_t    pos = 0;
+  bool      ok = true;
+
+  u8 Byte()
+  {
+    if ( pos >= size ) {
+      ok = false;
+      return 0;
+    }
+    return data[pos++];
+  }
+  u16 Word()
+  {
+    u8 const low = Byte();
+    return low | ( Byte() << 8 );
+  }
+  u64 Varint()
+  {
+    u64 value = 0;
+    for ( int shift = 0; shift < 64; shift += 7 ) {
+      u8 const byte = Byte();
+      value |= static_cast<u64>( byte & 0x7F ) << shift;
+      if ( ( byte & 0x80 ) == 0 ) {
+        return value;
+      }
+    }
+    ok = false;
+    return value;
+  }
+};
+
+// Where the PPU is expected to be after `cycles` CPU cycles, ignoring the skipped dot of odd frames
+void AdvancePpu( u16 &scanline, u16 &dot, u64 cycles )
+{
+  u64 const dots = dot + ( cycles * 3 );
+  dot = static_cast<u16>( dots % 341 );
+  scanline = static_cast<u16>( ( scanline + ( dots / 341 ) ) % 262 );
+}
+
+// Opcode, then its operands, with unused operand bytes zeroed
+std::array<u8, 3> InstructionBytes( const TraceRecord &record )
+{
+  u8 const length = gOpcodeInfo[record.opcode].bytes;
+  return { record.opcode, length > 1 ? record.operand[0] : u8( 0 ), length > 2 ? record.operand[1] : u8( 0 ) };
+}
+} // namespace
+
+/*
+################################################################
+||                                                            ||
+||                       Chunk Encoding                       ||
+||                                                            ||
+################################################################
+*/
+TraceChunkCodec::TraceChunkCodec() : _instructions( std::make_unique<Instruction[]>( 0x10000 ) )
+{
+}
+
+void TraceChunkCodec::Begin()
+{
+  // Bumping the chunk number invalidates the whole instruction table without clearing it
+  _chunk++;
+  _previous = TraceRecord{};
+  _hasPrevious = false;
+}
+
+TraceRecord TraceChunkCodec::Predict() const
+{
+  TraceRecord predicted{};
+  if ( _hasPrevious ) {
+    predicted = _previous;
+    predicted.pc = _previous.pc + gOpcodeInfo[_previous.opcode].bytes;
+  }
+  return predicted;
+}
+
+void TraceChunkCodec::Encode( const std::vector<TraceRecord> &records, std::vector<u8> &out )
+{
+  Begin();
+  for ( const auto &record : records ) {
+    TraceRecord const       predicted = Predict();
+    std::array<u8, 3> const bytes = InstructionBytes( record );
+    Instruction            &cached = _instructions[record.pc];
+    bool const instructionKnown = cached.chunk == _chunk && std::memcmp( cached.bytes, bytes.data(), 3 ) == 0;
+
+    u64 const cycleDelta = record.cycle - predicted.cycle;
+    u16       scanline = predicted.scanline;
+    u16       dot = predicted.dot;
+    AdvancePpu( scanline, dot, cycleDelta );
+
+    u8 mask = 0;
+    mask |= record.pc != predicted.pc ? FieldPc : 0;
+    mask |= !instructionKnown ? FieldInstruction : 0;
+    mask |= record.a != predicted.a ? FieldA : 0;
+    mask |= record.x != predicted.x ? FieldX : 0;
+    mask |= record.y != predicted.y ? FieldY : 0;
+    mask |= record.s != predicted.s ? FieldS : 0;
+    mask |= record.p != predicted.p ? FieldP : 0;
+    mask |= !_hasPrevious || record.dot != dot || record.scanline != scanline ? FieldPpu : 0;
+
+    out.push_back( mask );
+    AppendVarint( out, cycleDelta );
+    if ( mask & FieldPc ) {
+      AppendLE<u16>( out, record.pc );
+    }
+    if ( mask & FieldInstruction ) {
+      out.insert( out.end(), bytes.begin(), bytes.begin() + gOpcodeInfo[record.opcode].bytes );
+      cached.chunk = _chunk;
+      std::memcpy( cached.bytes, bytes.data(), 3 );
+    }
+    for ( auto const &[field, value] : { std::pair{ FieldA, record.a }, std::pair{ FieldX, record.x },
+                                         std::pair{ FieldY, record.y }, std::pair{ FieldS, record.s },
+                                         std::pair{ FieldP, record.p } } ) {
+      if ( mask & field ) {
+        out.push_back( value );
+      }
+    }
+    if ( mask & FieldPpu ) {
+      AppendLE<u16>( out, record.scanline );
+      AppendLE<u16>( out, record.dot );
+    }
+
+    _previous = record;
+    _hasPrevious = true;
+  }
+}
+
+bool TraceChunkCodec::Decode( const u8 *data, size_t size, u32 count, std::vector<TraceRecord> &out )
+{
+  Begin();
+  out.clear();
+  out.reserve( count );
+
+  ChunkCursor cursor{ data, size };
+  for ( u32 i = 0; i < count && cursor.ok; i++ ) {
+    TraceRecord record = Predict();
+    u8 const    mask = cursor.Byte();
+    u64 const   cycleDelta = cursor.Varint();
+    record.cycle += cycleDelta;
+
+    AdvancePpu( record.scanline, record.dot, cycleDelta );
+
+    if ( mask & FieldPc ) {
+      record.pc = cursor.Word();
+    }
+    Instruction &cached = _instructions[record.pc];
+    if ( mask & FieldInstruction ) {
+      cached.chunk = _chunk;
+      cached.bytes[0] = cursor.Byte();
+      u8 const length = gOpcodeInfo[cached.bytes[0]].bytes;
+      cached.bytes[1] = length > 1 ? cursor.Byte() : 0;
+      cached.bytes[2] = length > 2 ? cursor.Byte() : 0;
+    } else if ( cached.chunk != _chunk ) {
+      return false;
+    }
+    record.opcode = cached.bytes[0];
+    record.operand[0] = cached.bytes[1];
+    record.operand[1] = cached.bytes[2];
+
+    record.a = ( mask & FieldA ) ? cursor.Byte() : record.a;
+    record.x = ( mask & FieldX ) ? cursor.Byte() : record.x;
+    record.y = ( mask & FieldY ) ? cursor.Byte() : record.y;
+    record.s = ( mask & FieldS ) ? cursor.Byte() : record.s;
+    record.p = ( mask & FieldP ) ? cursor.Byte() : record.p;
+    if ( mask & FieldPpu ) {
+      record.scanline = cursor.Word();
+      record.dot = cursor.Word();
+    }
+
+    out.push_back( record );
+    _previous = record;
+    _hasPrevious = true;
+  }
+  return cursor.ok && cursor.pos == size;
+}
+
+/*
+################################################################
+||                                                            ||
+||                        Trace Writer                        ||
+||                                                            ||
+################################################################
+*/
+TraceWriter::TraceWriter( const std::string &path, size_t queueCapacity, u32 chunkRecords )
+    : _file( path, std::ios::out | std::ios::binary | std::ios::trunc ), _chunkRecords( std::max<u32>( chunkRecords, 1 ) )
+{
+  if ( !_file ) {
+    throw std::runtime_error( "Could not open '" + path + "' for writing" );
+  }
+
+  // One slot always stays empty, so the ring holds queueCapacity records
+  size_t const slots = std::bit_ceil( std::max<size_t>( queueCapacity, 1 ) + 1 );
+  _queue.resize( slots );
+  _mask = slots - 1;
+  _chunk.reserve( _chunkRecords );
+
+  std::vector<u8> header( fileMagic.begin(), fileMagic.end() );
+  AppendLE<u32>( header, version );
+  _file.write( reinterpret_cast<const char *>( header.data() ), static_cast<std::streamsize>( header.size() ) );
+
+  _thread = std::thread( &TraceWriter::Run, this );
+}
+
+TraceWriter::~TraceWriter()
+{
+  try {
+    Close();
+  } catch ( ... ) { // NOLINT(bugprone-empty-catch)
+    // Nothing sensible to do with a failed write while unwinding
+  }
+}
+
+void TraceWriter::Close()
+{
+  if ( _closed ) {
+    return;
+  }
+  _closed = true;
+  _stopping.store( true, std::memory_order_release );
+  _thread.join();
+
+  if ( !_chunk.empty() ) {
+    WriteChunk();
+  }
+
+  std::vector<u8> footer;
+  u64 const       indexOffset = static_cast<u64>( _file.tellp() );
+  for ( const auto &entry : _index ) {
+    AppendLE<u64>( footer, entry.offset );
+    AppendLE<u64>( footer, entry.firstCycle );
+    AppendLE<u32>( footer, entry.records );
+  }
+  AppendLE<u64>( footer, indexOffset );
+  AppendLE<u64>( footer, _index.size() );
+  AppendLE<u64>( footer, GetWritten() );
+  AppendLE<u64>( footer, GetDropped() );
+  footer.insert( footer.end(), footerMagic.begin(), footerMagic.end() );
+  _file.write( reinterpret_cast<const char *>( footer.data() ), static_cast<std::streamsize>( footer.size() ) );
+  _file.close();
+  if ( !_file ) {
+    throw std::runtime_error( "Failed to finish writing the trace file" );
+  }
+}
+
+void TraceWriter::Run()
+{
+  /** @brief Writer thread: drains the ring into chunks until Close() is called and the ring is empty
+   */
+  for ( ;; ) {
+    size_t       tail = _tail.load( std::memory_order_relaxed );
+    size_t const head = _head.load( std::memory_order_acquire );
+    if ( tail == head ) {
+      if ( _stopping.load( std::memory_order_acquire ) && head == _head.load( std::memory_order_acquire ) ) {
+        return;
+      }
+      std::this_thread::sleep_for( std::chrono::microseconds( 200 ) );
+      continue;
+    }
+
+    while ( tail != head ) {
+      _chunk.push_back( _queue[tail] );
+      tail = ( tail + 1 ) & _mask;
+      _tail.store( tail, std::memory_order_release );
+      if ( _chunk.size() == _chunkRecords ) {
+        WriteChunk();
+      }
+    }
+  }
+}
+
+void TraceWriter::WriteChunk()
+{
+  _encoded.clear();
+  AppendLE<u32>( _encoded, 0 ); // Sizes, filled in below
+  AppendLE<u32>( _encoded, 0 );
+  _codec.Encode( _chunk, _encoded );
+
+  u32 const records = static_cast<u32>( _chunk.size() );
+  u32 const bytes = static_cast<u32>( _encoded.size() - 8 );
+  for ( size_t i = 0; i < 4; i++ ) {
+    _encoded[i] = static_cast<u8>( records >> ( i * 8 ) );
+    _encoded[4 + i] = static_cast<u8>( bytes >> ( i * 8 ) );
+  }
+
+  _index.push_back( { static_cast<u64>( _file.tellp() ), _chunk.front().cycle, records } );
+  _file.write( reinterpret_cast<const char *>( _encoded.data() ), static_cast<std::streamsize>( _encoded.size() ) );
+  _written.fetch_add( records, std::memory_order_relaxed );
+  _chunk.clear();
+}
+
+/*
+################################################################
+||                                                            ||
+||                        Trace Reader                        ||
+||                                                            ||
+################################################################
+*/
+TraceReader::TraceReader( const std::string &path ) : _file( path, std::ios::in | std::ios::binary )
+{
+  if ( !_file ) {
+    throw std::runtime_error( "Could not open '" + path + "' for reading" );
+  }
+
+  auto const readBytes = [&]( u64 offset, size_t size ) {
+    std::vector<u8> bytes( size );
+    _file.seekg( static_cast<std::streamoff>( offset ) );
+    _file.read( reinterpret_cast<char *>( bytes.data() ), static_cast<std::streamsize>( size ) );
+    if ( !_file ) {
+      throw std::runtime_error( "'" + path + "' is truncated" );
+    }
+    return bytes;
+  };
+
+  _file.seekg( 0, std::ios::end );
+  u64 const fileSize = static_cast<u64>( _file.tellg() );
+  if ( fileSize < headerSize + footerSize ) {
+    throw std::runtime_error( "'" + path + "' is not a trace file" );
+  }
+
+  std::vector<u8> const header = readBytes( 0, headerSize );
+  std::vector<u8> const footer = readBytes( fileSize - footerSize, footerSize );
+  if ( !std::equal( fileMagic.begin(), fileMagic.end(), header.begin() ) ||
+       !std::equal( footerMagic.begin(), footerMagic.end(), footer.begin() + 32 ) ) {
+    throw std::runtime_error( "'" + path + "' is not a finished trace file" );
+  }
+  if ( ReadLE<u32>( header.data() + 8 ) != TraceWriter::version ) {
+    throw std::runtime_error( "'" + path + "' has an unsupported trace version" );
+  }
+
+  u64 const indexOffset = ReadLE<u64>( footer.data() );
+  u64 const chunks = ReadLE<u64>( footer.data() + 8 );
+  _records = ReadLE<u64>( footer.data() + 16 );
+  _dropped = ReadLE<u64>( footer.data() + 24 );
+  if ( indexOffset + ( chunks * indexEntrySize ) + footerSize != fileSize ) {
+    throw std::runtime_error( "'" + path + "' has a corrupt chunk index" );
+  }
+
+  std::vector<u8> const index = readBytes( indexOffset, chunks * indexEntrySize );
+  for ( u64 i = 0; i < chunks; i++ ) {
+    const u8 *entry = index.data() + ( i * indexEntrySize );
+    _index.push_back( { ReadLE<u64>( entry ), ReadLE<u64>( entry + 8 ), ReadLE<u32>( entry + 16 ) } );
+  }
+}
+
+void TraceReader::ReadChunk( size_t chunk, std::vector<TraceRecord> &records )
+{
+  IndexEntry const &entry = _index.at( chunk );
+
+  std::array<u8, 8> sizes{};
+  _file.clear();
+  _file.seekg( static_cast<std::streamoff>( entry.offset ) );
+  _file.read( reinterpret_cast<char *>( sizes.data() ), sizes.size() );
+  u32 const count = ReadLE<u32>( sizes.data() );
+  u32 const bytes = ReadLE<u32>( sizes.data() + 4 );
+  _encoded.resize( bytes );
+  _file.read( reinterpret_cast<char *>( _encoded.data() ), bytes );
+
+  if ( !_file || count != entry.records || !_codec.Decode( _encoded.data(), _encoded.size(), count, records ) ) {
+    throw std::runtime_error( "Trace chunk " + std::to_string( chunk ) + " is corrupt" );
+  }
+}
@@ -0,0 +1,186 @@
+#pragma once
+
+#include "global-types.h"
+#include "trace.h"
+#include <atomic>
+#include <cstddef>
+#include <fstream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+/*
+################################################################
+||                                                            ||
+||                       Chunk Encoding                       ||
+||                                                            ||
+################################################################
+*/
+
+/*
+ * @brief Packs records against the previous record of the same chunk
+ *
+ * Each record starts with a mask of the fields that differ from what the previous record predicts, and
+ * a varint cycle delta, followed by only the changed fields:
+ *   pc:          predicted from the previous pc plus its instruction length
+ *   instruction: the opcode and operands last seen at this pc in the chunk
+ *   a, x, y, s, p
+ *   scanline / dot: predicted by advancing the PPU 3 dots per CPU cycle
+ * Straight-line code and loops mostly shrink to 2-3 bytes per record. Chunks start from a blank state,
+ * so each one decodes on its own.
+ */
+class TraceChunkCodec
+{
+public:
+  TraceChunkCodec();
+
+  void Encode( const std::vector<TraceRecord> &records, std::vector<u8> &out );
+  // Returns false if the data is malformed
+  bool Decode( const u8 *data, size_t size, u32 count, std::vector<TraceRecord> &out );
+
+private:
+  struct Instruction {
+    u32 chunk; // Chunk the entry was written in, older entries are stale
+    u8  bytes[3];
+  };
+
+  void        Begin();
+  TraceRecord Predict() const;
+
+  std::unique_ptr<Instruction[]> _instructions; // One per address
+  u32                            _chunk = 0;
+  TraceRecord                    _previous{};
+  bool                           _hasPrevious = false;
+};
+
+/*
+################################################################
+||                                                            ||
+||                        Trace Writer                        ||
+||                                                            ||
+################################################################
+*/
+
+/*
+ * @brief Streams trace records to a file on a background thread
+ *
+ * The emulation thread hands records over through a single-producer / single-consumer ring and never
+ * waits: when the ring is full the record is dropped and counted. The writer thread packs records into
+ * chunks, encoding each record against the previous one (see TraceChunkCodec), and writes an index of
+ * the chunks when the file is closed, so a reader can jump to any chunk.
+ *
+ * File layout, little endian:
+ *   header:  "NESTRACE", u32 version
+ *   chunks:  u32 records, u32 bytes, encoded records
+ *   index:   per chunk u64 file offset, u64 first cycle, u32 records
+ *   footer:  u64 index offset, u64 chunks, u64 records, u64 dropped, "NESTRIDX"
+ */
+class TraceWriter
+{
+public:
+  explicit TraceWriter( const std::string &path, size_t queueCapacity = size_t( 1 ) << 16,
+                        u32 chunkRecords = u32( 1 ) << 14 );
+  ~TraceWriter();
+
+  TraceWriter( const TraceWriter & ) = delete;
+  TraceWriter &operator=( const TraceWriter & ) = delete;
+  TraceWriter( TraceWriter && ) = delete;
+  TraceWriter &operator=( TraceWriter && ) = delete;
+
+  /*
+  ################################
+  ||    Trace Writer Methods    ||
+  ################################
+  */
+  // Called from the emulation thread. Returns false if the record was dropped
+  bool Push( const TraceRecord &record )
+  {
+    size_t const head = _head.load( std::memory_order_relaxed );
+    size_t const next = ( head + 1 ) & _mask;
+    if ( next == _tail.load( std::memory_order_acquire ) ) {
+      _dropped.fetch_add( 1, std::memory_order_relaxed );
+      return false;
+    }
+    _queue[head] = record;
+    _head.store( next, std::memory_order_release );
+    return true;
+  }
+
+  // Writes everything still queued, then the chunk index. Called by the destructor if needed
+  void Close();
+
+  u64 GetWritten() const { return _written.load( std::memory_order_relaxed ); }
+  u64 GetDropped() const { return _dropped.load( std::memory_order_relaxed ); }
+
+  static constexpr u32 version = 1;
+
+private:
+  void Run();
+  void WriteChunk();
+
+  struct IndexEntry {
+    u64 offset;
+    u64 firstCycle;
+    u32 records;
+  };
+
+  std::ofstream            _file;
+  std::vector<TraceRecord> _queue;
+  size_t                   _mask = 0;
+  std::atomic<size_t>      _head = 0; // Written by the emulation thread
+  std::atomic<size_t>      _tail = 0; // Written by the writer thread
+  std::atomic<u64>         _written = 0;
+  std::atomic<u64>         _dropped = 0;
+  std::atomic<bool>        _stopping = false;
+  bool                     _closed = false;
+
+  // Only touched by the writer thread
+  u32                      _chunkRecords;
+  std::vector<TraceRecord> _chunk;
+  TraceChunkCodec          _codec;
+  std::vector<u8>          _encoded;
+  std::vector<IndexEntry>  _index;
+
+  std::thread _thread;
+};
+
+/*
+################################################################
+||                                                            ||
+||                        Trace Reader                        ||
+||                                                            ||
+################################################################
+*/
+
+/*
+ * @brief Reads files written by TraceWriter, one chunk at a time
+ * Throws std::runtime_error if the file is missing, truncated, or not a trace.
+ */
+class TraceReader
+{
+public:
+  explicit TraceReader( const std::string &path );
+
+  size_t GetChunkCount() const { return _index.size(); }
+  u64    GetRecordCount() const { return _records; }
+  u64    GetDropped() const { return _dropped; }
+  u64    GetChunkFirstCycle( size_t chunk ) const { return _index.at( chunk ).firstCycle; }
+
+  // Replaces the contents of `records` with the records of one chunk
+  void ReadChunk( size_t chunk, std::vector<TraceRecord> &records );
+
+private:
+  struct IndexEntry {
+    u64 offset;
+    u64 firstCycle;
+    u32 records;
+  };
+
+  std::ifstream           _file;
+  std::vector<IndexEntry> _index;
+  TraceChunkCodec         _codec;
+  std::vector<u8>         _encoded;
+  u64                     _records = 0;
+  u64                     _dropped = 0;
+};
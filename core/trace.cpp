@@ -0,0 +1,351 @@
+#include "trace.h"
+#include "cpu-types.h"
+#include "global-types.h"
+#include <algorithm>
+#include <charconv>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <utility>
+
+namespace
+{
+void AppendHex( std::string &out, u16 value, int width )
+{
+  for ( int shift = ( width - 1 ) * 4; shift >= 0; shift -= 4 ) {
+    out += "0123456789ABCDEF"[( value >> shift ) & 0xF];
+  }
+}
+
+void AppendPadded( std::string &out, const std::string &text, size_t width )
+{
+  out += text;
+  if ( text.size() < width ) {
+    out.append( width - text.size(), ' ' );
+  }
+}
+
+bool IsUnofficialMnemonic( Mnemonic mnemonic )
+{
+  switch ( mnemonic ) {
+    case Mnemonic::ALR:
+    case Mnemonic::ANC:
+    case Mnemonic::ANE:
+    case Mnemonic::ARR:
+    case Mnemonic::DCP:
+    case Mnemonic::ISC:
+    case Mnemonic::JAM:
+    case Mnemonic::LAS:
+    case Mnemonic::LAX:
+    case Mnemonic::LXA:
+    case Mnemonic::RLA:
+    case Mnemonic::RRA:
+    case Mnemonic::SAX:
+    case Mnemonic::SBX:
+    case Mnemonic::SHA:
+    case Mnemonic::SHX:
+    case Mnemonic::SHY:
+    case Mnemonic::SLO:
+    case Mnemonic::SRE:
+    case Mnemonic::TAS:
+      return true;
+    default:
+      return false;
+  }
+}
+
+template <typename T> bool ParseNumber( const std::string &line, size_t pos, size_t length, int base, T &value )
+{
+  if ( pos == std::string::npos || pos + length > line.size() ) {
+    return false;
+  }
+  auto const [ptr, ec] = std::from_chars( line.data() + pos, line.data() + pos + length, value, base );
+  return ec == std::errc() && ptr != line.data() + pos;
+}
+} // namespace
+
+/*
+################################
+||         Formatting         ||
+################################
+*/
+void AppendTraceLine( std::string &out, const TraceRecord &record, bool verbose ) // NOLINT
+{
+  /*
+   * @brief Disassembles a recorded instruction
+   * i.e. C000  4C F5 C5  JMP $C5F5       a: 00 x: 00 y: 00 s: FD p: 24 nv--dIzc  V: 0  H: 21   Cycle: 7
+   * The non verbose form leaves out the instruction bytes, the operand and the PPU / cycle counters.
+   */
+  OpcodeInfo const &info = gOpcodeInfo[record.opcode];
+  u16 const         operand = record.operand[0] | ( record.operand[1] << 8 );
+
+  AppendHex( out, record.pc, 4 );
+  out += ' ';
+
+  if ( verbose ) {
+    // Instruction bytes, padded so every line lines up
+    out += "  ";
+    AppendHex( out, record.opcode, 2 );
+    out += ' ';
+    for ( u8 i = 1; i < info.bytes; i++ ) {
+      AppendHex( out, record.operand[i - 1], 2 );
+      out += ' ';
+    }
+    out.append( 9 - ( info.bytes * 3 ), ' ' );
+  }
+
+  // Illegal opcodes are prefixed with a "*"
+  out += gInstructionNames[record.opcode];
+  out += ' ';
+
+  if ( verbose ) {
+    std::string assembly;
+    switch ( info.addrMode ) {
+      case AddrMode::IMP:
+        break;
+      case AddrMode::IMM:
+        assembly += "#$";
+        AppendHex( assembly, record.operand[0], 2 );
+        break;
+      case AddrMode::ZPG:
+      case AddrMode::ZPGX:
+      case AddrMode::ZPGY:
+        assembly += '$';
+        AppendHex( assembly, record.operand[0], 2 );
+        assembly += info.addrMode == AddrMode::ZPGX ? ", X" : info.addrMode == AddrMode::ZPGY ? ", Y" : "";
+        break;
+      case AddrMode::ABS:
+      case AddrMode::ABSX:
+      case AddrMode::ABSY:
+        assembly += '$';
+        AppendHex( assembly, operand, 4 );
+        assembly += info.addrMode == AddrMode::ABSX ? ", X" : info.addrMode == AddrMode::ABSY ? ", Y" : "";
+        break;
+      case AddrMode::IND:
+        assembly += "($";
+        AppendHex( assembly, operand, 4 );
+        assembly += ')';
+        break;
+      case AddrMode::INDX:
+      case AddrMode::INDY:
+        assembly += "($";
+        AppendHex( assembly, record.operand[0], 2 );
+        assembly += info.addrMode == AddrMode::INDX ? ", X)" : "), Y";
+        break;
+      case AddrMode::REL: {
+        s8 const  offset = static_cast<s8>( record.operand[0] );
+        u16 const address = record.pc + 2 + offset;
+        assembly += '$';
+        AppendHex( assembly, record.operand[0], 2 );
+        assembly += " [$";
+        AppendHex( assembly, address, 4 );
+        assembly += ']';
+        break;
+      }
+      default:
+        throw std::runtime_error( "Unknown addressing mode: " + std::string( gAddressingModes[record.opcode] ) );
+    }
+    AppendPadded( out, assembly, 15 );
+  }
+
+  // a: 00 x: 00 y: 00 s: FD p: 24 nv--dIzc
+  auto const reg = [&]( const char *name, u8 value ) {
+    out += name;
+    AppendHex( out, value, 2 );
+    out += ' ';
+  };
+  reg( "a: ", record.a );
+  reg( "x: ", record.x );
+  reg( "y: ", record.y );
+  reg( "s: ", record.s );
+  reg( "p: ", record.p );
+
+  // Letter present is flag set, lowercase is flag unset
+  constexpr std::string_view statusFlags = "NV-BDIZC";
+  constexpr std::string_view statusFlagsLower = "nv--dizc";
+  for ( int i = 7; i >= 0; i-- ) {
+    out += ( record.p & ( 1 << i ) ) != 0 ? statusFlags[7 - i] : statusFlagsLower[7 - i];
+  }
+
+  if ( verbose ) {
+    out += "  V: ";
+    out += std::to_string( record.scanline );
+    out += "  H: ";
+    AppendPadded( out, std::to_string( record.dot ), 4 );
+    out += "  Cycle: ";
+    out += std::to_string( record.cycle );
+  }
+}
+
+void AppendNestestTraceLine( std::string &out, const TraceRecord &record ) // NOLINT
+{
+  /*
+   * @brief i.e. C000  4C F5 C5  JMP $C5F5                       A:00 X:00 Y:00 P:24 SP:FD PPU:  0, 21 CYC:7
+   */
+  OpcodeInfo const &info = gOpcodeInfo[record.opcode];
+  u16 const         operand = record.operand[0] | ( record.operand[1] << 8 );
+  size_t const      lineStart = out.size();
+
+  AppendHex( out, record.pc, 4 );
+  out += "  ";
+  std::string bytes;
+  AppendHex( bytes, record.opcode, 2 );
+  for ( u8 i = 1; i < info.bytes; i++ ) {
+    bytes += ' ';
+    AppendHex( bytes, record.operand[i - 1], 2 );
+  }
+  AppendPadded( out, bytes, 8 );
+
+  // Unofficial opcodes take the column in front of the mnemonic for their "*". Nestest only stars the
+  // unofficial mnemonics and the duplicate NOPs / SBC, and spells ISC as ISB
+  Mnemonic const mnemonic = info.mnemonic;
+  bool const     unofficial = record.opcode == 0xEB || ( mnemonic == Mnemonic::NOP && record.opcode != 0xEA ) ||
+                          ( info.illegal && IsUnofficialMnemonic( mnemonic ) );
+  out += unofficial ? " *" : "  ";
+  out += mnemonic == Mnemonic::ISC ? "ISB" : gMnemonicNames[static_cast<size_t>( mnemonic )];
+
+  switch ( info.addrMode ) {
+    case AddrMode::IMP:
+      // Accumulator forms of the shifts
+      if ( record.opcode == 0x0A || record.opcode == 0x2A || record.opcode == 0x4A || record.opcode == 0x6A ) {
+        out += " A";
+      }
+      break;
+    case AddrMode::IMM:
+      out += " #$";
+      AppendHex( out, record.operand[0], 2 );
+      break;
+    case AddrMode::ZPG:
+    case AddrMode::ZPGX:
+    case AddrMode::ZPGY:
+      out += " $";
+      AppendHex( out, record.operand[0], 2 );
+      out += info.addrMode == AddrMode::ZPGX ? ",X" : info.addrMode == AddrMode::ZPGY ? ",Y" : "";
+      break;
+    case AddrMode::ABS:
+    case AddrMode::ABSX:
+    case AddrMode::ABSY:
+      out += " $";
+      AppendHex( out, operand, 4 );
+      out += info.addrMode == AddrMode::ABSX ? ",X" : info.addrMode == AddrMode::ABSY ? ",Y" : "";
+      break;
+    case AddrMode::IND:
+      out += " ($";
+      AppendHex( out, operand, 4 );
+      out += ')';
+      break;
+    case AddrMode::INDX:
+    case AddrMode::INDY:
+      out += " ($";
+      AppendHex( out, record.operand[0], 2 );
+      out += info.addrMode == AddrMode::INDX ? ",X)" : "),Y";
+      break;
+    case AddrMode::REL:
+      out += " $";
+      AppendHex( out, record.pc + 2 + static_cast<s8>( record.operand[0] ), 4 );
+      break;
+    default:
+      throw std::runtime_error( "Unknown addressing mode: " + std::string( gAddressingModes[record.opcode] ) );
+  }
+
+  // Registers start at column 48
+  size_t const width = out.size() - lineStart;
+  out.append( width < 48 ? 48 - width : 1, ' ' );
+
+  auto const reg = [&]( const char *label, u8 value ) {
+    out += label;
+    AppendHex( out, value, 2 );
+    out += ' ';
+  };
+  reg( "A:", record.a );
+  reg( "X:", record.x );
+  reg( "Y:", record.y );
+  reg( "P:", record.p );
+  reg( "SP:", record.s );
+
+  std::string const scanline = std::to_string( record.scanline );
+  std::string const dot = std::to_string( record.dot );
+  out += "PPU:";
+  out.append( scanline.size() < 3 ? 3 - scanline.size() : 0, ' ' );
+  out += scanline + ',';
+  out.append( dot.size() < 3 ? 3 - dot.size() : 0, ' ' );
+  out += dot + " CYC:" + std::to_string( record.cycle );
+}
+
+std::optional<TraceRecord> ParseTraceLine( const std::string &line )
+{
+  /*
+   * @brief Inverse of AppendTraceLine() for verbose lines, used to load traces stored in state files
+   */
+  TraceRecord record{};
+  if ( !ParseNumber( line, 0, 4, 16, record.pc ) || !ParseNumber( line, 7, 2, 16, record.opcode ) ) {
+    return std::nullopt;
+  }
+  for ( u8 i = 1; i < gOpcodeInfo[record.opcode].bytes; i++ ) {
+    if ( !ParseNumber( line, 7 + ( i * 3 ), 2, 16, record.operand[i - 1] ) ) {
+      return std::nullopt;
+    }
+  }
+
+  size_t const registers = line.find( "a: " );
+  if ( registers == std::string::npos || !ParseNumber( line, registers + 3, 2, 16, record.a ) ||
+       !ParseNumber( line, registers + 9, 2, 16, record.x ) || !ParseNumber( line, registers + 15, 2, 16, record.y ) ||
+       !ParseNumber( line, registers + 21, 2, 16, record.s ) || !ParseNumber( line, registers + 27, 2, 16, record.p ) ) {
+    return std::nullopt;
+  }
+
+  size_t const scanline = line.find( "V: " );
+  size_t const dot = line.find( "H: " );
+  size_t const cycle = line.find( "Cycle: " );
+  if ( scanline == std::string::npos || dot == std::string::npos || cycle == std::string::npos ||
+       !ParseNumber( line, scanline + 3, dot - scanline - 3, 10, record.scanline ) ||
+       !ParseNumber( line, dot + 3, cycle - dot - 3, 10, record.dot ) ||
+       !ParseNumber( line, cycle + 7, line.size() - cycle - 7, 10, record.cycle ) ) {
+    return std::nullopt;
+  }
+  return record;
+}
+
+/*
+################################
+||        Trace Buffer        ||
+################################
+*/
+void TraceBuffer::SetCapacity( size_t capacity )
+{
+  _records.assign( std::max<size_t>( capacity, 1 ), TraceRecord{} );
+  Clear();
+}
+
+void TraceBuffer::AppendText( std::string &out ) const
+{
+  for ( size_t i = 0; i < _size; i++ ) {
+    AppendTraceLine( out, ( *this )[i] );
+    out += '\n';
+  }
+}
+
+std::deque<std::string> TraceBuffer::GetLines() const
+{
+  std::deque<std::string> lines;
+  for ( size_t i = 0; i < _size; i++ ) {
+    std::string line;
+    AppendTraceLine( line, ( *this )[i] );
+    line += '\n';
+    lines.push_back( std::move( line ) );
+  }
+  return lines;
+}
+
+bool TraceBuffer::operator==( const TraceBuffer &other ) const
+{
+  if ( _size != other._size ) {
+    return false;
+  }
+  for ( size_t i = 0; i < _size; i++ ) {
+    if ( !( ( *this )[i] == other[i] ) ) {
+      return false;
+    }
+  }
+  return true;
+}
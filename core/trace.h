@@ -0,0 +1,133 @@
+#pragma once
+
+#include "global-types.h"
+#include <cstddef>
+#include <deque>
+#include <optional>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+#include <cereal/types/deque.hpp>
+#include <cereal/types/string.hpp>
+
+/*
+################################################################
+||                                                            ||
+||                        Trace Records                       ||
+||                                                            ||
+################################################################
+*/
+
+/*
+ * @brief Everything a trace line shows, captured at the start of an instruction
+ * Plain data, so recording it is a copy. Text is only produced by FormatTraceRecord(), when a line is
+ * actually displayed or written out.
+ */
+struct TraceRecord {
+  u64 cycle;
+  u16 pc;
+  u16 scanline;
+  u16 dot; // PPU cycle
+  u8  opcode;
+  u8  operand[2];
+  u8  a;
+  u8  x;
+  u8  y;
+  u8  s;
+  u8  p;
+
+  bool operator==( const TraceRecord & ) const = default;
+};
+static_assert( std::is_trivially_copyable_v<TraceRecord> );
+
+// Appends the trace line for a record, in the same format as CPU::LogLineAtPC(). No trailing newline
+void AppendTraceLine( std::string &out, const TraceRecord &record, bool verbose = true );
+// Appends the trace line for a record in the nestest.log format (see tests/logs), without the memory
+// values nestest prints after some operands. No trailing newline
+void AppendNestestTraceLine( std::string &out, const TraceRecord &record );
+// Parses a verbose trace line back into a record
+std::optional<TraceRecord> ParseTraceLine( const std::string &line );
+
+/*
+################################################################
+||                                                            ||
+||                        Trace Buffer                        ||
+||                                                            ||
+################################################################
+*/
+
+/*
+ * @brief Fixed capacity ring of trace records, overwriting the oldest when full
+ * Storage is only allocated by SetCapacity(), so Push() never touches the heap.
+ */
+class TraceBuffer
+{
+public:
+  explicit TraceBuffer( size_t capacity = 100 ) { SetCapacity( capacity ); }
+
+  /*
+  ################################
+  ||          Serialize         ||
+  ################################
+  */
+  // Written as text lines, like the deque of strings the trace used to be, so state files keep their layout
+  template <class Archive> void save( Archive &ar ) const // NOLINT
+  {
+    ar( GetLines() );
+  }
+  template <class Archive> void load( Archive &ar ) // NOLINT
+  {
+    std::deque<std::string> lines;
+    ar( lines );
+    Clear();
+    for ( const auto &line : lines ) {
+      if ( auto const record = ParseTraceLine( line ) ) {
+        Push( *record );
+      }
+    }
+  }
+
+  /*
+  ################################
+  ||    Trace Buffer Methods    ||
+  ################################
+  */
+  void Push( const TraceRecord &record )
+  {
+    _records[_head] = record;
+    _head = _head + 1 == _records.size() ? 0 : _head + 1;
+    if ( _size < _records.size() ) {
+      _size++;
+    }
+  }
+  void Clear()
+  {
+    _head = 0;
+    _size = 0;
+  }
+
+  // Drops everything recorded so far
+  void   SetCapacity( size_t capacity );
+  size_t GetCapacity() const { return _records.size(); }
+  size_t Size() const { return _size; }
+  bool   Empty() const { return _size == 0; }
+
+  // Oldest record first
+  TraceRecord const &operator[]( size_t index ) const
+  {
+    size_t const start = _head + _records.size() - _size;
+    return _records[( start + index ) % _records.size()];
+  }
+
+  // Formatted lines, oldest first, each ending in a newline
+  void                    AppendText( std::string &out ) const;
+  std::deque<std::string> GetLines() const;
+
+  bool operator==( const TraceBuffer &other ) const;
+
+private:
+  std::vector<TraceRecord> _records;
+  size_t                   _head = 0; // Where the next record goes
+  size_t                   _size = 0;
+};
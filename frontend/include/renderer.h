@@ -210,6 +210,7 @@ public:
     bus.cartridge.LoadRom( romFile );
     cpu.Reset();
     ppu.onFrameReady = [this]( const u32 *frameBuffer ) { this->ProcessPpuFrameBuffer( frameBuffer ); };
+    bus.engine.onApuFrameEnd = [this]() { apu.end_frame(); };
     currentFrame = ppu.frame;
 
     // Set sample rate and check for out of memory error
@@ -1380,17 +1381,20 @@ public:
 
   void ExecuteFrame()
   {
-    while ( currentFrame == ppu.frame ) {
-      if ( paused ) {
-        break;
-      }
-      bus.Clock();
+    // Runs to the end of the frame the PPU is in, also when the debugger stepped past the last one
+    if ( !paused && bus.RunFrame().breakpoint ) {
+      // Stay where the breakpoint stopped the frame, the debugger window shows the hit
+      paused = true;
+      ui.ShowDebuggerWindow();
+      NotifyStart( "Breakpoint hit" );
     }
     // End of frame, set the current frame to the next one.
     currentFrame = ppu.frame;
 
-    // generate 1/60th second of sound into APU's sample buffer
-    apu.end_frame();
+    // generate 1/60th second of sound into APU's sample buffer. The coroutine engine's APU did it already
+    if ( paused || !bus.engine.IsEnabled() ) {
+      apu.end_frame();
+    }
 
     long count = apu.read_samples( audioBuffer, audioBufferSize );
     PlaySamples( audioBuffer, count );
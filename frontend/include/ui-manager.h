@@ -31,6 +31,7 @@ public:
   // Window toggles
   void ToggleOverlay();
   void ToggleDebuggerWindow();
+  void ShowDebuggerWindow();
   void ToggleMemory();
   void ToggleLog();
   void ToggleCpu();
@@ -101,77 +101,62 @@ void UIComponent::DebugControls( const std::string &parentLabel )
       return debuggerStatus == TIMEOUT;
     };
 
-    auto execute = [&]() { renderer->bus.Clock(); };
+    // Runs one instruction at a time while `condition` holds. The PPU is caught up before every check, the
+    // conditions look at its position and flags
+    Bus &bus = renderer->bus;
+    auto runWhile = [&]( auto condition ) {
+      bus.RunUntil( [&]() {
+        bus.ppu.CatchUp();
+        return !condition() || didTimeout();
+      } );
+    };
+    auto vblank = [&]() { return bus.ppu.GetStatusVblank() != 0; };
+    auto noVblank = [&]() { return bus.ppu.GetStatusVblank() == 0; };
+    auto nmiEnabled = [&]() { return bus.ppu.GetCtrlNmiEnable() != 0; };
+    auto nmiDisabled = [&]() { return bus.ppu.GetCtrlNmiEnable() == 0; };
+    auto irqDisabled = [&]() { return bus.cpu.GetInterruptDisableFlag() != 0; };
+    auto irqEnabled = [&]() { return bus.cpu.GetInterruptDisableFlag() == 0; };
+
+    bus.ppu.CatchUp();
     switch ( item ) {
 
       case 0: { // Cycles
-        auto const target = renderer->bus.cpu.GetCycles() + i0;
-        while ( renderer->bus.cpu.GetCycles() < target && !didTimeout() ) {
-          execute();
-        }
+        auto const target = bus.cpu.GetCycles() + i0;
+        runWhile( [&]() { return bus.cpu.GetCycles() < target; } );
         break;
       }
-      case 1: // Instructions
-        for ( int i = 0; i < i0; i++ ) {
-          execute();
-        }
+      case 1: { // Instructions
+        int executed = 0;
+        bus.RunUntil( [&]() { return executed++ >= i0; } );
         break;
+      }
       case 2: // VBlank
-        if ( !renderer->bus.ppu.GetStatusVblank() ) {
-          while ( !renderer->bus.ppu.GetStatusVblank() && !didTimeout() ) {
-            execute();
-          }
-        } else {
-          while ( renderer->bus.ppu.GetStatusVblank() && !didTimeout() ) {
-            execute();
-          }
-          while ( !renderer->bus.ppu.GetStatusVblank() && !didTimeout() ) {
-            execute();
-          }
+        if ( vblank() ) {
+          runWhile( vblank );
         }
+        runWhile( noVblank );
         break;
       case 3: { // Scanlines
-        auto const target = renderer->bus.ppu.scanline + i0;
-        while ( renderer->bus.ppu.scanline < target && !didTimeout() ) {
-          execute();
-        }
+        auto const target = bus.ppu.scanline + i0;
+        runWhile( [&]() { return bus.ppu.scanline < target; } );
         break;
       }
       case 4: { // Frame
-        auto const target = renderer->bus.ppu.frame + i0;
-        while ( renderer->bus.ppu.frame < target && !didTimeout() ) {
-          execute();
-        }
+        auto const target = bus.ppu.frame + i0;
+        runWhile( [&]() { return bus.ppu.frame < target; } );
         break;
       }
-      case 5: { // NMI
-        if ( !renderer->bus.ppu.GetCtrlNmiEnable() ) {
-          while ( !renderer->bus.ppu.GetCtrlNmiEnable() && !didTimeout() ) {
-            execute();
-          }
-        } else {
-          while ( renderer->bus.ppu.GetCtrlNmiEnable() && !didTimeout() ) {
-            execute();
-          }
-          while ( !renderer->bus.ppu.GetCtrlNmiEnable() && !didTimeout() ) {
-            execute();
-          }
+      case 5: // NMI
+        if ( nmiEnabled() ) {
+          runWhile( nmiEnabled );
         }
+        runWhile( nmiDisabled );
         break;
-      } break;
       case 6: // IRQ
-        if ( !renderer->bus.cpu.GetInterruptDisableFlag() ) {
-          while ( !renderer->bus.cpu.GetInterruptDisableFlag() && !didTimeout() ) {
-            execute();
-          }
-        } else {
-          while ( renderer->bus.cpu.GetInterruptDisableFlag() && !didTimeout() ) {
-            execute();
-          }
-          while ( !renderer->bus.cpu.GetInterruptDisableFlag() && !didTimeout() ) {
-            execute();
-          }
+        if ( irqDisabled() ) {
+          runWhile( irqDisabled );
         }
+        runWhile( irqEnabled );
         break;
       default: break;
     }
@@ -51,6 +51,12 @@ void UIManager::ToggleDebuggerWindow()
     win->visible = !win->visible;
   }
 }
+void UIManager::ShowDebuggerWindow()
+{
+  if ( auto *win = GetComponent<DebuggerWindow>() ) {
+    win->visible = true;
+  }
+}
 void UIManager::ToggleMemory()
 {
   if ( auto *win = GetComponent<MemoryDisplayWindow>() ) {
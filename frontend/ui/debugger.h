@@ -3,7 +3,10 @@
 #include "renderer.h"
 #include "log.h"
 #include <imgui.h>
+#include <array>
 #include <chrono>
+#include <cstdio>
+#include <vector>
 
 class DebuggerWindow : public UIComponent
 {
@@ -32,12 +35,110 @@ public:
     if ( ImGui::Begin( "Debugger", &visible, windowFlags ) ) {
       RenderMenuBar();
       DebugControls( "Debugger debugger controls" ); // Defined in ui-component.cpp
+      ImGui::Dummy( ImVec2( 0, 5 ) );
+      RenderBreakpoints();
     }
     ImGui::End();
     ImGui::PopStyleVar();
   }
 
 private:
+  using Kind = Breakpoints::Kind;
+
+  static constexpr std::array<const char *, Breakpoints::kindCount> kindLabels = { "Execute", "Read", "Write",
+                                                                                  "PPU Read", "PPU Write" };
+  int  kindSelected = 0;
+  u16  firstAddress = 0x8000;
+  u16  lastAddress = 0x8000;
+  bool isRange = false;
+
+  void RenderBreakpoints()
+  {
+    Breakpoints &breakpoints = renderer->bus.breakpoints;
+
+    bool enabled = breakpoints.IsEnabled();
+    if ( ImGui::Checkbox( "Breakpoints", &enabled ) ) {
+      breakpoints.SetEnabled( enabled );
+    }
+    ImGui::SameLine();
+    if ( ImGui::Button( "Clear All" ) ) {
+      breakpoints.ClearAll();
+    }
+
+    // New breakpoint: a kind, an address, and optionally the last address of a range
+    ImGui::PushItemWidth( 100 );
+    ImGui::Combo( "##kind", &kindSelected, kindLabels.data(), static_cast<int>( kindLabels.size() ) );
+    ImGui::SameLine();
+    ImGui::InputScalar( "##first", ImGuiDataType_U16, &firstAddress, nullptr, nullptr, "%04X",
+                        ImGuiInputTextFlags_CharsHexadecimal );
+    ImGui::SameLine();
+    ImGui::Checkbox( "to", &isRange );
+    ImGui::SameLine();
+    ImGui::BeginDisabled( !isRange );
+    ImGui::InputScalar( "##last", ImGuiDataType_U16, &lastAddress, nullptr, nullptr, "%04X",
+                        ImGuiInputTextFlags_CharsHexadecimal );
+    ImGui::EndDisabled();
+    ImGui::PopItemWidth();
+    ImGui::SameLine();
+    if ( ImGui::Button( "Add" ) ) {
+      u16 const last = isRange && lastAddress > firstAddress ? lastAddress : firstAddress;
+      breakpoints.AddRange( static_cast<Kind>( kindSelected ), firstAddress, last );
+    }
+
+    // What stopped the emulator last
+    if ( auto const &hit = breakpoints.GetHit() ) {
+      ImGui::Text( "Hit: %s $%04X at pc $%04X, value $%02X", kindLabels.at( static_cast<size_t>( hit->kind ) ),
+                   hit->address, hit->pc, hit->value );
+    } else {
+      ImGui::TextDisabled( "No breakpoint hit" );
+    }
+
+    // Set breakpoints, consecutive addresses shown as one range
+    if ( ImGui::BeginTable( "Breakpoints", 3, ImGuiTableFlags_Borders | ImGuiTableFlags_RowBg ) ) {
+      ImGui::TableSetupColumn( "Kind" );
+      ImGui::TableSetupColumn( "Address" );
+      ImGui::TableSetupColumn( "" );
+      ImGui::TableHeadersRow();
+      for ( size_t k = 0; k < Breakpoints::kindCount; k++ ) {
+        auto const kind = static_cast<Kind>( k );
+        if ( breakpoints.Count( kind ) == 0 ) {
+          continue;
+        }
+        std::vector<u16> const addresses = breakpoints.List( kind );
+        for ( size_t i = 0; i < addresses.size(); ) {
+          size_t end = i;
+          while ( end + 1 < addresses.size() && addresses[end + 1] == addresses[end] + 1 ) {
+            end++;
+          }
+          RenderBreakpointRow( breakpoints, kind, addresses[i], addresses[end] );
+          i = end + 1;
+        }
+      }
+      ImGui::EndTable();
+    }
+  }
+
+  void RenderBreakpointRow( Breakpoints &breakpoints, Kind kind, u16 first, u16 last )
+  {
+    ImGui::TableNextRow();
+    ImGui::TableNextColumn();
+    ImGui::Text( "%s", kindLabels.at( static_cast<size_t>( kind ) ) );
+    ImGui::TableNextColumn();
+    if ( first == last ) {
+      ImGui::Text( "$%04X", first );
+    } else {
+      ImGui::Text( "$%04X-$%04X", first, last );
+    }
+    ImGui::TableNextColumn();
+    ImGui::PushID( static_cast<int>( ( static_cast<u32>( kind ) << 16 ) | first ) );
+    if ( ImGui::SmallButton( "Remove" ) ) {
+      for ( u32 address = first; address <= last; address++ ) {
+        breakpoints.Remove( kind, static_cast<u16>( address ) );
+      }
+    }
+    ImGui::PopID();
+  }
+
   void RenderMenuBar()
   {
     if ( ImGui::BeginMenuBar() ) {
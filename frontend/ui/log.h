@@ -2,6 +2,7 @@
 #include "ui-component.h"
 #include "renderer.h"
 #include <cstdint>
+#include <string>
 #include <imgui.h>
 
 #include <algorithm>
@@ -73,15 +74,15 @@ public:
         _lineOffsets.clear();
         _lineOffsets.push_back( 0 );
         lastCpuCycleLogged = currentCycle;
+
+        // The cpu only records raw trace records, the text is formatted here
+        _text.clear();
         if ( usingLogType == NORMAL ) {
-          for ( const auto &line : renderer->bus.cpu.GetTracelog() ) {
-            AddLog( line.c_str() );
-          }
+          renderer->bus.cpu.GetTraceRecords().AppendText( _text );
         } else {
-          for ( const auto &line : renderer->bus.cpu.GetMesenFormatTracelog() ) {
-            AddLog( line.c_str() );
-          }
+          renderer->bus.cpu.GetMesenFormatTraceRecords().AppendText( _text );
         }
+        AddLog( _text.c_str() );
       }
 
       // Options menu
@@ -100,11 +101,12 @@ public:
       bool const copy = ImGui::Button( "Copy" );
       ImGui::SameLine();
       ImGui::PushItemWidth( 120 );
-      static int inputSize = renderer->bus.cpu.traceSize;
+      static int inputSize = static_cast<int>( renderer->bus.cpu.GetTraceSize() );
       if ( ImGui::InputInt( "Max Lines", &inputSize ) ) {
         inputSize = std::max( inputSize, 1 );
         inputSize = std::min( inputSize, 10000 );
-        renderer->bus.cpu.traceSize = inputSize;
+        renderer->bus.cpu.SetTraceSize( inputSize );
+        renderer->bus.cpu.SetMesenTraceSize( inputSize );
       }
       ImGui::PopItemWidth();
 
@@ -181,6 +183,7 @@ public:
 
 private:
   ImGuiTextBuffer _buf;
+  std::string     _text; // Reused between frames
   ImGuiTextFilter _filter;
   ImVector<int>   _lineOffsets;
   bool            _autoScroll{ true };
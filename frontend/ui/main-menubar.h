@@ -85,6 +85,16 @@ public:
           renderer->bus.DebugReset();
           renderer->NotifyStart( "Reset" );
         }
+        bool skipIdleLoops = renderer->bus.idleLoop.IsEnabled();
+        if ( ImGui::MenuItem( "Skip Idle Loops", nullptr, &skipIdleLoops ) ) {
+          renderer->bus.idleLoop.SetEnabled( skipIdleLoops );
+          renderer->NotifyStart( skipIdleLoops ? "Idle loop skipping on" : "Idle loop skipping off" );
+        }
+        bool coroutineEngine = renderer->bus.engine.IsEnabled();
+        if ( ImGui::MenuItem( "Coroutine Engine (Experimental)", nullptr, &coroutineEngine ) ) {
+          renderer->bus.engine.SetEnabled( coroutineEngine );
+          renderer->NotifyStart( coroutineEngine ? "Coroutine engine on" : "Coroutine engine off" );
+        }
 
         ImGui::EndMenu();
       }
@@ -33,6 +33,7 @@ public:
       ImGui::Text( "Cycle: " U64_FORMAT_SPECIFIER, renderer->bus.cpu.GetCycles() );
       ImGui::Text( "CyclePS: %.1f", renderer->GetCyclesPerSecond() );
       ImGui::Text( "FPS: %.1f", renderer->GetAvgFps() );
+      ImGui::Text( "Idle Skip: " U64_FORMAT_SPECIFIER, renderer->bus.idleLoop.GetStats().skippedCyclesLastFrame );
       ImGui::PopFont();
     }
     ImGui::End();
@@ -1,4 +1,5 @@
 #pragma once
+#include <cstddef>
 #include <cstdint>
 #include <filesystem>
 
@@ -9,3 +10,6 @@ using u64 = std::uint64_t;
 using s8 = std::int8_t;
 using s16 = std::int16_t;
 using path = std::filesystem::path;
+
+// Host cache line, for keeping the state touched on every cycle together (see the hot state of CPU, PPU and Bus)
+constexpr std::size_t cacheLineSize = 64;
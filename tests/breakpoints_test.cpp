@@ -0,0 +1,190 @@
+#include "bus.h"
+#include "checks.h"
+#include "test-machine.h"
+#include <gtest/gtest.h>
+#include <string>
+
+namespace
+{
+using Kind = Breakpoints::Kind;
+
+u16 NmiHandler( Bus &bus )
+{
+  return static_cast<u16>( bus.Read( 0xFFFB, true ) << 8 | bus.Read( 0xFFFA, true ) );
+}
+
+class BreakpointsTest : public ::testing::Test
+{
+protected:
+  void SetUp() override
+  {
+    if ( !checks::enabled ) {
+      GTEST_SKIP() << "The fast core has no breakpoint hooks";
+    }
+  }
+};
+} // namespace
+
+TEST_F( BreakpointsTest, ExecuteStopsBeforeTheInstruction )
+{
+  auto bus = MakeBus( "mario.nes" );
+  for ( int i = 0; i < 30; i++ ) {
+    bus->RunFrame();
+  }
+  u16 const handler = NmiHandler( *bus );
+  bus->breakpoints.Add( Kind::Execute, handler );
+  EXPECT_TRUE( bus->breakpoints.IsArmed() );
+
+  // Each vblank NMI stops the run with pc on the handler. The next run starts by executing it, and goes on
+  // to the end of the frame
+  for ( int i = 0; i < 3; i++ ) {
+    u64 const frame = bus->ppu.frame;
+    Bus::RunStats const stats = bus->RunFrame();
+    ASSERT_TRUE( stats.breakpoint );
+    EXPECT_EQ( stats.frames, 0 );
+    ASSERT_TRUE( bus->breakpoints.GetHit().has_value() );
+    auto const &hit = *bus->breakpoints.GetHit();
+    EXPECT_EQ( hit.kind, Kind::Execute );
+    EXPECT_EQ( hit.address, handler );
+    EXPECT_EQ( hit.pc, handler );
+    EXPECT_EQ( hit.value, bus->Read( handler, true ) );
+    EXPECT_EQ( bus->cpu.GetProgramCounter(), handler );
+    EXPECT_EQ( bus->ppu.scanline, 241 );
+
+    Bus::RunStats const rest = bus->RunFrame();
+    EXPECT_FALSE( rest.breakpoint );
+    EXPECT_GT( rest.instructions, 0 );
+    EXPECT_EQ( bus->ppu.frame, frame + 1 );
+  }
+
+  bus->breakpoints.Remove( Kind::Execute, handler );
+  EXPECT_FALSE( bus->breakpoints.IsArmed() );
+  EXPECT_FALSE( bus->breakpoints.GetHit().has_value() );
+  Bus::RunStats const stats = bus->RunFrame();
+  EXPECT_FALSE( stats.breakpoint );
+  EXPECT_EQ( stats.frames, 1 );
+}
+
+TEST_F( BreakpointsTest, ArmedRunsMatchUnarmedRuns )
+{
+  // Arming turns off the idle loop skipping and bulk DMA, none of which changes the machine
+  for ( const auto *rom : { "mario.nes", "metroid.nes" } ) {
+    auto armed = MakeBus( rom );
+    auto reference = MakeBus( rom );
+    armed->breakpoints.Add( Kind::Execute, 0x5FFF );
+    armed->breakpoints.Add( Kind::Write, 0x5FFF );
+
+    for ( int frame = 0; frame < 60; frame++ ) {
+      Bus::RunStats const stats = armed->RunFrame();
+      reference->RunFrame();
+      std::string const where = std::string( rom ) + " frame " + std::to_string( frame );
+      ASSERT_FALSE( stats.breakpoint ) << where;
+      ASSERT_NO_FATAL_FAILURE( ExpectSameMachine( *armed, *reference, where ) );
+    }
+  }
+}
+
+TEST_F( BreakpointsTest, WriteStopsAfterTheInstruction )
+{
+  // Mario builds its sprites in page 2 every frame
+  auto bus = MakeBus( "mario.nes" );
+  for ( int i = 0; i < 60; i++ ) {
+    bus->RunFrame();
+  }
+  bus->breakpoints.AddRange( Kind::Write, 0x0200, 0x02FF );
+  EXPECT_EQ( bus->breakpoints.Count( Kind::Write ), 256 );
+
+  Bus::RunStats const stats = bus->RunFrame();
+  ASSERT_TRUE( stats.breakpoint );
+  auto const &hit = *bus->breakpoints.GetHit();
+  EXPECT_EQ( hit.kind, Kind::Write );
+  EXPECT_GE( hit.address, 0x0200 );
+  EXPECT_LE( hit.address, 0x02FF );
+  // The write is done, and pc is past the instruction that made it
+  EXPECT_EQ( bus->GetRam()[hit.address], hit.value );
+  EXPECT_NE( bus->cpu.GetProgramCounter(), hit.pc );
+}
+
+TEST_F( BreakpointsTest, ReadsAreDataReads )
+{
+  auto bus = MakeBus( "mario.nes" );
+  for ( int i = 0; i < 30; i++ ) {
+    bus->RunFrame();
+  }
+
+  // The NMI handler runs every frame, but nothing reads its bytes as data
+  u16 const handler = NmiHandler( *bus );
+  bus->breakpoints.AddRange( Kind::Read, handler, handler + 15 );
+  for ( int i = 0; i < 5; i++ ) {
+    EXPECT_FALSE( bus->RunFrame().breakpoint );
+  }
+  bus->breakpoints.Clear( Kind::Read );
+
+  // The controllers are read once a frame
+  bus->breakpoints.Add( Kind::Read, 0x4016 );
+  ASSERT_TRUE( bus->RunFrame().breakpoint );
+  EXPECT_EQ( bus->breakpoints.GetHit()->kind, Kind::Read );
+  EXPECT_EQ( bus->breakpoints.GetHit()->address, 0x4016 );
+}
+
+TEST_F( BreakpointsTest, PpuWrites )
+{
+  // Mario draws the title screen into the first nametable through $2007
+  auto bus = MakeBus( "mario.nes" );
+  bus->breakpoints.AddRange( Kind::PpuWrite, 0x2000, 0x23FF );
+  EXPECT_TRUE( bus->breakpoints.Has( Kind::PpuWrite, 0x6000 ) ); // A mirror of $2000
+
+  bool hit = false;
+  for ( int i = 0; i < 60 && !hit; i++ ) {
+    hit = bus->RunFrame().breakpoint;
+  }
+  ASSERT_TRUE( hit );
+  auto const &where = *bus->breakpoints.GetHit();
+  EXPECT_EQ( where.kind, Kind::PpuWrite );
+  EXPECT_GE( where.address, 0x2000 );
+  EXPECT_LE( where.address, 0x23FF );
+}
+
+TEST_F( BreakpointsTest, CoroutineEngineStopsAtTheSamePlace )
+{
+  auto engine = MakeBus( "metroid.nes" );
+  auto classic = MakeBus( "metroid.nes" );
+  engine->engine.SetEnabled( true );
+  for ( Bus *bus : { engine.get(), classic.get() } ) {
+    bus->breakpoints.Add( Kind::Execute, NmiHandler( *bus ) );
+    bus->breakpoints.Add( Kind::Write, 0x4014 );
+  }
+
+  for ( int run = 0; run < 20; run++ ) {
+    Bus::RunStats const engineStats = engine->RunFrame();
+    Bus::RunStats const classicStats = classic->RunFrame();
+    ASSERT_EQ( engineStats.breakpoint, classicStats.breakpoint ) << "run " << run;
+    ASSERT_NO_FATAL_FAILURE( ExpectSameMachine( *engine, *classic, "run " + std::to_string( run ) ) );
+    if ( classicStats.breakpoint ) {
+      EXPECT_EQ( engine->breakpoints.GetHit()->kind, classic->breakpoints.GetHit()->kind ) << "run " << run;
+    }
+  }
+}
+
+TEST_F( BreakpointsTest, Disabled )
+{
+  auto bus = MakeBus( "mario.nes" );
+  bus->breakpoints.Add( Kind::Read, 0x4016 );
+  bus->breakpoints.SetEnabled( false );
+  EXPECT_FALSE( bus->breakpoints.IsArmed() );
+  for ( int i = 0; i < 40; i++ ) {
+    EXPECT_FALSE( bus->RunFrame().breakpoint );
+  }
+
+  bus->breakpoints.SetEnabled( true );
+  EXPECT_TRUE( bus->RunFrame().breakpoint );
+  bus->breakpoints.ClearAll();
+  EXPECT_FALSE( bus->breakpoints.IsArmed() );
+  EXPECT_TRUE( bus->breakpoints.List( Kind::Read ).empty() );
+}
+
+int main( int argc, char **argv )
+{
+  ::testing::InitGoogleTest( &argc, argv );
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,172 @@
+#include "bus.h"
+#include "test-bus.h"
+#include "test-machine.h"
+#include <gtest/gtest.h>
+#include <initializer_list>
+#include <memory>
+#include <set>
+#include <sstream>
+#include <string>
+
+namespace
+{
+/*
+ * @brief A bus in flat memory mode with a program at $8000 and the reset vector pointing at it
+ */
+std::unique_ptr<TestBus> MakeProgram( std::initializer_list<std::pair<u16, std::initializer_list<u8>>> code )
+{
+  auto bus = std::make_unique<TestBus>();
+  bus->EnableJsonTestMode();
+  for ( const auto &[address, bytes] : code ) {
+    u16 at = address;
+    for ( u8 const byte : bytes ) {
+      bus->Write( at++, byte );
+    }
+  }
+  bus->Write( 0xFFFC, 0x00 );
+  bus->Write( 0xFFFD, 0x80 );
+  bus->cpu.Reset();
+  bus->callGraph.SetEnabled( true );
+  return bus;
+}
+
+void Step( Bus &bus, int instructions )
+{
+  for ( int i = 0; i < instructions; i++ ) {
+    bus.cpu.DecodeExecute();
+  }
+}
+
+void RunFrames( Bus &bus, int frames )
+{
+  for ( int i = 0; i < frames; i++ ) {
+    bus.RunFrame();
+  }
+}
+} // namespace
+
+TEST( CallGraphTest, NestedCalls )
+{
+  auto bus = MakeProgram( {
+      { 0x8000, { 0x20, 0x10, 0x80, 0x4C, 0x03, 0x80 } }, // JSR $8010, JMP *
+      { 0x8010, { 0x20, 0x20, 0x80, 0x60 } },             // JSR $8020, RTS
+      { 0x8020, { 0xEA, 0x60 } },                         // NOP, RTS
+  } );
+  u64 const start = bus->cpu.GetCycles();
+
+  Step( *bus, 2 );
+  EXPECT_EQ( bus->callGraph.GetDepth(), 2 );
+  Step( *bus, 3 );
+  EXPECT_EQ( bus->callGraph.GetDepth(), 0 );
+  Step( *bus, 2 );
+
+  // JSR: 6 cycles, charged to the caller. NOP + RTS: 2 + 6, charged to the callee
+  std::string const folded = bus->callGraph.GetFoldedStacks();
+  EXPECT_NE( folded.find( "(root) " ), std::string::npos );
+  EXPECT_NE( folded.find( "$8010 12\n" ), std::string::npos ) << folded;
+  EXPECT_NE( folded.find( "$8010;$8020 8\n" ), std::string::npos ) << folded;
+  EXPECT_EQ( bus->callGraph.GetTotalCycles(), bus->cpu.GetCycles() - start );
+}
+
+TEST( CallGraphTest, RtsAsJump )
+{
+  // The callee pushes an address and returns to it, a common way to jump through a table
+  auto bus = MakeProgram( {
+      { 0x8000, { 0x20, 0x10, 0x80, 0x4C, 0x03, 0x80 } },             // JSR $8010, JMP *
+      { 0x8010, { 0xA9, 0x80, 0x48, 0xA9, 0x1F, 0x48, 0x60 } },       // push $801F, RTS
+      { 0x8020, { 0x60 } },                                           // RTS
+  } );
+
+  Step( *bus, 6 );
+  EXPECT_EQ( bus->cpu.GetProgramCounter(), 0x8020 );
+  EXPECT_EQ( bus->callGraph.GetDepth(), 1 );
+  Step( *bus, 1 );
+  EXPECT_EQ( bus->cpu.GetProgramCounter(), 0x8003 );
+  EXPECT_EQ( bus->callGraph.GetDepth(), 0 );
+}
+
+TEST( CallGraphTest, SkippedReturn )
+{
+  // The inner function drops its own return address, so its RTS returns from both calls
+  auto bus = MakeProgram( {
+      { 0x8000, { 0x20, 0x10, 0x80, 0x4C, 0x03, 0x80 } }, // JSR $8010, JMP *
+      { 0x8010, { 0x20, 0x20, 0x80, 0x60 } },             // JSR $8020, RTS
+      { 0x8020, { 0x68, 0x68, 0x60 } },                   // PLA, PLA, RTS
+  } );
+
+  Step( *bus, 2 );
+  EXPECT_EQ( bus->callGraph.GetDepth(), 2 );
+  Step( *bus, 3 );
+  EXPECT_EQ( bus->cpu.GetProgramCounter(), 0x8003 );
+  EXPECT_EQ( bus->callGraph.GetDepth(), 0 );
+}
+
+TEST( CallGraphTest, Interrupts )
+{
+  auto bus = MakeProgram( {
+      { 0x8000, { 0x20, 0x10, 0x80 } },       // JSR $8010
+      { 0x8010, { 0x4C, 0x10, 0x80 } },       // JMP *
+      { 0x8100, { 0x20, 0x10, 0x81, 0x40 } }, // JSR $8110, RTI
+      { 0x8110, { 0x60 } },                   // RTS
+      { 0xFFFA, { 0x00, 0x81 } },             // NMI vector
+  } );
+
+  Step( *bus, 2 );
+  bus->cpu.NMI();
+  EXPECT_EQ( bus->callGraph.GetDepth(), 2 );
+  Step( *bus, 2 );
+  EXPECT_EQ( bus->callGraph.GetDepth(), 2 );
+  Step( *bus, 1 );
+  EXPECT_EQ( bus->callGraph.GetDepth(), 1 );
+  EXPECT_EQ( bus->cpu.GetProgramCounter(), 0x8010 );
+
+  // The handler is its own tree, not a child of the function it interrupted
+  std::string const folded = bus->callGraph.GetFoldedStacks();
+  EXPECT_NE( folded.find( "\nNMI $8100;$8110 " ), std::string::npos ) << folded;
+  EXPECT_EQ( folded.find( "$8010;NMI" ), std::string::npos ) << folded;
+}
+
+TEST( CallGraphTest, DoesNotChangeEmulation )
+{
+  auto profiled = MakeBus( "mario.nes" );
+  auto plain = MakeBus( "mario.nes" );
+  profiled->callGraph.SetEnabled( true );
+  u64 const start = profiled->cpu.GetCycles();
+
+  RunFrames( *profiled, 120 );
+  RunFrames( *plain, 120 );
+  ExpectSameMachine( *profiled, *plain );
+  EXPECT_EQ( profiled->callGraph.GetTotalCycles(), profiled->cpu.GetCycles() - start );
+
+  // Mario does all of its work in the NMI handler
+  std::string const report = profiled->callGraph.Report();
+  EXPECT_NE( report.find( "NMI 00:8082" ), std::string::npos ) << report;
+}
+
+TEST( CallGraphTest, BanksAreKeptApart )
+{
+  // Metroid switches 16 KiB banks into $8000 with MMC1
+  auto bus = MakeBus( "metroid.nes" );
+  bus->callGraph.SetEnabled( true );
+  for ( int frame = 0; frame < 600; frame++ ) {
+    bus->controller[0] = ( frame % 60 ) < 5 ? 0x10 : 0x00;
+    RunFrames( *bus, 1 );
+  }
+
+  std::set<std::string> banks;
+  std::istringstream    folded( bus->callGraph.GetFoldedStacks() );
+  for ( std::string line; std::getline( folded, line ); ) {
+    size_t const start = line.rfind( ';' ) == std::string::npos ? 0 : line.rfind( ';' ) + 1;
+    size_t const colon = line.find( ':', start );
+    if ( colon != std::string::npos && colon >= 2 ) {
+      banks.insert( line.substr( colon - 2, 2 ) );
+    }
+  }
+  EXPECT_GE( banks.size(), 3 );
+}
+
+int main( int argc, char **argv )
+{
+  ::testing::InitGoogleTest( &argc, argv );
+  return RUN_ALL_TESTS();
+}
@@ -1,8 +1,10 @@
 #include "bus.h"
 #include "cartridge.h"
 #include "paths.h"
+#include <array>
 #include <fmt/base.h>
 #include <gtest/gtest.h>
+#include <string>
 
 class CartTest : public ::testing::Test
 // This class is a test fixture that provides shared setup and teardown for all tests
@@ -90,6 +92,207 @@ TEST_F( CartTest, iNes )
   EXPECT_EQ( ines.GetChrRamSizeBytes(), 0 );
 }
 
+TEST_F( CartTest, Predecode )
+{
+  Cartridge &cart = bus.cartridge;
+
+  // Only PRG ROM is predecoded, everything else is fetched through the bus
+  EXPECT_EQ( cart.Predecode( 0x0000 ), nullptr );
+  EXPECT_EQ( cart.Predecode( 0x6000 ), nullptr );
+
+  // Instructions that straddle a 4 KiB page are not cached, their operands may live in another bank
+  EXPECT_EQ( cart.Predecode( 0x8FFE ), nullptr );
+  EXPECT_NE( cart.Predecode( 0x8FFD ), nullptr );
+
+  // Records match what the bus reads
+  u16 const                 resetVector = cpu.GetProgramCounter();
+  const DecodedInstruction *record = cart.Predecode( resetVector );
+  ASSERT_NE( record, nullptr );
+  EXPECT_EQ( record->opcode, bus.Read( resetVector ) );
+  EXPECT_EQ( record->length, gOpcodeInfo[record->opcode].bytes );
+  EXPECT_EQ( record->operand[0], bus.Read( resetVector + 1 ) );
+  EXPECT_EQ( record->operand[1], bus.Read( resetVector + 2 ) );
+
+  // Decoded once, the same record is returned on the next visit
+  EXPECT_EQ( cart.Predecode( resetVector ), record );
+
+  cart.SetPredecodeEnabled( false );
+  EXPECT_EQ( cart.Predecode( resetVector ), nullptr );
+  cart.SetPredecodeEnabled( true );
+}
+
+TEST_F( CartTest, PredecodeBankSwitch )
+{
+  // amagon.nes is UxROM (mapper 2): 8 switchable 16 KiB banks at $8000, last bank fixed at $C000
+  Cartridge &cart = bus.cartridge;
+  cart.LoadRom( std::string( paths::roms() ) + "/amagon.nes" );
+
+  for ( u8 bank = 0; bank < 8; bank++ ) {
+    cart.Write( 0x8000, bank );
+    for ( u16 address = 0x8000; address < 0xC000; address += 0x0531 ) {
+      const DecodedInstruction *record = cart.Predecode( address );
+      ASSERT_NE( record, nullptr );
+      EXPECT_EQ( record->opcode, cart.Read( address ) ) << "bank " << int( bank ) << " address " << address;
+      EXPECT_EQ( record->operand[0], cart.Read( address + 1 ) );
+    }
+  }
+}
+
+TEST_F( CartTest, PageTableBankSwitch )
+{
+  // Reads through the bus page table match the mapper after every bank switch, in ROM and PRG RAM
+  for ( const auto *rom : { "amagon.nes", "metroid.nes" } ) {
+    bus.cartridge.LoadRom( std::string( paths::roms() ) + "/" + rom );
+    bus.Write( 0x6123, 0x5A );
+    EXPECT_EQ( bus.DecodeRead( 0x6123 ), bus.Read( 0x6123 ) ) << rom;
+
+    for ( u8 bank = 0; bank < 8; bank++ ) {
+      // UxROM takes the bank in one write, MMC1 through five writes to its shift register
+      if ( std::string( rom ) == "amagon.nes" ) {
+        bus.Write( 0x8000, bank );
+      } else {
+        for ( int bit = 0; bit < 5; bit++ ) {
+          bus.Write( 0xE000, ( bank >> bit ) & 0x01 );
+        }
+      }
+      for ( u32 address = 0x6000; address <= 0xFFFF; address += 0x0123 ) {
+        EXPECT_EQ( bus.Read( address ), bus.DecodeRead( address ) ) << rom << " bank " << int( bank ) << " " << address;
+      }
+    }
+  }
+
+  // RAM mirrors share one page of memory
+  bus.Write( 0x1842, 0x77 );
+  EXPECT_EQ( bus.Read( 0x0042 ), 0x77 );
+  EXPECT_EQ( bus.DecodeRead( 0x0842 ), 0x77 );
+}
+
+namespace
+{
+// Checks every row of $0000-$1FFF against the two planes the cartridge reads
+void ExpectChrRowsMatch( Cartridge &cart, const std::string &what )
+{
+  for ( u16 address = 0; address < 0x2000; address++ ) {
+    ChrRow const &row = cart.GetChrRow( address );
+    u16 const     plane0 = address & ~0x08;
+    u8 const      low = cart.Read( plane0 );
+    u8 const      high = cart.Read( plane0 + 8 );
+    for ( int x = 0; x < 8; x++ ) {
+      u8 const pixel = static_cast<u8>( ( ( ( high >> ( 7 - x ) ) & 0x01 ) << 1 ) | ( ( low >> ( 7 - x ) ) & 0x01 ) );
+      ASSERT_EQ( row.pixels[x], pixel ) << what << " address " << address << " x " << x;
+      ASSERT_EQ( row.flipped[7 - x], pixel ) << what << " address " << address << " x " << x;
+    }
+  }
+}
+} // namespace
+
+TEST_F( CartTest, ChrCacheMatchesChrRom )
+{
+  Cartridge &cart = bus.cartridge;
+  for ( const auto *rom : { "mario.nes", "nestest.nes" } ) {
+    cart.LoadRom( std::string( paths::roms() ) + "/" + rom );
+    ExpectChrRowsMatch( cart, rom );
+  }
+
+  // Writes to CHR ROM are ignored, and leave the cache alone
+  cart.Write( 0x0010, 0xFF );
+  ExpectChrRowsMatch( cart, "after a write" );
+}
+
+TEST_F( CartTest, ChrCacheFollowsChrRamWrites )
+{
+  // metroid.nes is MMC1 with CHR RAM, which the game fills through $2007
+  Cartridge &cart = bus.cartridge;
+  cart.LoadRom( std::string( paths::roms() ) + "/metroid.nes" );
+  ExpectChrRowsMatch( cart, "empty" );
+
+  for ( u16 address = 0; address < 0x2000; address++ ) {
+    cart.Write( address, static_cast<u8>( ( address * 37 ) ^ ( address >> 5 ) ) );
+  }
+  ExpectChrRowsMatch( cart, "filled" );
+
+  // One plane of one row changes, and only that row's pixels do
+  ChrRow const before = cart.GetChrRow( 0x1234 );
+  cart.Write( 0x123C, static_cast<u8>( ~cart.Read( 0x123C ) ) );
+  ChrRow const &after = cart.GetChrRow( 0x1234 );
+  for ( int x = 0; x < 8; x++ ) {
+    EXPECT_EQ( after.pixels[x], before.pixels[x] ^ 0x02 ) << x;
+  }
+  ExpectChrRowsMatch( cart, "one write" );
+
+  // Switching MMC1 to 4 KiB CHR mode and back re-points the windows over the same 8 KiB
+  for ( u8 const control : { 0x1C, 0x0C } ) {
+    for ( int bit = 0; bit < 5; bit++ ) {
+      cart.Write( 0x8000, ( control >> bit ) & 0x01 );
+    }
+    ExpectChrRowsMatch( cart, "control " + std::to_string( control ) );
+  }
+
+  // A fresh game, then a frame of the real one, which uploads its tiles
+  cart.LoadRom( std::string( paths::roms() ) + "/metroid.nes" );
+  bus.cpu.Reset();
+  for ( int frame = 0; frame < 30; frame++ ) {
+    bus.RunFrame();
+  }
+  ExpectChrRowsMatch( cart, "after 30 frames" );
+}
+
+namespace
+{
+// Which nametable each 1 KiB page of $2000-$2FFF lands in
+std::array<int, 4> NametablesOf( MirrorMode mode )
+{
+  switch ( mode ) {
+    case MirrorMode::Vertical   : return { 0, 1, 0, 1 };
+    case MirrorMode::Horizontal : return { 0, 0, 1, 1 };
+    case MirrorMode::SingleLower: return { 0, 0, 0, 0 };
+    case MirrorMode::SingleUpper: return { 1, 1, 1, 1 };
+    case MirrorMode::FourScreen : return { 0, 1, 2, 3 };
+  }
+  return {};
+}
+
+// Writes a different byte through every page, and reads each back from the nametable it should be in
+void ExpectNametablesMapped( PPU &ppu, MirrorMode mode, const std::string &what )
+{
+  std::array<int, 4> const tables = NametablesOf( mode );
+  for ( u16 page = 0; page < 4; page++ ) {
+    for ( u16 offset : { 0x000, 0x123, 0x3C0, 0x3FF } ) {
+      u16 const address = 0x2000 + ( page * 0x400 ) + offset;
+      u8 const  value = static_cast<u8>( ( page * 0x40 ) + offset );
+      ppu.WriteVram( address, value );
+      ASSERT_EQ( ppu.nameTables[tables[page]][offset], value ) << what << " address " << address;
+      ASSERT_EQ( ppu.ReadVram( address ), value ) << what << " address " << address;
+    }
+  }
+}
+} // namespace
+
+TEST_F( CartTest, NametablePagesFollowMirroring )
+{
+  // Mapper 0 and 2 keep one mirroring per game
+  for ( const auto *rom : { "palette.nes", "mario.nes", "amagon.nes" } ) {
+    bus.cartridge.LoadRom( std::string( paths::roms() ) + "/" + rom );
+    EXPECT_EQ( ppu.GetMirrorMode(), bus.cartridge.GetMirrorMode() ) << rom;
+    ExpectNametablesMapped( ppu, ppu.GetMirrorMode(), rom );
+  }
+
+  // MMC1 picks it with the low bits of its control register, five writes to $8000-$9FFF
+  bus.cartridge.LoadRom( std::string( paths::roms() ) + "/metroid.nes" );
+  EXPECT_EQ( ppu.GetMirrorMode(), MirrorMode::SingleLower );
+  for ( u8 const control : { 0x0E, 0x0F, 0x0D, 0x0C, 0x0E } ) {
+    for ( int bit = 0; bit < 5; bit++ ) {
+      bus.Write( 0x8000, ( control >> bit ) & 0x01 );
+    }
+    EXPECT_EQ( ppu.GetMirrorMode(), bus.cartridge.GetMirrorMode() );
+    ExpectNametablesMapped( ppu, ppu.GetMirrorMode(), "control " + std::to_string( control ) );
+  }
+
+  // No test rom has four screens
+  ppu.SetMirroring( MirrorMode::FourScreen );
+  ExpectNametablesMapped( ppu, MirrorMode::FourScreen, "four screen" );
+}
+
 int main( int argc, char **argv )
 {
   ::testing::InitGoogleTest( &argc, argv );
@@ -0,0 +1,148 @@
+#include "compositor.h"
+#include <array>
+#include <gtest/gtest.h>
+#include <random>
+
+namespace
+{
+using compositor::Kernel;
+
+constexpr std::array<Kernel, 3> kernels = { Kernel::Scalar, Kernel::Sse2, Kernel::Avx2 };
+
+// Entry i shows as color i + 1, so a 0 in the output is a pixel the compositor didn't write
+std::array<u32, 32> Colors()
+{
+  std::array<u32, 32> colors{};
+  for ( u32 i = 0; i < colors.size(); i++ ) {
+    colors[i] = i + 1;
+  }
+  return colors;
+}
+
+struct Line {
+  std::array<u8, 256>  background{};
+  std::array<u8, 256>  sprites{};
+  std::array<u32, 256> out{};
+};
+
+bool CompositeOne( u8 bg, u8 sprite, int x, int backgroundFrom, int spritesFrom, u32 &color )
+{
+  // A tile group with the pixel under test at `x`
+  std::array<u32, 32> const colors = Colors();
+  Line                      line;
+  int const                 first = x & ~0x07;
+  line.background[x - first] = bg;
+  line.sprites[x - first] = sprite;
+  compositor::Span const span{ line.background.data(), line.sprites.data(), colors.data(), line.out.data(),
+                               first, 8, backgroundFrom, spritesFrom };
+  bool const hit = compositor::Composite( span, Kernel::Scalar );
+  color = line.out[x - first] - 1;
+  return hit;
+}
+} // namespace
+
+TEST( CompositorTest, Priority )
+{
+  u32 color = 0;
+  // Background palette 2 pixel 1 is entry 9, sprite palette 1 pixel 3 is entry 0x17
+  CompositeOne( 0x09, 0x00, 40, 0, 0, color );
+  EXPECT_EQ( color, 0x09 );
+  CompositeOne( 0x08, 0x00, 40, 0, 0, color );
+  EXPECT_EQ( color, 0x00 ); // Transparent shows entry 0, whatever the palette
+  CompositeOne( 0x08, 0x07, 40, 0, 0, color );
+  EXPECT_EQ( color, 0x17 ); // Behind, over a transparent background
+  CompositeOne( 0x09, 0x07, 40, 0, 0, color );
+  EXPECT_EQ( color, 0x09 ); // Behind an opaque one
+  CompositeOne( 0x09, 0x07 | compositor::spriteFront, 40, 0, 0, color );
+  EXPECT_EQ( color, 0x17 );
+  CompositeOne( 0x09, 0x04 | compositor::spriteFront, 40, 0, 0, color );
+  EXPECT_EQ( color, 0x09 ); // A transparent sprite pixel never wins
+}
+
+TEST( CompositorTest, LeftColumnClipping )
+{
+  u32 color = 0;
+  CompositeOne( 0x09, 0x00, 7, 8, 0, color );
+  EXPECT_EQ( color, 0x00 );
+  CompositeOne( 0x09, 0x00, 8, 8, 0, color );
+  EXPECT_EQ( color, 0x09 );
+  CompositeOne( 0x09, 0x07, 3, 8, 0, color );
+  EXPECT_EQ( color, 0x17 ); // The background is gone, so the sprite behind it shows
+  CompositeOne( 0x09, 0x07 | compositor::spriteFront, 3, 0, 8, color );
+  EXPECT_EQ( color, 0x09 );
+  CompositeOne( 0x09, 0x07, 200, 256, 0, color );
+  EXPECT_EQ( color, 0x17 ); // A layer that starts past the line is off
+}
+
+TEST( CompositorTest, SpriteZeroHit )
+{
+  u32 const zero = 0x01 | compositor::spriteZero;
+  u32       color = 0;
+  EXPECT_FALSE( CompositeOne( 0x00, 0x01, 100, 0, 0, color ) );
+  EXPECT_TRUE( CompositeOne( 0x00, zero, 100, 0, 0, color ) ); // The background isn't looked at
+  EXPECT_FALSE( CompositeOne( 0x01, zero, 7, 0, 0, color ) );
+  EXPECT_TRUE( CompositeOne( 0x01, zero, 8, 0, 0, color ) );
+  EXPECT_TRUE( CompositeOne( 0x01, zero, 254, 0, 0, color ) );
+  EXPECT_FALSE( CompositeOne( 0x01, zero, 255, 0, 0, color ) );
+  EXPECT_FALSE( CompositeOne( 0x01, zero, 100, 0, 101, color ) ); // Clipped sprites don't hit
+}
+
+TEST( CompositorTest, KernelsMatchScalar )
+{
+  // Random lines, composited whole and in tile groups at every offset, with both clips
+  std::array<u32, 32> const colors = Colors();
+  std::mt19937              random( 2025 );
+  for ( Kernel const kernel : kernels ) {
+    if ( !compositor::IsSupported( kernel ) ) {
+      continue;
+    }
+    for ( int round = 0; round < 200; round++ ) {
+      Line line;
+      for ( size_t x = 0; x < 256; x++ ) {
+        line.background[x] = static_cast<u8>( random() & 0x0F );
+        // Mostly transparent sprites
+        line.sprites[x] = ( random() % 4 ) == 0 ? static_cast<u8>( random() & 0x1F ) : 0;
+      }
+      // One pixel of sprite 0 in most lines, often at the ends of where it can hit
+      constexpr std::array<int, 4> edges = { 7, 8, 254, 255 };
+      int const zeroAt = ( round % 3 ) == 0 ? edges[( round / 3 ) % edges.size()] : static_cast<int>( random() % 320 );
+      if ( zeroAt < 256 ) {
+        line.sprites[zeroAt] = static_cast<u8>( 0x01 | ( random() & 0x1E ) | compositor::spriteZero );
+      }
+      int const backgroundFrom = ( round & 1 ) != 0 ? 8 : 0;
+      int const spritesFrom = ( round & 2 ) != 0 ? 8 : 0;
+
+      for ( int count : { 256, 8, 16, 24, 40 } ) {
+        for ( int x = 0; x + count <= 256; x += count == 256 ? 256 : 8 ) {
+          Line expected = line;
+          Line actual = line;
+          compositor::Span const reference{ &line.background[x], &line.sprites[x], colors.data(), &expected.out[x],
+                                            x, count, backgroundFrom, spritesFrom };
+          compositor::Span const span{ &line.background[x], &line.sprites[x], colors.data(), &actual.out[x],
+                                       x, count, backgroundFrom, spritesFrom };
+          bool const expectedHit = compositor::Composite( reference, Kernel::Scalar );
+          ASSERT_EQ( compositor::Composite( span, kernel ), expectedHit )
+              << compositor::KernelName( kernel ) << " x " << x << " count " << count;
+          ASSERT_EQ( actual.out, expected.out ) << compositor::KernelName( kernel ) << " x " << x << " count " << count;
+
+          // Without an output, only the hit
+          compositor::Span hitOnly = span;
+          hitOnly.out = nullptr;
+          ASSERT_EQ( compositor::Composite( hitOnly, kernel ), expectedHit );
+        }
+      }
+    }
+  }
+}
+
+TEST( CompositorTest, BestKernelIsSupported )
+{
+  EXPECT_TRUE( compositor::IsSupported( compositor::BestKernel() ) );
+  EXPECT_TRUE( compositor::IsSupported( Kernel::Scalar ) );
+}
+
+int main( int argc, char **argv )
+{
+  ::testing::InitGoogleTest( &argc, argv );
+  return RUN_ALL_TESTS();
+}
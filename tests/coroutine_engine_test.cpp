@@ -0,0 +1,131 @@
+#include "bus.h"
+#include "test-machine.h"
+#include <functional>
+#include <gtest/gtest.h>
+#include <string>
+
+namespace
+{
+/*
+ * @brief Run a rom through the coroutine engine and the classic loop, and compare the machines after every frame
+ */
+void ExpectIdenticalFrames( const std::string &romName, u64 frames, const std::function<void( Bus & )> &setup = {} )
+{
+  auto engine = MakeBus( romName );
+  auto reference = MakeBus( romName );
+  engine->engine.SetEnabled( true );
+  if ( setup ) {
+    setup( *engine );
+    setup( *reference );
+  }
+
+  for ( u64 frame = 0; frame < frames; frame++ ) {
+    u8 const pad = ( frame % 60 ) < 5 ? 0x10 : 0x00;
+    engine->controller[0] = pad;
+    reference->controller[0] = pad;
+    Bus::RunStats const engineStats = engine->RunFrame();
+    Bus::RunStats const referenceStats = reference->RunFrame();
+
+    std::string const where = romName + " frame " + std::to_string( frame );
+    ASSERT_NO_FATAL_FAILURE( ExpectSameMachine( *engine, *reference, where ) );
+    ASSERT_EQ( engineStats.cycles, referenceStats.cycles ) << where;
+    // An idle loop replay also stops at events that don't raise an NMI, and the interpreter runs the rest of
+    // that iteration: the same machine, with some more instructions counted
+    if ( !engine->idleLoop.IsEnabled() ) {
+      ASSERT_EQ( engineStats.instructions, referenceStats.instructions ) << where;
+    }
+  }
+}
+} // namespace
+
+TEST( CoroutineEngineTest, IdenticalFrames )
+{
+  for ( const auto *rom : { "nestest.nes", "mario.nes", "metroid.nes", "amagon.nes" } ) {
+    ExpectIdenticalFrames( rom, 180 );
+  }
+}
+
+TEST( CoroutineEngineTest, IdenticalFramesWithoutShortcuts )
+{
+  // Byte by byte OAM DMA and no idle loop skipping: every DMA cycle and every instruction is a step
+  for ( const auto *rom : { "mario.nes", "metroid.nes" } ) {
+    ExpectIdenticalFrames( rom, 120, []( Bus &bus ) {
+      bus.SetBulkDma( false );
+      bus.idleLoop.SetEnabled( false );
+    } );
+  }
+}
+
+TEST( CoroutineEngineTest, IdenticalFramesLockstepPpu )
+{
+  ExpectIdenticalFrames( "mario.nes", 60, []( Bus &bus ) { bus.ppu.SetCatchUp( false ); } );
+}
+
+TEST( CoroutineEngineTest, StopsAtTheSameSteps )
+{
+  // The predicate is checked once per step, like in the classic loop
+  auto engine = MakeBus( "metroid.nes" );
+  auto clocked = MakeBus( "metroid.nes" );
+  engine->engine.SetEnabled( true );
+  engine->SetBulkDma( false );
+  clocked->SetBulkDma( false );
+
+  int steps = 0;
+  engine->RunUntil( [&]() { return steps++ == 50000; } );
+  for ( int i = 0; i < 50000; i++ ) {
+    clocked->Clock();
+  }
+  clocked->ppu.CatchUp();
+  ExpectSameMachine( *engine, *clocked, "after 50000 steps" );
+}
+
+TEST( CoroutineEngineTest, SwitchesLoopsBetweenRuns )
+{
+  // Short runs stop in the middle of frames and OAM DMA transfers, and every other one is classic
+  auto switching = MakeBus( "mario.nes" );
+  auto reference = MakeBus( "mario.nes" );
+  switching->engine.SetEnabled( true );
+  switching->SetBulkDma( false );
+  reference->SetBulkDma( false );
+
+  for ( int run = 0; run < 2000; run++ ) {
+    switching->engine.SetEnabled( run % 2 == 0 );
+    u64 const cycles = 37 + ( run % 7 ) * 101;
+    switching->RunCycles( cycles );
+    reference->RunCycles( cycles );
+    ASSERT_NO_FATAL_FAILURE( ExpectSameMachine( *switching, *reference, "run " + std::to_string( run ) ) );
+  }
+}
+
+TEST( CoroutineEngineTest, ApuHearsEveryFrameEnd )
+{
+  auto bus = MakeBus( "mario.nes" );
+  bus->engine.SetEnabled( true );
+  int  frameEnds = 0;
+  bus->engine.onApuFrameEnd = [&]() { frameEnds++; };
+
+  for ( int i = 0; i < 30; i++ ) {
+    bus->RunFrame();
+  }
+  EXPECT_EQ( frameEnds, 30 );
+
+  auto const &stats = bus->engine.GetStats();
+  EXPECT_EQ( stats.apuFrames, 30 );
+  EXPECT_GT( stats.resumes[static_cast<size_t>( CoroutineEngine::Component::Cpu )], 0 );
+  EXPECT_GT( stats.resumes[static_cast<size_t>( CoroutineEngine::Component::Ppu )], 0 );
+  EXPECT_GT( stats.resumes[static_cast<size_t>( CoroutineEngine::Component::Dma )], 0 );
+}
+
+TEST( CoroutineEngineTest, Disabled )
+{
+  auto bus = MakeBus( "mario.nes" );
+  bus->RunFrame();
+  EXPECT_FALSE( bus->engine.IsRunning() );
+  EXPECT_EQ( bus->engine.GetStats().apuFrames, 0 );
+}
+
+int main( int argc, char **argv )
+{
+  ::testing::InitGoogleTest( &argc, argv );
+  return RUN_ALL_TESTS();
+}
@@ -3,6 +3,7 @@
 #include "ppu.h"
 #include "apu.h"
 #include "cartridge.h"
+#include "test-bus.h"
 #include "json.hpp"
 #include <cstdint>
 #include <fstream>
@@ -22,10 +23,10 @@ class CpuTest : public ::testing::Test
 // This class is a test fixture that provides shared setup and teardown for all tests
 {
 public:
-  // All tests assume flat memory model, which is why true is passed to Bus constructor
-  Bus  bus;
-  CPU &cpu = bus.cpu;
-  PPU &ppu = bus.ppu;
+  // The JSON tests switch the bus to flat memory, see TestBus
+  TestBus bus;
+  CPU    &cpu = bus.cpu;
+  PPU    &ppu = bus.ppu;
 
   CpuTest() = default;
   void LoadTestCartridge()
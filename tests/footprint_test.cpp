@@ -0,0 +1,137 @@
+#include "bus-arena.h"
+#include "bus.h"
+#include "ppu.h"
+#include "test-machine.h"
+#include <cstddef>
+#include <cstdint>
+#include <gtest/gtest.h>
+#include <iostream>
+#include <memory>
+#include <string>
+
+namespace
+{
+// What one emulator may take, frame buffer aside. Raise it on purpose, not by accident
+constexpr size_t busBudget = 48 * 1024;
+
+template <typename Object, typename Member> size_t OffsetIn( const Object &object, const Member &member )
+{
+  return static_cast<size_t>( reinterpret_cast<const std::byte *>( &member ) -
+                              reinterpret_cast<const std::byte *>( &object ) );
+}
+} // namespace
+
+TEST( FootprintTest, BusBudget )
+{
+  RecordProperty( "sizeof_Bus", std::to_string( sizeof( Bus ) ) );
+  std::cout << "sizeof(Bus): " << sizeof( Bus ) << " bytes (PPU " << sizeof( PPU ) << ", Cartridge "
+            << sizeof( Cartridge ) << ", APU " << sizeof( Simple_Apu ) << "), budget " << busBudget << '\n';
+  EXPECT_LE( sizeof( Bus ), busBudget );
+}
+
+TEST( FootprintTest, HotStateLayout )
+{
+  // What runs on every cycle starts a cache line and fills as few as it can: one for the CPU, two for the PPU
+  auto bus = std::make_unique<Bus>( nullptr );
+  EXPECT_EQ( alignof( CPU ), cacheLineSize );
+  EXPECT_EQ( alignof( PPU ), cacheLineSize );
+  EXPECT_EQ( reinterpret_cast<std::uintptr_t>( &bus->cpu ) % cacheLineSize, 0 );
+  EXPECT_EQ( reinterpret_cast<std::uintptr_t>( &bus->ppu ) % cacheLineSize, 0 );
+
+  CPU const &cpu = bus->cpu;
+  EXPECT_EQ( OffsetIn( cpu, cpu.bus ), 0 );
+  for ( size_t const offset :
+        { OffsetIn( cpu, cpu.cycles ), OffsetIn( cpu, cpu.predecoded ), OffsetIn( cpu, cpu.traceSink ),
+          OffsetIn( cpu, cpu.pc ), OffsetIn( cpu, cpu.nzResult ), OffsetIn( cpu, cpu.operandAddress ),
+          OffsetIn( cpu, cpu.p ), OffsetIn( cpu, cpu.opcode ), OffsetIn( cpu, cpu.mesenFormatTraceEnabled ) } ) {
+    EXPECT_LT( offset, cacheLineSize );
+  }
+  EXPECT_GE( OffsetIn( cpu, cpu.traceLog ), cacheLineSize );
+
+  PPU const &ppu = bus->ppu;
+  EXPECT_EQ( OffsetIn( ppu, ppu.bus ), 0 );
+  for ( size_t const offset :
+        { OffsetIn( ppu, ppu.frame ), OffsetIn( ppu, ppu.nmiReady ), OffsetIn( ppu, ppu.scanline ),
+          OffsetIn( ppu, ppu.cycle ), OffsetIn( ppu, ppu.ppuMask ), OffsetIn( ppu, ppu.vramAddr ),
+          OffsetIn( ppu, ppu.fineX ), OffsetIn( ppu, ppu.bgAttributeShiftHigh ), OffsetIn( ppu, ppu.spriteShiftHigh ),
+          OffsetIn( ppu, ppu.nOamEntry ) } ) {
+    EXPECT_LT( offset, 2 * cacheLineSize );
+  }
+
+  EXPECT_EQ( reinterpret_cast<std::uintptr_t>( &bus->dmaInProgress ) % cacheLineSize, 0 );
+}
+
+TEST( FootprintTest, HeadlessMatchesFrameBuffer )
+{
+  // Without a frame buffer the PPU still works out every pixel, so sprite 0 hit and timing don't change
+  auto headless = std::make_unique<Bus>( nullptr );
+  auto drawn = std::make_unique<Bus>();
+  EXPECT_EQ( headless->ppu.GetFrameBuffer(), nullptr );
+  ASSERT_NE( drawn->ppu.GetFrameBuffer(), nullptr );
+
+  LoadRom( *headless, "mario.nes" );
+  LoadRom( *drawn, "mario.nes" );
+  for ( int frame = 0; frame < 120; frame++ ) {
+    headless->RunFrame();
+    drawn->RunFrame();
+    ASSERT_NO_FATAL_FAILURE( ExpectSameMachine( *headless, *drawn, "frame " + std::to_string( frame ) ) );
+  }
+}
+
+TEST( FootprintTest, ExternalFrameBuffer )
+{
+  auto external = std::make_unique<PPU::FrameBuffer>();
+  auto bus = std::make_unique<Bus>( external.get() );
+  auto reference = MakeBus( "metroid.nes" );
+  EXPECT_EQ( bus->ppu.GetFrameBuffer(), external.get() );
+
+  LoadRom( *bus, "metroid.nes" );
+  for ( int frame = 0; frame < 60; frame++ ) {
+    bus->RunFrame();
+    reference->RunFrame();
+  }
+  EXPECT_EQ( *external, *reference->ppu.GetFrameBuffer() );
+}
+
+TEST( FootprintTest, Arena )
+{
+  // Buses in an arena are contiguous, cache line aligned, and run like any other
+  BusArena arena( 4 );
+  ASSERT_EQ( arena.Size(), 4 );
+  for ( size_t i = 0; i < arena.Size(); i++ ) {
+    auto const address = reinterpret_cast<std::uintptr_t>( &arena[i] );
+    EXPECT_EQ( address % BusArena::alignment, 0 );
+    if ( i > 0 ) {
+      EXPECT_EQ( address - reinterpret_cast<std::uintptr_t>( &arena[i - 1] ), BusArena::stride );
+    }
+    EXPECT_NE( arena[i].ppu.GetFrameBuffer(), nullptr );
+  }
+
+  const char *roms[] = { "mario.nes", "metroid.nes", "nestest.nes", "mario.nes" };
+  for ( size_t i = 0; i < arena.Size(); i++ ) {
+    LoadRom( arena[i], roms[i] );
+  }
+  for ( int frame = 0; frame < 30; frame++ ) {
+    for ( size_t i = 0; i < arena.Size(); i++ ) {
+      arena[i].RunFrame();
+    }
+  }
+
+  for ( size_t i = 0; i < arena.Size(); i++ ) {
+    auto reference = MakeBus( roms[i] );
+    for ( int frame = 0; frame < 30; frame++ ) {
+      reference->RunFrame();
+    }
+    ExpectSameMachine( arena[i], *reference, roms[i] );
+  }
+
+  BusArena headless( 2, true );
+  EXPECT_EQ( headless[0].ppu.GetFrameBuffer(), nullptr );
+  EXPECT_EQ( headless[1].ppu.GetFrameBuffer(), nullptr );
+}
+
+int main( int argc, char **argv )
+{
+  ::testing::InitGoogleTest( &argc, argv );
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,190 @@
+#include "bus.h"
+#include "test-machine.h"
+#include <array>
+#include <filesystem>
+#include <fstream>
+#include <gtest/gtest.h>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace
+{
+/*
+ * @brief Run a rom with and without idle loop skipping, and compare the machines after every frame
+ */
+void ExpectIdenticalFrames( const std::string &romName, u64 frames )
+{
+  auto skipping = MakeBus( romName );
+  auto reference = MakeBus( romName );
+  skipping->idleLoop.SetEnabled( true );
+  reference->idleLoop.SetEnabled( false );
+
+  for ( u64 frame = 0; frame < frames; frame++ ) {
+    u8 const pad = ( frame % 60 ) < 5 ? 0x10 : 0x00;
+    skipping->controller[0] = pad;
+    reference->controller[0] = pad;
+    skipping->RunFrame();
+    reference->RunFrame();
+
+    std::string const where = romName + " frame " + std::to_string( frame );
+    ASSERT_NO_FATAL_FAILURE( ExpectSameMachine( *skipping, *reference, where ) );
+  }
+}
+
+/*
+ * @brief Write a 16 KiB NROM probe that starts at $8000 and takes its NMI and IRQ at `handler`
+ */
+std::string WriteProbe( const std::string &name, const std::vector<u8> &program, u16 handler )
+{
+  std::vector<u8> rom( 16 + 0x4000 + 0x2000, 0x00 );
+  std::array<u8, 16> const header = { 'N', 'E', 'S', 0x1A, 0x01, 0x01 };
+  std::copy( header.begin(), header.end(), rom.begin() );
+  std::copy( program.begin(), program.end(), rom.begin() + 16 );
+
+  u8 const lo = handler & 0xFF;
+  u8 const hi = handler >> 8;
+  std::array<u8, 6> const vectors = { lo, hi, 0x00, 0x80, lo, hi };
+  std::copy( vectors.begin(), vectors.end(), rom.begin() + 16 + 0x3FFA );
+
+  std::string const path = ( std::filesystem::temp_directory_path() / ( "nes_emu_" + name + ".nes" ) ).string();
+  std::ofstream file( path, std::ios::binary );
+  file.write( reinterpret_cast<const char *>( rom.data() ), static_cast<std::streamsize>( rom.size() ) );
+  return path;
+}
+
+/*
+ * @brief Run a probe on `skipping` and on a bus that interprets everything, and compare them after every frame
+ */
+void ExpectIdenticalProbeFrames( const std::string &path, u64 frames, Bus &skipping )
+{
+  auto reference = std::make_unique<Bus>();
+  for ( Bus *bus : { &skipping, reference.get() } ) {
+    bus->cartridge.LoadRom( path );
+    bus->cpu.Reset();
+  }
+  skipping.idleLoop.SetEnabled( true );
+  reference->idleLoop.SetEnabled( false );
+
+  for ( u64 frame = 0; frame < frames; frame++ ) {
+    skipping.RunFrame();
+    reference->RunFrame();
+    ASSERT_NO_FATAL_FAILURE( ExpectSameMachine( skipping, *reference, "frame " + std::to_string( frame ) ) );
+  }
+}
+} // namespace
+
+TEST( IdleLoopTest, IdenticalFramesMapper0 )
+{
+  ExpectIdenticalFrames( "mario.nes", 240 );
+}
+
+TEST( IdleLoopTest, IdenticalFramesMapper1 )
+{
+  ExpectIdenticalFrames( "metroid.nes", 240 );
+}
+
+TEST( IdleLoopTest, IdenticalFramesMapper2 )
+{
+  ExpectIdenticalFrames( "amagon.nes", 240 );
+}
+
+TEST( IdleLoopTest, IdenticalFramesNestest )
+{
+  ExpectIdenticalFrames( "nestest.nes", 120 );
+}
+
+TEST( IdleLoopTest, StopsWithMidIterationRegisters )
+{
+  // `LDA $10 / AND #$80 / BEQ` with $10 = $40: A is $40 between the load and the AND, $00 at the start of
+  // every iteration. The NMI handler stores A in $0300, and lands after the load as often as after the AND
+  std::vector<u8> const program = {
+    0x78,             // $8000 SEI
+    0xD8,             // $8001 CLD
+    0xA2, 0xFF,       // $8002 LDX #$FF
+    0x9A,             // $8004 TXS
+    0x2C, 0x02, 0x20, // $8005 BIT $2002, twice through vblank: PPUCTRL ignores writes until the PPU warms up
+    0x10, 0xFB,       // $8008 BPL $8005
+    0x2C, 0x02, 0x20, // $800A BIT $2002
+    0x10, 0xFB,       // $800D BPL $800A
+    0xA9, 0x40,       // $800F LDA #$40
+    0x85, 0x10,       // $8011 STA $10
+    0xA9, 0x80,       // $8013 LDA #$80
+    0x8D, 0x00, 0x20, // $8015 STA $2000
+    0xA5, 0x10,       // $8018 LDA $10
+    0x29, 0x80,       // $801A AND #$80
+    0xF0, 0xFA,       // $801C BEQ $8018
+    0x4C, 0x1E, 0x80, // $801E JMP $801E
+    0x8D, 0x00, 0x03, // $8021 STA $0300 (NMI)
+    0xEE, 0x01, 0x03, // $8024 INC $0301
+    0x40,             // $8027 RTI
+  };
+  auto skipping = std::make_unique<Bus>();
+  ASSERT_NO_FATAL_FAILURE( ExpectIdenticalProbeFrames( WriteProbe( "idle_mid_iteration", program, 0x8021 ), 120, *skipping ) );
+  EXPECT_GT( skipping->GetRam()[0x0301], 100 );
+  EXPECT_GT( skipping->idleLoop.GetStats().skippedCycles, 0 );
+}
+
+TEST( IdleLoopTest, SkipsVblankPolls )
+{
+  // Rendering stays off, so the two waits are skipped up to just before vblank, frame after frame. The
+  // interpreter takes the reads around it, including the one that can suppress the flag
+  std::vector<u8> const program = {
+    0x78,             // $8000 SEI
+    0xD8,             // $8001 CLD
+    0xA2, 0xFF,       // $8002 LDX #$FF
+    0x9A,             // $8004 TXS
+    0x2C, 0x02, 0x20, // $8005 BIT $2002
+    0x10, 0xFB,       // $8008 BPL $8005
+    0xEE, 0x00, 0x03, // $800A INC $0300
+    0xAD, 0x02, 0x20, // $800D LDA $2002
+    0x10, 0xFB,       // $8010 BPL $800D
+    0xEE, 0x01, 0x03, // $8012 INC $0301
+    0x4C, 0x05, 0x80, // $8015 JMP $8005
+    0x40,             // $8018 RTI
+  };
+  auto skipping = std::make_unique<Bus>();
+  ASSERT_NO_FATAL_FAILURE( ExpectIdenticalProbeFrames( WriteProbe( "idle_vblank_polls", program, 0x8018 ), 120, *skipping ) );
+  EXPECT_GT( skipping->GetRam()[0x0300] + skipping->GetRam()[0x0301], 100 );
+  EXPECT_GT( skipping->idleLoop.GetStats().loopsDetected, 0 );
+  EXPECT_GT( skipping->idleLoop.GetStats().skippedCycles, 0 );
+}
+
+TEST( IdleLoopTest, SkipsMainLoop )
+{
+  // Mario's main loop is a `JMP *` that waits for the NMI
+  auto bus = MakeBus( "mario.nes" );
+  bus->idleLoop.SetEnabled( true );
+  for ( int i = 0; i < 60; i++ ) {
+    bus->RunFrame();
+  }
+
+  auto const &stats = bus->idleLoop.GetStats();
+  EXPECT_GT( stats.loopsDetected, 0 );
+  EXPECT_GT( stats.skippedCycles, 0 );
+  EXPECT_GT( stats.skippedCyclesLastFrame, 0 );
+  EXPECT_LT( stats.skippedCyclesLastFrame, 29781 );
+
+  // Frames that skip nothing still move the count on
+  bus->idleLoop.SetEnabled( false );
+  bus->RunFrame();
+  bus->RunFrame();
+  EXPECT_EQ( bus->idleLoop.GetStats().skippedCyclesLastFrame, 0 );
+}
+
+TEST( IdleLoopTest, Disabled )
+{
+  auto bus = MakeBus( "mario.nes" );
+  bus->idleLoop.SetEnabled( false );
+  for ( int i = 0; i < 60; i++ ) {
+    bus->RunFrame();
+  }
+  EXPECT_EQ( bus->idleLoop.GetStats().skippedCycles, 0 );
+  EXPECT_EQ( bus->idleLoop.GetStats().loopsDetected, 0 );
+}
+
+int main( int argc, char **argv )
+{
+  ::testing::InitGoogleTest( &argc, argv );
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,56 @@
+// test-machine.h
+// Helpers shared by the tests that run roms: a bus to run them on, and the comparison of two machines that
+// ran the same rom two different ways (idle loop skipping, coroutine engine, batched PPU, bulk DMA, ...).
+
+#pragma once
+#include "bus.h"
+#include "paths.h"
+#include "global-types.h"
+#include <gtest/gtest.h>
+#include <memory>
+#include <string>
+
+/*
+ * @brief Load a rom from the roms folder into `bus` and reset the cpu
+ */
+inline void LoadRom( Bus &bus, const std::string &romName )
+{
+  bus.cartridge.LoadRom( std::string( paths::roms() ) + "/" + romName );
+  bus.cpu.Reset();
+}
+
+/*
+ * @brief Heap allocate a bus with a rom loaded and the cpu reset. The bus is too big for the stack.
+ */
+inline std::unique_ptr<Bus> MakeBus( const std::string &romName )
+{
+  auto bus = std::make_unique<Bus>();
+  LoadRom( *bus, romName );
+  return bus;
+}
+
+/*
+ * @brief Compare two machines that should be in the same state: the CPU registers, RAM, the PPU and its frame
+ * Both PPUs must be caught up (the run loops leave them so). Frame buffers are compared when both buses
+ * draw. Stops at the first difference, so wrap calls in a loop with ASSERT_NO_FATAL_FAILURE()
+ */
+inline void ExpectSameMachine( const Bus &a, const Bus &b, const std::string &where = {} )
+{
+  ASSERT_EQ( a.cpu.GetCycles(), b.cpu.GetCycles() ) << where;
+  ASSERT_EQ( a.cpu.GetProgramCounter(), b.cpu.GetProgramCounter() ) << where;
+  ASSERT_EQ( a.cpu.GetStatusRegister(), b.cpu.GetStatusRegister() ) << where;
+  ASSERT_EQ( a.cpu.GetAccumulator(), b.cpu.GetAccumulator() ) << where;
+  ASSERT_EQ( a.cpu.GetXRegister(), b.cpu.GetXRegister() ) << where;
+  ASSERT_EQ( a.cpu.GetYRegister(), b.cpu.GetYRegister() ) << where;
+  ASSERT_EQ( a.cpu.GetStackPointer(), b.cpu.GetStackPointer() ) << where;
+  ASSERT_EQ( a.GetRam(), b.GetRam() ) << where;
+  ASSERT_EQ( a.dmaInProgress, b.dmaInProgress ) << where;
+  ASSERT_EQ( a.ppu.frame, b.ppu.frame ) << where;
+  ASSERT_EQ( a.ppu.scanline, b.ppu.scanline ) << where;
+  ASSERT_EQ( a.ppu.cycle, b.ppu.cycle ) << where;
+  ASSERT_EQ( a.ppu.ppuStatus.value, b.ppu.ppuStatus.value ) << where;
+  ASSERT_EQ( a.ppu.oam.data, b.ppu.oam.data ) << where;
+  if ( a.ppu.GetFrameBuffer() != nullptr && b.ppu.GetFrameBuffer() != nullptr ) {
+    ASSERT_EQ( *a.ppu.GetFrameBuffer(), *b.ppu.GetFrameBuffer() ) << where;
+  }
+}
@@ -1,8 +1,15 @@
 #include "bus.h"
 #include "cartridge.h"
 #include "paths.h"
+#include "test-machine.h"
+#include <algorithm>
+#include <array>
+#include <cstring>
 #include <fmt/base.h>
 #include <gtest/gtest.h>
+#include <memory>
+#include <random>
+#include <string>
 
 class PpuTest : public ::testing::Test
 // This class is a test fixture that provides shared setup and teardown for all
@@ -546,6 +553,288 @@ TEST_F( PpuTest, IsSpriteInRange )
   }
 }
 
+TEST( PpuCatchUpTest, MatchesLockstep )
+{
+  // The same rom with the PPU caught up in batches and ticked in lockstep. The CPUs are compared after every
+  // instruction, the PPUs at the end of every frame, once the batched one has caught up
+  for ( const auto *rom : { "mario.nes", "metroid.nes" } ) {
+    auto batched = MakeBus( rom );
+    auto lockstep = MakeBus( rom );
+    lockstep->ppu.SetCatchUp( false );
+    // Only the batched PPU lets the idle loop skip $2002 polls, which would end its steps elsewhere
+    for ( Bus *bus : { batched.get(), lockstep.get() } ) {
+      bus->idleLoop.SetEnabled( false );
+    }
+
+    for ( int frame = 0; frame < 120; frame++ ) {
+      u64 const target = lockstep->ppu.frame;
+      while ( lockstep->ppu.frame == target ) {
+        batched->Clock();
+        lockstep->Clock();
+        // An NMI taken a cycle late would show up here as a different pc
+        ASSERT_EQ( batched->cpu.GetProgramCounter(), lockstep->cpu.GetProgramCounter() ) << rom;
+        ASSERT_EQ( batched->cpu.GetCycles(), lockstep->cpu.GetCycles() ) << rom;
+      }
+      ASSERT_EQ( batched->ppu.frame, lockstep->ppu.frame ) << rom;
+
+      batched->ppu.CatchUp();
+      EXPECT_EQ( batched->ppu.GetDebt(), 0 );
+      std::string const where = std::string( rom ) + " frame " + std::to_string( frame );
+      ASSERT_NO_FATAL_FAILURE( ExpectSameMachine( *batched, *lockstep, where ) );
+    }
+  }
+}
+
+TEST( PpuScanlineRendererTest, MatchesDotRenderer )
+{
+  // The same rom drawn a line at a time where it can be and dot by dot throughout. The CPUs would part ways
+  // on any difference in the status flags, the PPUs are compared down to the shifters after every frame
+  for ( const auto *rom : { "mario.nes", "metroid.nes", "bomberman2.nes", "scanline.nes" } ) {
+    auto lines = MakeBus( rom );
+    auto dots = MakeBus( rom );
+    dots->ppu.SetScanlineRenderer( false );
+
+    for ( int frame = 0; frame < 300; frame++ ) {
+      u8 const pad = ( frame % 60 ) < 5 ? 0x10 : 0x00;
+      lines->controller[0] = pad;
+      dots->controller[0] = pad;
+      lines->RunFrame();
+      dots->RunFrame();
+      lines->ppu.CatchUp();
+      dots->ppu.CatchUp();
+
+      PPU const &a = lines->ppu;
+      PPU const &b = dots->ppu;
+      std::string const where = std::string( rom ) + " frame " + std::to_string( frame );
+      ASSERT_NO_FATAL_FAILURE( ExpectSameMachine( *lines, *dots, where ) );
+      ASSERT_EQ( a.vramAddr.value, b.vramAddr.value ) << rom << " frame " << frame;
+      ASSERT_EQ( a.bgPatternShiftLow, b.bgPatternShiftLow ) << rom << " frame " << frame;
+      ASSERT_EQ( a.bgAttributeShiftHigh, b.bgAttributeShiftHigh ) << rom << " frame " << frame;
+      ASSERT_EQ( a.secondaryOam.data, b.secondaryOam.data ) << rom << " frame " << frame;
+      ASSERT_EQ( a.spriteShiftLow, b.spriteShiftLow ) << rom << " frame " << frame;
+      ASSERT_EQ( a.bSprite0Appeared, b.bSprite0Appeared ) << rom << " frame " << frame;
+    }
+  }
+}
+
+TEST( PpuScanlineRendererTest, TakesLinesAndTileGroups )
+{
+  auto bus = MakeBus( "mario.nes" );
+  bus->ppu.CatchUp();
+
+  PPU &ppu = bus->ppu;
+  ppu.SetScanline( 20 );
+  ppu.SetCycles( 0 );
+  EXPECT_EQ( ppu.ScanlineDots(), PPU::dotsPerScanline );
+  // The compositor sets the hit flag, so sprite 0 doesn't keep the line from the scanline renderer
+  ppu.bSpriteZeroHitPossible = true;
+  EXPECT_EQ( ppu.ScanlineDots(), PPU::dotsPerScanline );
+  EXPECT_EQ( ppu.TileDots(), 0 );
+
+  // Tile groups start on dots 1, 9, ... 249
+  for ( u16 const cycle : { 1, 9, 129, 249 } ) {
+    ppu.SetCycles( cycle );
+    EXPECT_EQ( ppu.ScanlineDots(), 0 );
+    EXPECT_EQ( ppu.TileDots(), PPU::tileDots ) << cycle;
+  }
+  for ( u16 const cycle : { 2, 8, 257, 321, 329 } ) {
+    ppu.SetCycles( cycle );
+    EXPECT_EQ( ppu.TileDots(), 0 ) << cycle;
+  }
+
+  ppu.SetScanline( 240 );
+  ppu.SetCycles( 0 );
+  EXPECT_EQ( ppu.ScanlineDots(), 0 );
+  ppu.SetCycles( 1 );
+  EXPECT_EQ( ppu.TileDots(), 0 );
+  ppu.SetScanlineRenderer( false );
+  ppu.SetScanline( 20 );
+  EXPECT_EQ( ppu.TileDots(), 0 );
+  ppu.SetCycles( 0 );
+  EXPECT_EQ( ppu.ScanlineDots(), 0 );
+}
+
+TEST( PpuScanlineRendererTest, SpriteZeroHitsLikeTheDots )
+{
+  // One opaque pixel of sprite 0 on a line, drawn whole, in tile groups and dot by dot. It hits from pixel 8
+  // to pixel 254, over any background
+  struct Case {
+    u8   x;
+    u8   plane; // The sprite's low plane, bit 7 leftmost
+    u8   mask;
+    bool hits;
+  };
+  for ( Case const test : { Case{ 100, 0x80, 0x1E, true }, Case{ 255, 0x80, 0x1E, true }, Case{ 255, 0x40, 0x1E, false },
+                            Case{ 7, 0x80, 0x1E, false }, Case{ 7, 0x01, 0x1E, true }, Case{ 0, 0x02, 0x1E, false },
+                            Case{ 100, 0x80, 0x10, false }, Case{ 100, 0x80, 0x18, true } } ) {
+    std::array<bool, 3> hit{};
+    for ( int renderer = 0; renderer < 3; renderer++ ) {
+      auto bus = MakeBus( "mario.nes" );
+      PPU &ppu = bus->ppu;
+      ppu.SetScanline( 20 );
+      ppu.SetCycles( 0 );
+      ppu.SetScanlineRenderer( renderer != 2 );
+      ppu.ppuMask.value = test.mask;
+      ppu.ppuStatus.bit.spriteZeroHit = 0;
+      ppu.spriteCount = 1;
+      ppu.secondaryOam.entries[0] = SpriteEntry{ 20, 0, {}, test.x };
+      ppu.spriteShiftLow[0] = test.plane;
+      ppu.spriteShiftHigh[0] = 0x00;
+      ppu.bSpriteZeroHitPossible = true;
+
+      if ( renderer == 0 ) {
+        ppu.RenderScanline();
+      } else if ( renderer == 1 ) {
+        ppu.Tick();
+        while ( ppu.cycle <= 256 ) {
+          ppu.RenderTile();
+        }
+      } else {
+        for ( int dot = 0; dot <= 256; dot++ ) {
+          ppu.Tick();
+        }
+      }
+      hit[renderer] = ppu.ppuStatus.bit.spriteZeroHit != 0;
+    }
+    EXPECT_EQ( hit[0], test.hits ) << "x " << int( test.x ) << " plane " << int( test.plane );
+    EXPECT_EQ( hit[1], test.hits ) << "x " << int( test.x ) << " plane " << int( test.plane );
+    EXPECT_EQ( hit[2], test.hits ) << "x " << int( test.x ) << " plane " << int( test.plane );
+  }
+}
+
+TEST( PpuDmaTest, BulkCopyMatchesByteByByte )
+{
+  // The same transfer copied in one go and one byte per cycle: same OAM, same cycle count
+  for ( u8 const oamAddr : { 0x00, 0x03, 0xFE } ) {
+    auto bulk = MakeBus( "palette.nes" );
+    auto bytes = MakeBus( "palette.nes" );
+    bytes->SetBulkDma( false );
+    for ( Bus *bus : { bulk.get(), bytes.get() } ) {
+      for ( u16 i = 0; i < 256; i++ ) {
+        bus->Write( 0x0300 + i, static_cast<u8>( ( i * 7 ) + 1 ) );
+      }
+      bus->Write( 0x2003, oamAddr );
+      bus->Write( 0x4014, 0x03 );
+    }
+
+    u64 const start = bulk->cpu.GetCycles();
+    bulk->Clock();
+    EXPECT_FALSE( bulk->dmaInProgress );
+    EXPECT_EQ( bulk->cpu.GetCycles() - start, 512 + ( start % 2 ) );
+
+    while ( bytes->dmaInProgress ) {
+      bytes->Clock();
+    }
+    EXPECT_EQ( bulk->ppu.oamAddr, bytes->ppu.oamAddr );
+    bulk->ppu.CatchUp();
+    bytes->ppu.CatchUp();
+    ExpectSameMachine( *bulk, *bytes, "OAMADDR " + std::to_string( oamAddr ) );
+  }
+}
+
+TEST( PpuDmaTest, BulkCopyMatchesInGames )
+{
+  // Games copy their sprites every frame, mostly at the start of vblank
+  for ( const auto *rom : { "mario.nes", "metroid.nes" } ) {
+    auto bulk = MakeBus( rom );
+    auto bytes = MakeBus( rom );
+    bytes->SetBulkDma( false );
+
+    for ( int frame = 0; frame < 120; frame++ ) {
+      bulk->RunFrame();
+      bytes->RunFrame();
+      std::string const where = std::string( rom ) + " frame " + std::to_string( frame );
+      ASSERT_NO_FATAL_FAILURE( ExpectSameMachine( *bulk, *bytes, where ) );
+    }
+  }
+}
+
+TEST( PpuOamShadowTest, FollowsOamWrites )
+{
+  auto bus = MakeBus( "palette.nes" );
+  PPU &ppu = bus->ppu;
+  auto expectInStep = [&ppu]( const char *what ) {
+    for ( size_t address = 0; address < ppu.oam.data.size(); address++ ) {
+      ASSERT_EQ( ppu.GetOamShadow().fields[address & 0x03][address >> 2], ppu.oam.data[address] )
+          << what << " at " << address;
+    }
+  };
+
+  // $2004 writes, with rendering off
+  bus->Write( 0x2003, 0x10 );
+  for ( u8 value : { 0x33, 0x44, 0xA5, 0x9C, 0x01 } ) {
+    bus->Write( 0x2004, value );
+  }
+  expectInStep( "$2004" );
+  EXPECT_EQ( ppu.GetOamShadow().Entry( 4 ).attribute.value, 0xA5 );
+
+  // DMA, in one copy and byte by byte, both wrapping around from $FE
+  for ( bool const bulk : { true, false } ) {
+    bus->SetBulkDma( bulk );
+    for ( u16 i = 0; i < 256; i++ ) {
+      bus->Write( 0x0300 + i, static_cast<u8>( ( i * 13 ) + ( bulk ? 1 : 2 ) ) );
+    }
+    bus->Write( 0x2003, 0xFE );
+    bus->Write( 0x4014, 0x03 );
+    while ( bus->dmaInProgress ) {
+      bus->Clock();
+    }
+    expectInStep( bulk ? "bulk DMA" : "byte DMA" );
+  }
+
+  // Anything else that writes OAM resyncs
+  ppu.oam.data[0x81] = 0x5A;
+  ppu.SyncOamShadow();
+  expectInStep( "sync" );
+}
+
+TEST( PpuOamShadowTest, SpriteEvalMatchesTheOamWalk )
+{
+  // Random OAM crowded into the top of the frame, so lines have 0 to many sprites, evaluated on every line
+  // against the walk over the 64 entries that it replaces
+  auto bus = MakeBus( "palette.nes" );
+  bus->ppu.CatchUp();
+  PPU &ppu = bus->ppu;
+
+  std::mt19937 random( 24 );
+  for ( int round = 0; round < 20; round++ ) {
+    for ( u16 address = 0; address < 256; address++ ) {
+      bool const crowded = ( address & 0x03 ) == 0 && ( random() % 2 ) == 0;
+      ppu.WriteOam( static_cast<u8>( address ), static_cast<u8>( crowded ? random() % 48 : random() ) );
+    }
+
+    for ( bool const isLarge : { false, true } ) {
+      for ( int line = 0; line <= PPU::gPrerenderScanline; line++ ) {
+        std::array<u8, 32> expected{};
+        expected.fill( 0xFF );
+        u64 bits = 0;
+        int found = 0;
+        for ( u8 i = 0; i < 64; i++ ) {
+          if ( PPU::IsSpriteInRange( line, ppu.oam.entries[i].y, isLarge ) ) {
+            bits |= u64{ 1 } << i;
+            if ( found < 8 ) {
+              std::memcpy( expected.data() + ( found * 4 ), &ppu.oam.data[i * 4], 4 );
+            }
+            found++;
+          }
+        }
+        ASSERT_EQ( ppu.SpritesOnLine( line, isLarge ? 16 : 8 ), bits ) << "line " << line;
+
+        ppu.ppuMask.value = 0x18;
+        ppu.ppuCtrl.bit.spriteSize = isLarge ? 1 : 0;
+        ppu.ppuStatus.bit.spriteOverflow = 0;
+        ppu.scanline = static_cast<u16>( line );
+        ppu.cycle = 257;
+        ppu.SpriteEval();
+        ASSERT_EQ( ppu.secondaryOam.data, expected ) << "line " << line;
+        ASSERT_EQ( ppu.spriteCount, std::min( found, 8 ) ) << "line " << line;
+        ASSERT_EQ( ppu.bSpriteZeroHitPossible, ( bits & 0x01 ) != 0 ) << "line " << line;
+        ASSERT_EQ( ppu.ppuStatus.bit.spriteOverflow, found > 8 ? 1 : 0 ) << "line " << line;
+      }
+    }
+  }
+}
+
 int main( int argc, char **argv )
 {
   ::testing::InitGoogleTest( &argc, argv );
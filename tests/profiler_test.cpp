@@ -0,0 +1,86 @@
+#include "profiler.h"
+#include <gtest/gtest.h>
+#include <string>
+
+using profiler::HostProfiler;
+
+TEST( ProfilerTest, BusRegions )
+{
+  EXPECT_EQ( profiler::BusRegion( 0x0000 ), profiler::BusRam );
+  EXPECT_EQ( profiler::BusRegion( 0x1FFF ), profiler::BusRam );
+  EXPECT_EQ( profiler::BusRegion( 0x2000 ), profiler::BusPpuRegisters );
+  EXPECT_EQ( profiler::BusRegion( 0x3FFF ), profiler::BusPpuRegisters );
+  EXPECT_EQ( profiler::BusRegion( 0x4014 ), profiler::BusApuIo );
+  EXPECT_EQ( profiler::BusRegion( 0x401F ), profiler::BusApuIo );
+  EXPECT_EQ( profiler::BusRegion( 0x4020 ), profiler::BusCartridge );
+  EXPECT_EQ( profiler::BusRegion( 0xFFFF ), profiler::BusCartridge );
+}
+
+TEST( ProfilerTest, NestedScopes )
+{
+  HostProfiler profiler;
+  for ( int i = 0; i < 3; i++ ) {
+    profiler.Enter( static_cast<profiler::Counter>( 0xA9 ) );
+    profiler.Enter( profiler::BusCartridge );
+    profiler.Enter( profiler::PpuTick );
+    profiler.Leave();
+    profiler.Leave();
+    profiler.Enter( profiler::PpuTick );
+    profiler.Leave();
+    profiler.Leave();
+  }
+
+  auto const &lda = profiler.GetStats( static_cast<profiler::Counter>( 0xA9 ) );
+  auto const &bus = profiler.GetStats( profiler::BusCartridge );
+  auto const &tick = profiler.GetStats( profiler::PpuTick );
+  EXPECT_EQ( lda.calls, 3 );
+  EXPECT_EQ( bus.calls, 3 );
+  EXPECT_EQ( tick.calls, 6 );
+
+  // A scope's inclusive time is its own time plus everything nested in it
+  EXPECT_EQ( tick.exclusive, tick.inclusive );
+  EXPECT_LE( bus.inclusive, lda.inclusive );
+  EXPECT_EQ( lda.inclusive, lda.exclusive + bus.exclusive + tick.exclusive );
+}
+
+TEST( ProfilerTest, DepthOverflow )
+{
+  // Scopes past the maximum depth aren't counted, but leave the stack balanced
+  HostProfiler profiler;
+  for ( size_t i = 0; i < HostProfiler::maxDepth + 4; i++ ) {
+    profiler.Enter( profiler::PpuTick );
+  }
+  for ( size_t i = 0; i < HostProfiler::maxDepth + 4; i++ ) {
+    profiler.Leave();
+  }
+  EXPECT_EQ( profiler.GetStats( profiler::PpuTick ).calls, HostProfiler::maxDepth );
+
+  profiler.Enter( profiler::BusRam );
+  profiler.Leave();
+  EXPECT_EQ( profiler.GetStats( profiler::BusRam ).calls, 1 );
+}
+
+TEST( ProfilerTest, Report )
+{
+  HostProfiler profiler;
+  profiler.Enter( static_cast<profiler::Counter>( 0x8D ) );
+  profiler.Enter( profiler::BusPpuRegisters );
+  profiler.Leave();
+  profiler.Leave();
+
+  std::string const report = profiler.Report();
+  EXPECT_NE( report.find( "Opcodes" ), std::string::npos );
+  EXPECT_NE( report.find( "STA" ), std::string::npos );
+  EXPECT_NE( report.find( "Addressing modes" ), std::string::npos );
+  EXPECT_NE( report.find( "ABS" ), std::string::npos );
+  EXPECT_NE( report.find( "PPU registers" ), std::string::npos );
+  // Counters that were never entered are left out
+  EXPECT_EQ( report.find( "LDA" ), std::string::npos );
+  EXPECT_EQ( report.find( "Cartridge" ), std::string::npos );
+}
+
+int main( int argc, char **argv )
+{
+  ::testing::InitGoogleTest( &argc, argv );
+  return RUN_ALL_TESTS();
+}
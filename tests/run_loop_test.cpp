@@ -0,0 +1,99 @@
+#include "bus.h"
+#include "test-machine.h"
+#include <gtest/gtest.h>
+#include <string>
+
+TEST( RunLoopTest, RunFrame )
+{
+  auto bus = MakeBus( "mario.nes" );
+  bus->RunFrame();
+
+  for ( int i = 0; i < 30; i++ ) {
+    u64 const startCycles = bus->cpu.GetCycles();
+    Bus::RunStats const stats = bus->RunFrame();
+    EXPECT_EQ( stats.frames, 1 );
+    EXPECT_EQ( stats.cycles, bus->cpu.GetCycles() - startCycles );
+    // A frame is 29780.5 CPU cycles, give or take the instruction that ends it
+    EXPECT_NEAR( static_cast<double>( stats.cycles ), 29780.5, 16.0 );
+    EXPECT_GT( stats.instructions, 0 );
+    // The run leaves the PPU caught up, at the start of the next frame
+    EXPECT_EQ( bus->ppu.GetDebt(), 0 );
+    EXPECT_EQ( bus->ppu.scanline, 0 );
+  }
+}
+
+TEST( RunLoopTest, RunCycles )
+{
+  auto bus = MakeBus( "nestest.nes" );
+  bus->idleLoop.SetEnabled( false );
+
+  for ( u64 const cycles : { 1, 100, 5000, 40000 } ) {
+    u64 const target = bus->cpu.GetCycles() + cycles;
+    Bus::RunStats const stats = bus->RunCycles( cycles );
+    EXPECT_GE( bus->cpu.GetCycles(), target );
+    // Overshoots by at most one instruction and the NMI it was followed by
+    EXPECT_LT( bus->cpu.GetCycles() - target, 14 );
+    EXPECT_EQ( stats.cycles >= cycles, true );
+  }
+}
+
+TEST( RunLoopTest, RunUntilMatchesClock )
+{
+  // The run loop steps exactly like calling Clock() by hand
+  auto looped = MakeBus( "metroid.nes" );
+  auto clocked = MakeBus( "metroid.nes" );
+
+  int steps = 0;
+  Bus::RunStats const stats = looped->RunUntil( [&]() { return steps++ == 50000; } );
+  for ( int i = 0; i < 50000; i++ ) {
+    clocked->Clock();
+  }
+  clocked->ppu.CatchUp();
+
+  ExpectSameMachine( *looped, *clocked );
+  EXPECT_EQ( stats.cycles, looped->cpu.GetCycles() - 7 );
+  EXPECT_EQ( stats.instructions, looped->cpu.GetInstructions() );
+}
+
+TEST( RunLoopTest, BatchesMatchSteppedRuns )
+{
+  // RunFrame() and RunCycles() only check between batches, and stop where the check before every step would
+  for ( const auto *rom : { "mario.nes", "metroid.nes", "bomberman2.nes", "nestest.nes" } ) {
+    for ( int mode = 0; mode < 3; mode++ ) {
+      auto batched = MakeBus( rom );
+      auto stepped = MakeBus( rom );
+      for ( Bus *bus : { batched.get(), stepped.get() } ) {
+        bus->idleLoop.SetEnabled( mode == 1 );
+        bus->SetBulkDma( mode != 0 );
+      }
+
+      for ( int frame = 0; frame < 60; frame++ ) {
+        u8 const pad = ( frame % 20 ) < 3 ? 0x10 : 0x00;
+        batched->controller[0] = pad;
+        stepped->controller[0] = pad;
+
+        Bus::RunStats stats{};
+        if ( ( frame % 3 ) == 2 ) {
+          stats = batched->RunCycles( 7919 );
+          u64 const target = stepped->cpu.GetCycles() + 7919;
+          stepped->RunUntil( [&]() { return stepped->cpu.GetCycles() >= target; } );
+        } else {
+          stats = batched->RunFrame();
+          u64 const start = stepped->ppu.frame;
+          stepped->RunUntil( [&]() { return stepped->ppu.frame != start; } );
+        }
+        std::string const where = std::string( rom ) + " mode " + std::to_string( mode ) + " run " +
+                                  std::to_string( frame );
+        ASSERT_NO_FATAL_FAILURE( ExpectSameMachine( *batched, *stepped, where ) );
+        ASSERT_EQ( batched->cpu.GetInstructions(), stepped->cpu.GetInstructions() ) << where;
+        ASSERT_FALSE( stats.breakpoint );
+      }
+    }
+  }
+}
+
+int main( int argc, char **argv )
+{
+  ::testing::InitGoogleTest( &argc, argv );
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,97 @@
+#include "bus.h"
+#include "paths.h"
+#include "scheduler.h"
+#include <gtest/gtest.h>
+#include <memory>
+#include <string>
+
+TEST( SchedulerTest, EarliestFirst )
+{
+  Scheduler scheduler;
+  EXPECT_EQ( scheduler.GetNextTimestamp(), Scheduler::never );
+
+  scheduler.Schedule( EventType::FrameEnd, 300 );
+  scheduler.Schedule( EventType::Nmi, 100 );
+  EXPECT_EQ( scheduler.Size(), 2 );
+  EXPECT_EQ( scheduler.GetNextTimestamp(), 100 );
+  EXPECT_FALSE( scheduler.IsDue( 99 ) );
+  EXPECT_TRUE( scheduler.IsDue( 100 ) );
+
+  EventType type{};
+  EXPECT_FALSE( scheduler.PopDue( 99, type ) );
+  ASSERT_TRUE( scheduler.PopDue( 1000, type ) );
+  EXPECT_EQ( type, EventType::Nmi );
+  ASSERT_TRUE( scheduler.PopDue( 1000, type ) );
+  EXPECT_EQ( type, EventType::FrameEnd );
+  EXPECT_FALSE( scheduler.PopDue( 1000, type ) );
+  EXPECT_EQ( scheduler.Size(), 0 );
+}
+
+TEST( SchedulerTest, ScheduleMovesPendingEvent )
+{
+  Scheduler scheduler;
+  scheduler.Schedule( EventType::Nmi, 100 );
+  scheduler.Schedule( EventType::FrameEnd, 200 );
+
+  // Later, then earlier again: still one event per type
+  scheduler.Schedule( EventType::Nmi, 500 );
+  EXPECT_EQ( scheduler.Size(), 2 );
+  EXPECT_EQ( scheduler.GetNextTimestamp(), 200 );
+  scheduler.Schedule( EventType::Nmi, 50 );
+  EXPECT_EQ( scheduler.GetNextTimestamp(), 50 );
+  EXPECT_EQ( scheduler.GetTimestamp( EventType::FrameEnd ), 200 );
+
+  scheduler.Cancel( EventType::Nmi );
+  EXPECT_FALSE( scheduler.IsScheduled( EventType::Nmi ) );
+  EXPECT_EQ( scheduler.GetNextTimestamp(), 200 );
+
+  // Ties go to the type listed first
+  scheduler.Schedule( EventType::Nmi, 200 );
+  EventType type{};
+  ASSERT_TRUE( scheduler.PopDue( 200, type ) );
+  EXPECT_EQ( type, EventType::Nmi );
+}
+
+TEST( SchedulerTest, Rebase )
+{
+  Scheduler scheduler;
+  scheduler.Schedule( EventType::Nmi, 90 );
+  scheduler.Schedule( EventType::FrameEnd, 1000 );
+
+  // The clock moves from 100 back to 10: the overdue event stays due, the other keeps its distance
+  scheduler.Rebase( 100, 10 );
+  EXPECT_EQ( scheduler.GetTimestamp( EventType::Nmi ), 10 );
+  EXPECT_EQ( scheduler.GetTimestamp( EventType::FrameEnd ), 910 );
+  EXPECT_TRUE( scheduler.IsDue( 10 ) );
+}
+
+TEST( SchedulerTest, PpuEventsTrackThePpu )
+{
+  auto bus = std::make_unique<Bus>();
+  bus->cartridge.LoadRom( std::string( paths::roms() ) + "/mario.nes" );
+  bus->cpu.Reset();
+
+  for ( int frame = 0; frame < 10; frame++ ) {
+    u64 const target = bus->ppu.frame;
+    while ( bus->ppu.frame == target ) {
+      bus->Clock();
+      // Both events are always pending, and never overdue between instructions
+      ASSERT_TRUE( bus->scheduler.IsScheduled( EventType::Nmi ) );
+      ASSERT_TRUE( bus->scheduler.IsScheduled( EventType::FrameEnd ) );
+      ASSERT_GT( bus->scheduler.GetNextTimestamp(), bus->GetMasterClock() );
+    }
+    // The frame ended on the frame end event, so the PPU is at most one instruction behind
+    EXPECT_EQ( bus->ppu.scanline, 0 );
+  }
+
+  // Setting the cycle count moves the events with it
+  u64 const ahead = bus->scheduler.GetTimestamp( EventType::Nmi ) - bus->GetMasterClock();
+  bus->cpu.SetCycles( 7 );
+  EXPECT_EQ( bus->scheduler.GetTimestamp( EventType::Nmi ) - bus->GetMasterClock(), ahead );
+}
+
+int main( int argc, char **argv )
+{
+  ::testing::InitGoogleTest( &argc, argv );
+  return RUN_ALL_TESTS();
+}
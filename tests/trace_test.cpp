@@ -0,0 +1,110 @@
+#include "bus.h"
+#include "checks.h"
+#include "paths.h"
+#include "trace.h"
+#include <gtest/gtest.h>
+#include <string>
+#include <vector>
+
+class TraceTest : public ::testing::Test
+{
+protected:
+  Bus  bus;
+  CPU &cpu = bus.cpu;
+
+  TraceTest()
+  {
+    bus.cartridge.LoadRom( std::string( paths::roms() ) + "/nestest.nes" );
+    cpu.Reset();
+    cpu.SetProgramCounter( 0xC000 );
+  }
+
+  void SetUp() override
+  {
+    if ( !checks::enabled ) {
+      GTEST_SKIP() << "The fast core has no trace hooks";
+    }
+  }
+};
+
+TEST_F( TraceTest, RecordsMatchLogLine )
+{
+  // Every trace record formats to the line LogLineAtPC() gives at the start of the instruction
+  cpu.SetTraceSize( 5000 );
+  cpu.EnableTracelog();
+
+  std::vector<std::string> expected;
+  for ( int i = 0; i < 5000; i++ ) {
+    expected.push_back( cpu.LogLineAtPC() );
+    bus.Clock();
+  }
+
+  TraceBuffer const &trace = cpu.GetTraceRecords();
+  ASSERT_EQ( trace.Size(), expected.size() );
+  for ( size_t i = 0; i < trace.Size(); i++ ) {
+    std::string line;
+    AppendTraceLine( line, trace[i] );
+    ASSERT_EQ( line, expected[i] ) << "line " << i;
+
+    auto const parsed = ParseTraceLine( line );
+    ASSERT_TRUE( parsed.has_value() ) << line;
+    EXPECT_EQ( *parsed, trace[i] ) << line;
+  }
+}
+
+TEST_F( TraceTest, RingKeepsNewest )
+{
+  cpu.SetTraceSize( 3 );
+  cpu.EnableTracelog();
+
+  std::vector<u64> cycles;
+  for ( int i = 0; i < 10; i++ ) {
+    cycles.push_back( cpu.GetCycles() );
+    bus.Clock();
+  }
+
+  TraceBuffer const &trace = cpu.GetTraceRecords();
+  ASSERT_EQ( trace.Size(), 3 );
+  EXPECT_EQ( trace[0].cycle, cycles[7] );
+  EXPECT_EQ( trace[1].cycle, cycles[8] );
+  EXPECT_EQ( trace[2].cycle, cycles[9] );
+
+  auto const lines = cpu.GetTracelog();
+  ASSERT_EQ( lines.size(), 3 );
+  EXPECT_EQ( lines.back().back(), '\n' );
+
+  cpu.ClearTraceLog();
+  EXPECT_TRUE( cpu.GetTraceRecords().Empty() );
+  EXPECT_EQ( cpu.GetTraceSize(), 3 );
+}
+
+TEST_F( TraceTest, MesenTraceOncePerInstruction )
+{
+  // Mesen traces are taken on the first cycle of each instruction, after the opcode fetch started
+  cpu.SetMesenTraceSize( 100 );
+  cpu.EnableMesenFormatTraceLog();
+
+  std::vector<u16> pcs;
+  for ( int i = 0; i < 50; i++ ) {
+    pcs.push_back( cpu.GetProgramCounter() );
+    u64 const cycle = cpu.GetCycles();
+    bus.Clock();
+    TraceBuffer const &trace = cpu.GetMesenFormatTraceRecords();
+    ASSERT_EQ( trace.Size(), pcs.size() );
+    EXPECT_EQ( trace[i].pc, pcs.back() );
+    EXPECT_EQ( trace[i].cycle, cycle + 1 );
+  }
+}
+
+TEST( TraceRecordTest, ParseRejectsGarbage )
+{
+  EXPECT_FALSE( ParseTraceLine( "" ).has_value() );
+  EXPECT_FALSE( ParseTraceLine( "not a trace line" ).has_value() );
+  EXPECT_FALSE( ParseTraceLine( "C000 JMP a: 00 x: 00 y: 00 s: FD p: 24 nv--dIzc" ).has_value() );
+}
+
+int main( int argc, char **argv )
+{
+  ::testing::InitGoogleTest( &argc, argv );
+  return RUN_ALL_TESTS();
+}
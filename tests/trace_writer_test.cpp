@@ -0,0 +1,171 @@
+#include "bus.h"
+#include "checks.h"
+#include "paths.h"
+#include "trace-writer.h"
+#include <filesystem>
+#include <fstream>
+#include <gtest/gtest.h>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace
+{
+std::string TempTracePath( const std::string &name )
+{
+  return ( std::filesystem::temp_directory_path() / ( "nes_emu_" + name + ".trace" ) ).string();
+}
+
+std::vector<TraceRecord> ReadAll( TraceReader &reader )
+{
+  std::vector<TraceRecord> all;
+  std::vector<TraceRecord> chunk;
+  for ( size_t i = 0; i < reader.GetChunkCount(); i++ ) {
+    reader.ReadChunk( i, chunk );
+    all.insert( all.end(), chunk.begin(), chunk.end() );
+  }
+  return all;
+}
+} // namespace
+
+class TraceWriterTest : public ::testing::Test
+{
+protected:
+  Bus  bus;
+  CPU &cpu = bus.cpu;
+
+  TraceWriterTest()
+  {
+    bus.cartridge.LoadRom( std::string( paths::roms() ) + "/nestest.nes" );
+    cpu.Reset();
+    cpu.SetProgramCounter( 0xC000 );
+    cpu.SetStatusRegister( 0x24 ); // Where nestest-log.txt starts
+  }
+
+  void SetUp() override
+  {
+    if ( !checks::enabled ) {
+      GTEST_SKIP() << "The fast core has no trace hooks";
+    }
+  }
+
+  // Run nestest with both the in-memory trace and a trace file recording
+  std::vector<TraceRecord> RecordNestest( const std::string &path, size_t instructions, u32 chunkRecords )
+  {
+    cpu.SetTraceSize( instructions );
+    cpu.EnableTracelog();
+    {
+      TraceWriter writer( path, instructions, chunkRecords );
+      cpu.SetTraceSink( &writer );
+      for ( size_t i = 0; i < instructions; i++ ) {
+        bus.Clock();
+      }
+      cpu.SetTraceSink( nullptr );
+      writer.Close();
+      EXPECT_EQ( writer.GetDropped(), 0 );
+      EXPECT_EQ( writer.GetWritten(), instructions );
+    }
+
+    std::vector<TraceRecord> records;
+    TraceBuffer const       &trace = cpu.GetTraceRecords();
+    for ( size_t i = 0; i < trace.Size(); i++ ) {
+      records.push_back( trace[i] );
+    }
+    return records;
+  }
+};
+
+TEST_F( TraceWriterTest, RoundTrip )
+{
+  std::string const              path = TempTracePath( "round_trip" );
+  std::vector<TraceRecord> const expected = RecordNestest( path, 8000, 1000 );
+
+  TraceReader reader( path );
+  EXPECT_EQ( reader.GetChunkCount(), 8 );
+  EXPECT_EQ( reader.GetRecordCount(), expected.size() );
+  EXPECT_EQ( reader.GetDropped(), 0 );
+  EXPECT_EQ( reader.GetChunkFirstCycle( 3 ), expected[3000].cycle );
+
+  std::vector<TraceRecord> const actual = ReadAll( reader );
+  ASSERT_EQ( actual.size(), expected.size() );
+  for ( size_t i = 0; i < actual.size(); i++ ) {
+    ASSERT_EQ( actual[i], expected[i] ) << "record " << i;
+  }
+
+  // Chunks decode on their own, in any order
+  std::vector<TraceRecord> chunk;
+  reader.ReadChunk( 5, chunk );
+  ASSERT_EQ( chunk.size(), 1000 );
+  EXPECT_EQ( chunk.front(), expected[5000] );
+
+  // Much smaller than the records themselves
+  EXPECT_LT( std::filesystem::file_size( path ), expected.size() * sizeof( TraceRecord ) / 3 );
+  std::filesystem::remove( path );
+}
+
+TEST_F( TraceWriterTest, NestestFormat )
+{
+  std::string const              path = TempTracePath( "nestest_format" );
+  std::vector<TraceRecord> const records = RecordNestest( path, 5000, 4096 );
+  std::filesystem::remove( path );
+
+  std::ifstream log( "tests/logs/nestest-log.txt" );
+  ASSERT_TRUE( log.is_open() );
+
+  std::string expected;
+  for ( size_t i = 0; i < records.size() && std::getline( log, expected ); i++ ) {
+    std::string actual;
+    AppendNestestTraceLine( actual, records[i] );
+
+    // Instruction bytes and mnemonic, registers, and cycle count. Nestest also prints the memory an
+    // operand points to, which a trace record doesn't have
+    ASSERT_EQ( actual.substr( 0, 19 ), expected.substr( 0, 19 ) ) << "line " << i + 1;
+    ASSERT_EQ( actual.substr( 48, 26 ), expected.substr( 48, 26 ) ) << "line " << i + 1;
+    ASSERT_EQ( actual.substr( actual.find( "CYC:" ) ), expected.substr( expected.find( "CYC:" ) ) ) << "line " << i + 1;
+  }
+}
+
+TEST( TraceWriterStandaloneTest, CountsDroppedRecords )
+{
+  std::string const path = TempTracePath( "dropped" );
+  u64 const         pushed = 200000;
+  {
+    TraceWriter writer( path, 4, 256 );
+    TraceRecord record{};
+    for ( u64 i = 0; i < pushed; i++ ) {
+      record.cycle = i;
+      writer.Push( record );
+    }
+    writer.Close();
+    EXPECT_EQ( writer.GetWritten() + writer.GetDropped(), pushed );
+  }
+
+  TraceReader reader( path );
+  EXPECT_EQ( reader.GetRecordCount() + reader.GetDropped(), pushed );
+
+  // Records that made it are in order
+  std::vector<TraceRecord> const records = ReadAll( reader );
+  ASSERT_EQ( records.size(), reader.GetRecordCount() );
+  for ( size_t i = 1; i < records.size(); i++ ) {
+    ASSERT_LT( records[i - 1].cycle, records[i].cycle );
+  }
+  std::filesystem::remove( path );
+}
+
+TEST( TraceWriterStandaloneTest, RejectsOtherFiles )
+{
+  std::string const path = TempTracePath( "not_a_trace" );
+  {
+    std::ofstream file( path );
+    file << "C000  4C F5 C5  JMP $C5F5                       A:00 X:00 Y:00 P:24 SP:FD PPU:  0, 21 CYC:7\n";
+  }
+  EXPECT_THROW( TraceReader reader( path ), std::runtime_error );
+  EXPECT_THROW( TraceReader reader( TempTracePath( "missing" ) ), std::runtime_error );
+  std::filesystem::remove( path );
+}
+
+int main( int argc, char **argv )
+{
+  ::testing::InitGoogleTest( &argc, argv );
+  return RUN_ALL_TESTS();
+}
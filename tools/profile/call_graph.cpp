@@ -0,0 +1,43 @@
+// call_graph.cpp
+// Runs a rom headless with the guest call graph profiler on, prints the costliest functions, and
+// optionally writes folded stacks for flamegraph.pl, speedscope, or inferno.
+// Usage: call_graph <rom file> [frames] [folded output file]
+
+#include "bus.h"
+#include <exception>
+#include <iostream>
+#include <memory>
+#include <string>
+
+int main( int argc, char **argv )
+{
+  if ( argc < 2 ) {
+    std::cerr << "Usage: call_graph <rom file> [frames] [folded output file]\n";
+    return 1;
+  }
+  std::string const rom = argv[1];
+  u64 const         frames = argc > 2 ? std::stoull( argv[2] ) : 600;
+  std::string const output = argc > 3 ? argv[3] : "";
+
+  try {
+    // The bus is too big for the stack
+    auto bus = std::make_unique<Bus>();
+    bus->cartridge.LoadRom( rom );
+    bus->cpu.Reset();
+    bus->callGraph.SetEnabled( true );
+
+    for ( u64 i = 0; i < frames; i++ ) {
+      bus->RunFrame();
+    }
+
+    std::cout << bus->callGraph.Report();
+    if ( !output.empty() ) {
+      bus->callGraph.WriteFoldedStacks( output );
+      std::cout << "Folded stacks written to " << output << "\n";
+    }
+  } catch ( const std::exception &e ) {
+    std::cerr << e.what() << "\n";
+    return 1;
+  }
+  return 0;
+}
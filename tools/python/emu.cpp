@@ -1,7 +1,12 @@
 #include "bus.h"
+#include "trace-writer.h"
 #include <fmt/base.h>
 #include <pybind11/pybind11.h>
+#include <pybind11/stl.h>
 #include "paths.h"
+#include <memory>
+#include <optional>
+#include <vector>
 
 namespace py = pybind11;
 
@@ -65,7 +70,7 @@ public:
   ||         PPU Setters        ||
   ################################
   */
-  void SetScanline( s16 value ) { ppu.scanline = value; }
+  void SetScanline( s16 value ) { ppu.SetScanline( value ); }
   void SetPpuCycles( s16 value ) { ppu.SetCycles( value ); }
 
   /*
@@ -106,12 +111,38 @@ public:
     fmt::print( "{}\n", out );
   }
 
-  void Step( int n = 1 )
+  Bus::RunStats Step( int n = 1 )
   {
-    for ( int i = 0; i < n; i++ ) {
-      bus.Clock();
+    int executed = 0;
+    return bus.RunUntil( [&]() { return executed++ >= n; } );
+  }
+  Bus::RunStats RunFrame( int frames = 1 )
+  {
+    Bus::RunStats total;
+    for ( int i = 0; i < frames; i++ ) {
+      Bus::RunStats const stats = bus.RunFrame();
+      total.cycles += stats.cycles;
+      total.instructions += stats.instructions;
+      total.frames += stats.frames;
     }
+    return total;
+  }
+  Bus::RunStats RunCycles( u64 cycles ) { return bus.RunCycles( cycles ); }
+
+  /*
+  #######################################
+  ||            Breakpoints            ||
+  #######################################
+  */
+  // Runs stop at the next hit, with RunStats.breakpoint set, see core/breakpoints.h
+  void AddBreakpoint( Breakpoints::Kind kind, u16 first, std::optional<u16> last )
+  {
+    bus.breakpoints.AddRange( kind, first, last.value_or( first ) );
   }
+  void RemoveBreakpoint( Breakpoints::Kind kind, u16 addr ) { bus.breakpoints.Remove( kind, addr ); }
+  void ClearBreakpoints() { bus.breakpoints.ClearAll(); }
+  std::vector<u16> ListBreakpoints( Breakpoints::Kind kind ) const { return bus.breakpoints.List( kind ); }
+  std::optional<Breakpoints::Hit> LastHit() const { return bus.breakpoints.GetHit(); }
 
   u8 Read( u16 addr ) const { return bus.cpu.Read( addr ); }
   u8 PpuRead( u16 addr ) { return bus.ppu.ReadVram( addr ); }
@@ -128,10 +159,49 @@ public:
       fmt::print( "{}", line );
     }
   }
+
+  // Streams every instruction to a binary trace file, see tools/trace/trace_convert.cpp
+  void StartTraceFile( const std::string &path )
+  {
+    StopTraceFile();
+    traceWriter = std::make_unique<TraceWriter>( path );
+    cpu.SetTraceSink( traceWriter.get() );
+  }
+  void StopTraceFile()
+  {
+    if ( traceWriter ) {
+      cpu.SetTraceSink( nullptr );
+      traceWriter->Close();
+      fmt::print( "Trace: {} records written, {} dropped\n", traceWriter->GetWritten(), traceWriter->GetDropped() );
+      traceWriter.reset();
+    }
+  }
+
+private:
+  std::unique_ptr<TraceWriter> traceWriter;
 };
 
 PYBIND11_MODULE( emu, m ) // <-- Python module name. Must match the name in the CMakeLists
 {
+  py::class_<Bus::RunStats>( m, "RunStats" )
+      .def_readonly( "cycles", &Bus::RunStats::cycles )
+      .def_readonly( "instructions", &Bus::RunStats::instructions )
+      .def_readonly( "frames", &Bus::RunStats::frames )
+      .def_readonly( "breakpoint", &Bus::RunStats::breakpoint );
+
+  py::enum_<Breakpoints::Kind>( m, "BreakpointKind" )
+      .value( "EXECUTE", Breakpoints::Kind::Execute )
+      .value( "READ", Breakpoints::Kind::Read )
+      .value( "WRITE", Breakpoints::Kind::Write )
+      .value( "PPU_READ", Breakpoints::Kind::PpuRead )
+      .value( "PPU_WRITE", Breakpoints::Kind::PpuWrite );
+
+  py::class_<Breakpoints::Hit>( m, "BreakpointHit" )
+      .def_readonly( "kind", &Breakpoints::Hit::kind )
+      .def_readonly( "address", &Breakpoints::Hit::address )
+      .def_readonly( "pc", &Breakpoints::Hit::pc )
+      .def_readonly( "value", &Breakpoints::Hit::value );
+
   py::class_<Emulator>( m, "Emulator" )
       .def( py::init<>() )
       // CPU Getters
@@ -175,10 +245,22 @@ PYBIND11_MODULE( emu, m ) // <-- Python module name. Must match the name in the
       .def( "preset", &Emulator::Preset, "Load custom.nes rom for debugging" )
       .def( "debug_reset", &Emulator::DebugReset, "Reset the CPU and PPU" )
       .def( "log", &Emulator::Log, "Log CPU state" )
-      .def( "step", &Emulator::Step, "Step the CPU by one or more cycles", py::arg( "n" ) = 1 )
+      .def( "step", &Emulator::Step, "Step the CPU by one or more instructions", py::arg( "n" ) = 1 )
+      .def( "run_frame", &Emulator::RunFrame, "Run to the end of the frame, once or more",
+            py::arg( "frames" ) = 1 )
+      .def( "run_cycles", &Emulator::RunCycles, "Run at least n CPU cycles", py::arg( "n" ) )
       .def( "enable_mesen_trace", &Emulator::EnableMesenTrace, "Enable Mesen trace log", py::arg( "n" ) = 100 )
       .def( "disable_mesen_trace", &Emulator::DisableMesenTrace, "Disable Mesen trace log" )
       .def( "print_mesen_trace", &Emulator::PrintMesenTrace, "Print Mesen trace log" )
+      .def( "start_trace_file", &Emulator::StartTraceFile, "Stream a binary trace to a file", py::arg( "path" ) )
+      .def( "stop_trace_file", &Emulator::StopTraceFile, "Finish the binary trace file" )
+      .def( "add_breakpoint", &Emulator::AddBreakpoint, "Stop runs on an address, or on a range up to last",
+            py::arg( "kind" ), py::arg( "addr" ), py::arg( "last" ) = py::none() )
+      .def( "remove_breakpoint", &Emulator::RemoveBreakpoint, "Remove a breakpoint", py::arg( "kind" ),
+            py::arg( "addr" ) )
+      .def( "clear_breakpoints", &Emulator::ClearBreakpoints, "Remove all breakpoints" )
+      .def( "breakpoints", &Emulator::ListBreakpoints, "Addresses with a breakpoint of a kind", py::arg( "kind" ) )
+      .def_property_readonly( "last_hit", &Emulator::LastHit, "What stopped the last run, or None" )
       .def( "read", &Emulator::Read, "Read from CPU memory", py::arg( "addr" ) )
       .def( "ppu_read", &Emulator::PpuRead, "Read from PPU memory", py::arg( "addr" ) )
       .def_static( "test", &Emulator::Test, "Test function" );
@@ -75,10 +75,19 @@ method_names = [
     # Methods
     "log",
     "step",
+    "run_frame",
+    "run_cycles",
     "test",
     "enable_mesen_trace",
     "disable_mesen_trace",
     "print_mesen_trace",
+    "start_trace_file",
+    "stop_trace_file",
+    "add_breakpoint",
+    "remove_breakpoint",
+    "clear_breakpoints",
+    "breakpoints",
+    "last_hit",
     "debug_reset",
     "read",
     "ppu_read",
@@ -87,6 +96,18 @@ for name in method_names:
     globals()[name] = bind_method(name)
 
 
+def run_to(addr, frames=60):
+    """Runs until the instruction at addr is about to execute, up to a number of frames."""
+    e.add_breakpoint(emu.BreakpointKind.EXECUTE, addr)
+    hit = None
+    for _ in range(frames):
+        if e.run_frame().breakpoint:
+            hit = e.last_hit
+            break
+    e.remove_breakpoint(emu.BreakpointKind.EXECUTE, addr)
+    return hit
+
+
 def step_until(callback_condition):
     while not callback_condition():
         e.step()
@@ -96,6 +117,7 @@ def commands():
     for name in method_names:
         print(f"{YELLOW}{name}(){RESET}")
     print(f"{YELLOW}step_until(callback_condition){RESET}")
+    print(f"{YELLOW}run_to(addr, frames=60){RESET} # Run until the instruction at addr")
     print(f"{YELLOW}out(filename){RESET} # Redirect stdout to a file")
 
 
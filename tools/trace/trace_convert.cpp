@@ -0,0 +1,72 @@
+// trace_convert.cpp
+// Converts a binary trace written by TraceWriter into text.
+// Usage: trace_convert <trace file> [output file] [--format nestest|emu]
+//   nestest (default): the nestest.log layout used by tests/logs
+//   emu:               the layout of CPU::LogLineAtPC() and the Trace Log window
+
+#include "trace-writer.h"
+#include <cstdio>
+#include <exception>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+int main( int argc, char **argv )
+{
+  std::string input;
+  std::string output;
+  bool        nestest = true;
+  for ( int i = 1; i < argc; i++ ) {
+    std::string const arg = argv[i];
+    if ( arg == "--format" && i + 1 < argc ) {
+      std::string const format = argv[++i];
+      if ( format != "nestest" && format != "emu" ) {
+        std::cerr << "Unknown format '" << format << "', expected nestest or emu\n";
+        return 1;
+      }
+      nestest = format == "nestest";
+    } else if ( input.empty() ) {
+      input = arg;
+    } else if ( output.empty() ) {
+      output = arg;
+    }
+  }
+  if ( input.empty() ) {
+    std::cerr << "Usage: trace_convert <trace file> [output file] [--format nestest|emu]\n";
+    return 1;
+  }
+
+  try {
+    TraceReader   reader( input );
+    std::ofstream file;
+    if ( !output.empty() ) {
+      file.open( output, std::ios::out | std::ios::trunc );
+      if ( !file ) {
+        std::cerr << "Could not open '" << output << "' for writing\n";
+        return 1;
+      }
+    }
+    std::ostream &out = output.empty() ? std::cout : file;
+
+    std::vector<TraceRecord> records;
+    std::string              text;
+    for ( size_t chunk = 0; chunk < reader.GetChunkCount(); chunk++ ) {
+      reader.ReadChunk( chunk, records );
+      text.clear();
+      for ( const auto &record : records ) {
+        nestest ? AppendNestestTraceLine( text, record ) : AppendTraceLine( text, record );
+        text += '\n';
+      }
+      out << text;
+    }
+
+    if ( reader.GetDropped() > 0 ) {
+      std::cerr << "Warning: " << reader.GetDropped() << " records were dropped while recording\n";
+    }
+  } catch ( const std::exception &e ) {
+    std::cerr << "Error: " << e.what() << '\n';
+    return 1;
+  }
+  return 0;
+}